@@ -65,6 +65,8 @@ static void finalize_key(void *a, void *b)
 
 	key->new_key_aid = APP_AID_INVALID;
 
+	/* The cipher context reference moves along with the key value */
+	mesh_crypto_key_unref(key->key);
 	memcpy(key->key, key->new_key, 16);
 }
 
@@ -96,12 +98,17 @@ static bool set_key(struct mesh_app_key *key, uint16_t app_idx,
 		return false;
 
 	key_aid = KEY_ID_AKF | (key_aid << KEY_AID_SHIFT);
-	if (!is_new)
+	if (!is_new) {
 		key->key_aid = key_aid;
-	else
+	} else {
+		if (key->new_key_aid != APP_AID_INVALID)
+			mesh_crypto_key_unref(key->new_key);
+
 		key->new_key_aid = key_aid;
+	}
 
 	memcpy(is_new ? key->new_key : key->key, key_value, 16);
+	mesh_crypto_key_ref(key_value);
 
 	return true;
 }
@@ -113,6 +120,11 @@ void appkey_key_free(void *data)
 	if (!key)
 		return;
 
+	mesh_crypto_key_unref(key->key);
+
+	if (key->new_key_aid != APP_AID_INVALID)
+		mesh_crypto_key_unref(key->new_key);
+
 	l_free(key);
 }
 
@@ -24,12 +24,95 @@
 /* Multiply used Zero array */
 static const uint8_t zero[16] = { 0, };
 
+/*
+ * Cipher contexts of long lived keys (network encryption, privacy and
+ * beacon keys, application and device keys). Each kernel crypto context
+ * is set up once on first use and reused for every subsequent PDU, rather
+ * than being created and destroyed per operation.
+ */
+struct crypto_key {
+	uint8_t key[16];
+	unsigned int ref_cnt;
+	struct l_cipher *ecb;
+	struct l_checksum *cmac;
+	struct l_aead_cipher *ccm4;
+	struct l_aead_cipher *ccm8;
+};
+
+static struct l_queue *crypto_keys;
+
+static bool match_crypto_key(const void *a, const void *b)
+{
+	const struct crypto_key *ck = a;
+
+	return !memcmp(ck->key, b, sizeof(ck->key));
+}
+
+static struct crypto_key *crypto_key_find(const uint8_t key[16])
+{
+	return l_queue_find(crypto_keys, match_crypto_key, key);
+}
+
+static void crypto_key_free(void *data)
+{
+	struct crypto_key *ck = data;
+
+	l_cipher_free(ck->ecb);
+	l_checksum_free(ck->cmac);
+	l_aead_cipher_free(ck->ccm4);
+	l_aead_cipher_free(ck->ccm8);
+	l_free(ck);
+}
+
+bool mesh_crypto_key_ref(const uint8_t key[16])
+{
+	struct crypto_key *ck = crypto_key_find(key);
+
+	if (!ck) {
+		if (!crypto_keys)
+			crypto_keys = l_queue_new();
+
+		ck = l_new(struct crypto_key, 1);
+		memcpy(ck->key, key, sizeof(ck->key));
+		l_queue_push_tail(crypto_keys, ck);
+	}
+
+	ck->ref_cnt++;
+
+	return true;
+}
+
+void mesh_crypto_key_unref(const uint8_t key[16])
+{
+	struct crypto_key *ck = crypto_key_find(key);
+
+	if (!ck || --ck->ref_cnt)
+		return;
+
+	l_queue_remove(crypto_keys, ck);
+	crypto_key_free(ck);
+
+	if (l_queue_isempty(crypto_keys)) {
+		l_queue_destroy(crypto_keys, NULL);
+		crypto_keys = NULL;
+	}
+}
+
 static bool aes_ecb_one(const uint8_t key[16], const uint8_t in[16],
 								uint8_t out[16])
 {
+	struct crypto_key *ck = crypto_key_find(key);
 	void *cipher;
 	bool result = false;
 
+	if (ck) {
+		if (!ck->ecb)
+			ck->ecb = l_cipher_new(L_CIPHER_AES, key, 16);
+
+		if (ck->ecb)
+			return l_cipher_encrypt(ck->ecb, in, out, 16);
+	}
+
 	cipher = l_cipher_new(L_CIPHER_AES, key, 16);
 
 	if (cipher) {
@@ -55,9 +138,18 @@ static bool aes_cmac(void *checksum, const uint8_t *msg,
 static bool aes_cmac_one(const uint8_t key[16], const void *msg,
 					size_t msg_len, uint8_t res[16])
 {
+	struct crypto_key *ck = crypto_key_find(key);
 	void *checksum;
 	bool result;
 
+	if (ck) {
+		if (!ck->cmac)
+			ck->cmac = l_checksum_new_cmac_aes(key, 16);
+
+		if (ck->cmac)
+			return aes_cmac(ck->cmac, msg, msg_len, res);
+	}
+
 	checksum = l_checksum_new_cmac_aes(key, 16);
 	if (!checksum)
 		return false;
@@ -74,6 +166,35 @@ static bool aes_cmac_one(const uint8_t key[16], const void *msg,
 	return result;
 }
 
+/*
+ * Returns the AES-CCM context for the key, either the cached one or, for
+ * keys not registered with mesh_crypto_key_ref, a new one which the caller
+ * has to free (signalled by *owned).
+ */
+static struct l_aead_cipher *aes_ccm_get(const uint8_t key[16],
+						size_t mic_size, bool *owned)
+{
+	struct crypto_key *ck = crypto_key_find(key);
+	struct l_aead_cipher **cipher;
+
+	*owned = false;
+
+	if (ck && (mic_size == 4 || mic_size == 8)) {
+		cipher = mic_size == 4 ? &ck->ccm4 : &ck->ccm8;
+
+		if (!*cipher)
+			*cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM,
+							key, 16, mic_size);
+
+		if (*cipher)
+			return *cipher;
+	}
+
+	*owned = true;
+
+	return l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
+}
+
 bool mesh_crypto_aes_cmac(const uint8_t key[16], const uint8_t *msg,
 					size_t msg_len, uint8_t res[16])
 {
@@ -86,10 +207,11 @@ bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
 					void *out_msg,
 					void *out_mic, size_t mic_size)
 {
-	void *cipher;
+	struct l_aead_cipher *cipher;
+	bool owned;
 	bool result;
 
-	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
+	cipher = aes_ccm_get(key, mic_size, &owned);
 
 	result = l_aead_cipher_encrypt(cipher, msg, msg_len, aad, aad_len,
 					nonce, 13, out_msg, msg_len + mic_size);
@@ -101,7 +223,8 @@ bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
 			*(uint64_t *)out_mic = l_get_be64(out_msg + msg_len);
 	}
 
-	l_aead_cipher_free(cipher);
+	if (owned)
+		l_aead_cipher_free(cipher);
 
 	return result;
 }
@@ -112,11 +235,12 @@ bool mesh_crypto_aes_ccm_decrypt(const uint8_t nonce[13], const uint8_t key[16],
 				void *out_msg,
 				void *out_mic, size_t mic_size)
 {
-	void *cipher;
+	struct l_aead_cipher *cipher;
+	bool owned;
 	bool result;
 	size_t out_msg_len = enc_msg_len - mic_size;
 
-	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
+	cipher = aes_ccm_get(key, mic_size, &owned);
 
 	result = l_aead_cipher_decrypt(cipher, enc_msg, enc_msg_len,
 							aad, aad_len, nonce, 13,
@@ -131,7 +255,8 @@ bool mesh_crypto_aes_ccm_decrypt(const uint8_t nonce[13], const uint8_t key[16],
 				l_get_be64(enc_msg + enc_msg_len - mic_size);
 	}
 
-	l_aead_cipher_free(cipher);
+	if (owned)
+		l_aead_cipher_free(cipher);
 
 	return result;
 }
@@ -12,6 +12,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+bool mesh_crypto_key_ref(const uint8_t key[16]);
+void mesh_crypto_key_unref(const uint8_t key[16]);
 bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
 					const uint8_t *aad, uint16_t aad_len,
 					const void *msg, uint16_t msg_len,
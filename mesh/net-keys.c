@@ -86,6 +86,24 @@ static bool match_network(const void *a, const void *b)
 	return memcmp(key->network, network, sizeof(key->network)) == 0;
 }
 
+static void net_key_crypto_ref(struct net_key *key)
+{
+	mesh_crypto_key_ref(key->encrypt);
+	mesh_crypto_key_ref(key->privacy);
+
+	if (!key->friend_key)
+		mesh_crypto_key_ref(key->beacon);
+}
+
+static void net_key_crypto_unref(struct net_key *key)
+{
+	mesh_crypto_key_unref(key->encrypt);
+	mesh_crypto_key_unref(key->privacy);
+
+	if (!key->friend_key)
+		mesh_crypto_key_unref(key->beacon);
+}
+
 /* Key added from Provisioning, NetKey Add or NetKey update */
 uint32_t net_key_add(const uint8_t master[16])
 {
@@ -117,6 +135,8 @@ uint32_t net_key_add(const uint8_t master[16])
 	if (!result)
 		goto fail;
 
+	net_key_crypto_ref(key);
+
 	key->id = ++last_master_id;
 	l_queue_push_tail(keys, key);
 	return key->id;
@@ -154,6 +174,7 @@ uint32_t net_key_frnd_add(uint32_t master_id, uint16_t lpn, uint16_t frnd,
 	}
 
 	frnd_key->friend_key = true;
+	net_key_crypto_ref(frnd_key);
 	frnd_key->ref_cnt++;
 	frnd_key->id = ++last_master_id;
 	l_queue_push_head(keys, frnd_key);
@@ -169,6 +190,7 @@ void net_key_unref(uint32_t id)
 		if (--key->ref_cnt == 0) {
 			l_timeout_remove(key->snb.timeout);
 			l_queue_remove(keys, key);
+			net_key_crypto_unref(key);
 			l_free(key);
 		}
 	}
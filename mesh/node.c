@@ -24,6 +24,7 @@
 #include "mesh/mesh.h"
 #include "mesh/net.h"
 #include "mesh/net-keys.h"
+#include "mesh/crypto.h"
 #include "mesh/appkey.h"
 #include "mesh/mesh-config.h"
 #include "mesh/provision.h"
@@ -295,6 +296,7 @@ static void free_node_resources(void *data)
 	mesh_agent_remove(node->agent);
 	mesh_config_release(node->cfg);
 	mesh_net_free(node->net);
+	mesh_crypto_key_unref(node->dev_key);
 	l_free(node->storage_dir);
 	l_free(node);
 }
@@ -438,6 +440,7 @@ static bool init_from_storage(struct mesh_config_node *db_node,
 	node->seq_number = db_node->seq_number;
 
 	memcpy(node->dev_key, db_node->dev_key, 16);
+	mesh_crypto_key_ref(node->dev_key);
 	memcpy(node->token, db_node->token, 8);
 
 	num_ele = l_queue_length(db_node->elements);
@@ -1254,6 +1257,7 @@ static bool add_local_node(struct mesh_node *node, uint16_t unicast, bool kr,
 		return false;
 
 	memcpy(node->dev_key, dev_key, 16);
+	mesh_crypto_key_ref(node->dev_key);
 	if (!mesh_config_write_device_key(node->cfg, dev_key))
 		return false;
 
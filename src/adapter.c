@@ -23,7 +23,6 @@
 #include <sys/ioctl.h>
 #include <sys/file.h>
 #include <sys/stat.h>
-#include <dirent.h>
 
 #include <glib.h>
 #include <dbus/dbus.h>
@@ -44,6 +43,7 @@
 #include "src/shared/mgmt.h"
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
+#include "src/shared/hashmap.h"
 #include "src/shared/att.h"
 #include "src/shared/gatt-db.h"
 
@@ -86,6 +86,9 @@
 #define DISTANCE_VAL_INVALID	0x7FFF
 #define PATHLOSS_MAX		137
 
+#define FOUND_CACHE_BITS	8
+#define FOUND_CACHE_SIZE	(1 << FOUND_CACHE_BITS)
+
 /*
  * These are known security keys that have been compromised.
  * If this grows or there are needs to be platform specific, it is
@@ -175,6 +178,17 @@ struct discovery_client {
 	struct discovery_filter *discovery_filter;
 };
 
+/* Device found report already applied during the current discovery */
+struct found_cache_entry {
+	bdaddr_t bdaddr;
+	uint8_t bdaddr_type;
+	bool valid;
+	bool bredr;			/* report set BR/EDR support */
+	uint8_t len;
+	uint32_t flags;			/* mgmt device found flags */
+	uint64_t hash;			/* hash of the AD/EIR payload */
+};
+
 struct service_auth {
 	guint id;
 	unsigned int svc_id;
@@ -237,6 +251,7 @@ struct btd_adapter {
 	struct discovery_client *client;	/* active discovery client */
 
 	GSList *discovery_found;	/* list of found devices */
+	struct found_cache_entry found_cache[FOUND_CACHE_SIZE];
 	guint discovery_idle_timeout;	/* timeout between discovery runs */
 	guint passive_scan_timeout;	/* timeout between passive scans */
 
@@ -246,6 +261,8 @@ struct btd_adapter {
 	bool pincode_requested;		/* PIN requested during last bonding */
 	GSList *connections;		/* Connected devices */
 	GSList *devices;		/* Devices structure pointers */
+	struct hashmap *devices_addr;	/* Devices indexed by address */
+	GHashTable *devices_path;	/* Devices indexed by object path */
 	GSList *connect_list;		/* Devices to connect when found */
 	struct btd_device *connect_le;	/* LE device waiting to be connected */
 	sdp_list_t *services;		/* Services associated to adapter */
@@ -502,10 +519,8 @@ static void store_adapter_info(struct btd_adapter *adapter)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/settings",
 					btd_adapter_get_storage_dir(adapter));
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_write(filename, str, length);
 	g_free(str);
 
 	g_key_file_free(key_file);
@@ -854,6 +869,99 @@ int adapter_set_name(struct btd_adapter *adapter, const char *name)
 	return set_name(adapter, name);
 }
 
+/*
+ * The address index is keyed by the 48-bit address only: which device a
+ * (bdaddr, bdaddr_type) pair resolves to depends on the public address
+ * equivalence and the bearer flags checked by device_addr_type_cmp, so
+ * each bucket holds the candidates which are then filtered with it. A
+ * device is indexed under its current address and, when it differs (e.g.
+ * after the identity address got resolved), under the address it last
+ * connected with.
+ */
+static void devices_addr_add(struct btd_adapter *adapter,
+				const bdaddr_t *bdaddr, struct btd_device *dev)
+{
+	uint64_t key = hashmap_bdaddr_key(bdaddr, 0);
+	GSList *list;
+
+	list = hashmap_lookup(adapter->devices_addr, key);
+	if (list) {
+		if (!g_slist_find(list, dev))
+			list = g_slist_append(list, dev);
+		return;
+	}
+
+	hashmap_insert(adapter->devices_addr, key, g_slist_append(NULL, dev));
+}
+
+static void devices_addr_remove(struct btd_adapter *adapter,
+				const bdaddr_t *bdaddr, struct btd_device *dev)
+{
+	uint64_t key = hashmap_bdaddr_key(bdaddr, 0);
+	GSList *list, *new_list;
+
+	list = hashmap_lookup(adapter->devices_addr, key);
+	new_list = g_slist_remove(list, dev);
+	if (new_list == list)
+		return;
+
+	hashmap_remove_key(adapter->devices_addr, key);
+
+	if (new_list)
+		hashmap_insert(adapter->devices_addr, key, new_list);
+}
+
+static void index_device_addr(struct btd_adapter *adapter,
+						struct btd_device *dev)
+{
+	const bdaddr_t *bdaddr = device_get_address(dev);
+	const bdaddr_t *conn_bdaddr = device_get_conn_address(dev);
+
+	devices_addr_add(adapter, bdaddr, dev);
+
+	if (bacmp(conn_bdaddr, BDADDR_ANY) && bacmp(conn_bdaddr, bdaddr))
+		devices_addr_add(adapter, conn_bdaddr, dev);
+}
+
+static void unindex_device_addr(struct btd_adapter *adapter,
+						struct btd_device *dev)
+{
+	devices_addr_remove(adapter, device_get_address(dev), dev);
+	devices_addr_remove(adapter, device_get_conn_address(dev), dev);
+}
+
+static void adapter_add_device(struct btd_adapter *adapter,
+						struct btd_device *dev)
+{
+	adapter->devices = g_slist_append(adapter->devices, dev);
+
+	index_device_addr(adapter, dev);
+	g_hash_table_insert(adapter->devices_path,
+				(gpointer) device_get_path(dev), dev);
+}
+
+static guint device_path_hash(gconstpointer key)
+{
+	const char *p;
+	guint hash = 5381;
+
+	/* Object paths have always been matched case insensitively */
+	for (p = key; *p; p++)
+		hash = (hash << 5) + hash + g_ascii_tolower(*p);
+
+	return hash;
+}
+
+static gboolean device_path_equal(gconstpointer a, gconstpointer b)
+{
+	return !strcasecmp(a, b);
+}
+
+static void devices_addr_free(void *data)
+{
+	g_slist_free(data);
+}
+
 struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 							const bdaddr_t *dst,
 							uint8_t bdaddr_type)
@@ -868,8 +976,9 @@ struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 	bacpy(&addr.bdaddr, dst);
 	addr.bdaddr_type = bdaddr_type;
 
-	list = g_slist_find_custom(adapter->devices, &addr,
-							device_addr_type_cmp);
+	list = hashmap_lookup(adapter->devices_addr,
+					hashmap_bdaddr_key(dst, 0));
+	list = g_slist_find_custom(list, &addr, device_addr_type_cmp);
 	if (!list)
 		return NULL;
 
@@ -888,28 +997,13 @@ struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 	return device;
 }
 
-static int device_path_cmp(gconstpointer a, gconstpointer b)
-{
-	const struct btd_device *device = a;
-	const char *path = b;
-	const char *dev_path = device_get_path(device);
-
-	return strcasecmp(dev_path, path);
-}
-
 struct btd_device *btd_adapter_find_device_by_path(struct btd_adapter *adapter,
 						   const char *path)
 {
-	GSList *list;
-
-	if (!adapter)
-		return NULL;
-
-	list = g_slist_find_custom(adapter->devices, path, device_path_cmp);
-	if (!list)
+	if (!adapter || !path)
 		return NULL;
 
-	return list->data;
+	return g_hash_table_lookup(adapter->devices_path, path);
 }
 
 static void uuid_to_uuid128(uuid_t *uuid128, const uuid_t *uuid)
@@ -1218,7 +1312,7 @@ static struct btd_device *adapter_create_device(struct btd_adapter *adapter,
 	if (!device)
 		return NULL;
 
-	adapter->devices = g_slist_append(adapter->devices, device);
+	adapter_add_device(adapter, device);
 
 	return device;
 }
@@ -1254,6 +1348,8 @@ void btd_adapter_remove_device(struct btd_adapter *adapter,
 	adapter->connect_list = g_slist_remove(adapter->connect_list, dev);
 
 	adapter->devices = g_slist_remove(adapter->devices, dev);
+	unindex_device_addr(adapter, dev);
+	g_hash_table_remove(adapter->devices_path, device_get_path(dev));
 	btd_adv_monitor_device_remove(adapter->adv_monitor_manager, dev);
 
 	adapter->discovery_found = g_slist_remove(adapter->discovery_found,
@@ -1506,12 +1602,19 @@ static void invalidate_rssi_and_tx_power(gpointer a)
 	device_set_tx_power(dev, 127);
 }
 
+void btd_adapter_found_cache_flush(struct btd_adapter *adapter)
+{
+	memset(adapter->found_cache, 0, sizeof(adapter->found_cache));
+}
+
 static void discovery_cleanup(struct btd_adapter *adapter, int timeout)
 {
 	GSList *l, *next;
 
 	adapter->discovery_type = 0x00;
 
+	btd_adapter_found_cache_flush(adapter);
+
 	if (adapter->discovery_idle_timeout > 0) {
 		g_source_remove(adapter->discovery_idle_timeout);
 		adapter->discovery_idle_timeout = 0;
@@ -2162,6 +2265,9 @@ static int update_discovery_filter(struct btd_adapter *adapter)
 
 	DBG("");
 
+	/* Cached reports were accepted with the previous filters */
+	btd_adapter_found_cache_flush(adapter);
+
 	if (discovery_filter_to_mgmt_cp(adapter, &sd_cp)) {
 		btd_error(adapter->dev_id,
 				"discovery_filter_to_mgmt_cp returned error");
@@ -3240,21 +3346,18 @@ static DBusMessage *remove_device(DBusConnection *conn,
 	struct btd_adapter *adapter = user_data;
 	struct btd_device *device;
 	const char *path;
-	GSList *list;
 
 	if (dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &path,
 						DBUS_TYPE_INVALID) == FALSE)
 		return btd_error_invalid_args(msg);
 
-	list = g_slist_find_custom(adapter->devices, path, device_path_cmp);
-	if (!list)
+	device = g_hash_table_lookup(adapter->devices_path, path);
+	if (!device)
 		return btd_error_does_not_exist(msg);
 
 	if (!(adapter->current_settings & MGMT_SETTING_POWERED))
 		return btd_error_not_ready(msg);
 
-	device = list->data;
-
 	btd_device_set_temporary(device, true);
 
 	if (!btd_device_is_connected(device)) {
@@ -3760,7 +3863,7 @@ static int generate_and_write_irk(uint8_t *irk, GKeyFile *key_file,
 	g_key_file_set_string(key_file, "General", "IdentityResolvingKey",
 								str_irk_out);
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_set_contents(filename, str, length);
 	g_free(str);
 	DBG("Generated IRK written to file");
 	return 0;
@@ -3777,7 +3880,7 @@ static int load_irk(struct btd_adapter *adapter, uint8_t *irk)
 					btd_adapter_get_storage_dir(adapter));
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	str_irk = g_key_file_get_string(key_file, "General",
 						"IdentityResolvingKey", NULL);
@@ -4447,21 +4550,16 @@ static void load_devices(struct btd_adapter *adapter)
 	GSList *irks = NULL;
 	GSList *params = NULL;
 	GSList *added_devices = NULL;
-	DIR *dir;
-	struct dirent *entry;
+	char **names;
+	int i;
 
 	snprintf(dirname, PATH_MAX, STORAGEDIR "/%s",
 					btd_adapter_get_storage_dir(adapter));
 
-	dir = opendir(dirname);
-	if (!dir) {
-		btd_error(adapter->dev_id,
-				"Unable to open adapter storage directory: %s",
-								dirname);
-		return;
-	}
+	names = btd_storage_list_dirs(dirname);
 
-	while ((entry = readdir(dir)) != NULL) {
+	for (i = 0; names[i]; i++) {
+		const char *name = names[i];
 		struct btd_device *device;
 		char filename[PATH_MAX];
 		GKeyFile *key_file;
@@ -4471,31 +4569,29 @@ static void load_devices(struct btd_adapter *adapter)
 		GSList *list;
 		struct irk_info *irk_info;
 		struct conn_param *param;
+		bdaddr_t bdaddr;
 		uint8_t bdaddr_type;
 
-		if (entry->d_type == DT_UNKNOWN)
-			entry->d_type = util_get_dt(dirname, entry->d_name);
-
-		if (entry->d_type != DT_DIR || bachk(entry->d_name) < 0)
+		if (bachk(name) < 0)
 			continue;
 
 		snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 					btd_adapter_get_storage_dir(adapter),
-					entry->d_name);
+					name);
 
 		key_file = g_key_file_new();
-		g_key_file_load_from_file(key_file, filename, 0, NULL);
+		btd_storage_load(key_file, filename);
 
-		key_info = get_key_info(key_file, entry->d_name);
+		key_info = get_key_info(key_file, name);
 
 		bdaddr_type = get_le_addr_type(key_file);
 
-		ltk_info = get_ltk_info(key_file, entry->d_name, bdaddr_type);
+		ltk_info = get_ltk_info(key_file, name, bdaddr_type);
 
-		slave_ltk_info = get_slave_ltk_info(key_file, entry->d_name,
+		slave_ltk_info = get_slave_ltk_info(key_file, name,
 								bdaddr_type);
 
-		irk_info = get_irk_info(key_file, entry->d_name, bdaddr_type);
+		irk_info = get_irk_info(key_file, name, bdaddr_type);
 
 		// If any key for the device is blocked, we discard all.
 		if ((key_info && key_info->is_blocked) ||
@@ -4539,24 +4635,27 @@ static void load_devices(struct btd_adapter *adapter)
 		if (irk_info)
 			irks = g_slist_append(irks, irk_info);
 
-		param = get_conn_param(key_file, entry->d_name, bdaddr_type);
+		param = get_conn_param(key_file, name, bdaddr_type);
 		if (param)
 			params = g_slist_append(params, param);
 
-		list = g_slist_find_custom(adapter->devices, entry->d_name,
-							device_address_cmp);
+		str2ba(name, &bdaddr);
+
+		list = hashmap_lookup(adapter->devices_addr,
+					hashmap_bdaddr_key(&bdaddr, 0));
+		list = g_slist_find_custom(list, &bdaddr, device_bdaddr_cmp);
 		if (list) {
 			device = list->data;
 			goto device_exist;
 		}
 
-		device = device_create_from_storage(adapter, entry->d_name,
+		device = device_create_from_storage(adapter, name,
 							key_file);
 		if (!device)
 			goto free;
 
 		btd_device_set_temporary(device, false);
-		adapter->devices = g_slist_append(adapter->devices, device);
+		adapter_add_device(adapter, device);
 
 		/* TODO: register services from pre-loaded list of primaries */
 
@@ -4584,7 +4683,7 @@ free:
 		g_key_file_free(key_file);
 	}
 
-	closedir(dir);
+	g_strfreev(names);
 
 	load_link_keys(adapter, keys, btd_opts.debug_keys);
 	g_slist_free_full(keys, g_free);
@@ -4722,7 +4821,10 @@ static void adapter_add_connection(struct btd_adapter *adapter,
 						struct btd_device *device,
 						uint8_t bdaddr_type)
 {
+	/* Connecting may change the address the device is also indexed by */
+	unindex_device_addr(adapter, device);
 	device_add_connection(device, bdaddr_type);
+	index_device_addr(adapter, device);
 
 	if (g_slist_find(adapter->connections, device)) {
 		btd_error(adapter->dev_id,
@@ -5355,6 +5457,9 @@ static void adapter_free(gpointer user_data)
 	g_queue_foreach(adapter->auths, free_service_auth, NULL);
 	g_queue_free(adapter->auths);
 
+	hashmap_destroy(adapter->devices_addr, devices_addr_free);
+	g_hash_table_destroy(adapter->devices_path);
+
 	/*
 	 * Unregister all handlers for this specific index since
 	 * the adapter bound to them is no longer valid.
@@ -5427,14 +5532,13 @@ static void convert_names_entry(char *key, char *value, void *user_data)
 		return;
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", address, str);
-	create_file(filename, S_IRUSR | S_IWUSR);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 	g_key_file_set_string(key_file, "General", "Name", value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, data, length, NULL);
+	btd_storage_set_contents(filename, data, length);
 	g_free(data);
 
 	g_key_file_free(key_file);
@@ -5640,14 +5744,10 @@ static void convert_entry(char *key, char *value, void *user_data)
 		return;
 
 	if (converter->force == FALSE) {
-		struct stat st;
-		int err;
-
 		snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s",
 				converter->address, key);
 
-		err = stat(filename, &st);
-		if (err || !S_ISDIR(st.st_mode))
+		if (!btd_storage_exists(filename))
 			return;
 	}
 
@@ -5655,17 +5755,15 @@ static void convert_entry(char *key, char *value, void *user_data)
 			converter->address, key);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	set_device_type(key_file, type);
 
 	converter->cb(key_file, value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_set_contents(filename, data, length);
 
 	g_free(data);
 
@@ -5752,16 +5850,14 @@ static void store_sdp_record(char *local, char *peer, int handle, char *value)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	sprintf(handle_str, "0x%8.8X", handle);
 	g_key_file_set_string(key_file, "ServiceRecords", handle_str, value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_set_contents(filename, data, length);
 
 	g_free(data);
 
@@ -5776,12 +5872,10 @@ static void convert_sdp_entry(char *key, char *value, void *user_data)
 	int handle, ret;
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
-	struct stat st;
 	sdp_record_t *rec;
 	uuid_t uuid;
 	char *att_uuid, *prim_uuid;
 	uint16_t start = 0, end = 0, psm = 0;
-	int err;
 	char *data;
 	gsize length = 0;
 
@@ -5799,8 +5893,7 @@ static void convert_sdp_entry(char *key, char *value, void *user_data)
 	 * only be converted for known devices */
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s", src_addr, dst_addr);
 
-	err = stat(filename, &st);
-	if (err || !S_ISDIR(st.st_mode))
+	if (!btd_storage_exists(filename))
 		return;
 
 	/* store device records in cache */
@@ -5827,15 +5920,13 @@ static void convert_sdp_entry(char *key, char *value, void *user_data)
 								dst_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	store_attribute_uuid(key_file, start, end, prim_uuid, uuid);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_set_contents(filename, data, length);
 
 	g_free(data);
 	g_key_file_free(key_file);
@@ -5878,7 +5969,7 @@ static void convert_primaries_entry(char *key, char *value, void *user_data)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/attributes", address,
 									key);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	for (service = services; *service; service++) {
 		ret = sscanf(*service, "%04hX#%04hX#%s", &start, &end,
@@ -5898,8 +5989,7 @@ static void convert_primaries_entry(char *key, char *value, void *user_data)
 	if (length == 0)
 		goto end;
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-	g_file_set_contents(filename, data, length, NULL);
+	btd_storage_set_contents(filename, data, length);
 
 	if (device_type < 0)
 		goto end;
@@ -5910,14 +6000,12 @@ static void convert_primaries_entry(char *key, char *value, void *user_data)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", address, key);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 	set_device_type(key_file, device_type);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_set_contents(filename, data, length);
 
 end:
 	g_free(data);
@@ -5931,10 +6019,9 @@ static void convert_ccc_entry(char *key, char *value, void *user_data)
 	char dst_addr[18];
 	char type = BDADDR_BREDR;
 	uint16_t handle;
-	int ret, err;
+	int ret;
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
-	struct stat st;
 	char group[6];
 	char *data;
 	gsize length = 0;
@@ -5950,23 +6037,20 @@ static void convert_ccc_entry(char *key, char *value, void *user_data)
 	 * only be converted for known devices */
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s", src_addr, dst_addr);
 
-	err = stat(filename, &st);
-	if (err || !S_ISDIR(st.st_mode))
+	if (!btd_storage_exists(filename))
 		return;
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/ccc", src_addr,
 								dst_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	sprintf(group, "%hu", handle);
 	g_key_file_set_string(key_file, group, "Value", value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_set_contents(filename, data, length);
 
 	g_free(data);
 	g_key_file_free(key_file);
@@ -5978,10 +6062,9 @@ static void convert_gatt_entry(char *key, char *value, void *user_data)
 	char dst_addr[18];
 	char type = BDADDR_BREDR;
 	uint16_t handle;
-	int ret, err;
+	int ret;
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
-	struct stat st;
 	char group[6];
 	char *data;
 	gsize length = 0;
@@ -5997,23 +6080,20 @@ static void convert_gatt_entry(char *key, char *value, void *user_data)
 	 * only be converted for known devices */
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s", src_addr, dst_addr);
 
-	err = stat(filename, &st);
-	if (err || !S_ISDIR(st.st_mode))
+	if (!btd_storage_exists(filename))
 		return;
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/gatt", src_addr,
 								dst_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	sprintf(group, "%hu", handle);
 	g_key_file_set_string(key_file, group, "Value", value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_set_contents(filename, data, length);
 
 	g_free(data);
 	g_key_file_free(key_file);
@@ -6025,8 +6105,6 @@ static void convert_proximity_entry(char *key, char *value, void *user_data)
 	char *alert;
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
-	struct stat st;
-	int err;
 	char *data;
 	gsize length = 0;
 
@@ -6043,22 +6121,19 @@ static void convert_proximity_entry(char *key, char *value, void *user_data)
 	 * only be converted for known devices */
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s", src_addr, key);
 
-	err = stat(filename, &st);
-	if (err || !S_ISDIR(st.st_mode))
+	if (!btd_storage_exists(filename))
 		return;
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/proximity", src_addr,
 									key);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	g_key_file_set_string(key_file, alert, "Level", value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_set_contents(filename, data, length);
 
 	g_free(data);
 	g_key_file_free(key_file);
@@ -6154,10 +6229,8 @@ static void convert_config(struct btd_adapter *adapter, const char *filename,
 	if (read_local_name(&adapter->bdaddr, str) == 0)
 		g_key_file_set_string(key_file, "General", "Alias", str);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, data, length, NULL);
+	btd_storage_set_contents(filename, data, length);
 	g_free(data);
 }
 
@@ -6228,7 +6301,6 @@ static void load_config(struct btd_adapter *adapter)
 {
 	GKeyFile *key_file;
 	char filename[PATH_MAX];
-	struct stat st;
 	GError *gerr = NULL;
 
 	key_file = g_key_file_new();
@@ -6236,12 +6308,15 @@ static void load_config(struct btd_adapter *adapter)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/settings",
 					btd_adapter_get_storage_dir(adapter));
 
-	if (stat(filename, &st) < 0) {
+	/* The adapter may come back before its last settings were written */
+	btd_storage_sync(filename);
+
+	if (!btd_storage_exists(filename)) {
 		convert_config(adapter, filename, key_file);
 		convert_device_storage(adapter);
 	}
 
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	/* Get alias */
 	adapter->stored_alias = g_key_file_get_string(key_file, "General",
@@ -6320,6 +6395,9 @@ static struct btd_adapter *btd_adapter_new(uint16_t index)
 	DBG("Pairable timeout: %u seconds", adapter->pairable_timeout);
 
 	adapter->auths = g_queue_new();
+	adapter->devices_addr = hashmap_new();
+	adapter->devices_path = g_hash_table_new(device_path_hash,
+							device_path_equal);
 
 	return btd_adapter_ref(adapter);
 }
@@ -6328,12 +6406,22 @@ static void adapter_remove(struct btd_adapter *adapter)
 {
 	GSList *l;
 	struct gatt_db *db;
+	char filename[PATH_MAX];
 
 	DBG("Removing adapter %s", adapter->path);
 
+	/* Don't leave settings queued for an adapter that is gone */
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/settings",
+					btd_adapter_get_storage_dir(adapter));
+	btd_storage_sync(filename);
+
 	g_slist_free(adapter->connect_list);
 	adapter->connect_list = NULL;
 
+	hashmap_remove_all(adapter->devices_addr, NULL, NULL,
+							devices_addr_free);
+	g_hash_table_remove_all(adapter->devices_path);
+
 	for (l = adapter->devices; l; l = l->next)
 		device_remove(l->data, FALSE);
 
@@ -6470,29 +6558,34 @@ static void confirm_name(struct btd_adapter *adapter, const bdaddr_t *bdaddr,
 
 static void adapter_msd_notify(struct btd_adapter *adapter,
 							struct btd_device *dev,
-							GSList *msd_list)
+							const uint8_t *data,
+							uint8_t data_len)
 {
 	GSList *cb_l, *cb_next;
-	GSList *msd_l, *msd_next;
+	struct bt_ad_iter iter;
+	const uint8_t *msd;
+	uint8_t type, len;
 
 	for (cb_l = adapter->msd_callbacks; cb_l != NULL; cb_l = cb_next) {
 		btd_msd_cb_t cb = cb_l->data;
 
 		cb_next = g_slist_next(cb_l);
 
-		for (msd_l = msd_list; msd_l != NULL; msd_l = msd_next) {
-			const struct eir_msd *msd = msd_l->data;
+		bt_ad_iter_init(&iter, data, data_len);
 
-			msd_next = g_slist_next(msd_l);
+		while (bt_ad_iter_next(&iter, &type, &len, &msd)) {
+			if (type != EIR_MANUFACTURER_DATA || len < 2 ||
+						len > 2 + EIR_MSD_MAX_LEN)
+				continue;
 
-			cb(adapter, dev, msd->company, msd->data,
-								msd->data_len);
+			cb(adapter, dev, get_le16(msd), msd + 2, len - 2);
 		}
 	}
 }
 
-static bool is_filter_match(GSList *discovery_filter, struct eir_data *eir_data,
-								int8_t rssi)
+static bool is_filter_match(GSList *discovery_filter, struct eir_view *eir,
+					const uint8_t *data, uint8_t data_len,
+					int8_t rssi)
 {
 	GSList *l, *m;
 	bool got_match = false;
@@ -6519,12 +6612,15 @@ static bool is_filter_match(GSList *discovery_filter, struct eir_data *eir_data,
 		else {
 			for (m = item->uuids; m != NULL && got_match != true;
 							m = g_slist_next(m)) {
+				bt_uuid_t uuid;
+
 				/* m->data contains string representation of
 				 * uuid.
 				 */
-				if (g_slist_find_custom(eir_data->services,
-							m->data,
-							g_strcmp) != NULL)
+				if (bt_string_to_uuid(&uuid, m->data) < 0)
+					continue;
+
+				if (eir_has_uuid(data, data_len, &uuid))
 					got_match = true;
 			}
 		}
@@ -6534,8 +6630,8 @@ static bool is_filter_match(GSList *discovery_filter, struct eir_data *eir_data,
 			if (item->rssi == DISTANCE_VAL_INVALID ||
 			    item->rssi <= rssi ||
 			    item->pathloss == DISTANCE_VAL_INVALID ||
-			    (eir_data->tx_power != 127 &&
-			     eir_data->tx_power - rssi <= item->pathloss))
+			    (eir->tx_power != 127 &&
+			     eir->tx_power - rssi <= item->pathloss))
 				return true;
 
 			got_match = false;
@@ -6557,7 +6653,7 @@ static void filter_duplicate_data(void *data, void *user_data)
 }
 
 static bool device_is_discoverable(struct btd_adapter *adapter,
-					struct eir_data *eir, const char *addr,
+					struct eir_view *eir, const char *addr,
 					uint8_t bdaddr_type)
 {
 	GSList *l;
@@ -6594,15 +6690,133 @@ static bool device_is_discoverable(struct btd_adapter *adapter,
 		if (!strncmp(filter->pattern, addr, pattern_len))
 			return true;
 
-		if (eir->name && !strncmp(filter->pattern, eir->name,
-							pattern_len))
+		if (eir->name && eir->name_len >= pattern_len &&
+				!memcmp(filter->pattern, eir->name, pattern_len))
 			return true;
 	}
 
 	return discoverable;
 }
 
-static void update_found_devices(struct btd_adapter *adapter,
+static uint64_t found_cache_hash(const uint8_t *data, uint8_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint8_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static struct found_cache_entry *found_cache_get(struct btd_adapter *adapter,
+						const bdaddr_t *bdaddr,
+						uint8_t bdaddr_type)
+{
+	uint64_t key = hashmap_bdaddr_key(bdaddr, bdaddr_type);
+
+	key *= 0x9e3779b97f4a7c15ULL;
+
+	return &adapter->found_cache[key >> (64 - FOUND_CACHE_BITS)];
+}
+
+static void found_cache_add(struct btd_adapter *adapter,
+					const bdaddr_t *bdaddr,
+					uint8_t bdaddr_type, uint32_t flags,
+					const uint8_t *data, uint8_t data_len)
+{
+	struct found_cache_entry *entry;
+	struct eir_view eir;
+
+	entry = found_cache_get(adapter, bdaddr, bdaddr_type);
+
+	eir_parse_view(&eir, data, data_len);
+
+	bacpy(&entry->bdaddr, bdaddr);
+	entry->bdaddr_type = bdaddr_type;
+	entry->valid = true;
+	entry->bredr = bdaddr_type != BDADDR_BREDR && eir.flags &&
+					!(eir.flags & EIR_BREDR_UNSUP);
+	entry->flags = flags;
+	entry->len = data_len;
+	entry->hash = found_cache_hash(data, data_len);
+}
+
+/*
+ * Short-circuits a report whose payload was already applied to the device
+ * during the current discovery, in which case only the last seen time and
+ * RSSI need refreshing. Returns false if the report needs full processing.
+ */
+static bool found_cache_lookup(struct btd_adapter *adapter,
+					const bdaddr_t *bdaddr,
+					uint8_t bdaddr_type, int8_t rssi,
+					uint32_t flags, const uint8_t *data,
+					uint8_t data_len)
+{
+	struct found_cache_entry *entry;
+	struct btd_device *dev;
+	bool duplicate = false;
+
+	if (!adapter->discovery_list)
+		return false;
+
+	entry = found_cache_get(adapter, bdaddr, bdaddr_type);
+
+	if (!entry->valid || bacmp(&entry->bdaddr, bdaddr) ||
+				entry->bdaddr_type != bdaddr_type ||
+				entry->flags != flags ||
+				entry->len != data_len ||
+				entry->hash != found_cache_hash(data, data_len))
+		goto miss;
+
+	/* Clients asking for duplicate data get every report applied */
+	g_slist_foreach(adapter->discovery_list, filter_duplicate_data,
+								&duplicate);
+	if (duplicate)
+		goto miss;
+
+	/*
+	 * Only reports no monitor matched are cached, and the cache is
+	 * flushed once a new monitor is active, so the same payload cannot
+	 * match any monitor now either.
+	 */
+	dev = btd_adapter_find_device(adapter, bdaddr, bdaddr_type);
+	if (!dev || device_eir_changed(dev, data, data_len))
+		goto miss;
+
+	device_update_last_seen(dev, bdaddr_type);
+
+	if (entry->bredr)
+		device_update_last_seen(dev, BDADDR_BREDR);
+
+	if (adapter->filtered_discovery) {
+		struct eir_view eir;
+
+		/* The RSSI and pathloss filters depend on each report */
+		eir_parse_view(&eir, data, data_len);
+
+		if (is_filter_match(adapter->discovery_list, &eir, data,
+							data_len, rssi))
+			device_set_rssi_with_delta(dev, rssi, 0);
+	} else
+		device_set_rssi(dev, rssi);
+
+	return true;
+
+miss:
+	entry->valid = false;
+
+	return false;
+}
+
+/*
+ * Returns true if the report got applied to a device found by the ongoing
+ * discovery and an identical one may be short-circuited by the found cache.
+ */
+static bool update_found_devices(struct btd_adapter *adapter,
 					const bdaddr_t *bdaddr,
 					uint8_t bdaddr_type, int8_t rssi,
 					bool confirm, bool legacy,
@@ -6610,43 +6824,39 @@ static void update_found_devices(struct btd_adapter *adapter,
 					const uint8_t *data, uint8_t data_len)
 {
 	struct btd_device *dev;
-	struct bt_ad *ad = NULL;
+	struct eir_view eir;
 	struct eir_data eir_data;
-	bool name_known, discoverable;
+	bool name_known, discoverable, eir_changed, monitored;
 	char addr[18];
 	bool duplicate = false;
 	struct queue *matched_monitors = NULL;
 
-	if (bdaddr_type != BDADDR_BREDR)
-		ad = bt_ad_new_with_data(data_len, data);
-
 	/* During the background scanning, update the device only when the data
 	 * match at least one Adv monitor
 	 */
-	if (ad) {
+	if (bdaddr_type != BDADDR_BREDR)
 		matched_monitors = btd_adv_monitor_content_filter(
-					adapter->adv_monitor_manager, ad);
-		bt_ad_unref(ad);
-		ad = NULL;
-	}
+						adapter->adv_monitor_manager,
+						data, data_len);
 
 	if (!adapter->discovering && !matched_monitors)
-		return;
+		return false;
 
-	memset(&eir_data, 0, sizeof(eir_data));
-	eir_parse(&eir_data, data, data_len);
+	/*
+	 * Filtering only needs the fixed size fields, the UUID lists and
+	 * the data fields are only parsed into lists once the report is
+	 * accepted and differs from the last one applied to the device.
+	 */
+	eir_parse_view(&eir, data, data_len);
 
 	ba2str(bdaddr, addr);
 
-	discoverable = device_is_discoverable(adapter, &eir_data, addr,
-							bdaddr_type);
+	discoverable = device_is_discoverable(adapter, &eir, addr, bdaddr_type);
 
 	dev = btd_adapter_find_device(adapter, bdaddr, bdaddr_type);
 	if (!dev) {
-		if (!discoverable) {
-			eir_data_free(&eir_data);
-			return;
-		}
+		if (!discoverable)
+			return false;
 
 		dev = adapter_create_device(adapter, bdaddr, bdaddr_type);
 	}
@@ -6654,8 +6864,7 @@ static void update_found_devices(struct btd_adapter *adapter,
 	if (!dev) {
 		btd_error(adapter->dev_id,
 			"Unable to create object for found device %s", addr);
-		eir_data_free(&eir_data);
-		return;
+		return false;
 	}
 
 	device_update_last_seen(dev, bdaddr_type);
@@ -6666,13 +6875,19 @@ static void update_found_devices(struct btd_adapter *adapter,
 	 * kernels send them merged, so once we know which mgmt version
 	 * supports this we can make the non-zero check conditional.
 	 */
-	if (bdaddr_type != BDADDR_BREDR && eir_data.flags &&
-					!(eir_data.flags & EIR_BREDR_UNSUP)) {
+	if (bdaddr_type != BDADDR_BREDR && eir.flags &&
+					!(eir.flags & EIR_BREDR_UNSUP)) {
 		device_set_bredr_support(dev);
 		/* Update last seen for BR/EDR in case its flag is set */
 		device_update_last_seen(dev, BDADDR_BREDR);
 	}
 
+	memset(&eir_data, 0, sizeof(eir_data));
+
+	eir_changed = device_eir_changed(dev, data, data_len);
+	if (eir_changed)
+		eir_parse(&eir_data, data, data_len);
+
 	if (eir_data.name != NULL && eir_data.name_complete)
 		device_store_cached_name(dev, eir_data.name);
 
@@ -6684,7 +6899,7 @@ static void update_found_devices(struct btd_adapter *adapter,
 		(device_is_temporary(dev) && !adapter->discovery_list) &&
 		!matched_monitors) {
 		eir_data_free(&eir_data);
-		return;
+		return false;
 	}
 
 	/* If there is no matched Adv monitors, don't continue if not
@@ -6692,9 +6907,10 @@ static void update_found_devices(struct btd_adapter *adapter,
 	 */
 	if (!matched_monitors && (!discoverable ||
 		(adapter->filtered_discovery && !is_filter_match(
-				adapter->discovery_list, &eir_data, rssi)))) {
+				adapter->discovery_list, &eir, data, data_len,
+				rssi)))) {
 		eir_data_free(&eir_data);
-		return;
+		return false;
 	}
 
 	device_set_legacy(dev, legacy);
@@ -6704,11 +6920,19 @@ static void update_found_devices(struct btd_adapter *adapter,
 	else
 		device_set_rssi(dev, rssi);
 
-	if (eir_data.tx_power != 127)
-		device_set_tx_power(dev, eir_data.tx_power);
+	if (eir.tx_power != 127)
+		device_set_tx_power(dev, eir.tx_power);
 
-	if (eir_data.appearance != 0)
-		device_set_appearance(dev, eir_data.appearance);
+	if (eir.appearance != 0)
+		device_set_appearance(dev, eir.appearance);
+
+	if (adapter->discovery_list)
+		g_slist_foreach(adapter->discovery_list, filter_duplicate_data,
+								&duplicate);
+
+	/* Clients asking for duplicate data get every report applied */
+	if (duplicate && !eir_changed)
+		eir_parse(&eir_data, data, data_len);
 
 	/* Report an unknown name to the kernel even if there is a short name
 	 * known, but still update the name with the known short name. */
@@ -6717,26 +6941,21 @@ static void update_found_devices(struct btd_adapter *adapter,
 	if (eir_data.name && (eir_data.name_complete || !name_known))
 		btd_device_device_set_name(dev, eir_data.name);
 
-	if (eir_data.class != 0)
-		device_set_class(dev, eir_data.class);
+	if (eir.class != 0)
+		device_set_class(dev, eir.class);
 
-	if (eir_data.did_source || eir_data.did_vendor ||
-			eir_data.did_product || eir_data.did_version)
-		btd_device_set_pnpid(dev, eir_data.did_source,
-							eir_data.did_vendor,
-							eir_data.did_product,
-							eir_data.did_version);
+	if (eir.did_source || eir.did_vendor || eir.did_product ||
+							eir.did_version)
+		btd_device_set_pnpid(dev, eir.did_source, eir.did_vendor,
+						eir.did_product,
+						eir.did_version);
 
 	device_add_eir_uuids(dev, eir_data.services);
 
-	if (adapter->discovery_list)
-		g_slist_foreach(adapter->discovery_list, filter_duplicate_data,
-								&duplicate);
-
-	if (eir_data.msd_list) {
+	if (eir_data.msd_list)
 		device_set_manufacturer_data(dev, eir_data.msd_list, duplicate);
-		adapter_msd_notify(adapter, dev, eir_data.msd_list);
-	}
+
+	adapter_msd_notify(adapter, dev, data, data_len);
 
 	if (eir_data.sd_list)
 		device_set_service_data(dev, eir_data.sd_list, duplicate);
@@ -6745,11 +6964,15 @@ static void update_found_devices(struct btd_adapter *adapter,
 		device_set_data(dev, eir_data.data_list, duplicate);
 
 	if (bdaddr_type != BDADDR_BREDR)
-		device_set_flags(dev, eir_data.flags);
+		device_set_flags(dev, eir.flags);
+
+	if (eir_changed || duplicate)
+		device_cache_eir(dev, data, data_len);
 
 	eir_data_free(&eir_data);
 
 	/* After the device is updated, notify the matched Adv monitors */
+	monitored = matched_monitors != NULL;
 	if (matched_monitors) {
 		btd_adv_monitor_notify_monitors(adapter->adv_monitor_manager,
 						dev, rssi, matched_monitors);
@@ -6766,21 +6989,20 @@ static void update_found_devices(struct btd_adapter *adapter,
 	if (!adapter->discovery_list)
 		goto connect_le;
 
-	if (g_slist_find(adapter->discovery_found, dev))
-		return;
-
-	if (confirm)
-		confirm_name(adapter, bdaddr, bdaddr_type, name_known);
+	if (!g_slist_find(adapter->discovery_found, dev)) {
+		if (confirm)
+			confirm_name(adapter, bdaddr, bdaddr_type, name_known);
 
-	adapter->discovery_found = g_slist_prepend(adapter->discovery_found,
-									dev);
+		adapter->discovery_found = g_slist_prepend(
+						adapter->discovery_found, dev);
+	}
 
-	return;
+	return !monitored && !duplicate;
 
 connect_le:
 	/* Ignore non-connectable events */
 	if (not_connectable)
-		return;
+		return false;
 
 	/*
 	 * If we're in the process of stopping passive scanning and
@@ -6788,14 +7010,14 @@ connect_le:
 	 * ignore this one.
 	 */
 	if (adapter->connect_le)
-		return;
+		return false;
 
 	/*
 	 * If kernel background scan is used then the kernel is
 	 * responsible for connecting.
 	 */
 	if (btd_has_kernel_features(KERNEL_CONN_CONTROL))
-		return;
+		return false;
 
 	/*
 	 * If this is an LE device that's not connected and part of the
@@ -6807,6 +7029,8 @@ connect_le:
 		adapter->connect_le = dev;
 		stop_passive_scanning(adapter);
 	}
+
+	return false;
 }
 
 static void device_found_callback(uint16_t index, uint16_t length,
@@ -6849,10 +7073,16 @@ static void device_found_callback(uint16_t index, uint16_t length,
 	confirm_name = (flags & MGMT_DEV_FOUND_CONFIRM_NAME);
 	legacy = (flags & MGMT_DEV_FOUND_LEGACY_PAIRING);
 
-	update_found_devices(adapter, &ev->addr.bdaddr, ev->addr.type,
+	if (found_cache_lookup(adapter, &ev->addr.bdaddr, ev->addr.type,
+					ev->rssi, flags, eir, eir_len))
+		return;
+
+	if (update_found_devices(adapter, &ev->addr.bdaddr, ev->addr.type,
 					ev->rssi, confirm_name, legacy,
 					flags & MGMT_DEV_FOUND_NOT_CONNECTABLE,
-					eir, eir_len);
+					eir, eir_len))
+		found_cache_add(adapter, &ev->addr.bdaddr, ev->addr.type,
+						flags, eir, eir_len);
 }
 
 struct agent *adapter_get_agent(struct btd_adapter *adapter)
@@ -7952,7 +8182,7 @@ static void store_link_key(struct btd_adapter *adapter,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(key_str + (i * 2), "%2.2X", key[i]);
@@ -7962,10 +8192,8 @@ static void store_link_key(struct btd_adapter *adapter,
 	g_key_file_set_integer(key_file, "LinkKey", "Type", type);
 	g_key_file_set_integer(key_file, "LinkKey", "PINLength", pin_length);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_set_contents(filename, str, length);
 	g_free(str);
 
 	g_key_file_free(key_file);
@@ -8042,7 +8270,7 @@ static void store_longtermkey(struct btd_adapter *adapter, const bdaddr_t *peer,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	/* Old files may contain this so remove it in case it exists */
 	g_key_file_remove_key(key_file, "LongTermKey", "Master", NULL);
@@ -8059,10 +8287,8 @@ static void store_longtermkey(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, group, "EDiv", ediv);
 	g_key_file_set_uint64(key_file, group, "Rand", rand);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_set_contents(filename, str, length);
 	g_free(str);
 
 	g_key_file_free(key_file);
@@ -8174,7 +8400,7 @@ static void store_csrk(struct btd_adapter *adapter, const bdaddr_t *peer,
 			btd_adapter_get_storage_dir(adapter), device_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(key_str + (i * 2), "%2.2X", key[i]);
@@ -8183,10 +8409,8 @@ static void store_csrk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, group, "Counter", counter);
 	g_key_file_set_boolean(key_file, group, "Authenticated", auth);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_set_contents(filename, str, length);
 	g_free(str);
 
 	g_key_file_free(key_file);
@@ -8244,17 +8468,15 @@ static void store_irk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(str + (i * 2), "%2.2X", key[i]);
 
 	g_key_file_set_string(key_file, "IdentityResolvingKey", "Key", str);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	store_data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, store_data, length, NULL);
+	btd_storage_set_contents(filename, store_data, length);
 	g_free(store_data);
 
 	g_key_file_free(key_file);
@@ -8300,7 +8522,9 @@ static void new_irk_callback(uint16_t index, uint16_t length,
 		return;
 	}
 
+	unindex_device_addr(adapter, device);
 	device_update_addr(device, &addr->bdaddr, addr->type);
+	index_device_addr(adapter, device);
 
 	if (duplicate)
 		device_merge_duplicate(device, duplicate);
@@ -8332,7 +8556,7 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	g_key_file_set_integer(key_file, "ConnectionParameters",
 						"MinInterval", min_interval);
@@ -8343,10 +8567,8 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, "ConnectionParameters",
 						"Timeout", timeout);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	store_data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, store_data, length, NULL);
+	btd_storage_set_contents(filename, store_data, length);
 	g_free(store_data);
 
 	g_key_file_free(key_file);
@@ -8822,8 +9044,7 @@ static void connected_callback(uint16_t index, uint16_t length,
 		btd_device_device_set_name(device, eir_data.name);
 	}
 
-	if (eir_data.msd_list)
-		adapter_msd_notify(adapter, device, eir_data.msd_list);
+	adapter_msd_notify(adapter, device, ev->eir, eir_len);
 
 	eir_data_free(&eir_data);
 }
@@ -8982,7 +9203,7 @@ static void remove_keys(struct btd_adapter *adapter,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	if (type == BDADDR_BREDR) {
 		g_key_file_remove_group(key_file, "LinkKey", NULL);
@@ -8994,7 +9215,7 @@ static void remove_keys(struct btd_adapter *adapter,
 	}
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_set_contents(filename, str, length);
 	g_free(str);
 
 	g_key_file_free(key_file);
@@ -9074,7 +9295,7 @@ static bool get_static_addr(struct btd_adapter *adapter)
 	snprintf(mfg, sizeof(mfg), "0x%04x", adapter->manufacturer);
 
 	file = g_key_file_new();
-	g_key_file_load_from_file(file, STORAGEDIR "/addresses", 0, NULL);
+	btd_storage_load(file, STORAGEDIR "/addresses");
 	addrs = g_key_file_get_string_list(file, "Static", mfg, &len, NULL);
 	if (addrs) {
 		for (i = 0; i < len; i++) {
@@ -9128,7 +9349,7 @@ static bool get_static_addr(struct btd_adapter *adapter)
 						(const char **)addrs, len);
 
 	str = g_key_file_to_data(file, &len, NULL);
-	g_file_set_contents(STORAGEDIR "/addresses", str, len, NULL);
+	btd_storage_set_contents(STORAGEDIR "/addresses", str, len);
 	g_free(str);
 
 	ret = true;
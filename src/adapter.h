@@ -227,6 +227,8 @@ void btd_adapter_for_each_device(struct btd_adapter *adapter,
 			void (*cb)(struct btd_device *device, void *data),
 			void *data);
 
+void btd_adapter_found_cache_flush(struct btd_adapter *adapter);
+
 bool btd_le_connect_before_pairing(void);
 
 enum kernel_features {
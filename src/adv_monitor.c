@@ -31,6 +31,7 @@
 #include "src/error.h"
 #include "src/shared/mgmt.h"
 #include "src/shared/queue.h"
+#include "src/shared/hashmap.h"
 #include "src/shared/util.h"
 
 #include "adv_monitor.h"
@@ -104,7 +105,7 @@ struct adv_monitor {
 					 * Currenly unimplemented in user space.
 					 * Used only to pass data to kernel.
 					 */
-	struct queue *devices;		/* List of adv_monitor_device objects */
+	struct hashmap *devices;	/* Map of adv_monitor_device objects */
 
 	enum monitor_type type;		/* MONITOR_TYPE_* */
 	struct queue *patterns;		/* List of bt_ad_pattern objects */
@@ -136,7 +137,8 @@ struct app_match_data {
 };
 
 struct adv_content_filter_info {
-	struct bt_ad *ad;
+	const uint8_t *data;
+	uint8_t len;
 	struct queue *matched_monitors;	/* List of matched monitors */
 };
 
@@ -182,7 +184,7 @@ static void monitor_free(struct adv_monitor *monitor)
 	g_dbus_proxy_unref(monitor->proxy);
 	g_free(monitor->path);
 
-	queue_destroy(monitor->devices, monitor_device_free);
+	hashmap_destroy(monitor->devices, monitor_device_free);
 	monitor->devices = NULL;
 
 	queue_destroy(monitor->patterns, pattern_free);
@@ -373,7 +375,7 @@ static struct adv_monitor *monitor_new(struct adv_monitor_app *app,
 	monitor->low_rssi = ADV_MONITOR_UNSET_RSSI;
 	monitor->low_rssi_timeout = ADV_MONITOR_UNSET_TIMEOUT;
 	monitor->sampling_period = ADV_MONITOR_UNSET_SAMPLING_PERIOD;
-	monitor->devices = queue_new();
+	monitor->devices = hashmap_new();
 
 	monitor->type = MONITOR_TYPE_NONE;
 	monitor->patterns = NULL;
@@ -690,6 +692,9 @@ static void add_adv_patterns_monitor_cb(uint8_t status, uint16_t length,
 	monitor->monitor_handle = le16_to_cpu(rp->monitor_handle);
 	monitor->state = MONITOR_STATE_ACTIVE;
 
+	/* Reports cached as matching no monitor may match this one */
+	btd_adapter_found_cache_flush(monitor->app->manager->adapter);
+
 	DBG("Calling Activate() on Adv Monitor of owner %s at path %s",
 		monitor->app->owner, monitor->path);
 
@@ -1274,7 +1279,8 @@ static void adv_match_per_monitor(void *data, void *user_data)
 		return;
 
 	if (monitor->type == MONITOR_TYPE_OR_PATTERNS &&
-		bt_ad_pattern_match(info->ad, monitor->patterns)) {
+		bt_ad_pattern_match_data(info->data, info->len,
+							monitor->patterns)) {
 		goto matched;
 	}
 
@@ -1307,14 +1313,15 @@ static void adv_match_per_app(void *data, void *user_data)
  */
 struct queue *btd_adv_monitor_content_filter(
 				struct btd_adv_monitor_manager *manager,
-				struct bt_ad *ad)
+				const uint8_t *data, uint8_t len)
 {
 	struct adv_content_filter_info info;
 
-	if (!manager || !ad)
+	if (!manager || !data || !len)
 		return NULL;
 
-	info.ad = ad;
+	info.data = data;
+	info.len = len;
 	info.matched_monitors = NULL;
 
 	queue_foreach(manager->apps, adv_match_per_app, &info);
@@ -1357,23 +1364,6 @@ void btd_adv_monitor_notify_monitors(struct btd_adv_monitor_manager *manager,
 	queue_foreach(matched_monitors, monitor_filter_rssi, &info);
 }
 
-/* Matches a device based on btd_device object */
-static bool monitor_device_match(const void *a, const void *b)
-{
-	const struct adv_monitor_device *dev = a;
-	const struct btd_device *device = b;
-
-	if (!dev) {
-		error("Unexpected NULL adv_monitor_device object upon match");
-		return false;
-	}
-
-	if (dev->device != device)
-		return false;
-
-	return true;
-}
-
 /* Frees a monitor device object */
 static void monitor_device_free(void *data)
 {
@@ -1395,7 +1385,7 @@ static void monitor_device_free(void *data)
 	free(dev);
 }
 
-/* Removes a device from monitor->devices list */
+/* Removes a device from monitor->devices map */
 static void remove_device_from_monitor(void *data, void *user_data)
 {
 	struct adv_monitor *monitor = data;
@@ -1407,7 +1397,7 @@ static void remove_device_from_monitor(void *data, void *user_data)
 		return;
 	}
 
-	dev = queue_remove_if(monitor->devices, monitor_device_match, device);
+	dev = hashmap_remove_key(monitor->devices, hashmap_ptr_key(device));
 	if (dev) {
 		DBG("Device removed from the Adv Monitor at path %s",
 		    monitor->path);
@@ -1454,7 +1444,7 @@ static struct adv_monitor_device *monitor_device_create(
 	dev->monitor = monitor;
 	dev->device = device;
 
-	queue_push_tail(monitor->devices, dev);
+	hashmap_insert(monitor->devices, hashmap_ptr_key(device), dev);
 
 	return dev;
 }
@@ -1523,7 +1513,7 @@ static void adv_monitor_filter_rssi(struct adv_monitor *monitor,
 		return;
 	}
 
-	dev = queue_find(monitor->devices, monitor_device_match, device);
+	dev = hashmap_lookup(monitor->devices, hashmap_ptr_key(device));
 	if (!dev) {
 		dev = monitor_device_create(monitor, device);
 		if (!dev) {
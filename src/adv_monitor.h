@@ -29,7 +29,7 @@ void btd_adv_monitor_manager_destroy(struct btd_adv_monitor_manager *manager);
 
 struct queue *btd_adv_monitor_content_filter(
 				struct btd_adv_monitor_manager *manager,
-				struct bt_ad *ad);
+				const uint8_t *data, uint8_t len);
 
 void btd_adv_monitor_notify_monitors(struct btd_adv_monitor_manager *manager,
 					struct btd_device *device, int8_t rssi,
@@ -22,6 +22,11 @@ typedef enum {
 	BT_GATT_CACHE_NO,
 } bt_gatt_cache_t;
 
+typedef enum {
+	BT_STORAGE_FILES,
+	BT_STORAGE_LOG,
+} bt_storage_t;
+
 enum jw_repairing_t {
 	JW_REPAIRING_NEVER,
 	JW_REPAIRING_CONFIRM,
@@ -115,6 +120,11 @@ struct btd_opts {
 	bt_gatt_cache_t gatt_cache;
 	uint16_t	gatt_mtu;
 	uint8_t		gatt_channels;
+	uint8_t		gatt_scheduler;
+	uint16_t	gatt_nfy_latency;
+	uint8_t		gatt_nfy_pending;
+	size_t		gatt_nfy_store;
+	uint16_t	gatt_read_cache;
 	enum mps_mode_t	mps;
 
 	struct btd_avdtp_opts avdtp;
@@ -122,6 +132,10 @@ struct btd_opts {
 	uint8_t		key_size;
 
 	enum jw_repairing_t jw_repairing;
+
+	bt_storage_t	storage_backend;
+	uint32_t	storage_delay;
+	gboolean	storage_sync;
 };
 
 extern struct btd_opts btd_opts;
@@ -20,7 +20,6 @@
 #include <fcntl.h>
 #include <stdbool.h>
 #include <errno.h>
-#include <dirent.h>
 #include <time.h>
 
 #include <glib.h>
@@ -202,6 +201,8 @@ struct btd_device {
 	GSList		*eir_uuids;
 	struct bt_ad	*ad;
 	uint8_t         ad_flags[1];
+	uint8_t		*eir;		/* Last report applied to the device */
+	uint8_t		eir_len;
 	char		name[MAX_NAME_LENGTH + 1];
 	char		*alias;
 	uint32_t	class;
@@ -270,7 +271,7 @@ struct btd_device {
 	int8_t		tx_power;
 
 	GIOChannel	*att_io;
-	guint		store_id;
+	char		*stored_name;
 };
 
 static const uint16_t uuid_list[] = {
@@ -374,26 +375,21 @@ static void store_csrk(struct csrk_info *csrk, GKeyFile *key_file,
 	g_key_file_set_integer(key_file, group, "Counter", csrk->counter);
 }
 
-static gboolean store_device_info_cb(gpointer user_data)
+static void device_info_filename(struct btd_device *device, char *filename)
 {
-	struct btd_device *device = user_data;
-	GKeyFile *key_file;
-	char filename[PATH_MAX];
 	char device_addr[18];
-	char *str;
-	char class[9];
-	char **uuids = NULL;
-	gsize length = 0;
-
-	device->store_id = 0;
 
 	ba2str(&device->bdaddr, device_addr);
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
+}
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+static void update_device_info(GKeyFile *key_file, void *user_data)
+{
+	struct btd_device *device = user_data;
+	char class[9];
+	char **uuids = NULL;
 
 	g_key_file_set_string(key_file, "General", "Name", device->name);
 
@@ -463,16 +459,7 @@ static gboolean store_device_info_cb(gpointer user_data)
 	if (device->remote_csrk)
 		store_csrk(device->remote_csrk, key_file, "RemoteSignatureKey");
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
-
-	g_key_file_free(key_file);
 	g_free(uuids);
-
-	return FALSE;
 }
 
 static bool device_address_is_private(struct btd_device *dev)
@@ -491,7 +478,9 @@ static bool device_address_is_private(struct btd_device *dev)
 
 static void store_device_info(struct btd_device *device)
 {
-	if (device->temporary || device->store_id > 0)
+	char filename[PATH_MAX];
+
+	if (device->temporary)
 		return;
 
 	if (device_address_is_private(device)) {
@@ -500,18 +489,22 @@ static void store_device_info(struct btd_device *device)
 		return;
 	}
 
-	device->store_id = g_idle_add(store_device_info_cb, device);
+	/* The info is collected from the device when the write happens */
+	device_info_filename(device, filename);
+	btd_storage_update(filename, update_device_info, device, NULL);
+}
+
+static void update_cached_name(GKeyFile *key_file, void *user_data)
+{
+	const char *name = user_data;
+
+	g_key_file_set_string(key_file, "General", "Name", name);
 }
 
 void device_store_cached_name(struct btd_device *dev, const char *name)
 {
 	char filename[PATH_MAX];
 	char d_addr[18];
-	GKeyFile *key_file;
-	char *data;
-	char *data_old;
-	gsize length = 0;
-	gsize length_old = 0;
 
 	if (device_address_is_private(dev)) {
 		DBG("Can't store name for private addressed device %s",
@@ -519,26 +512,19 @@ void device_store_cached_name(struct btd_device *dev, const char *name)
 		return;
 	}
 
+	/* Adverts keep repeating the same name so only queue changes */
+	if (!g_strcmp0(dev->stored_name, name))
+		return;
+
+	g_free(dev->stored_name);
+	dev->stored_name = g_strdup(name);
+
 	ba2str(&dev->bdaddr, d_addr);
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
 			btd_adapter_get_storage_dir(dev->adapter), d_addr);
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
-	data_old = g_key_file_to_data(key_file, &length_old, NULL);
-
-	g_key_file_set_string(key_file, "General", "Name", name);
-
-	data = g_key_file_to_data(key_file, &length, NULL);
-
-	if ((length != length_old) || (memcmp(data, data_old, length)))
-		g_file_set_contents(filename, data, length, NULL);
-
-	g_free(data);
-	g_free(data_old);
 
-	g_key_file_free(key_file);
+	btd_storage_update(filename, update_cached_name, g_strdup(name),
+								g_free);
 }
 
 static void browse_request_free(struct browse_req *req)
@@ -670,6 +656,9 @@ static void device_free(gpointer user_data)
 {
 	struct btd_device *device = user_data;
 
+	/* Queued updates read the device so write them while it's intact */
+	btd_storage_sync_updates(device);
+
 	btd_gatt_client_destroy(device->client_dbus);
 	device->client_dbus = NULL;
 
@@ -685,6 +674,7 @@ static void device_free(gpointer user_data)
 	gatt_db_unref(device->db);
 
 	bt_ad_unref(device->ad);
+	g_free(device->eir);
 
 	if (device->tmp_records)
 		sdp_list_free(device->tmp_records,
@@ -719,6 +709,7 @@ static void device_free(gpointer user_data)
 
 	g_free(device->local_csrk);
 	g_free(device->remote_csrk);
+	g_free(device->stored_name);
 	g_free(device->path);
 	g_free(device->alias);
 	free(device->modalias);
@@ -1831,6 +1822,27 @@ void device_add_eir_uuids(struct btd_device *dev, GSList *uuids)
 						DEVICE_INTERFACE, "UUIDs");
 }
 
+/*
+ * Reports identical to the last one applied carry nothing new, which lets
+ * the caller skip parsing them into lists and applying them field by field.
+ */
+bool device_eir_changed(struct btd_device *dev, const uint8_t *data,
+								uint8_t len)
+{
+	if (!dev->eir)
+		return true;
+
+	return dev->eir_len != len || memcmp(dev->eir, data, len);
+}
+
+void device_cache_eir(struct btd_device *dev, const uint8_t *data,
+								uint8_t len)
+{
+	g_free(dev->eir);
+	dev->eir = len ? g_memdup(data, len) : NULL;
+	dev->eir_len = len;
+}
+
 static void add_manufacturer_data(void *data, void *user_data)
 {
 	struct eir_msd *msd = data;
@@ -2289,22 +2301,213 @@ static void store_services(struct btd_device *device)
 	}
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_set_contents(filename, data, length);
 
 	free(prim_uuid);
 	g_free(data);
 	g_key_file_free(key_file);
 }
 
+/*
+ * The remote GATT database is cached in a binary file next to the text cache
+ * file of the device, which is only parsed to migrate databases stored by
+ * older versions. The file starts with a header:
+ *
+ *	magic(4) version(1) flags(1) Database Hash(16) records(2)
+ *
+ * followed by a record per service, included service, characteristic and
+ * descriptor in handle order, little endian:
+ *
+ *	type(1) handle(2) data(2) data(2) uuid_len(1) uuid value_len(1) value
+ *
+ * where data holds the end handle of services, the range of included
+ * services and the value handle and properties of characteristics.
+ */
+#define GATT_CACHE_MAGIC	0x43544147
+#define GATT_CACHE_VERSION	1
+#define GATT_CACHE_HDR_SIZE	24
+#define GATT_CACHE_HASH		0x01
+
+enum {
+	GATT_CACHE_PRIM_SVC = 1,
+	GATT_CACHE_SND_SVC,
+	GATT_CACHE_INCL,
+	GATT_CACHE_CHRC,
+	GATT_CACHE_DESC,
+};
+
+struct gatt_cache_attr {
+	uint8_t type;
+	uint16_t handle;
+	uint16_t data[2];
+	bt_uuid_t uuid;
+	uint8_t value_len;
+	const uint8_t *value;
+};
+
 struct gatt_saver {
 	struct btd_device *device;
+	GByteArray *buf;
+	GKeyFile *key_file;		/* Text format instead of binary */
+	uint16_t count;
 	uint16_t ext_props;
-	GKeyFile *key_file;
+	bool unspec;			/* UUID without a type left out */
 };
 
+static void gatt_cache_filename(struct btd_device *device, char *filename)
+{
+	char dst_addr[18];
+
+	ba2str(&device->bdaddr, dst_addr);
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s.gatt",
+				btd_adapter_get_storage_dir(device->adapter),
+				dst_addr);
+}
+
+static void gatt_cache_append_text(struct gatt_saver *saver,
+					const struct gatt_cache_attr *attr)
+{
+	char handle[6], value[128], uuid_str[MAX_LEN_UUID_STR];
+	const char *type;
+	int i, len;
+
+	sprintf(handle, "%04hx", attr->handle);
+	bt_uuid_to_string(&attr->uuid, uuid_str, sizeof(uuid_str));
+
+	switch (attr->type) {
+	case GATT_CACHE_PRIM_SVC:
+	case GATT_CACHE_SND_SVC:
+		if (attr->type == GATT_CACHE_PRIM_SVC)
+			type = GATT_PRIM_SVC_UUID_STR;
+		else
+			type = GATT_SND_SVC_UUID_STR;
+
+		sprintf(value, "%s:%04hx:%s", type, attr->data[0], uuid_str);
+		break;
+	case GATT_CACHE_INCL:
+		sprintf(value, GATT_INCLUDE_UUID_STR ":%04hx:%04hx:%s",
+					attr->data[0], attr->data[1], uuid_str);
+		break;
+	case GATT_CACHE_CHRC:
+		len = sprintf(value, GATT_CHARAC_UUID_STR ":%04hx:%02hhx:",
+					attr->data[0], (uint8_t) attr->data[1]);
+
+		/* Database Hash value goes before the UUID */
+		for (i = 0; i < attr->value_len; i++)
+			len += sprintf(value + len, "%02hhx", attr->value[i]);
+
+		if (attr->value_len)
+			value[len++] = ':';
+
+		strcpy(value + len, uuid_str);
+		break;
+	case GATT_CACHE_DESC:
+		/* Extended Properties are the only value stored */
+		if (attr->value_len)
+			sprintf(value, "%04hx:%s", get_le16(attr->value),
+								uuid_str);
+		else
+			strcpy(value, uuid_str);
+		break;
+	default:
+		return;
+	}
+
+	g_key_file_set_string(saver->key_file, "Attributes", handle, value);
+}
+
+static void gatt_cache_append(struct gatt_saver *saver,
+					const struct gatt_cache_attr *attr)
+{
+	uint8_t rec[9 + 16 + 1];
+	uint8_t len;
+
+	if (saver->key_file) {
+		gatt_cache_append_text(saver, attr);
+		return;
+	}
+
+	rec[0] = attr->type;
+	put_le16(attr->handle, &rec[1]);
+	put_le16(attr->data[0], &rec[3]);
+	put_le16(attr->data[1], &rec[5]);
+
+	switch (attr->uuid.type) {
+	case BT_UUID16:
+		len = 2;
+		put_le16(attr->uuid.value.u16, &rec[8]);
+		break;
+	case BT_UUID32:
+		len = 4;
+		put_le32(attr->uuid.value.u32, &rec[8]);
+		break;
+	case BT_UUID128:
+		len = 16;
+		memcpy(&rec[8], attr->uuid.value.u128.data, len);
+		break;
+	case BT_UUID_UNSPEC:
+	default:
+		/* Could not be loaded back without a type */
+		saver->unspec = true;
+		return;
+	}
+
+	rec[7] = len;
+	rec[8 + len] = attr->value_len;
+
+	g_byte_array_append(saver->buf, rec, 9 + len);
+
+	if (attr->value_len)
+		g_byte_array_append(saver->buf, attr->value, attr->value_len);
+
+	saver->count++;
+}
+
+static bool gatt_cache_pull(const uint8_t **data, size_t *size,
+					struct gatt_cache_attr *attr)
+{
+	const uint8_t *p = *data;
+	uint128_t u128;
+	uint8_t len;
+
+	if (*size < 8)
+		return false;
+
+	len = p[7];
+	if (*size < 9U + len || *size < 9U + len + p[8 + len])
+		return false;
+
+	attr->type = p[0];
+	attr->handle = get_le16(&p[1]);
+	attr->data[0] = get_le16(&p[3]);
+	attr->data[1] = get_le16(&p[5]);
+
+	switch (len) {
+	case 2:
+		bt_uuid16_create(&attr->uuid, get_le16(&p[8]));
+		break;
+	case 4:
+		bt_uuid32_create(&attr->uuid, get_le32(&p[8]));
+		break;
+	case 16:
+		memcpy(u128.data, &p[8], len);
+		bt_uuid128_create(&attr->uuid, u128);
+		break;
+	default:
+		return false;
+	}
+
+	attr->value_len = p[8 + len];
+	attr->value = attr->value_len ? &p[9 + len] : NULL;
+
+	*data += 9 + len + attr->value_len;
+	*size -= 9 + len + attr->value_len;
+
+	return true;
+}
+
 static void db_hash_read_value_cb(struct gatt_db_attribute *attrib,
 						int err, const uint8_t *value,
 						size_t length, void *user_data)
@@ -2317,77 +2520,83 @@ static void db_hash_read_value_cb(struct gatt_db_attribute *attrib,
 	*hash = value;
 }
 
+static void db_hash_attr(struct gatt_db_attribute *attrib, void *user_data)
+{
+	struct gatt_db_attribute **attr = user_data;
+
+	*attr = attrib;
+}
+
+static const uint8_t *remote_db_hash(struct gatt_db *db)
+{
+	struct gatt_db_attribute *attr = NULL;
+	const uint8_t *hash = NULL;
+	bt_uuid_t uuid;
+
+	bt_uuid16_create(&uuid, GATT_CHARAC_DB_HASH);
+
+	gatt_db_find_by_type(db, 0x0001, 0xffff, &uuid, db_hash_attr, &attr);
+	if (!attr)
+		return NULL;
+
+	gatt_db_attribute_read(attr, 0, BT_ATT_OP_READ_REQ, NULL,
+					db_hash_read_value_cb, &hash);
+
+	return hash;
+}
+
 static void store_desc(struct gatt_db_attribute *attr, void *user_data)
 {
 	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
-	const bt_uuid_t *uuid;
+	struct gatt_cache_attr desc;
 	bt_uuid_t ext_uuid;
-	uint16_t handle_num;
-
-	handle_num = gatt_db_attribute_get_handle(attr);
-	sprintf(handle, "%04hx", handle_num);
+	uint8_t value[2];
 
-	uuid = gatt_db_attribute_get_type(attr);
-	bt_uuid_to_string(uuid, uuid_str, sizeof(uuid_str));
+	memset(&desc, 0, sizeof(desc));
+	desc.type = GATT_CACHE_DESC;
+	desc.handle = gatt_db_attribute_get_handle(attr);
+	desc.uuid = *gatt_db_attribute_get_type(attr);
 
 	bt_uuid16_create(&ext_uuid, GATT_CHARAC_EXT_PROPER_UUID);
-	if (!bt_uuid_cmp(uuid, &ext_uuid) && saver->ext_props)
-		sprintf(value, "%04hx:%s", saver->ext_props, uuid_str);
-	else
-		sprintf(value, "%s", uuid_str);
+	if (!bt_uuid_cmp(&desc.uuid, &ext_uuid) && saver->ext_props) {
+		put_le16(saver->ext_props, value);
+		desc.value = value;
+		desc.value_len = sizeof(value);
+	}
 
-	g_key_file_set_string(key_file, "Attributes", handle, value);
+	gatt_cache_append(saver, &desc);
 }
 
 static void store_chrc(struct gatt_db_attribute *attr, void *user_data)
 {
 	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
-	uint16_t handle_num, value_handle;
+	struct gatt_cache_attr chrc;
+	uint16_t value_handle;
 	uint8_t properties;
-	bt_uuid_t uuid, hash_uuid;
+	bt_uuid_t hash_uuid;
+
+	memset(&chrc, 0, sizeof(chrc));
 
-	if (!gatt_db_attribute_get_char_data(attr, &handle_num, &value_handle,
+	if (!gatt_db_attribute_get_char_data(attr, &chrc.handle, &value_handle,
 						&properties, &saver->ext_props,
-						&uuid)) {
+						&chrc.uuid)) {
 		warn("Error storing characteristic - can't get data");
 		return;
 	}
 
-	sprintf(handle, "%04hx", handle_num);
-	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
+	chrc.type = GATT_CACHE_CHRC;
+	chrc.data[0] = value_handle;
+	chrc.data[1] = properties;
 
 	/* Store Database Hash  value if available */
 	bt_uuid16_create(&hash_uuid, GATT_CHARAC_DB_HASH);
-	if (!bt_uuid_cmp(&uuid, &hash_uuid)) {
-		const uint8_t *hash = NULL;
-
-		attr = gatt_db_get_attribute(saver->device->db, value_handle);
-
-		gatt_db_attribute_read(attr, 0, BT_ATT_OP_READ_REQ, NULL,
-					db_hash_read_value_cb, &hash);
-		if (hash)
-			sprintf(value, GATT_CHARAC_UUID_STR ":%04hx:%02hhx:"
-				"%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx"
-				"%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx"
-				"%02hhx%02hhx:%s", value_handle, properties,
-				hash[0], hash[1], hash[2], hash[3],
-				hash[4], hash[5], hash[6], hash[7],
-				hash[8], hash[9], hash[10], hash[11],
-				hash[12], hash[13], hash[14], hash[15],
-				uuid_str);
-		else
-			sprintf(value, GATT_CHARAC_UUID_STR ":%04hx:%02hhx:%s",
-				value_handle, properties, uuid_str);
-
-	} else
-		sprintf(value, GATT_CHARAC_UUID_STR ":%04hx:%02hhx:%s",
-				value_handle, properties, uuid_str);
+	if (!bt_uuid_cmp(&chrc.uuid, &hash_uuid)) {
+		chrc.value = remote_db_hash(saver->device->db);
+		if (chrc.value)
+			chrc.value_len = 16;
+	}
 
-	g_key_file_set_string(key_file, "Attributes", handle, value);
+	gatt_cache_append(saver, &chrc);
 
 	gatt_db_service_foreach_desc(attr, store_desc, saver);
 }
@@ -2395,109 +2604,195 @@ static void store_chrc(struct gatt_db_attribute *attr, void *user_data)
 static void store_incl(struct gatt_db_attribute *attr, void *user_data)
 {
 	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
+	struct gatt_cache_attr incl;
 	struct gatt_db_attribute *service;
-	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
-	uint16_t handle_num, start, end;
-	bt_uuid_t uuid;
 
-	if (!gatt_db_attribute_get_incl_data(attr, &handle_num, &start, &end)) {
+	memset(&incl, 0, sizeof(incl));
+
+	if (!gatt_db_attribute_get_incl_data(attr, &incl.handle, &incl.data[0],
+							&incl.data[1])) {
 		warn("Error storing included service - can't get data");
 		return;
 	}
 
-	service = gatt_db_get_attribute(saver->device->db, start);
+	service = gatt_db_get_attribute(saver->device->db, incl.data[0]);
 	if (!service) {
 		warn("Error storing included service - can't find it");
 		return;
 	}
 
-	sprintf(handle, "%04hx", handle_num);
-
-	gatt_db_attribute_get_service_uuid(service, &uuid);
-	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
-	sprintf(value, GATT_INCLUDE_UUID_STR ":%04hx:%04hx:%s", start,
-								end, uuid_str);
+	incl.type = GATT_CACHE_INCL;
+	gatt_db_attribute_get_service_uuid(service, &incl.uuid);
 
-	g_key_file_set_string(key_file, "Attributes", handle, value);
+	gatt_cache_append(saver, &incl);
 }
 
 static void store_service(struct gatt_db_attribute *attr, void *user_data)
 {
 	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	char uuid_str[MAX_LEN_UUID_STR], handle[6], value[256];
-	uint16_t start, end;
-	bt_uuid_t uuid;
+	struct gatt_cache_attr svc;
 	bool primary;
-	char *type;
 
-	if (!gatt_db_attribute_get_service_data(attr, &start, &end, &primary,
-								&uuid)) {
+	memset(&svc, 0, sizeof(svc));
+
+	if (!gatt_db_attribute_get_service_data(attr, &svc.handle,
+							&svc.data[0], &primary,
+							&svc.uuid)) {
 		warn("Error storing service - can't get data");
 		return;
 	}
 
-	sprintf(handle, "%04hx", start);
+	svc.type = primary ? GATT_CACHE_PRIM_SVC : GATT_CACHE_SND_SVC;
 
-	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
+	gatt_cache_append(saver, &svc);
 
-	if (primary)
-		type = GATT_PRIM_SVC_UUID_STR;
-	else
-		type = GATT_SND_SVC_UUID_STR;
+	gatt_db_service_foreach_incl(attr, store_incl, saver);
+	gatt_db_service_foreach_char(attr, store_chrc, saver);
+}
 
-	sprintf(value, "%s:%04hx:%s", type, end, uuid_str);
+static bool gatt_cache_is_current(const char *filename, const uint8_t *hash,
+					const uint8_t *data, size_t length)
+{
+	uint8_t hdr[GATT_CACHE_HDR_SIZE];
+	uint8_t *contents;
+	size_t len;
+	bool current;
 
-	g_key_file_set_string(key_file, "Attributes", handle, value);
+	if (btd_storage_read(filename, hdr, sizeof(hdr)) !=
+						(ssize_t) sizeof(hdr) ||
+				get_le32(hdr) != GATT_CACHE_MAGIC ||
+				hdr[4] != GATT_CACHE_VERSION)
+		return false;
 
-	gatt_db_service_foreach_incl(attr, store_incl, saver);
-	gatt_db_service_foreach_char(attr, store_chrc, saver);
+	/* The hash identifies the database so there is no need to compare */
+	if (hash)
+		return (hdr[5] & GATT_CACHE_HASH) && !memcmp(&hdr[6], hash, 16);
+
+	/* Records are only worth comparing when the header matches */
+	if (memcmp(hdr, data, sizeof(hdr)))
+		return false;
+
+	contents = (uint8_t *) btd_storage_get_contents(filename, &len);
+	if (!contents)
+		return false;
+
+	current = len == length && !memcmp(contents, data, length);
+
+	g_free(contents);
+
+	return current;
 }
 
-static void store_gatt_db(struct btd_device *device)
+static void update_gatt_attributes(GKeyFile *key_file, void *user_data)
 {
-	char filename[PATH_MAX];
-	char dst_addr[18];
-	GKeyFile *key_file;
-	char *data;
-	gsize length = 0;
+	struct btd_device *device = user_data;
 	struct gatt_saver saver;
 
-	if (device_address_is_private(device)) {
-		DBG("Can't store GATT db for private addressed device %s",
+	/* Remove current attributes since it might have changed */
+	g_key_file_remove_group(key_file, "Attributes", NULL);
+
+	memset(&saver, 0, sizeof(saver));
+	saver.device = device;
+	saver.key_file = key_file;
+
+	gatt_db_foreach_service(device->db, NULL, store_service, &saver);
+}
+
+/* Fall back to the text format for what the binary one cannot hold */
+static void store_gatt_text(struct btd_device *device, const char *filename)
+{
+	char text_filename[PATH_MAX];
+	char dst_addr[18];
+
+	warn("GATT db of %s has attributes without UUID type, storing as text",
 								device->path);
-		return;
-	}
 
-	if (!gatt_cache_is_enabled(device))
-		return;
+	/* The binary cache would be loaded in place of the text one */
+	btd_storage_discard(filename);
+	btd_storage_remove(filename);
 
 	ba2str(&device->bdaddr, dst_addr);
 
-	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
+	snprintf(text_filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
 				btd_adapter_get_storage_dir(device->adapter),
 				dst_addr);
-	create_file(filename, S_IRUSR | S_IWUSR);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_update(text_filename, update_gatt_attributes, device, NULL);
+}
 
-	/* Remove current attributes since it might have changed */
-	g_key_file_remove_group(key_file, "Attributes", NULL);
+static bool store_gatt_cache(struct btd_device *device)
+{
+	char filename[PATH_MAX];
+	struct gatt_saver saver;
+	const uint8_t *hash;
+	uint8_t *hdr;
+	bool pending;
 
-	saver.key_file = key_file;
+	gatt_cache_filename(device, filename);
+
+	/* A queued write makes whatever is on disk outdated */
+	pending = btd_storage_pending(filename);
+
+	hash = remote_db_hash(device->db);
+	if (hash && !pending && gatt_cache_is_current(filename, hash, NULL, 0)) {
+		DBG("GATT cache of %s up to date", device->path);
+		return true;
+	}
+
+	memset(&saver, 0, sizeof(saver));
 	saver.device = device;
+	saver.buf = g_byte_array_sized_new(1024);
+	g_byte_array_set_size(saver.buf, GATT_CACHE_HDR_SIZE);
 
 	gatt_db_foreach_service(device->db, NULL, store_service, &saver);
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, data, length, NULL);
+	if (saver.unspec) {
+		g_byte_array_free(saver.buf, TRUE);
+		store_gatt_text(device, filename);
+		return false;
+	}
 
-	g_free(data);
-	g_key_file_free(key_file);
+	hdr = saver.buf->data;
+	memset(hdr, 0, GATT_CACHE_HDR_SIZE);
+	put_le32(GATT_CACHE_MAGIC, hdr);
+	hdr[4] = GATT_CACHE_VERSION;
+	if (hash) {
+		hdr[5] |= GATT_CACHE_HASH;
+		memcpy(&hdr[6], hash, 16);
+	}
+	put_le16(saver.count, &hdr[22]);
+
+	if (hash || pending || !gatt_cache_is_current(filename, NULL,
+					saver.buf->data, saver.buf->len))
+		btd_storage_write(filename, saver.buf->data, saver.buf->len);
+
+	g_byte_array_free(saver.buf, TRUE);
+
+	return true;
+}
+
+static int sync_gatt_cache(struct btd_device *device)
+{
+	char filename[PATH_MAX];
+
+	gatt_cache_filename(device, filename);
+
+	return btd_storage_sync(filename);
 }
 
+static void store_gatt_db(struct btd_device *device)
+{
+	if (device_address_is_private(device)) {
+		DBG("Can't store GATT db for private addressed device %s",
+								device->path);
+		return;
+	}
+
+	if (!gatt_cache_is_enabled(device))
+		return;
+
+	store_gatt_cache(device);
+}
 
 static void browse_request_complete(struct browse_req *req, uint8_t type,
 						uint8_t bdaddr_type, int err)
@@ -3118,7 +3413,7 @@ static char *load_cached_name(struct btd_device *device, const char *local,
 
 	key_file = g_key_file_new();
 
-	if (!g_key_file_load_from_file(key_file, filename, 0, NULL))
+	if (!btd_storage_load(key_file, filename))
 		goto failed;
 
 	str = g_key_file_get_string(key_file, "General", "Name", NULL);
@@ -3217,7 +3512,7 @@ static void convert_info(struct btd_device *device, GKeyFile *key_file)
 			device_addr);
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_set_contents(filename, str, length);
 	g_free(str);
 
 	store_device_info(device);
@@ -3377,7 +3672,7 @@ static void load_att_info(struct btd_device *device, const char *local,
 			peer);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 	groups = g_key_file_get_groups(key_file, NULL);
 
 	for (handle = groups; *handle; handle++) {
@@ -3748,21 +4043,170 @@ static int load_gatt_db_impl(GKeyFile *key_file, char **keys,
 	return 0;
 }
 
+static int gatt_cache_load(struct gatt_db *db, const uint8_t *data,
+					size_t size, uint16_t count,
+					bool services)
+{
+	struct gatt_db_attribute *service = NULL, *attr;
+	struct gatt_cache_attr rec;
+	bt_uuid_t ext_uuid;
+
+	bt_uuid16_create(&ext_uuid, GATT_CHARAC_EXT_PROPER_UUID);
+
+	for (; count; count--) {
+		if (!gatt_cache_pull(&data, &size, &rec))
+			return -EIO;
+
+		if (rec.type == GATT_CACHE_PRIM_SVC ||
+					rec.type == GATT_CACHE_SND_SVC) {
+			if (!services) {
+				if (service)
+					gatt_db_service_set_active(service,
+									true);
+
+				service = gatt_db_get_attribute(db, rec.handle);
+				continue;
+			}
+
+			if (rec.data[0] < rec.handle)
+				return -EIO;
+
+			attr = gatt_db_insert_service(db, rec.handle, &rec.uuid,
+					rec.type == GATT_CACHE_PRIM_SVC,
+					rec.data[0] - rec.handle + 1);
+			if (!attr) {
+				error("Unable load service into db!");
+				return -EIO;
+			}
+
+			continue;
+		}
+
+		/* Services are loaded first so includes can be resolved */
+		if (services)
+			continue;
+
+		if (!service)
+			return -EIO;
+
+		switch (rec.type) {
+		case GATT_CACHE_INCL:
+			attr = gatt_db_get_attribute(db, rec.data[0]);
+			if (attr)
+				attr = gatt_db_service_add_included(service,
+									attr);
+			if (!attr) {
+				warn("loading included service to db failed");
+				return -EIO;
+			}
+			break;
+		case GATT_CACHE_CHRC:
+			attr = gatt_db_service_insert_characteristic(service,
+							rec.data[0], &rec.uuid,
+							0, rec.data[1], NULL,
+							NULL, NULL);
+			if (!attr ||
+				gatt_db_attribute_get_handle(attr) != rec.data[0]) {
+				warn("loading characteristic to db failed");
+				return -EIO;
+			}
+			break;
+		case GATT_CACHE_DESC:
+			/* If it is CEP then it must contain the value */
+			if (!bt_uuid_cmp(&rec.uuid, &ext_uuid) &&
+							!rec.value_len) {
+				warn("cannot load CEP descriptor without value");
+				return -EIO;
+			}
+
+			attr = gatt_db_service_insert_descriptor(service,
+							rec.handle, &rec.uuid,
+							0, NULL, NULL, NULL);
+			if (!attr ||
+				gatt_db_attribute_get_handle(attr) != rec.handle) {
+				warn("loading descriptor to db failed");
+				return -EIO;
+			}
+			break;
+		default:
+			return -EIO;
+		}
+
+		if (rec.value_len && !gatt_db_attribute_write(attr, 0,
+						rec.value, rec.value_len, 0,
+						NULL, load_desc_value, NULL))
+			return -EIO;
+	}
+
+	if (service)
+		gatt_db_service_set_active(service, true);
+
+	return 0;
+}
+
+static int load_gatt_cache(struct btd_device *device)
+{
+	char filename[PATH_MAX];
+	uint8_t *data;
+	size_t len;
+	uint16_t count;
+	int err;
+
+	gatt_cache_filename(device, filename);
+
+	data = (uint8_t *) btd_storage_get_contents(filename, &len);
+	if (!data)
+		return -ENOENT;
+
+	if (len < GATT_CACHE_HDR_SIZE || get_le32(data) != GATT_CACHE_MAGIC ||
+					data[4] != GATT_CACHE_VERSION) {
+		err = -EPROTO;
+		goto done;
+	}
+
+	count = get_le16(&data[22]);
+
+	err = gatt_cache_load(device->db, data + GATT_CACHE_HDR_SIZE,
+				len - GATT_CACHE_HDR_SIZE, count, true);
+	if (!err)
+		err = gatt_cache_load(device->db, data + GATT_CACHE_HDR_SIZE,
+					len - GATT_CACHE_HDR_SIZE, count, false);
+	if (err)
+		gatt_db_clear(device->db);
+
+done:
+	g_free(data);
+
+	return err;
+}
+
 static void load_gatt_db(struct btd_device *device, const char *local,
 							const char *peer)
 {
 	char **keys, filename[PATH_MAX];
 	GKeyFile *key_file;
+	char *data;
+	gsize length = 0;
+	int err;
 
 	if (!gatt_cache_is_enabled(device))
 		return;
 
 	DBG("Restoring %s gatt database from file", peer);
 
+	err = load_gatt_cache(device);
+	if (!err)
+		goto done;
+
+	if (err != -ENOENT)
+		warn("Unable to load GATT cache for %s: %s", peer,
+							strerror(-err));
+
+	/* Fallback to the text format used by previous versions */
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 	keys = g_key_file_get_keys(key_file, "Attributes", NULL, NULL);
 
 	if (!keys) {
@@ -3771,12 +4215,32 @@ static void load_gatt_db(struct btd_device *device, const char *local,
 		return;
 	}
 
-	if (load_gatt_db_impl(key_file, keys, device->db))
+	if (load_gatt_db_impl(key_file, keys, device->db)) {
 		warn("Unable to load gatt db from file for %s", peer);
+		goto free;
+	}
+
+	/* Only drop the old format once the binary cache is on disk */
+	if (!store_gatt_cache(device))
+		goto free;
+
+	if (sync_gatt_cache(device) < 0)
+		warn("Unable to store GATT cache for %s", peer);
+	else {
+		DBG("Migrated %s gatt database to binary cache", peer);
 
+		g_key_file_remove_group(key_file, "Attributes", NULL);
+
+		data = g_key_file_to_data(key_file, &length, NULL);
+		btd_storage_set_contents(filename, data, length);
+		g_free(data);
+	}
+
+free:
 	g_strfreev(keys);
 	g_key_file_free(key_file);
 
+done:
 	g_slist_free_full(device->primaries, g_free);
 	device->primaries = NULL;
 	gatt_db_foreach_service(device->db, NULL, add_primary,
@@ -4183,6 +4647,10 @@ void btd_device_device_set_name(struct btd_device *device, const char *name)
 
 	strncpy(device->name, name, MAX_NAME_LENGTH);
 
+	/* Let the next report apply its name again */
+	g_free(device->eir);
+	device->eir = NULL;
+
 	store_device_info(device);
 
 	g_dbus_emit_property_changed(dbus_conn, device->path,
@@ -4358,36 +4826,6 @@ uint16_t btd_device_get_version(struct btd_device *device)
 	return device->version;
 }
 
-static void delete_folder_tree(const char *dirname)
-{
-	DIR *dir;
-	struct dirent *entry;
-	char filename[PATH_MAX];
-
-	dir = opendir(dirname);
-	if (dir == NULL)
-		return;
-
-	while ((entry = readdir(dir)) != NULL) {
-		if (g_str_equal(entry->d_name, ".") ||
-				g_str_equal(entry->d_name, ".."))
-			continue;
-
-		if (entry->d_type == DT_UNKNOWN)
-			entry->d_type = util_get_dt(dirname, entry->d_name);
-
-		snprintf(filename, PATH_MAX, "%s/%s", dirname, entry->d_name);
-
-		if (entry->d_type == DT_DIR)
-			delete_folder_tree(filename);
-		else
-			unlink(filename);
-	}
-	closedir(dir);
-
-	rmdir(dirname);
-}
-
 void device_remove_bonding(struct btd_device *device, uint8_t bdaddr_type)
 {
 	if (bdaddr_type == BDADDR_BREDR)
@@ -4402,6 +4840,30 @@ void device_remove_bonding(struct btd_device *device, uint8_t bdaddr_type)
 							bdaddr_type);
 }
 
+static void device_cache_filename(struct btd_device *device, char *filename)
+{
+	char device_addr[18];
+
+	ba2str(&device->bdaddr, device_addr);
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
+				btd_adapter_get_storage_dir(device->adapter),
+				device_addr);
+}
+
+/* Write out anything still queued for the device before it goes away */
+static void device_store_sync(struct btd_device *device)
+{
+	char filename[PATH_MAX];
+
+	device_info_filename(device, filename);
+	btd_storage_sync(filename);
+
+	device_cache_filename(device, filename);
+	btd_storage_sync(filename);
+
+	sync_gatt_cache(device);
+}
+
 static void device_remove_stored(struct btd_device *device)
 {
 	char device_addr[18];
@@ -4422,29 +4884,37 @@ static void device_remove_stored(struct btd_device *device)
 	if (device->blocked)
 		device_unblock(device, TRUE, FALSE);
 
+	/* Nothing of the device should be written back once removed */
+	btd_storage_cancel(device);
+
 	ba2str(&device->bdaddr, device_addr);
 
+	device_info_filename(device, filename);
+	btd_storage_discard(filename);
+
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s",
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
-	delete_folder_tree(filename);
+	btd_storage_remove(filename);
 
-	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
-				btd_adapter_get_storage_dir(device->adapter),
-				device_addr);
+	/* The cached name is kept so write it before editing the file */
+	device_cache_filename(device, filename);
+	btd_storage_sync(filename);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 	g_key_file_remove_group(key_file, "ServiceRecords", NULL);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_set_contents(filename, data, length);
 
 	g_free(data);
 	g_key_file_free(key_file);
+
+	gatt_cache_filename(device, filename);
+	btd_storage_discard(filename);
+	btd_storage_remove(filename);
 }
 
 void device_remove(struct btd_device *device, gboolean remove_stored)
@@ -4491,16 +4961,10 @@ void device_remove(struct btd_device *device, gboolean remove_stored)
 		device->temporary_timer = 0;
 	}
 
-	if (device->store_id > 0) {
-		g_source_remove(device->store_id);
-		device->store_id = 0;
-
-		if (!remove_stored)
-			store_device_info_cb(device);
-	}
-
-	if (remove_stored)
+	if (remove_stored) {
 		device_remove_stored(device);
+	} else
+		device_store_sync(device);
 
 	btd_device_unref(device);
 }
@@ -4829,13 +5293,13 @@ static void update_bredr_services(struct browse_req *req, sdp_list_t *recs)
 								dstaddr);
 
 	sdp_key_file = g_key_file_new();
-	g_key_file_load_from_file(sdp_key_file, sdp_file, 0, NULL);
+	btd_storage_load(sdp_key_file, sdp_file);
 
 	snprintf(att_file, PATH_MAX, STORAGEDIR "/%s/%s/attributes", srcaddr,
 								dstaddr);
 
 	att_key_file = g_key_file_new();
-	g_key_file_load_from_file(att_key_file, att_file, 0, NULL);
+	btd_storage_load(att_key_file, att_file);
 
 	for (seq = recs; seq; seq = seq->next) {
 		sdp_record_t *rec = (sdp_record_t *) seq->data;
@@ -4888,10 +5352,8 @@ next:
 
 	if (sdp_key_file) {
 		data = g_key_file_to_data(sdp_key_file, &length, NULL);
-		if (length > 0) {
-			create_file(sdp_file, S_IRUSR | S_IWUSR);
-			g_file_set_contents(sdp_file, data, length, NULL);
-		}
+		if (length > 0)
+			btd_storage_set_contents(sdp_file, data, length);
 
 		g_free(data);
 		g_key_file_free(sdp_key_file);
@@ -4899,10 +5361,8 @@ next:
 
 	if (att_key_file) {
 		data = g_key_file_to_data(att_key_file, &length, NULL);
-		if (length > 0) {
-			create_file(att_file, S_IRUSR | S_IWUSR);
-			g_file_set_contents(att_file, data, length, NULL);
-		}
+		if (length > 0)
+			btd_storage_set_contents(att_file, data, length);
 
 		g_free(data);
 		g_key_file_free(att_key_file);
@@ -5239,6 +5699,8 @@ static void gatt_server_init(struct btd_device *device,
 
 	bt_att_set_enc_key_size(device->att, device->ltk_enc_size);
 	bt_gatt_server_set_debug(device->server, gatt_debug, NULL, NULL);
+	bt_gatt_server_set_nfy_mult(device->server, btd_opts.gatt_nfy_latency,
+						btd_opts.gatt_nfy_pending);
 
 	btd_gatt_database_server_connected(database, device->server);
 }
@@ -5337,6 +5799,7 @@ bool device_attach_att(struct btd_device *dev, GIOChannel *io)
 	bt_att_ref(dev->att);
 
 	bt_att_set_debug(dev->att, BT_ATT_DEBUG, gatt_debug, NULL, NULL);
+	bt_att_set_scheduler(dev->att, btd_opts.gatt_scheduler);
 
 	dev->att_disconn_id = bt_att_register_disconnect(dev->att,
 						att_disconnected_cb, dev, NULL);
@@ -5655,6 +6118,12 @@ const bdaddr_t *device_get_address(struct btd_device *device)
 {
 	return &device->bdaddr;
 }
+
+const bdaddr_t *device_get_conn_address(struct btd_device *device)
+{
+	return &device->conn_bdaddr;
+}
+
 uint8_t device_get_le_address_type(struct btd_device *device)
 {
 	return device->bdaddr_type;
@@ -5784,7 +6253,7 @@ void device_store_svc_chng_ccc(struct btd_device *device, uint8_t bdaddr_type,
 				device_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	/* for bonded devices this is done on every connection so limit writes
 	 * to storage if no change needed
@@ -5807,10 +6276,8 @@ void device_store_svc_chng_ccc(struct btd_device *device, uint8_t bdaddr_type,
 									value);
 	}
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_set_contents(filename, str, length);
 	g_free(str);
 
 done:
@@ -5829,7 +6296,7 @@ void device_load_svc_chng_ccc(struct btd_device *device, uint16_t *ccc_le,
 				device_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	if (!g_key_file_has_group(key_file, "ServiceChanged")) {
 		if (ccc_le)
@@ -6679,7 +7146,7 @@ static sdp_list_t *read_device_records(struct btd_device *device)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 	keys = g_key_file_get_keys(key_file, "ServiceRecords", NULL, NULL);
 
 	for (handle = keys; handle && *handle; handle++) {
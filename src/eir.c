@@ -26,6 +26,7 @@
 #include "lib/sdp.h"
 
 #include "src/shared/util.h"
+#include "src/shared/ad.h"
 #include "uuid-helper.h"
 #include "eir.h"
 
@@ -238,36 +239,97 @@ static void eir_parse_data(struct eir_data *eir, uint8_t type,
 	eir->data_list = g_slist_append(eir->data_list, ad);
 }
 
-void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
+void eir_parse_view(struct eir_view *view, const uint8_t *eir_data,
+							uint8_t eir_len)
 {
-	uint16_t len = 0;
+	struct bt_ad_iter iter;
+	const uint8_t *data;
+	uint8_t type, data_len;
 
-	eir->flags = 0;
-	eir->tx_power = 127;
+	memset(view, 0, sizeof(*view));
+	view->tx_power = 127;
 
-	/* No EIR data to parse */
-	if (eir_data == NULL)
-		return;
+	bt_ad_iter_init(&iter, eir_data, eir_len);
 
-	while (len < eir_len - 1) {
-		uint8_t field_len = eir_data[0];
-		const uint8_t *data;
-		uint8_t data_len;
+	while (bt_ad_iter_next(&iter, &type, &data_len, &data)) {
+		switch (type) {
+		case EIR_FLAGS:
+			if (data_len > 0)
+				view->flags = *data;
+			break;
 
-		/* Check for the end of EIR */
-		if (field_len == 0)
+		case EIR_NAME_SHORT:
+		case EIR_NAME_COMPLETE:
+			/* Some vendors put a NUL byte terminator into
+			 * the name */
+			while (data_len > 0 && data[data_len - 1] == '\0')
+				data_len--;
+
+			view->name = data;
+			view->name_len = data_len;
+			view->name_complete = type == EIR_NAME_COMPLETE;
 			break;
 
-		len += field_len + 1;
+		case EIR_TX_POWER:
+			if (data_len < 1)
+				break;
+			view->tx_power = (int8_t) data[0];
+			break;
 
-		/* Do not continue EIR Data parsing if got incorrect length */
-		if (len > eir_len)
+		case EIR_CLASS_OF_DEV:
+			if (data_len < 3)
+				break;
+			view->class = data[0] | (data[1] << 8) |
+							(data[2] << 16);
 			break;
 
-		data = &eir_data[2];
-		data_len = field_len - 1;
+		case EIR_GAP_APPEARANCE:
+			if (data_len < 2)
+				break;
+			view->appearance = get_le16(data);
+			break;
+
+		case EIR_DEVICE_ID:
+			if (data_len < 8)
+				break;
+
+			view->did_source = data[0] | (data[1] << 8);
+			view->did_vendor = data[2] | (data[3] << 8);
+			view->did_product = data[4] | (data[5] << 8);
+			view->did_version = data[6] | (data[7] << 8);
+			break;
+		}
+	}
+}
+
+void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
+{
+	struct eir_view view;
+	struct bt_ad_iter iter;
+	const uint8_t *data;
+	uint8_t type, data_len;
+
+	eir_parse_view(&view, eir_data, eir_len);
+
+	eir->flags = view.flags;
+	eir->tx_power = view.tx_power;
+	eir->class = view.class;
+	eir->appearance = view.appearance;
+	eir->did_source = view.did_source;
+	eir->did_vendor = view.did_vendor;
+	eir->did_product = view.did_product;
+	eir->did_version = view.did_version;
+
+	if (view.name) {
+		g_free(eir->name);
+		eir->name = name2utf8(view.name, view.name_len);
+		eir->name_complete = view.name_complete;
+	}
+
+	bt_ad_iter_init(&iter, eir_data, eir_len);
 
-		switch (eir_data[1]) {
+	while (bt_ad_iter_next(&iter, &type, &data_len, &data)) {
+		switch (type) {
 		case EIR_UUID16_SOME:
 		case EIR_UUID16_ALL:
 			eir_parse_uuid16(eir, data, data_len);
@@ -284,40 +346,13 @@ void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
 			break;
 
 		case EIR_FLAGS:
-			if (data_len > 0)
-				eir->flags = *data;
-			break;
-
 		case EIR_NAME_SHORT:
 		case EIR_NAME_COMPLETE:
-			/* Some vendors put a NUL byte terminator into
-			 * the name */
-			while (data_len > 0 && data[data_len - 1] == '\0')
-				data_len--;
-
-			g_free(eir->name);
-
-			eir->name = name2utf8(data, data_len);
-			eir->name_complete = eir_data[1] == EIR_NAME_COMPLETE;
-			break;
-
 		case EIR_TX_POWER:
-			if (data_len < 1)
-				break;
-			eir->tx_power = (int8_t) data[0];
-			break;
-
 		case EIR_CLASS_OF_DEV:
-			if (data_len < 3)
-				break;
-			eir->class = data[0] | (data[1] << 8) |
-							(data[2] << 16);
-			break;
-
 		case EIR_GAP_APPEARANCE:
-			if (data_len < 2)
-				break;
-			eir->appearance = get_le16(data);
+		case EIR_DEVICE_ID:
+			/* Already parsed by eir_parse_view */
 			break;
 
 		case EIR_SSP_HASH:
@@ -332,16 +367,6 @@ void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
 			eir->randomizer = g_memdup(data, 16);
 			break;
 
-		case EIR_DEVICE_ID:
-			if (data_len < 8)
-				break;
-
-			eir->did_source = data[0] | (data[1] << 8);
-			eir->did_vendor = data[2] | (data[3] << 8);
-			eir->did_product = data[4] | (data[5] << 8);
-			eir->did_version = data[6] | (data[7] << 8);
-			break;
-
 		case EIR_SVC_DATA16:
 			eir_parse_uuid16_data(eir, data, data_len);
 			break;
@@ -359,12 +384,67 @@ void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
 			break;
 
 		default:
-			eir_parse_data(eir, eir_data[1], data, data_len);
+			eir_parse_data(eir, type, data, data_len);
 			break;
 		}
+	}
+}
+
+static bool uuid_list_has(uint8_t type, const uint8_t *data, uint8_t len,
+							const bt_uuid_t *uuid)
+{
+	bt_uuid_t entry;
+	uint128_t u128;
+
+	switch (type) {
+	case EIR_UUID16_SOME:
+	case EIR_UUID16_ALL:
+		for (; len >= 2; data += 2, len -= 2) {
+			bt_uuid16_create(&entry, get_le16(data));
+			if (!bt_uuid_cmp(&entry, uuid))
+				return true;
+		}
+		break;
+
+	case EIR_UUID32_SOME:
+	case EIR_UUID32_ALL:
+		for (; len >= 4; data += 4, len -= 4) {
+			bt_uuid32_create(&entry, get_le32(data));
+			if (!bt_uuid_cmp(&entry, uuid))
+				return true;
+		}
+		break;
+
+	case EIR_UUID128_SOME:
+	case EIR_UUID128_ALL:
+		for (; len >= 16; data += 16, len -= 16) {
+			bswap_128(data, &u128);
+			bt_uuid128_create(&entry, u128);
+			if (!bt_uuid_cmp(&entry, uuid))
+				return true;
+		}
+		break;
+	}
+
+	return false;
+}
+
+/* Checks the service UUID lists without converting them to strings */
+bool eir_has_uuid(const uint8_t *eir_data, uint8_t eir_len,
+							const bt_uuid_t *uuid)
+{
+	struct bt_ad_iter iter;
+	const uint8_t *data;
+	uint8_t type, data_len;
 
-		eir_data += field_len + 1;
+	bt_ad_iter_init(&iter, eir_data, eir_len);
+
+	while (bt_ad_iter_next(&iter, &type, &data_len, &data)) {
+		if (uuid_list_has(type, data, data_len, uuid))
+			return true;
 	}
+
+	return false;
 }
 
 int eir_parse_oob(struct eir_data *eir, uint8_t *eir_data, uint16_t eir_len)
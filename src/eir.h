@@ -12,6 +12,7 @@
 #include <glib.h>
 
 #include "lib/sdp.h"
+#include "lib/uuid.h"
 
 #define EIR_FLAGS                   0x01  /* flags */
 #define EIR_UUID16_SOME             0x02  /* 16-bit UUID, more available */
@@ -89,8 +90,30 @@ struct eir_data {
 	GSList *data_list;
 };
 
+/*
+ * Fixed size fields of EIR/AD data parsed without any allocation, name points
+ * into the parsed data and is not NUL terminated.
+ */
+struct eir_view {
+	unsigned int flags;
+	const uint8_t *name;
+	uint8_t name_len;
+	bool name_complete;
+	uint32_t class;
+	uint16_t appearance;
+	int8_t tx_power;
+	uint16_t did_vendor;
+	uint16_t did_product;
+	uint16_t did_version;
+	uint16_t did_source;
+};
+
 void eir_data_free(struct eir_data *eir);
 void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len);
+void eir_parse_view(struct eir_view *view, const uint8_t *eir_data,
+							uint8_t eir_len);
+bool eir_has_uuid(const uint8_t *eir_data, uint8_t eir_len,
+							const bt_uuid_t *uuid);
 int eir_parse_oob(struct eir_data *eir, uint8_t *eir_data, uint16_t eir_len);
 int eir_create_oob(const bdaddr_t *addr, const char *name, uint32_t cod,
 			const uint8_t *hash, const uint8_t *randomizer,
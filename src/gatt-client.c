@@ -109,6 +109,7 @@ struct characteristic {
 
 	struct async_dbus_op *read_op;
 	struct async_dbus_op *write_op;
+	gint64 read_expire;
 
 	struct queue *descs;
 
@@ -473,8 +474,9 @@ static DBusMessage *descriptor_read_value(DBusConnection *conn,
 	if (parse_options(&iter, &offset, NULL))
 		return btd_error_invalid_args(msg);
 
+	/* A read in progress also covers any offset past its own */
 	if (desc->read_op) {
-		if (desc->read_op->offset != offset)
+		if (offset < desc->read_op->offset)
 			return btd_error_in_progress(msg);
 		queue_push_tail(desc->read_op->msgs, dbus_message_ref(msg));
 		return NULL;
@@ -895,9 +897,14 @@ static void chrc_read_cb(bool success, uint8_t att_ecode, const uint8_t *value,
 	if (!success)
 		goto fail;
 
-	if (!op->offset)
+	if (!op->offset) {
 		gatt_db_attribute_reset(chrc->attr);
 
+		if (btd_opts.gatt_read_cache)
+			chrc->read_expire = g_get_monotonic_time() +
+					btd_opts.gatt_read_cache * 1000;
+	}
+
 	if (!gatt_db_attribute_write(chrc->attr, op->offset, value, length, 0,
 					NULL, write_characteristic_cb, chrc)) {
 		error("Failed to store attribute");
@@ -919,6 +926,30 @@ static void chrc_read_cb(bool success, uint8_t att_ecode, const uint8_t *value,
 fail:
 	async_dbus_op_reply(op, att_ecode, NULL, 0);
 	chrc->read_op = NULL;
+	chrc->read_expire = 0;
+}
+
+static bool chrc_read_cached(struct characteristic *chrc, DBusMessage *msg)
+{
+	struct async_dbus_op *op;
+	bool cached;
+
+	/* Notifying values are kept up to date by the remote instead */
+	if (!chrc->read_expire || chrc->notifying)
+		return false;
+
+	if (g_get_monotonic_time() >= chrc->read_expire) {
+		chrc->read_expire = 0;
+		return false;
+	}
+
+	/* Values stored in the client db are read back synchronously */
+	op = async_dbus_op_new(msg, chrc);
+	cached = gatt_db_attribute_read(chrc->attr, 0, 0, NULL, read_op_cb,
+									op);
+	async_dbus_op_free(op);
+
+	return cached;
 }
 
 static DBusMessage *characteristic_read_value(DBusConnection *conn,
@@ -937,13 +968,17 @@ static DBusMessage *characteristic_read_value(DBusConnection *conn,
 	if (parse_options(&iter, &offset, NULL))
 		return btd_error_invalid_args(msg);
 
+	/* A read in progress also covers any offset past its own */
 	if (chrc->read_op) {
-		if (chrc->read_op->offset != offset)
+		if (offset < chrc->read_op->offset)
 			return btd_error_in_progress(msg);
 		queue_push_tail(chrc->read_op->msgs, dbus_message_ref(msg));
 		return NULL;
 	}
 
+	if (chrc_read_cached(chrc, msg))
+		return NULL;
+
 	chrc->read_op = read_value(gatt, msg, chrc->value_handle, offset,
 							chrc_read_cb, chrc);
 	if (!chrc->read_op)
@@ -986,6 +1021,9 @@ static DBusMessage *characteristic_write_value(DBusConnection *conn,
 	if (chrc->write_op)
 		return btd_error_in_progress(msg);
 
+	/* The remote value is about to change, don't serve stale reads */
+	chrc->read_expire = 0;
+
 	dbus_message_iter_init(msg, &iter);
 
 	if (parse_value_arg(&iter, &value, &value_len))
@@ -1086,6 +1124,8 @@ static bool sock_read(struct io *io, void *user_data)
 	if (!gatt || bytes_read == 0)
 		return false;
 
+	chrc->read_expire = 0;
+
 	bt_gatt_client_write_without_response(gatt, chrc->value_handle,
 					chrc->props & BT_GATT_CHRC_PROP_AUTH,
 					buf, bytes_read);
@@ -25,6 +25,7 @@
 #include "gdbus/gdbus.h"
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
+#include "src/shared/hashmap.h"
 #include "src/shared/io.h"
 #include "src/shared/att.h"
 #include "src/shared/gatt-db.h"
@@ -68,7 +69,11 @@ struct btd_gatt_database {
 	GIOChannel *eatt_io;
 	GIOChannel *bredr_io;
 	struct queue *records;
-	struct queue *device_states;
+	struct hashmap *device_states;
+	struct hashmap *subscribers;	/* Enabled ccc_state by CCC handle */
+	struct stored_value *stored_lru;	/* Least recently updated */
+	struct stored_value *stored_mru;
+	size_t stored_size;
 	struct queue *ccc_callbacks;
 	struct gatt_db_attribute *svc_chngd;
 	struct gatt_db_attribute *svc_chngd_ccc;
@@ -108,6 +113,14 @@ struct external_profile {
 	struct queue *profiles; /* btd_profile list */
 };
 
+/* Local copy of the value of attributes flagged as cacheable */
+struct value_cache {
+	bool enabled;
+	bool valid;
+	uint8_t *value;
+	uint16_t len;
+};
+
 struct external_chrc {
 	struct external_service *service;
 	char *path;
@@ -125,6 +138,7 @@ struct external_chrc {
 	unsigned int ntfy_cnt;
 	bool prep_authorized;
 	bool req_prep_authorization;
+	struct value_cache cache;
 };
 
 struct external_desc {
@@ -138,6 +152,7 @@ struct external_desc {
 	struct queue *pending_writes;
 	bool prep_authorized;
 	bool req_prep_authorization;
+	struct value_cache cache;
 };
 
 struct pending_op {
@@ -150,6 +165,7 @@ struct pending_op {
 	struct iovec data;
 	bool is_characteristic;
 	bool prep_authorize;
+	struct value_cache *cache;
 };
 
 struct notify {
@@ -163,6 +179,19 @@ struct notify {
 
 #define CLI_FEAT_SIZE 1
 
+/* Notified values kept per device until it reconnects */
+#define DEVICE_STORED_MAX 32
+
+struct stored_value {
+	struct device_state *state;
+	struct stored_value *prev;
+	struct stored_value *next;
+	uint16_t handle;
+	uint16_t ccc_handle;
+	uint16_t len;
+	uint8_t value[];
+};
+
 struct device_state {
 	struct btd_gatt_database *db;
 	bdaddr_t bdaddr;
@@ -173,6 +202,8 @@ struct device_state {
 	bool out_of_sync;
 	struct queue *ccc_states;
 	struct notify *pending;
+	struct queue *stored;		/* Latest value by handle */
+	struct bt_gatt_server *server;	/* Set while connected */
 };
 
 typedef uint8_t (*btd_gatt_database_ccc_write_t) (struct pending_op *op,
@@ -180,6 +211,7 @@ typedef uint8_t (*btd_gatt_database_ccc_write_t) (struct pending_op *op,
 typedef void (*btd_gatt_database_destroy_t) (void *data);
 
 struct ccc_state {
+	struct device_state *state;
 	uint16_t handle;
 	uint16_t value;
 };
@@ -191,11 +223,6 @@ struct ccc_cb_data {
 	void *user_data;
 };
 
-struct device_info {
-	bdaddr_t bdaddr;
-	uint8_t bdaddr_type;
-};
-
 static void ccc_cb_free(void *data)
 {
 	struct ccc_cb_data *ccc_cb = data;
@@ -226,27 +253,20 @@ static bool ccc_cb_match_handle(const void *data, const void *match_data)
 	return ccc_cb->handle == handle;
 }
 
-static bool dev_state_match(const void *a, const void *b)
-{
-	const struct device_state *dev_state = a;
-	const struct device_info *dev_info = b;
-
-	return bacmp(&dev_state->bdaddr, &dev_info->bdaddr) == 0 &&
-				dev_state->bdaddr_type == dev_info->bdaddr_type;
-}
-
 static struct device_state *
 find_device_state(struct btd_gatt_database *database, const bdaddr_t *bdaddr,
 							uint8_t bdaddr_type)
 {
-	struct device_info dev_info;
-
-	memset(&dev_info, 0, sizeof(dev_info));
-
-	bacpy(&dev_info.bdaddr, bdaddr);
-	dev_info.bdaddr_type = bdaddr_type;
+	return hashmap_lookup(database->device_states,
+				hashmap_bdaddr_key(bdaddr, bdaddr_type));
+}
 
-	return queue_find(database->device_states, dev_state_match, &dev_info);
+static bool remove_device_state(struct btd_gatt_database *database,
+					struct device_state *state)
+{
+	return hashmap_remove_key(database->device_states,
+				hashmap_bdaddr_key(&state->bdaddr,
+						state->bdaddr_type)) != NULL;
 }
 
 static bool ccc_state_match(const void *a, const void *b)
@@ -264,6 +284,61 @@ static struct ccc_state *find_ccc_state(struct device_state *dev_state,
 							UINT_TO_PTR(handle));
 }
 
+static void subscriber_add(struct btd_gatt_database *database,
+						struct ccc_state *ccc)
+{
+	struct queue *subscribers;
+
+	subscribers = hashmap_lookup(database->subscribers, ccc->handle);
+	if (!subscribers) {
+		subscribers = queue_new();
+		hashmap_insert(database->subscribers, ccc->handle, subscribers);
+	}
+
+	queue_push_tail(subscribers, ccc);
+}
+
+static void subscriber_remove(struct btd_gatt_database *database,
+						struct ccc_state *ccc)
+{
+	struct queue *subscribers;
+
+	subscribers = hashmap_lookup(database->subscribers, ccc->handle);
+	if (!queue_remove(subscribers, ccc) || !queue_isempty(subscribers))
+		return;
+
+	/* Last subscriber gone, don't keep the handle around */
+	hashmap_remove_key(database->subscribers, ccc->handle);
+	queue_destroy(subscribers, NULL);
+}
+
+static void subscribers_free(void *data)
+{
+	queue_destroy(data, NULL);
+}
+
+static void ccc_state_set_value(struct ccc_state *ccc, uint16_t value)
+{
+	struct btd_gatt_database *database = ccc->state->db;
+
+	if (value && !ccc->value)
+		subscriber_add(database, ccc);
+	else if (!value && ccc->value)
+		subscriber_remove(database, ccc);
+
+	ccc->value = value;
+}
+
+static void ccc_state_free(void *data)
+{
+	struct ccc_state *ccc = data;
+
+	if (ccc->value)
+		subscriber_remove(ccc->state->db, ccc);
+
+	free(ccc);
+}
+
 static struct device_state *device_state_create(struct btd_gatt_database *db,
 							const bdaddr_t *bdaddr,
 							uint8_t bdaddr_type)
@@ -279,11 +354,55 @@ static struct device_state *device_state_create(struct btd_gatt_database *db,
 	return dev_state;
 }
 
+static void stored_unlink(struct stored_value *stored)
+{
+	struct btd_gatt_database *database = stored->state->db;
+
+	if (stored->prev)
+		stored->prev->next = stored->next;
+	else
+		database->stored_lru = stored->next;
+
+	if (stored->next)
+		stored->next->prev = stored->prev;
+	else
+		database->stored_mru = stored->prev;
+
+	stored->prev = NULL;
+	stored->next = NULL;
+}
+
+static void stored_link(struct stored_value *stored)
+{
+	struct btd_gatt_database *database = stored->state->db;
+
+	stored->prev = database->stored_mru;
+	stored->next = NULL;
+
+	if (database->stored_mru)
+		database->stored_mru->next = stored;
+	else
+		database->stored_lru = stored;
+
+	database->stored_mru = stored;
+}
+
+static void stored_value_free(void *data)
+{
+	struct stored_value *stored = data;
+
+	stored_unlink(stored);
+	stored->state->db->stored_size -= sizeof(*stored) + stored->len;
+
+	free(stored);
+}
+
 static void device_state_free(void *data)
 {
 	struct device_state *state = data;
 
-	queue_destroy(state->ccc_states, free);
+	queue_destroy(state->stored, stored_value_free);
+	queue_destroy(state->ccc_states, ccc_state_free);
 
 	if (state->pending) {
 		free(state->pending->value);
@@ -320,6 +439,7 @@ static void att_disconnected(int err, void *user_data)
 
 	state->disc_id = 0;
 	state->out_of_sync = false;
+	state->server = NULL;
 
 	device = btd_adapter_find_device(state->db->adapter, &state->bdaddr,
 							state->bdaddr_type);
@@ -342,7 +462,7 @@ static void att_disconnected(int err, void *user_data)
 
 remove:
 	/* Remove device state if device no longer exists or is not paired */
-	if (queue_remove(state->db->device_states, state)) {
+	if (remove_device_state(state->db, state)) {
 		queue_foreach(state->ccc_states, clear_ccc_state, state->db);
 		device_state_free(state);
 	}
@@ -396,7 +516,8 @@ static struct device_state *get_device_state(struct btd_gatt_database *database,
 
 	dev_state = device_state_create(database, &bdaddr, bdaddr_type);
 
-	queue_push_tail(database->device_states, dev_state);
+	hashmap_insert(database->device_states,
+			hashmap_bdaddr_key(&bdaddr, bdaddr_type), dev_state);
 
 done:
 	if (!dev_state->disc_id)
@@ -422,6 +543,7 @@ static struct ccc_state *get_ccc_state(struct btd_gatt_database *database,
 		return ccc;
 
 	ccc = new0(struct ccc_state, 1);
+	ccc->state = dev_state;
 	ccc->handle = handle;
 	queue_push_tail(dev_state->ccc_states, ccc);
 
@@ -447,6 +569,99 @@ static void cancel_pending_write(void *data)
 	op->owner_queue = NULL;
 }
 
+static void value_cache_update(struct value_cache *cache,
+					const uint8_t *value, uint16_t len)
+{
+	if (!cache->enabled)
+		return;
+
+	free(cache->value);
+	cache->value = NULL;
+
+	if (len) {
+		cache->value = malloc(len);
+		memcpy(cache->value, value, len);
+	}
+
+	cache->len = len;
+	cache->valid = true;
+}
+
+static void value_cache_update_iter(struct value_cache *cache,
+						DBusMessageIter *iter)
+{
+	DBusMessageIter array;
+	uint8_t *value = NULL;
+	int len = 0;
+
+	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY)
+		return;
+
+	dbus_message_iter_recurse(iter, &array);
+	dbus_message_iter_get_fixed_array(&array, &value, &len);
+
+	if (len < 0)
+		return;
+
+	value_cache_update(cache, value, MIN(BT_ATT_MAX_VALUE_LEN, len));
+}
+
+static void value_cache_load(struct value_cache *cache, GDBusProxy *proxy)
+{
+	DBusMessageIter iter;
+
+	if (cache->enabled && g_dbus_proxy_get_property(proxy, "Value", &iter))
+		value_cache_update_iter(cache, &iter);
+}
+
+static void value_cache_invalidate(struct value_cache *cache)
+{
+	free(cache->value);
+	cache->value = NULL;
+	cache->len = 0;
+	cache->valid = false;
+}
+
+static void pending_read_drop_cache(void *data, void *user_data)
+{
+	struct pending_op *op = data;
+
+	op->cache = NULL;
+}
+
+/* Remote writes go through the application which then updates Value */
+static void value_cache_write(struct value_cache *cache,
+						struct queue *pending_reads)
+{
+	if (!cache->enabled)
+		return;
+
+	value_cache_invalidate(cache);
+
+	/* Reads already sent may return the value from before the write */
+	queue_foreach(pending_reads, pending_read_drop_cache, NULL);
+}
+
+static bool value_cache_read(struct value_cache *cache,
+					struct gatt_db_attribute *attrib,
+					unsigned int id, uint16_t offset)
+{
+	if (!cache->valid)
+		return false;
+
+	if (offset > cache->len) {
+		gatt_db_attribute_read_result(attrib, id,
+						BT_ATT_ERROR_INVALID_OFFSET,
+						NULL, 0);
+		return true;
+	}
+
+	gatt_db_attribute_read_result(attrib, id, 0, cache->value + offset,
+						cache->len - offset);
+
+	return true;
+}
+
 static void chrc_free(void *data)
 {
 	struct external_chrc *chrc = data;
@@ -462,6 +677,8 @@ static void chrc_free(void *data)
 	g_dbus_proxy_set_property_watch(chrc->proxy, NULL, NULL);
 	g_dbus_proxy_unref(chrc->proxy);
 
+	value_cache_invalidate(&chrc->cache);
+
 	free(chrc);
 }
 
@@ -472,9 +689,14 @@ static void desc_free(void *data)
 	queue_destroy(desc->pending_reads, cancel_pending_read);
 	queue_destroy(desc->pending_writes, cancel_pending_write);
 
+	if (desc->cache.enabled)
+		g_dbus_proxy_set_property_watch(desc->proxy, NULL, NULL);
+
 	g_dbus_proxy_unref(desc->proxy);
 	g_free(desc->chrc_path);
 
+	value_cache_invalidate(&desc->cache);
+
 	free(desc);
 }
 
@@ -597,11 +819,13 @@ static void gatt_database_free(void *data)
 	gatt_db_unregister(database->db, database->db_id);
 
 	queue_destroy(database->records, gatt_record_free);
-	queue_destroy(database->device_states, device_state_free);
+	hashmap_destroy(database->device_states, device_state_free);
+	hashmap_destroy(database->subscribers, subscribers_free);
 	queue_destroy(database->apps, app_free);
 	queue_destroy(database->profiles, profile_free);
 	queue_destroy(database->ccc_callbacks, ccc_cb_free);
 	database->device_states = NULL;
+	database->subscribers = NULL;
 	database->ccc_callbacks = NULL;
 
 	gatt_db_unref(database->db);
@@ -1010,7 +1234,7 @@ static void gatt_ccc_write_cb(struct gatt_db_attribute *attrib,
 	}
 
 	if (!ecode)
-		ccc->value = val;
+		ccc_state_set_value(ccc, val);
 
 done:
 	gatt_db_attribute_write_result(attrib, id, ecode);
@@ -1296,11 +1520,96 @@ static void service_changed_conf(void *user_data)
 	state->change_aware = true;
 }
 
+static bool stored_match_handle(const void *data, const void *match_data)
+{
+	const struct stored_value *stored = data;
+
+	return stored->handle == PTR_TO_UINT(match_data);
+}
+
+static void state_store_value(struct device_state *state,
+						struct notify *notify)
+{
+	struct btd_gatt_database *database = notify->database;
+	struct stored_value *stored;
+
+	if (!btd_opts.gatt_nfy_store)
+		return;
+
+	/* Only the latest value of each handle is of interest */
+	stored = queue_remove_if(state->stored, stored_match_handle,
+						UINT_TO_PTR(notify->handle));
+	if (stored)
+		stored_value_free(stored);
+
+	if (!state->stored)
+		state->stored = queue_new();
+
+	if (queue_length(state->stored) >= DEVICE_STORED_MAX)
+		stored_value_free(queue_pop_head(state->stored));
+
+	stored = malloc(sizeof(*stored) + notify->len);
+	if (!stored)
+		return;
+
+	stored->state = state;
+	stored->handle = notify->handle;
+	stored->ccc_handle = notify->ccc_handle;
+	stored->len = notify->len;
+	memcpy(stored->value, notify->value, notify->len);
+
+	queue_push_tail(state->stored, stored);
+	stored_link(stored);
+	database->stored_size += sizeof(*stored) + stored->len;
+
+	/* Drop the values not updated for the longest time over the limit */
+	while (database->stored_size > btd_opts.gatt_nfy_store) {
+		struct stored_value *lru = database->stored_lru;
+
+		queue_remove(lru->state->stored, lru);
+		stored_value_free(lru);
+	}
+}
+
+static void state_flush_stored(struct device_state *state,
+						struct bt_gatt_server *server)
+{
+	struct stored_value *stored;
+	struct ccc_state *ccc;
+
+	if (queue_isempty(state->stored))
+		return;
+
+	DBG("GATT server sending %u stored notifications",
+						queue_length(state->stored));
+
+	/*
+	 * Values are sent from memory rather than read back from the
+	 * applications, letting them be aggregated with the multiple variant
+	 * when the client supports it.
+	 */
+	while ((stored = queue_pop_head(state->stored))) {
+		ccc = find_ccc_state(state, stored->ccc_handle);
+		if (ccc && (ccc->value & 0x0001))
+			bt_gatt_server_send_notification(server, stored->handle,
+					stored->value, stored->len,
+					state->cli_feat[0] &
+					BT_GATT_CHRC_CLI_FEAT_NFY_MULTI);
+
+		stored_value_free(stored);
+	}
+}
+
 static void state_set_pending(struct device_state *state, struct notify *notify)
 {
 	uint16_t start, end, old_start, old_end;
 
-	/* Cache this only for Service Changed */
+	if (!notify->conf) {
+		state_store_value(state, notify);
+		return;
+	}
+
+	/* Cache only Service Changed among indications */
 	if (notify->conf != service_changed_conf)
 		return;
 
@@ -1327,29 +1636,20 @@ static void state_set_pending(struct device_state *state, struct notify *notify)
 	memcpy(state->pending->value, notify->value, notify->len);
 }
 
-static void send_notification_to_device(void *data, void *user_data)
+static void send_notification_to_ccc(struct device_state *device_state,
+						struct ccc_state *ccc,
+						struct notify *notify)
 {
-	struct device_state *device_state = data;
-	struct notify *notify = user_data;
-	struct ccc_state *ccc;
 	struct btd_device *device;
 	struct bt_gatt_server *server;
 
-	if (notify->conf == service_changed_conf) {
-		if (device_state->cli_feat[0] &
-				BT_GATT_CHRC_CLI_FEAT_ROBUST_CACHING) {
-			device_state->change_aware = false;
-			notify->user_data = device_state;
-		}
-	}
-
-	ccc = find_ccc_state(device_state, notify->ccc_handle);
-	if (!ccc)
-		return;
-
 	if (!ccc->value || (notify->conf && !(ccc->value & 0x0002)))
 		return;
 
+	server = device_state->server;
+	if (server)
+		goto send;
+
 	device = btd_adapter_find_device(notify->database->adapter,
 						&device_state->bdaddr,
 						device_state->bdaddr_type);
@@ -1370,10 +1670,7 @@ static void send_notification_to_device(void *data, void *user_data)
 		return;
 	}
 
-	/*
-	 * TODO: If the device is not connected but bonded, send the
-	 * notification/indication when it becomes connected.
-	 */
+send:
 	if (!notify->conf) {
 		DBG("GATT server sending notification");
 		bt_gatt_server_send_notification(server,
@@ -1392,13 +1689,41 @@ static void send_notification_to_device(void *data, void *user_data)
 
 remove:
 	/* Remove device state if device no longer exists or is not paired */
-	if (queue_remove(notify->database->device_states, device_state)) {
+	if (remove_device_state(notify->database, device_state)) {
 		queue_foreach(device_state->ccc_states, clear_ccc_state,
 						notify->database);
 		device_state_free(device_state);
 	}
 }
 
+static void send_notification_to_device(void *data, void *user_data)
+{
+	struct device_state *device_state = data;
+	struct notify *notify = user_data;
+	struct ccc_state *ccc;
+
+	if (notify->conf == service_changed_conf) {
+		if (device_state->cli_feat[0] &
+				BT_GATT_CHRC_CLI_FEAT_ROBUST_CACHING) {
+			device_state->change_aware = false;
+			notify->user_data = device_state;
+		}
+	}
+
+	ccc = find_ccc_state(device_state, notify->ccc_handle);
+	if (!ccc)
+		return;
+
+	send_notification_to_ccc(device_state, ccc, notify);
+}
+
+static void send_notification_to_subscriber(void *data, void *user_data)
+{
+	struct ccc_state *ccc = data;
+
+	send_notification_to_ccc(ccc->state, ccc, user_data);
+}
+
 static void send_notification_to_devices(struct btd_gatt_database *database,
 					uint16_t handle, uint8_t *value,
 					uint16_t len, uint16_t ccc_handle,
@@ -1417,8 +1742,18 @@ static void send_notification_to_devices(struct btd_gatt_database *database,
 	notify.conf = conf;
 	notify.user_data = user_data;
 
-	queue_foreach(database->device_states, send_notification_to_device,
-								&notify);
+	/*
+	 * Service Changed also marks every robust caching client as change
+	 * unaware, whether subscribed or not.
+	 */
+	if (conf == service_changed_conf) {
+		hashmap_foreach(database->device_states,
+					send_notification_to_device, &notify);
+		return;
+	}
+
+	queue_foreach(hashmap_lookup(database->subscribers, ccc_handle),
+					send_notification_to_subscriber, &notify);
 }
 
 static void send_service_changed(struct btd_gatt_database *database,
@@ -1473,11 +1808,26 @@ static bool ccc_match_service(const void *data, const void *match_data)
 	return ccc->handle >= start && ccc->handle <= end;
 }
 
+static bool stored_match_service(const void *data, const void *match_data)
+{
+	const struct stored_value *stored = data;
+	const struct gatt_db_attribute *attrib = match_data;
+	uint16_t start, end;
+
+	if (!gatt_db_attribute_get_service_handles(attrib, &start, &end))
+		return false;
+
+	return stored->handle >= start && stored->handle <= end;
+}
+
 static void remove_device_ccc(void *data, void *user_data)
 {
 	struct device_state *state = data;
 
-	queue_remove_all(state->ccc_states, ccc_match_service, user_data, free);
+	queue_remove_all(state->ccc_states, ccc_match_service, user_data,
+							ccc_state_free);
+	queue_remove_all(state->stored, stored_match_service, user_data,
+							stored_value_free);
 }
 
 static bool match_gatt_record(const void *data, const void *user_data)
@@ -1502,7 +1852,7 @@ static void gatt_db_service_removed(struct gatt_db_attribute *attrib,
 
 	send_service_changed(database, attrib);
 
-	queue_foreach(database->device_states, remove_device_ccc, attrib);
+	hashmap_foreach(database->device_states, remove_device_ccc, attrib);
 	queue_remove_all(database->ccc_callbacks, ccc_cb_match_service, attrib,
 								ccc_cb_free);
 }
@@ -1600,7 +1950,8 @@ static bool incr_attr_count(struct external_service *service, uint16_t incr)
 
 static bool parse_chrc_flags(DBusMessageIter *array, uint8_t *props,
 					uint8_t *ext_props, uint32_t *perm,
-					bool *req_prep_authorization)
+					bool *req_prep_authorization,
+					bool *cacheable)
 {
 	const char *flag;
 
@@ -1663,6 +2014,8 @@ static bool parse_chrc_flags(DBusMessageIter *array, uint8_t *props,
 			*perm |= BT_ATT_PERM_WRITE | BT_ATT_PERM_WRITE_SECURE;
 		} else if (!strcmp("authorize", flag)) {
 			*req_prep_authorization = true;
+		} else if (!strcmp("cacheable", flag)) {
+			*cacheable = true;
 		} else {
 			error("Invalid characteristic flag: %s", flag);
 			return false;
@@ -1676,7 +2029,8 @@ static bool parse_chrc_flags(DBusMessageIter *array, uint8_t *props,
 }
 
 static bool parse_desc_flags(DBusMessageIter *array, uint32_t *perm,
-						bool *req_prep_authorization)
+						bool *req_prep_authorization,
+						bool *cacheable)
 {
 	const char *flag;
 
@@ -1706,6 +2060,8 @@ static bool parse_desc_flags(DBusMessageIter *array, uint32_t *perm,
 			*perm |= BT_ATT_PERM_WRITE | BT_ATT_PERM_WRITE_SECURE;
 		else if (!strcmp("authorize", flag))
 			*req_prep_authorization = true;
+		else if (!strcmp("cacheable", flag))
+			*cacheable = true;
 		else {
 			error("Invalid descriptor flag: %s", flag);
 			return false;
@@ -1716,7 +2072,8 @@ static bool parse_desc_flags(DBusMessageIter *array, uint32_t *perm,
 }
 
 static bool parse_flags(GDBusProxy *proxy, uint8_t *props, uint8_t *ext_props,
-				uint32_t *perm, bool *req_prep_authorization)
+				uint32_t *perm, bool *req_prep_authorization,
+				bool *cacheable)
 {
 	DBusMessageIter iter, array;
 	const char *iface;
@@ -1731,10 +2088,11 @@ static bool parse_flags(GDBusProxy *proxy, uint8_t *props, uint8_t *ext_props,
 
 	iface = g_dbus_proxy_get_interface(proxy);
 	if (!strcmp(iface, GATT_DESC_IFACE))
-		return parse_desc_flags(&array, perm, req_prep_authorization);
+		return parse_desc_flags(&array, perm, req_prep_authorization,
+								cacheable);
 
 	return parse_chrc_flags(&array, props, ext_props, perm,
-							req_prep_authorization);
+					req_prep_authorization, cacheable);
 }
 
 static struct external_chrc *chrc_create(struct gatt_app *app,
@@ -1783,7 +2141,8 @@ static struct external_chrc *chrc_create(struct gatt_app *app,
 	 * created.
 	 */
 	if (!parse_flags(proxy, &chrc->props, &chrc->ext_props, &chrc->perm,
-					&chrc->req_prep_authorization)) {
+					&chrc->req_prep_authorization,
+					&chrc->cache.enabled)) {
 		error("Failed to parse characteristic properties");
 		goto fail;
 	}
@@ -1866,7 +2225,8 @@ static struct external_desc *desc_create(struct gatt_app *app,
 	 * determine the permission the descriptor should have
 	 */
 	if (!parse_flags(proxy, NULL, NULL, &desc->perm,
-					&desc->req_prep_authorization)) {
+					&desc->req_prep_authorization,
+					&desc->cache.enabled)) {
 		error("Failed to parse characteristic properties");
 		goto fail;
 	}
@@ -2154,6 +2514,10 @@ static void read_reply_cb(DBusMessage *message, void *user_data)
 	len = MIN(BT_ATT_MAX_VALUE_LEN, len);
 	value = len ? value : NULL;
 
+	/* Whole values only, reads at an offset return partial ones */
+	if (op->cache && !op->offset)
+		value_cache_update(op->cache, value, len);
+
 done:
 	gatt_db_attribute_read_result(op->attrib, op->id, ecode, value, len);
 }
@@ -2238,12 +2602,14 @@ static struct pending_op *send_read(struct btd_device *device,
 					struct queue *owner_queue,
 					unsigned int id,
 					uint16_t offset,
-					uint8_t link_type)
+					uint8_t link_type,
+					struct value_cache *cache)
 {
 	struct pending_op *op;
 
 	op = pending_read_new(device, owner_queue, attrib, id, offset,
 							link_type);
+	op->cache = cache->enabled ? cache : NULL;
 
 	if (g_dbus_proxy_method_call(proxy, "ReadValue", read_setup_cb,
 				read_reply_cb, op, pending_op_free) == TRUE)
@@ -2721,6 +3087,11 @@ static void property_changed_cb(GDBusProxy *proxy, const char *name,
 	len = MIN(BT_ATT_MAX_VALUE_LEN, len);
 	value = len ? value : NULL;
 
+	value_cache_update(&chrc->cache, value, len);
+
+	if (!chrc->ccc)
+		return;
+
 	send_notification_to_devices(chrc->service->app->database,
 				gatt_db_attribute_get_handle(chrc->attrib),
 				value, len,
@@ -2815,8 +3186,12 @@ static void desc_read_cb(struct gatt_db_attribute *attrib,
 		goto fail;
 	}
 
+	if (value_cache_read(&desc->cache, attrib, id, offset))
+		return;
+
 	if (send_read(device, attrib, desc->proxy, desc->pending_reads, id,
-					offset, bt_att_get_link_type(att)))
+					offset, bt_att_get_link_type(att),
+					&desc->cache))
 		return;
 
 fail:
@@ -2838,6 +3213,8 @@ static void desc_write_cb(struct gatt_db_attribute *attrib,
 		goto fail;
 	}
 
+	value_cache_write(&desc->cache, desc->pending_reads);
+
 	device = att_get_device(att);
 	if (!device) {
 		error("Unable to find device object");
@@ -2881,6 +3258,15 @@ static void write_handle(struct GDBusProxy *proxy, uint16_t handle)
 					&handle, NULL, NULL, NULL);
 }
 
+static void desc_property_changed_cb(GDBusProxy *proxy, const char *name,
+					DBusMessageIter *iter, void *user_data)
+{
+	struct external_desc *desc = user_data;
+
+	if (!strcmp(name, "Value"))
+		value_cache_update_iter(&desc->cache, iter);
+}
+
 static bool database_add_desc(struct external_service *service,
 						struct external_desc *desc)
 {
@@ -2910,6 +3296,16 @@ static bool database_add_desc(struct external_service *service,
 
 	desc->handled = true;
 
+	if (desc->cache.enabled) {
+		value_cache_load(&desc->cache, desc->proxy);
+
+		if (!g_dbus_proxy_set_property_watch(desc->proxy,
+						desc_property_changed_cb, desc)) {
+			error("Failed to set up property watch for descriptor");
+			return false;
+		}
+	}
+
 	if (!handle) {
 		handle = gatt_db_attribute_get_handle(desc->attrib);
 		write_handle(desc->proxy, handle);
@@ -2941,8 +3337,12 @@ static void chrc_read_cb(struct gatt_db_attribute *attrib,
 		goto fail;
 	}
 
+	if (value_cache_read(&chrc->cache, attrib, id, offset))
+		return;
+
 	if (send_read(device, attrib, chrc->proxy, chrc->pending_reads, id,
-					offset, bt_att_get_link_type(att)))
+					offset, bt_att_get_link_type(att),
+					&chrc->cache))
 		return;
 
 fail:
@@ -2966,6 +3366,8 @@ static void chrc_write_cb(struct gatt_db_attribute *attrib,
 		goto fail;
 	}
 
+	value_cache_write(&chrc->cache, chrc->pending_reads);
+
 	device = att_get_device(att);
 	if (!device) {
 		error("Unable to find device object");
@@ -3085,6 +3487,18 @@ static bool database_add_chrc(struct external_service *service,
 	if (!database_add_cep(service, chrc))
 		return false;
 
+	if (chrc->cache.enabled) {
+		value_cache_load(&chrc->cache, chrc->proxy);
+
+		/* Characteristics with a CCC are already being watched */
+		if (!chrc->ccc && !g_dbus_proxy_set_property_watch(chrc->proxy,
+						property_changed_cb, chrc)) {
+			error("Failed to set up property watch for "
+							"characteristic");
+			return false;
+		}
+	}
+
 	if (!handle) {
 		handle = gatt_db_attribute_get_handle(chrc->attrib);
 		write_handle(chrc->proxy, handle);
@@ -3631,7 +4045,8 @@ struct btd_gatt_database *btd_gatt_database_new(struct btd_adapter *adapter)
 	database->adapter = btd_adapter_ref(adapter);
 	database->db = gatt_db_new();
 	database->records = queue_new();
-	database->device_states = queue_new();
+	database->device_states = hashmap_new();
+	database->subscribers = hashmap_new();
 	database->apps = queue_new();
 	database->profiles = queue_new();
 	database->ccc_callbacks = queue_new();
@@ -3732,23 +4147,32 @@ void btd_gatt_database_server_connected(struct btd_gatt_database *database,
 {
 	struct bt_att *att = bt_gatt_server_get_att(server);
 	struct device_state *state;
-	bdaddr_t bdaddr;
-	uint8_t bdaddr_type;
 
-	if (!get_dst_info(att, &bdaddr, &bdaddr_type))
+	state = get_device_state(database, att);
+	if (!state)
 		return;
 
 	bt_gatt_server_set_authorize(server, server_authorize, database);
 
-	state = find_device_state(database, &bdaddr, bdaddr_type);
-	if (!state || !state->pending)
-		return;
+	state->server = server;
+
+	if (state->pending) {
+		send_notification_to_device(state, state->pending);
+
+		free(state->pending->value);
+		free(state->pending);
+		state->pending = NULL;
+	}
 
-	send_notification_to_device(state, state->pending);
+	state_flush_stored(state, server);
+}
+
+static bool device_state_match_server(const void *data,
+						const void *match_data)
+{
+	const struct device_state *state = data;
 
-	free(state->pending->value);
-	free(state->pending);
-	state->pending = NULL;
+	return state->server == match_data;
 }
 
 void btd_gatt_database_att_disconnected(struct btd_gatt_database *database,
@@ -3766,8 +4190,15 @@ void btd_gatt_database_att_disconnected(struct btd_gatt_database *database,
 	type = btd_device_get_bdaddr_type(device);
 
 	state = find_device_state(database, addr, type);
-	if (!state)
+	if (!state) {
+		/* Don't leave the server behind if it was under another type */
+		state = hashmap_find(database->device_states,
+					device_state_match_server, server);
+		if (state)
+			state->server = NULL;
+
 		return;
+	}
 
 	if (state->disc_id)
 		bt_att_unregister_disconnect(att, state->disc_id);
@@ -3780,14 +4211,26 @@ static void restore_ccc(struct btd_gatt_database *database,
 {
 	struct device_state *dev_state;
 	struct ccc_state *ccc;
+	uint16_t handle;
 
-	dev_state = device_state_create(database, addr, addr_type);
-	queue_push_tail(database->device_states, dev_state);
+	dev_state = find_device_state(database, addr, addr_type);
+	if (!dev_state) {
+		dev_state = device_state_create(database, addr, addr_type);
+		hashmap_insert(database->device_states,
+				hashmap_bdaddr_key(addr, addr_type), dev_state);
+	}
 
-	ccc = new0(struct ccc_state, 1);
-	ccc->handle = gatt_db_attribute_get_handle(database->svc_chngd_ccc);
-	ccc->value = value;
-	queue_push_tail(dev_state->ccc_states, ccc);
+	handle = gatt_db_attribute_get_handle(database->svc_chngd_ccc);
+
+	ccc = find_ccc_state(dev_state, handle);
+	if (!ccc) {
+		ccc = new0(struct ccc_state, 1);
+		ccc->state = dev_state;
+		ccc->handle = handle;
+		queue_push_tail(dev_state->ccc_states, ccc);
+	}
+
+	ccc_state_set_value(ccc, value);
 }
 
 static void restore_state(struct btd_device *device, void *data)
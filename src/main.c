@@ -50,12 +50,14 @@
 #include "dbus-common.h"
 #include "agent.h"
 #include "profile.h"
+#include "storage.h"
 
 #define BLUEZ_NAME "org.bluez"
 
 #define DEFAULT_PAIRABLE_TIMEOUT       0 /* disabled */
 #define DEFAULT_DISCOVERABLE_TIMEOUT 180 /* 3 minutes */
 #define DEFAULT_TEMPORARY_TIMEOUT     30 /* 30 seconds */
+#define DEFAULT_STORAGE_FLUSH_DELAY  500 /* milliseconds */
 
 #define SHUTDOWN_GRACE_SECONDS 10
 
@@ -79,6 +81,9 @@ static const char *supported_options[] = {
 	"Privacy",
 	"JustWorksRepairing",
 	"TemporaryTimeout",
+	"StorageBackend",
+	"StorageFlushDelay",
+	"StorageSync",
 	NULL
 };
 
@@ -135,6 +140,11 @@ static const char *gatt_options[] = {
 	"KeySize",
 	"ExchangeMTU",
 	"Channels",
+	"ChannelScheduler",
+	"NotifyMultipleLatency",
+	"NotifyMultipleMaxPending",
+	"NotifyStoreSize",
+	"ReadCacheTimeout",
 	NULL
 };
 
@@ -229,6 +239,36 @@ static bt_gatt_cache_t parse_gatt_cache(const char *cache)
 	}
 }
 
+static bt_storage_t parse_storage_backend(const char *backend)
+{
+	if (!strcmp(backend, "files")) {
+		return BT_STORAGE_FILES;
+	} else if (!strcmp(backend, "log")) {
+		return BT_STORAGE_LOG;
+	} else {
+		DBG("Invalid value for StorageBackend=%s", backend);
+		return BT_STORAGE_FILES;
+	}
+}
+
+static enum bt_att_sched parse_gatt_scheduler(const char *sched)
+{
+	if (!strcmp(sched, "any")) {
+		return BT_ATT_SCHED_ANY;
+	} else if (!strcmp(sched, "round-robin")) {
+		return BT_ATT_SCHED_ROUND_ROBIN;
+	} else if (!strcmp(sched, "least-outstanding")) {
+		return BT_ATT_SCHED_LEAST_OUTSTANDING;
+	} else if (!strcmp(sched, "mtu-fit")) {
+		return BT_ATT_SCHED_MTU_FIT;
+	} else if (!strcmp(sched, "latency")) {
+		return BT_ATT_SCHED_LATENCY;
+	} else {
+		DBG("Invalid value for ChannelScheduler=%s", sched);
+		return BT_ATT_SCHED_ANY;
+	}
+}
+
 static enum jw_repairing_t parse_jw_repairing(const char *jw_repairing)
 {
 	if (!strcmp(jw_repairing, "never")) {
@@ -617,6 +657,36 @@ static void parse_config(GKeyFile *config)
 		btd_opts.tmpto = val;
 	}
 
+	str = g_key_file_get_string(config, "General", "StorageBackend",
+									&err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		DBG("storage_backend=%s", str);
+		btd_opts.storage_backend = parse_storage_backend(str);
+		g_free(str);
+	}
+
+	val = g_key_file_get_integer(config, "General",
+						"StorageFlushDelay", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else if (val < 0) {
+		DBG("Invalid StorageFlushDelay %d", val);
+	} else {
+		DBG("storage_delay=%d", val);
+		btd_opts.storage_delay = val;
+	}
+
+	boolean = g_key_file_get_boolean(config, "General",
+						"StorageSync", &err);
+	if (err)
+		g_clear_error(&err);
+	else
+		btd_opts.storage_sync = boolean;
+
 	str = g_key_file_get_string(config, "General", "Name", &err);
 	if (err) {
 		DBG("%s", err->message);
@@ -752,6 +822,62 @@ static void parse_config(GKeyFile *config)
 		btd_opts.gatt_channels = val;
 	}
 
+	str = g_key_file_get_string(config, "GATT", "ChannelScheduler", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		DBG("ChannelScheduler=%s", str);
+		btd_opts.gatt_scheduler = parse_gatt_scheduler(str);
+		g_free(str);
+	}
+
+	val = g_key_file_get_integer(config, "GATT", "NotifyMultipleLatency",
+									&err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		DBG("NotifyMultipleLatency=%d", val);
+		/* Ensure the latency is within a valid range. */
+		val = MIN(val, 1000);
+		val = MAX(val, 1);
+		btd_opts.gatt_nfy_latency = val;
+	}
+
+	val = g_key_file_get_integer(config, "GATT", "NotifyMultipleMaxPending",
+									&err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		DBG("NotifyMultipleMaxPending=%d", val);
+		val = MIN(val, UINT8_MAX);
+		val = MAX(val, 0);
+		btd_opts.gatt_nfy_pending = val;
+	}
+
+	val = g_key_file_get_integer(config, "GATT", "NotifyStoreSize", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		DBG("NotifyStoreSize=%d", val);
+		val = MAX(val, 0);
+		btd_opts.gatt_nfy_store = (size_t) val * 1024;
+	}
+
+	val = g_key_file_get_integer(config, "GATT", "ReadCacheTimeout", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		DBG("ReadCacheTimeout=%d", val);
+		val = MIN(val, 10000);
+		val = MAX(val, 0);
+		btd_opts.gatt_read_cache = val;
+	}
+
 	str = g_key_file_get_string(config, "AVDTP", "SessionMode", &err);
 	if (err) {
 		DBG("%s", err->message);
@@ -801,6 +927,9 @@ static void init_defaults(void)
 	btd_opts.pairto = DEFAULT_PAIRABLE_TIMEOUT;
 	btd_opts.discovto = DEFAULT_DISCOVERABLE_TIMEOUT;
 	btd_opts.tmpto = DEFAULT_TEMPORARY_TIMEOUT;
+	btd_opts.storage_backend = BT_STORAGE_FILES;
+	btd_opts.storage_delay = DEFAULT_STORAGE_FLUSH_DELAY;
+	btd_opts.storage_sync = FALSE;
 	btd_opts.reverse_discovery = TRUE;
 	btd_opts.name_resolv = TRUE;
 	btd_opts.debug_keys = FALSE;
@@ -822,6 +951,10 @@ static void init_defaults(void)
 	btd_opts.gatt_cache = BT_GATT_CACHE_ALWAYS;
 	btd_opts.gatt_mtu = BT_ATT_MAX_LE_MTU;
 	btd_opts.gatt_channels = 3;
+	btd_opts.gatt_scheduler = BT_ATT_SCHED_ANY;
+	btd_opts.gatt_nfy_latency = 10;
+	btd_opts.gatt_nfy_pending = 2;
+	btd_opts.gatt_nfy_store = 64 * 1024;
 
 	btd_opts.avdtp.session_mode = BT_IO_MODE_BASIC;
 	btd_opts.avdtp.stream_mode = BT_IO_MODE_BASIC;
@@ -1030,6 +1163,8 @@ int main(int argc, char *argv[])
 
 	parse_config(main_conf);
 
+	btd_storage_init(STORAGEDIR);
+
 	if (connect_dbus() < 0) {
 		error("Unable to get on D-Bus");
 		exit(1);
@@ -1093,6 +1228,8 @@ int main(int argc, char *argv[])
 
 	adapter_cleanup();
 
+	btd_storage_cleanup();
+
 	rfkill_exit();
 
 	if (btd_opts.mode != BT_MODE_LE)
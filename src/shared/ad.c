@@ -65,10 +65,47 @@ static bool ad_is_type_valid(uint8_t type)
 	return true;
 }
 
+void bt_ad_iter_init(struct bt_ad_iter *iter, const uint8_t *data, size_t len)
+{
+	iter->data = data;
+	iter->len = data ? len : 0;
+	iter->offset = 0;
+}
+
+/*
+ * Walks the length/type/data fields of raw advertising or EIR data in place,
+ * stopping at the first zero length field or at a field overrunning the
+ * buffer.
+ */
+bool bt_ad_iter_next(struct bt_ad_iter *iter, uint8_t *type, uint8_t *len,
+							const uint8_t **data)
+{
+	uint8_t field_len;
+
+	if (iter->offset + 1 >= iter->len)
+		return false;
+
+	field_len = iter->data[iter->offset];
+	if (!field_len || iter->offset + field_len + 1 > iter->len) {
+		iter->offset = iter->len;
+		return false;
+	}
+
+	*type = iter->data[iter->offset + 1];
+	*len = field_len - 1;
+	*data = &iter->data[iter->offset + 2];
+
+	iter->offset += field_len + 1;
+
+	return true;
+}
+
 struct bt_ad *bt_ad_new_with_data(size_t len, const uint8_t *data)
 {
 	struct bt_ad *ad;
-	uint16_t parsed_len = 0;
+	struct bt_ad_iter iter;
+	uint8_t d_type, d_len;
+	const uint8_t *d;
 
 	if (data == NULL || !len)
 		return NULL;
@@ -77,31 +114,14 @@ struct bt_ad *bt_ad_new_with_data(size_t len, const uint8_t *data)
 	if (!ad)
 		return NULL;
 
-	while (parsed_len < len - 1) {
-		uint8_t d_len;
-		uint8_t d_type;
-		const uint8_t *d;
-		uint8_t field_len = data[0];
-
-		if (field_len == 0)
-			break;
-
-		parsed_len += field_len + 1;
-
-		if (parsed_len > len)
-			break;
-
-		d = &data[2];
-		d_type = data[1];
-		d_len = field_len - 1;
+	bt_ad_iter_init(&iter, data, len);
 
+	while (bt_ad_iter_next(&iter, &d_type, &d_len, &d)) {
 		if (!ad_is_type_valid(d_type))
 			goto failed;
 
 		if (!ad_replace_data(ad, d_type, d, d_len))
 			goto failed;
-
-		data += field_len + 1;
 	}
 
 	return ad;
@@ -1143,3 +1163,65 @@ struct bt_ad_pattern *bt_ad_pattern_match(struct bt_ad *ad,
 
 	return info.matched_pattern;
 }
+
+struct pattern_match_data_info {
+	const uint8_t *data;
+	size_t len;
+};
+
+static bool pattern_data_match(const void *data, const void *user_data)
+{
+	const struct bt_ad_pattern *pattern = data;
+	const struct pattern_match_data_info *info = user_data;
+	struct bt_ad_iter iter;
+	const uint8_t *d, *field = NULL;
+	uint8_t type, len, field_len = 0;
+
+	if (!pattern)
+		return false;
+
+	/* Like bt_ad_new_with_data the last field of a given type wins */
+	bt_ad_iter_init(&iter, info->data, info->len);
+
+	while (bt_ad_iter_next(&iter, &type, &len, &d)) {
+		if (type != pattern->type)
+			continue;
+
+		field = d;
+		field_len = len;
+	}
+
+	if (!field || field_len < pattern->offset + pattern->len)
+		return false;
+
+	return !memcmp(field + pattern->offset, pattern->data, pattern->len);
+}
+
+/*
+ * Same as bt_ad_pattern_match but works directly on the raw data, so
+ * matching a report does not require parsing it into a bt_ad first.
+ */
+struct bt_ad_pattern *bt_ad_pattern_match_data(const uint8_t *data,
+					size_t len, struct queue *patterns)
+{
+	struct bt_ad_iter iter;
+	uint8_t type, d_len;
+	const uint8_t *d;
+	struct pattern_match_data_info info;
+
+	if (!data || !len || queue_isempty(patterns))
+		return NULL;
+
+	/* Data containing invalid types does not match any pattern */
+	bt_ad_iter_init(&iter, data, len);
+
+	while (bt_ad_iter_next(&iter, &type, &d_len, &d)) {
+		if (!ad_is_type_valid(type))
+			return NULL;
+	}
+
+	info.data = data;
+	info.len = len;
+
+	return queue_find(patterns, pattern_data_match, &info);
+}
@@ -95,10 +95,21 @@ struct bt_ad_pattern {
 	uint8_t data[BT_AD_MAX_DATA_LEN];
 };
 
+struct bt_ad_iter {
+	const uint8_t *data;
+	size_t len;
+	size_t offset;
+};
+
 struct bt_ad *bt_ad_new(void);
 
 struct bt_ad *bt_ad_new_with_data(size_t len, const uint8_t *data);
 
+void bt_ad_iter_init(struct bt_ad_iter *iter, const uint8_t *data, size_t len);
+
+bool bt_ad_iter_next(struct bt_ad_iter *iter, uint8_t *type, uint8_t *len,
+							const uint8_t **data);
+
 struct bt_ad *bt_ad_ref(struct bt_ad *ad);
 
 void bt_ad_unref(struct bt_ad *ad);
@@ -172,3 +183,6 @@ struct bt_ad_pattern *bt_ad_pattern_new(uint8_t type, size_t offset,
 
 struct bt_ad_pattern *bt_ad_pattern_match(struct bt_ad *ad,
 							struct queue *patterns);
+
+struct bt_ad_pattern *bt_ad_pattern_match_data(const uint8_t *data,
+					size_t len, struct queue *patterns);
@@ -33,6 +33,15 @@
 #define BT_ATT_EATT		0x02
 #define BT_ATT_LOCAL		0xff
 
+/* Assignment of PDUs queued with bt_att_send to the channels */
+enum bt_att_sched {
+	BT_ATT_SCHED_ANY,		/* First channel ready to write */
+	BT_ATT_SCHED_ROUND_ROBIN,	/* Rotate over the channels */
+	BT_ATT_SCHED_LEAST_OUTSTANDING,	/* Least queued/pending PDUs */
+	BT_ATT_SCHED_MTU_FIT,		/* Smallest MTU the PDU fits in */
+	BT_ATT_SCHED_LATENCY,		/* Lowest round trip time by depth */
+};
+
 /* ATT protocol opcodes */
 #define BT_ATT_OP_ERROR_RSP			0x01
 #define BT_ATT_OP_MTU_REQ			0x02
@@ -15,6 +15,9 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "src/shared/io.h"
 #include "src/shared/queue.h"
@@ -30,12 +33,17 @@
 #define ATT_OP_CMD_MASK			0x40
 #define ATT_OP_SIGNED_MASK		0x80
 #define ATT_TIMEOUT_INTERVAL		30000  /* 30000 ms */
+#define ATT_WRITE_BATCH			IO_SEND_BATCH_MAX  /* PDUs per wakeup */
+#define ATT_OP_POOL_SIZE		16  /* Send ops kept for reuse */
 
 /* Length of signature in write signed packet */
 #define BT_ATT_SIGNATURE_LEN		12
 
 struct att_send_op;
 
+static void wakeup_chan_writer(void *data, void *user_data);
+static void wakeup_writer(struct bt_att *att);
+
 struct bt_att_chan {
 	struct bt_att *att;
 	int fd;
@@ -53,6 +61,8 @@ struct bt_att_chan {
 
 	uint8_t *buf;
 	uint16_t mtu;
+
+	struct bt_att_chan_stats stats;
 };
 
 struct bt_att {
@@ -73,6 +83,12 @@ struct bt_att {
 	struct queue *write_queue;	/* Queue of PDUs ready to send */
 	bool in_disc;			/* Cleanup queues on disconnect_cb */
 
+	enum bt_att_sched sched;	/* Assignment of queued PDUs */
+	struct bt_att_chan *last_chan;	/* Last channel picked */
+
+	struct att_send_op *op_pool;	/* Free send ops with MTU buffers */
+	unsigned int op_pool_len;
+
 	bt_att_timeout_func_t timeout_callback;
 	bt_att_destroy_func_t timeout_destroy;
 	void *timeout_data;
@@ -185,30 +201,90 @@ static uint8_t get_req_opcode(uint8_t rsp_opcode)
 	return 0;
 }
 
+/*
+ * The PDU is stored right after the op in the same allocation, sized for
+ * the MTU so that freed ops can be kept in a per bt_att pool and reused
+ * without allocating for every PDU sent.
+ */
 struct att_send_op {
+	struct bt_att *att;
 	unsigned int id;
 	unsigned int timeout_id;
 	enum att_op_type type;
 	uint8_t opcode;
 	void *pdu;
 	uint16_t len;
+	uint16_t size;			/* Size of the PDU buffer */
 	bt_att_response_func_t callback;
 	bt_att_destroy_func_t destroy;
 	void *user_data;
+	uint64_t sent;			/* Time written, for round trip */
+	struct att_send_op *next;	/* Next op in the pool */
+	uint8_t buf[];
 };
 
+static struct att_send_op *att_send_op_alloc(struct bt_att *att,
+								uint16_t len)
+{
+	struct att_send_op *op = att->op_pool;
+	uint16_t size;
+
+	if (op) {
+		att->op_pool = op->next;
+		att->op_pool_len--;
+
+		if (op->size >= len) {
+			size = op->size;
+			memset(op, 0, offsetof(struct att_send_op, buf));
+			goto done;
+		}
+
+		/* Pooled before the MTU grew */
+		free(op);
+	}
+
+	size = len > att->mtu ? len : att->mtu;
+
+	op = malloc0(sizeof(*op) + size);
+	if (!op)
+		return NULL;
+
+done:
+	op->att = att;
+	op->size = size;
+	op->pdu = op->buf;
+
+	return op;
+}
+
+static void att_send_op_free(struct att_send_op *op)
+{
+	struct bt_att *att = op->att;
+
+	if (att->op_pool_len < ATT_OP_POOL_SIZE && op->size >= att->mtu) {
+		op->next = att->op_pool;
+		att->op_pool = op;
+		att->op_pool_len++;
+		return;
+	}
+
+	free(op);
+}
+
 static void destroy_att_send_op(void *data)
 {
 	struct att_send_op *op = data;
+	bt_att_destroy_func_t destroy = op->destroy;
+	void *user_data = op->user_data;
 
 	if (op->timeout_id)
 		timeout_remove(op->timeout_id);
 
-	if (op->destroy)
-		op->destroy(op->user_data);
+	/* The destroy callback may drop the last reference to bt_att */
+	att_send_op_free(op);
 
-	free(op->pdu);
-	free(op);
+	if (destroy)
+		destroy(user_data);
 }
 
 static void cancel_att_send_op(void *data)
@@ -303,60 +379,68 @@ static void att_hexdump(struct bt_att *att, char dir, const void *data,
 	util_hexdump(dir, data, len, att->debug_callback, att->debug_data);
 }
 
+static uint16_t iov_length(const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	return len > UINT16_MAX ? UINT16_MAX : len;
+}
+
 static bool encode_pdu(struct bt_att *att, struct att_send_op *op,
-					const void *pdu, uint16_t length)
+					const struct iovec *iov, int iovcnt,
+					uint16_t length)
 {
-	uint16_t pdu_len = 1;
 	struct sign_info *sign = att->local_sign;
+	uint8_t *pdu = op->pdu;
 	uint32_t sign_cnt;
+	int i;
 
-	if (sign && (op->opcode & ATT_OP_SIGNED_MASK))
-		pdu_len += BT_ATT_SIGNATURE_LEN;
-
-	if (length && pdu)
-		pdu_len += length;
-
-	if (pdu_len > att->mtu)
-		return false;
+	pdu[0] = op->opcode;
+	op->len = 1;
 
-	op->len = pdu_len;
-	op->pdu = malloc(op->len);
-	if (!op->pdu)
-		return false;
+	for (i = 0; i < iovcnt; i++) {
+		if (!iov[i].iov_len)
+			continue;
 
-	((uint8_t *) op->pdu)[0] = op->opcode;
-	if (pdu_len > 1)
-		memcpy(op->pdu + 1, pdu, length);
+		memcpy(pdu + op->len, iov[i].iov_base, iov[i].iov_len);
+		op->len += iov[i].iov_len;
+	}
 
 	if (!sign || !(op->opcode & ATT_OP_SIGNED_MASK) || !att->crypto)
 		return true;
 
+	op->len += BT_ATT_SIGNATURE_LEN;
+
 	if (!sign->counter(&sign_cnt, sign->user_data))
 		goto fail;
 
 	if ((bt_crypto_sign_att(att->crypto, sign->key, op->pdu, 1 + length,
-				sign_cnt, &((uint8_t *) op->pdu)[1 + length])))
+						sign_cnt, &pdu[1 + length])))
 		return true;
 
 	att_debug(att, "ATT unable to generate signature");
 
 fail:
-	free(op->pdu);
 	return false;
 }
 
 static struct att_send_op *create_att_send_op(struct bt_att *att,
 						uint8_t opcode,
-						const void *pdu,
-						uint16_t length,
+						const struct iovec *iov,
+						int iovcnt,
 						bt_att_response_func_t callback,
 						void *user_data,
 						bt_att_destroy_func_t destroy)
 {
 	struct att_send_op *op;
 	enum att_op_type type;
+	uint16_t length, pdu_len;
 
-	if (length && !pdu)
+	if (iovcnt < 0 || (iovcnt && !iov))
 		return NULL;
 
 	type = get_op_type(opcode);
@@ -376,55 +460,248 @@ static struct att_send_op *create_att_send_op(struct bt_att *att,
 	if (!callback && (type == ATT_OP_TYPE_REQ || type == ATT_OP_TYPE_IND))
 		return NULL;
 
-	op = new0(struct att_send_op, 1);
+	length = iov_length(iov, iovcnt);
+	pdu_len = 1 + length;
+
+	if (att->local_sign && (opcode & ATT_OP_SIGNED_MASK))
+		pdu_len += BT_ATT_SIGNATURE_LEN;
+
+	if (pdu_len > att->mtu || length == UINT16_MAX)
+		return NULL;
+
+	op = att_send_op_alloc(att, pdu_len);
+	if (!op)
+		return NULL;
+
 	op->type = type;
 	op->opcode = opcode;
 	op->callback = callback;
 	op->destroy = destroy;
 	op->user_data = user_data;
 
-	if (!encode_pdu(att, op, pdu, length)) {
-		free(op);
+	if (!encode_pdu(att, op, iov, iovcnt, length)) {
+		att_send_op_free(op);
 		return NULL;
 	}
 
 	return op;
 }
 
-static struct att_send_op *pick_next_send_op(struct bt_att_chan *chan)
+static unsigned int chan_outstanding(struct bt_att_chan *chan)
+{
+	return !!chan->pending_req + !!chan->pending_ind;
+}
+
+static unsigned int chan_depth(struct bt_att_chan *chan)
+{
+	return queue_length(chan->queue) + chan_outstanding(chan);
+}
+
+static bool chan_accepts_op(struct bt_att_chan *chan, struct att_send_op *op)
+{
+	if (op->len > chan->mtu)
+		return false;
+
+	switch (op->type) {
+	case ATT_OP_TYPE_REQ:
+		return !chan->pending_req;
+	case ATT_OP_TYPE_IND:
+		return !chan->pending_ind;
+	case ATT_OP_TYPE_RSP:
+	case ATT_OP_TYPE_CMD:
+	case ATT_OP_TYPE_NFY:
+	case ATT_OP_TYPE_CONF:
+	case ATT_OP_TYPE_UNKNOWN:
+	default:
+		return true;
+	}
+}
+
+/*
+ * Lower scores are preferred. Channels are pushed to the head of att->chans
+ * and compared with a strict '<', so ties go to the channel attached last.
+ */
+static uint64_t chan_score(struct bt_att *att, struct bt_att_chan *chan,
+						struct att_send_op *op)
+{
+	switch (att->sched) {
+	case BT_ATT_SCHED_LEAST_OUTSTANDING:
+		return chan_depth(chan);
+	case BT_ATT_SCHED_MTU_FIT:
+		/* Keep the channels with bigger MTU free for bigger PDUs */
+		return ((uint64_t) (chan->mtu - op->len) << 32) |
+							chan_depth(chan);
+	case BT_ATT_SCHED_LATENCY:
+		/*
+		 * Expected time until the PDU is through, including what is
+		 * ahead of it on the channel. Channels without a round trip
+		 * measured yet are tried before the others.
+		 */
+		return (uint64_t) chan->stats.rtt * (chan_depth(chan) + 1);
+	case BT_ATT_SCHED_ANY:
+	case BT_ATT_SCHED_ROUND_ROBIN:
+	default:
+		return 0;
+	}
+}
+
+static struct bt_att_chan *sched_round_robin(struct bt_att *att,
+						struct att_send_op *op)
+{
+	const struct queue_entry *entry;
+	struct bt_att_chan *first = NULL;
+	bool past_last = !att->last_chan;
+
+	/* First channel able to take it after the last one picked */
+	for (entry = queue_get_entries(att->chans); entry;
+							entry = entry->next) {
+		struct bt_att_chan *chan = entry->data;
+
+		if (chan == att->last_chan) {
+			past_last = true;
+			continue;
+		}
+
+		if (!chan_accepts_op(chan, op))
+			continue;
+
+		if (past_last)
+			return chan;
+
+		if (!first)
+			first = chan;
+	}
+
+	if (!first && att->last_chan && chan_accepts_op(att->last_chan, op))
+		return att->last_chan;
+
+	return first;
+}
+
+static struct bt_att_chan *sched_pick_chan(struct bt_att *att,
+						struct att_send_op *op,
+						unsigned int backlog)
+{
+	const struct queue_entry *entry;
+	struct bt_att_chan *best = NULL, *idle = NULL;
+	uint64_t best_score = 0, idle_score = 0;
+
+	if (att->sched == BT_ATT_SCHED_ROUND_ROBIN)
+		return sched_round_robin(att, op);
+
+	for (entry = queue_get_entries(att->chans); entry;
+							entry = entry->next) {
+		struct bt_att_chan *chan = entry->data;
+		uint64_t score;
+
+		if (op->len > chan->mtu)
+			continue;
+
+		score = chan_score(att, chan, op);
+
+		if (chan_accepts_op(chan, op) &&
+					(!idle || score < idle_score)) {
+			idle = chan;
+			idle_score = score;
+		}
+
+		/* Only the latency scheduler waits for busy channels */
+		if (att->sched != BT_ATT_SCHED_LATENCY)
+			continue;
+
+		if (!best || score < best_score) {
+			best = chan;
+			best_score = score;
+		}
+	}
+
+	if (!best || best == idle || !idle)
+		return best ? best : idle;
+
+	/*
+	 * The best channel is busy. Rather than waiting for it use an idle
+	 * channel once that finishes before the best one would get through
+	 * the backlog queued ahead of it.
+	 */
+	if (idle_score <= (uint64_t) best->stats.rtt *
+					(chan_depth(best) + backlog))
+		return idle;
+
+	return best;
+}
+
+static struct att_send_op *pick_queued_op(struct bt_att_chan *chan,
+							struct queue *queue)
+{
+	struct bt_att *att = chan->att;
+	struct att_send_op *op;
+	struct bt_att_chan *best;
+
+	op = queue_peek_head(queue);
+	if (!op)
+		return NULL;
+
+	if (att->sched != BT_ATT_SCHED_ANY) {
+		best = sched_pick_chan(att, op, queue_length(queue));
+		if (best && best != chan) {
+			/*
+			 * Leave it to the channel the scheduler picked, that
+			 * one may have gone idle while others held the queue.
+			 */
+			wakeup_chan_writer(best, NULL);
+			return NULL;
+		}
+	}
+
+	if (!chan_accepts_op(chan, op))
+		return NULL;
+
+	att->last_chan = chan;
+
+	op = queue_pop_head(queue);
+
+	/*
+	 * Channels passed over for this PDU may be the scheduler's pick for
+	 * the ones after it.
+	 */
+	if (att->sched != BT_ATT_SCHED_ANY && !queue_isempty(queue))
+		wakeup_writer(att);
+
+	return op;
+}
+
+/* Pick the next PDU for the channel along with the queue it came from */
+static struct att_send_op *pick_next_send_op(struct bt_att_chan *chan,
+							struct queue **from)
 {
 	struct bt_att *att = chan->att;
 	struct att_send_op *op;
 
 	/* Check if there is anything queued on the channel */
-	op = queue_pop_head(chan->queue);
+	*from = chan->queue;
+	op = queue_pop_head(*from);
 	if (op)
 		return op;
 
 	/* See if any operations are already in the write queue */
-	op = queue_peek_head(att->write_queue);
-	if (op && op->len <= chan->mtu)
-		return queue_pop_head(att->write_queue);
+	*from = att->write_queue;
+	op = pick_queued_op(chan, *from);
+	if (op)
+		return op;
 
 	/* If there is no pending request, pick an operation from the
 	 * request queue.
 	 */
-	if (!chan->pending_req) {
-		op = queue_peek_head(att->req_queue);
-		if (op && op->len <= chan->mtu)
-			return queue_pop_head(att->req_queue);
-	}
+	*from = att->req_queue;
+	op = pick_queued_op(chan, *from);
+	if (op)
+		return op;
 
 	/* There is either a request pending or no requests queued. If there is
 	 * no pending indication, pick an operation from the indication queue.
 	 */
-	if (!chan->pending_ind) {
-		op = queue_peek_head(att->ind_queue);
-		if (op && op->len <= chan->mtu)
-			return queue_pop_head(att->ind_queue);
-	}
-
-	return NULL;
+	*from = att->ind_queue;
+	return pick_queued_op(chan, *from);
 }
 
 static void disc_att_send_op(void *data)
@@ -486,60 +763,102 @@ static void write_watch_destroy(void *user_data)
 	chan->writer_active = false;
 }
 
-static ssize_t bt_att_chan_write(struct bt_att_chan *chan, uint8_t opcode,
-					const void *pdu, uint16_t len)
+static void bt_att_chan_log_write(struct bt_att_chan *chan,
+						struct att_send_op *op)
+{
+	struct bt_att *att = chan->att;
+
+	att_verbose(att, "(chan %p) ATT op 0x%02x", chan, op->opcode);
+
+	if (att->debug_level)
+		util_hexdump('<', op->pdu, op->len, att->debug_callback,
+						att->debug_data);
+
+	chan->stats.tx_pdus++;
+	chan->stats.tx_bytes += op->len;
+}
+
+/*
+ * Write as many of the PDUs as the socket takes, returning how many were
+ * written. Several PDUs go out with a single batched send, SEQPACKET
+ * keeps each of them a separate packet.
+ */
+static int bt_att_chan_write(struct bt_att_chan *chan,
+				struct att_send_op **ops, int count)
 {
 	struct bt_att *att = chan->att;
+	struct iovec iov[ATT_WRITE_BATCH];
 	ssize_t ret;
-	struct iovec iov;
+	int i;
 
-	iov.iov_base = (void *) pdu;
-	iov.iov_len = len;
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = ops[i]->pdu;
+		iov[i].iov_len = ops[i]->len;
+	}
+
+	if (count == 1) {
+		ret = io_send(chan->io, iov, 1);
+		if (ret >= 0)
+			ret = 1;
+	} else
+		ret = io_send_batch(chan->io, iov, count);
 
-	att_verbose(att, "(chan %p) ATT op 0x%02x", chan, opcode);
+	if (ret == -EAGAIN || ret == -EWOULDBLOCK)
+		return 0;
 
-	ret = io_send(chan->io, &iov, 1);
 	if (ret < 0) {
 		att_debug(att, "(chan %p) write failed: %s", chan,
 						strerror(-ret));
 		return ret;
 	}
 
-	if (att->debug_level)
-		util_hexdump('<', pdu, ret, att->debug_callback,
-						att->debug_data);
+	chan->stats.tx_writes++;
+
+	for (i = 0; i < ret; i++)
+		bt_att_chan_log_write(chan, ops[i]);
 
 	return ret;
 }
 
-static bool can_write_data(struct io *io, void *user_data)
+static void set_pending_op(struct bt_att_chan *chan, struct att_send_op *op)
 {
-	struct bt_att_chan *chan = user_data;
-	struct att_send_op *op;
-	struct timeout_data *timeout;
+	switch (op->type) {
+	case ATT_OP_TYPE_REQ:
+		chan->pending_req = op;
+		break;
+	case ATT_OP_TYPE_IND:
+		chan->pending_ind = op;
+		break;
+	case ATT_OP_TYPE_RSP:
+	case ATT_OP_TYPE_CMD:
+	case ATT_OP_TYPE_NFY:
+	case ATT_OP_TYPE_CONF:
+	case ATT_OP_TYPE_UNKNOWN:
+	default:
+		break;
+	}
+}
 
-	op = pick_next_send_op(chan);
-	if (!op)
-		return false;
+static void clear_pending_op(struct bt_att_chan *chan, struct att_send_op *op)
+{
+	if (chan->pending_req == op)
+		chan->pending_req = NULL;
+	else if (chan->pending_ind == op)
+		chan->pending_ind = NULL;
+}
 
-	if (!bt_att_chan_write(chan, op->opcode, op->pdu, op->len)) {
-		if (op->callback)
-			op->callback(BT_ATT_OP_ERROR_RSP, NULL, 0,
-							op->user_data);
-		destroy_att_send_op(op);
-		return true;
-	}
+static void write_op_done(struct bt_att_chan *chan, struct att_send_op *op)
+{
+	struct timeout_data *timeout;
 
-	/* Based on the operation type, set either the pending request or the
-	 * pending indication. If it came from the write queue, then there is
-	 * no need to keep it around.
+	/* Based on the operation type, keep either the pending request or
+	 * the pending indication around. Anything else there is no need to
+	 * keep around.
 	 */
 	switch (op->type) {
 	case ATT_OP_TYPE_REQ:
-		chan->pending_req = op;
-		break;
 	case ATT_OP_TYPE_IND:
-		chan->pending_ind = op;
+		op->sent = util_get_time_us();
 		break;
 	case ATT_OP_TYPE_RSP:
 		/* Set in_req to false to indicate that no request is pending */
@@ -551,7 +870,7 @@ static bool can_write_data(struct io *io, void *user_data)
 	case ATT_OP_TYPE_UNKNOWN:
 	default:
 		destroy_att_send_op(op);
-		return true;
+		return;
 	}
 
 	timeout = new0(struct timeout_data, 1);
@@ -559,6 +878,65 @@ static bool can_write_data(struct io *io, void *user_data)
 	timeout->id = op->id;
 	op->timeout_id = timeout_add(ATT_TIMEOUT_INTERVAL, timeout_cb,
 								timeout, free);
+}
+
+static bool can_write_data(struct io *io, void *user_data)
+{
+	struct bt_att_chan *chan = user_data;
+	struct att_send_op *ops[ATT_WRITE_BATCH];
+	struct queue *from[ATT_WRITE_BATCH];
+	bool requeued = false;
+	int count, written, i;
+
+	/*
+	 * Drain everything that can be sent right away. Requests and
+	 * indications are marked pending as they are picked so at most one
+	 * of each goes out.
+	 */
+	for (count = 0; count < ATT_WRITE_BATCH; count++) {
+		ops[count] = pick_next_send_op(chan, &from[count]);
+		if (!ops[count])
+			break;
+
+		set_pending_op(chan, ops[count]);
+	}
+
+	if (!count)
+		return false;
+
+	written = bt_att_chan_write(chan, ops, count);
+	if (written < 0) {
+		for (i = 0; i < count; i++) {
+			clear_pending_op(chan, ops[i]);
+
+			if (ops[i]->callback)
+				ops[i]->callback(BT_ATT_OP_ERROR_RSP, NULL, 0,
+							ops[i]->user_data);
+
+			destroy_att_send_op(ops[i]);
+		}
+
+		return true;
+	}
+
+	/*
+	 * Put what the socket did not take back at the head of the queue it
+	 * was picked from, in reverse so each queue keeps its order.
+	 */
+	for (i = count - 1; i >= written; i--) {
+		clear_pending_op(chan, ops[i]);
+		queue_push_head(from[i], ops[i]);
+
+		if (from[i] != chan->queue)
+			requeued = true;
+	}
+
+	for (i = 0; i < written; i++)
+		write_op_done(chan, ops[i]);
+
+	/* Other channels may be able to take the shared ones */
+	if (requeued)
+		wakeup_writer(chan->att);
 
 	/* Return true as there may be more operations ready to write. */
 	return true;
@@ -643,6 +1021,9 @@ static bool disconnect_cb(struct io *io, void *user_data)
 	/* Dettach channel */
 	queue_remove(att->chans, chan);
 
+	if (att->last_chan == chan)
+		att->last_chan = NULL;
+
 	if (chan->pending_req) {
 		disc_att_send_op(chan->pending_req);
 		chan->pending_req = NULL;
@@ -775,6 +1156,29 @@ static bool handle_error_rsp(struct bt_att_chan *chan, uint8_t *pdu,
 	return queue_push_head(att->req_queue, op);
 }
 
+static void update_rtt(struct bt_att_chan *chan, struct att_send_op *op)
+{
+	struct bt_att_chan_stats *stats = &chan->stats;
+	uint64_t rtt = util_get_time_us() - op->sent;
+
+	if (rtt > UINT32_MAX)
+		rtt = UINT32_MAX;
+
+	/* Smoothed the same way as TCP does, with a gain of 1/8 */
+	if (!stats->transactions)
+		stats->rtt = rtt;
+	else
+		stats->rtt = (stats->rtt * 7 + rtt) / 8;
+
+	if (!stats->transactions || rtt < stats->rtt_min)
+		stats->rtt_min = rtt;
+
+	if (rtt > stats->rtt_max)
+		stats->rtt_max = rtt;
+
+	stats->transactions++;
+}
+
 static void handle_rsp(struct bt_att_chan *chan, uint8_t opcode, uint8_t *pdu,
 								ssize_t pdu_len)
 {
@@ -828,6 +1232,8 @@ fail:
 	rsp_opcode = BT_ATT_OP_ERROR_RSP;
 
 done:
+	update_rtt(chan, op);
+
 	if (op->callback)
 		op->callback(rsp_opcode, rsp_pdu, rsp_pdu_len, op->user_data);
 
@@ -853,6 +1259,8 @@ static void handle_conf(struct bt_att_chan *chan, uint8_t *pdu, ssize_t pdu_len)
 		return;
 	}
 
+	update_rtt(chan, op);
+
 	if (op->callback)
 		op->callback(BT_ATT_OP_HANDLE_CONF, NULL, 0, op->user_data);
 
@@ -1007,6 +1415,9 @@ static bool can_read_data(struct io *io, void *user_data)
 
 	att_hexdump(att, '>', chan->buf, bytes_read);
 
+	chan->stats.rx_pdus++;
+	chan->stats.rx_bytes += bytes_read;
+
 	if (bytes_read < ATT_MIN_PDU_LEN)
 		return true;
 
@@ -1110,6 +1521,13 @@ static void bt_att_free(struct bt_att *att)
 	queue_destroy(att->disconn_list, NULL);
 	queue_destroy(att->chans, bt_att_chan_free);
 
+	while (att->op_pool) {
+		struct att_send_op *op = att->op_pool;
+
+		att->op_pool = op->next;
+		free(op);
+	}
+
 	free(att);
 }
 
@@ -1300,6 +1718,25 @@ int bt_att_attach_fd(struct bt_att *att, int fd)
 	return 0;
 }
 
+int bt_att_attach_local_fd(struct bt_att *att, int fd)
+{
+	struct bt_att_chan *chan;
+
+	if (!att || fd < 0)
+		return -EINVAL;
+
+	if (is_io_l2cap_based(fd))
+		return -EINVAL;
+
+	chan = bt_att_chan_new(fd, BT_ATT_LOCAL);
+	if (!chan)
+		return -EINVAL;
+
+	bt_att_attach_chan(att, chan);
+
+	return 0;
+}
+
 int bt_att_get_fd(struct bt_att *att)
 {
 	struct bt_att_chan *chan;
@@ -1323,6 +1760,54 @@ int bt_att_get_channels(struct bt_att *att)
 	return queue_length(att->chans);
 }
 
+bool bt_att_get_chan_stats(struct bt_att *att, unsigned int index,
+					struct bt_att_chan_stats *stats)
+{
+	const struct queue_entry *entry;
+	struct bt_att_chan *chan;
+
+	if (!att || !stats)
+		return false;
+
+	for (entry = queue_get_entries(att->chans); entry && index;
+							entry = entry->next)
+		index--;
+
+	if (!entry)
+		return false;
+
+	chan = entry->data;
+
+	*stats = chan->stats;
+	stats->type = chan->type;
+	stats->mtu = chan->mtu;
+	stats->queued = queue_length(chan->queue);
+	stats->outstanding = chan_outstanding(chan);
+
+	return true;
+}
+
+bool bt_att_set_scheduler(struct bt_att *att, enum bt_att_sched sched)
+{
+	if (!att)
+		return false;
+
+	switch (sched) {
+	case BT_ATT_SCHED_ANY:
+	case BT_ATT_SCHED_ROUND_ROBIN:
+	case BT_ATT_SCHED_LEAST_OUTSTANDING:
+	case BT_ATT_SCHED_MTU_FIT:
+	case BT_ATT_SCHED_LATENCY:
+		break;
+	default:
+		return false;
+	}
+
+	att->sched = sched;
+
+	return true;
+}
+
 bool bt_att_set_debug(struct bt_att *att, uint8_t level,
 			bt_att_debug_func_t callback, void *user_data,
 			bt_att_destroy_func_t destroy)
@@ -1470,6 +1955,23 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 				const void *pdu, uint16_t length,
 				bt_att_response_func_t callback, void *user_data,
 				bt_att_destroy_func_t destroy)
+{
+	struct iovec iov;
+
+	if (length && !pdu)
+		return 0;
+
+	iov.iov_base = (void *) pdu;
+	iov.iov_len = length;
+
+	return bt_att_send_iov(att, opcode, &iov, 1, callback, user_data,
+								destroy);
+}
+
+unsigned int bt_att_send_iov(struct bt_att *att, uint8_t opcode,
+				const struct iovec *iov, int iovcnt,
+				bt_att_response_func_t callback, void *user_data,
+				bt_att_destroy_func_t destroy)
 {
 	struct att_send_op *op;
 	bool result;
@@ -1477,7 +1979,7 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 	if (!att || queue_isempty(att->chans))
 		return 0;
 
-	op = create_att_send_op(att, opcode, pdu, length, callback, user_data,
+	op = create_att_send_op(att, opcode, iov, iovcnt, callback, user_data,
 								destroy);
 	if (!op)
 		return 0;
@@ -1506,8 +2008,7 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 	}
 
 	if (!result) {
-		free(op->pdu);
-		free(op);
+		att_send_op_free(op);
 		return 0;
 	}
 
@@ -1523,18 +2024,21 @@ unsigned int bt_att_chan_send(struct bt_att_chan *chan, uint8_t opcode,
 				bt_att_destroy_func_t destroy)
 {
 	struct att_send_op *op;
+	struct iovec iov;
 
-	if (!chan || !chan->att)
+	if (!chan || !chan->att || (len && !pdu))
 		return -EINVAL;
 
-	op = create_att_send_op(chan->att, opcode, pdu, len, callback,
+	iov.iov_base = (void *) pdu;
+	iov.iov_len = len;
+
+	op = create_att_send_op(chan->att, opcode, &iov, 1, callback,
 						user_data, destroy);
 	if (!op)
 		return -EINVAL;
 
 	if (!queue_push_tail(chan->queue, op)) {
-		free(op->pdu);
-		free(op);
+		att_send_op_free(op);
 		return 0;
 	}
 
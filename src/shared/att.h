@@ -10,6 +10,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include "src/shared/att-types.h"
 
@@ -30,9 +31,31 @@ bool bt_att_set_close_on_unref(struct bt_att *att, bool do_close);
 int bt_att_get_fd(struct bt_att *att);
 
 int bt_att_attach_fd(struct bt_att *att, int fd);
+int bt_att_attach_local_fd(struct bt_att *att, int fd);
 
 int bt_att_get_channels(struct bt_att *att);
 
+bool bt_att_set_scheduler(struct bt_att *att, enum bt_att_sched sched);
+
+struct bt_att_chan_stats {
+	uint8_t type;
+	uint16_t mtu;
+	unsigned int queued;		/* PDUs queued on the channel */
+	unsigned int outstanding;	/* Requests/indications in flight */
+	uint64_t tx_pdus;
+	uint64_t tx_bytes;
+	uint64_t tx_writes;		/* Write calls, batching PDUs */
+	uint64_t rx_pdus;
+	uint64_t rx_bytes;
+	uint64_t transactions;		/* Completed requests/indications */
+	uint32_t rtt;			/* Smoothed round trip time in usec */
+	uint32_t rtt_min;
+	uint32_t rtt_max;
+};
+
+bool bt_att_get_chan_stats(struct bt_att *att, unsigned int index,
+					struct bt_att_chan_stats *stats);
+
 typedef void (*bt_att_response_func_t)(uint8_t opcode, const void *pdu,
 					uint16_t length, void *user_data);
 typedef void (*bt_att_notify_func_t)(struct bt_att_chan *chan,
@@ -62,6 +85,11 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 					bt_att_response_func_t callback,
 					void *user_data,
 					bt_att_destroy_func_t destroy);
+unsigned int bt_att_send_iov(struct bt_att *att, uint8_t opcode,
+					const struct iovec *iov, int iovcnt,
+					bt_att_response_func_t callback,
+					void *user_data,
+					bt_att_destroy_func_t destroy);
 unsigned int bt_att_chan_send(struct bt_att_chan *chan, uint8_t opcode,
 					const void *pdu, uint16_t len,
 					bt_att_response_func_t callback,
@@ -16,6 +16,18 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/param.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <wmmintrin.h>
+#define HAVE_AES_NI
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_neon.h>
+#define HAVE_AES_CE
+#endif
 
 #include "src/shared/util.h"
 #include "src/shared/crypto.h"
@@ -64,13 +76,320 @@ struct af_alg_iv {
 
 #define ATT_SIGN_LEN	12
 
+#define AES_BLOCK_SIZE	16
+#define AES_ROUNDS	10
+
+struct aes_key {
+	uint8_t rk[(AES_ROUNDS + 1) * AES_BLOCK_SIZE];
+};
+
+typedef void (*aes_encrypt_func_t)(const struct aes_key *key,
+						const uint8_t in[16],
+						uint8_t out[16]);
+
 struct bt_crypto {
 	int ref_count;
 	int ecb_aes;
 	int urandom;
 	int cmac_aes;
+	enum bt_crypto_engine engine;
+	aes_encrypt_func_t encrypt;
+};
+
+static const uint8_t aes_sbox[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
+	0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+	0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc,
+	0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a,
+	0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+	0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
+	0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85,
+	0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+	0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17,
+	0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
+	0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+	0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9,
+	0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6,
+	0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+	0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94,
+	0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68,
+	0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+/*
+ * Combined SubBytes/ShiftRows/MixColumns lookup table. The tables for
+ * the other three state rows are byte rotations of this one.
+ */
+static uint32_t aes_te0[256];
+
+static inline uint8_t aes_xtime(uint8_t x)
+{
+	return (x << 1) ^ ((x & 0x80) ? 0x1b : 0x00);
+}
+
+static inline uint32_t ror32(uint32_t x, unsigned int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+static void aes_table_init(void)
+{
+	int i;
+
+	if (aes_te0[0])
+		return;
+
+	for (i = 0; i < 256; i++) {
+		uint8_t s = aes_sbox[i];
+		uint8_t s2 = aes_xtime(s);
+
+		aes_te0[i] = ((uint32_t) s2 << 24) | (s << 16) | (s << 8) |
+								(s2 ^ s);
+	}
+}
+
+static void aes_expand_key(const uint8_t key[16], struct aes_key *ctx)
+{
+	uint32_t w0, w1, w2, w3;
+	uint8_t rcon = 0x01;
+	uint8_t *rk = ctx->rk;
+	int r;
+
+	w0 = get_be32(key + 0);
+	w1 = get_be32(key + 4);
+	w2 = get_be32(key + 8);
+	w3 = get_be32(key + 12);
+
+	for (r = 0; r <= AES_ROUNDS; r++) {
+		put_be32(w0, rk + 0);
+		put_be32(w1, rk + 4);
+		put_be32(w2, rk + 8);
+		put_be32(w3, rk + 12);
+		rk += AES_BLOCK_SIZE;
+
+		/* RotWord, SubWord and Rcon applied to the last word */
+		w0 ^= ((uint32_t) aes_sbox[(w3 >> 16) & 0xff] << 24) ^
+			(aes_sbox[(w3 >> 8) & 0xff] << 16) ^
+			(aes_sbox[w3 & 0xff] << 8) ^
+			aes_sbox[w3 >> 24] ^ ((uint32_t) rcon << 24);
+		w1 ^= w0;
+		w2 ^= w1;
+		w3 ^= w2;
+
+		rcon = aes_xtime(rcon);
+	}
+}
+
+#define TE(a, b, c, d) \
+	(aes_te0[(a) >> 24] ^ ror32(aes_te0[((b) >> 16) & 0xff], 8) ^ \
+	ror32(aes_te0[((c) >> 8) & 0xff], 16) ^ ror32(aes_te0[(d) & 0xff], 24))
+
+#define SB(a, b, c, d) \
+	(((uint32_t) aes_sbox[(a) >> 24] << 24) | \
+	(aes_sbox[((b) >> 16) & 0xff] << 16) | \
+	(aes_sbox[((c) >> 8) & 0xff] << 8) | aes_sbox[(d) & 0xff])
+
+static void aes_soft_encrypt(const struct aes_key *key, const uint8_t in[16],
+							uint8_t out[16])
+{
+	const uint8_t *rk = key->rk;
+	uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+	int r;
+
+	s0 = get_be32(in + 0) ^ get_be32(rk + 0);
+	s1 = get_be32(in + 4) ^ get_be32(rk + 4);
+	s2 = get_be32(in + 8) ^ get_be32(rk + 8);
+	s3 = get_be32(in + 12) ^ get_be32(rk + 12);
+
+	for (r = 1; r < AES_ROUNDS; r++) {
+		rk += AES_BLOCK_SIZE;
+
+		t0 = TE(s0, s1, s2, s3) ^ get_be32(rk + 0);
+		t1 = TE(s1, s2, s3, s0) ^ get_be32(rk + 4);
+		t2 = TE(s2, s3, s0, s1) ^ get_be32(rk + 8);
+		t3 = TE(s3, s0, s1, s2) ^ get_be32(rk + 12);
+
+		s0 = t0;
+		s1 = t1;
+		s2 = t2;
+		s3 = t3;
+	}
+
+	rk += AES_BLOCK_SIZE;
+
+	put_be32(SB(s0, s1, s2, s3) ^ get_be32(rk + 0), out + 0);
+	put_be32(SB(s1, s2, s3, s0) ^ get_be32(rk + 4), out + 4);
+	put_be32(SB(s2, s3, s0, s1) ^ get_be32(rk + 8), out + 8);
+	put_be32(SB(s3, s0, s1, s2) ^ get_be32(rk + 12), out + 12);
+}
+
+#undef TE
+#undef SB
+
+#if defined(HAVE_AES_NI)
+static bool aes_accel_supported(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+
+	return !!(ecx & bit_AES);
+}
+
+__attribute__((target("aes,sse2")))
+static void aes_accel_encrypt(const struct aes_key *key, const uint8_t in[16],
+							uint8_t out[16])
+{
+	const __m128i *rk = (const __m128i *) key->rk;
+	__m128i s;
+	int r;
+
+	s = _mm_loadu_si128((const __m128i *) in);
+	s = _mm_xor_si128(s, _mm_loadu_si128(rk));
+
+	for (r = 1; r < AES_ROUNDS; r++)
+		s = _mm_aesenc_si128(s, _mm_loadu_si128(rk + r));
+
+	s = _mm_aesenclast_si128(s, _mm_loadu_si128(rk + AES_ROUNDS));
+
+	_mm_storeu_si128((__m128i *) out, s);
+}
+#elif defined(HAVE_AES_CE)
+static bool aes_accel_supported(void)
+{
+	return !!(getauxval(AT_HWCAP) & HWCAP_AES);
+}
+
+static void aes_accel_encrypt(const struct aes_key *key, const uint8_t in[16],
+							uint8_t out[16])
+{
+	const uint8_t *rk = key->rk;
+	uint8x16_t s;
+	int r;
+
+	s = vld1q_u8(in);
+
+	for (r = 0; r < AES_ROUNDS - 1; r++) {
+		s = vaeseq_u8(s, vld1q_u8(rk + r * AES_BLOCK_SIZE));
+		s = vaesmcq_u8(s);
+	}
+
+	s = vaeseq_u8(s, vld1q_u8(rk + r * AES_BLOCK_SIZE));
+	s = veorq_u8(s, vld1q_u8(rk + AES_ROUNDS * AES_BLOCK_SIZE));
+
+	vst1q_u8(out, s);
+}
+#else
+static bool aes_accel_supported(void)
+{
+	return false;
+}
+
+static void aes_accel_encrypt(const struct aes_key *key, const uint8_t in[16],
+							uint8_t out[16])
+{
+	aes_soft_encrypt(key, in, out);
+}
+#endif
+
+static inline void xor_block(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		dst[i] ^= src[i];
+}
+
+struct aes_cmac_ctx {
+	aes_encrypt_func_t encrypt;
+	struct aes_key key;
+	uint8_t x[AES_BLOCK_SIZE];
+	uint8_t buf[AES_BLOCK_SIZE];
+	size_t buf_len;
 };
 
+static void aes_cmac_init(struct aes_cmac_ctx *ctx, aes_encrypt_func_t encrypt,
+							const uint8_t key[16])
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->encrypt = encrypt;
+	aes_expand_key(key, &ctx->key);
+}
+
+static void aes_cmac_update(struct aes_cmac_ctx *ctx, const uint8_t *data,
+								size_t len)
+{
+	while (len) {
+		size_t n;
+
+		/*
+		 * Only process a full block once more data follows it, the
+		 * last block is special and gets handled by aes_cmac_final.
+		 */
+		if (ctx->buf_len == AES_BLOCK_SIZE) {
+			xor_block(ctx->x, ctx->buf, AES_BLOCK_SIZE);
+			ctx->encrypt(&ctx->key, ctx->x, ctx->x);
+			ctx->buf_len = 0;
+		}
+
+		n = MIN(len, AES_BLOCK_SIZE - ctx->buf_len);
+		memcpy(ctx->buf + ctx->buf_len, data, n);
+		ctx->buf_len += n;
+		data += n;
+		len -= n;
+	}
+}
+
+static void cmac_subkey_shift(uint8_t k[16])
+{
+	uint8_t msb = k[0] & 0x80;
+	int i;
+
+	for (i = 0; i < AES_BLOCK_SIZE - 1; i++)
+		k[i] = (k[i] << 1) | (k[i + 1] >> 7);
+
+	k[AES_BLOCK_SIZE - 1] <<= 1;
+
+	if (msb)
+		k[AES_BLOCK_SIZE - 1] ^= 0x87;
+}
+
+static void aes_cmac_final(struct aes_cmac_ctx *ctx, uint8_t mac[16])
+{
+	uint8_t k[AES_BLOCK_SIZE] = { };
+
+	/* Subkey K1 = L << 1 and K2 = K1 << 1 with L = AES(K, 0^128) */
+	ctx->encrypt(&ctx->key, k, k);
+	cmac_subkey_shift(k);
+
+	if (ctx->buf_len < AES_BLOCK_SIZE) {
+		cmac_subkey_shift(k);
+		ctx->buf[ctx->buf_len] = 0x80;
+		memset(ctx->buf + ctx->buf_len + 1, 0,
+					AES_BLOCK_SIZE - ctx->buf_len - 1);
+	}
+
+	xor_block(ctx->x, ctx->buf, AES_BLOCK_SIZE);
+	xor_block(ctx->x, k, AES_BLOCK_SIZE);
+	ctx->encrypt(&ctx->key, ctx->x, mac);
+}
+
 static int urandom_setup(void)
 {
 	int fd;
@@ -128,36 +447,54 @@ static int cmac_aes_setup(void)
 
 static struct bt_crypto *singleton;
 
+static void alg_close(struct bt_crypto *crypto)
+{
+	if (crypto->ecb_aes >= 0)
+		close(crypto->ecb_aes);
+
+	if (crypto->cmac_aes >= 0)
+		close(crypto->cmac_aes);
+
+	crypto->ecb_aes = -1;
+	crypto->cmac_aes = -1;
+}
+
+static bool alg_open(struct bt_crypto *crypto)
+{
+	if (crypto->ecb_aes >= 0 && crypto->cmac_aes >= 0)
+		return true;
+
+	crypto->ecb_aes = ecb_aes_setup();
+	if (crypto->ecb_aes < 0)
+		return false;
+
+	crypto->cmac_aes = cmac_aes_setup();
+	if (crypto->cmac_aes < 0) {
+		alg_close(crypto);
+		return false;
+	}
+
+	return true;
+}
+
 struct bt_crypto *bt_crypto_new(void)
 {
 	if (singleton)
 		return bt_crypto_ref(singleton);
 
 	singleton = new0(struct bt_crypto, 1);
-
-	singleton->ecb_aes = ecb_aes_setup();
-	if (singleton->ecb_aes < 0) {
-		free(singleton);
-		singleton = NULL;
-		return NULL;
-	}
+	singleton->ecb_aes = -1;
+	singleton->cmac_aes = -1;
 
 	singleton->urandom = urandom_setup();
 	if (singleton->urandom < 0) {
-		close(singleton->ecb_aes);
 		free(singleton);
 		singleton = NULL;
 		return NULL;
 	}
 
-	singleton->cmac_aes = cmac_aes_setup();
-	if (singleton->cmac_aes < 0) {
-		close(singleton->urandom);
-		close(singleton->ecb_aes);
-		free(singleton);
-		singleton = NULL;
-		return NULL;
-	}
+	aes_table_init();
+	bt_crypto_set_engine(singleton, BT_CRYPTO_ENGINE_AUTO);
 
 	return bt_crypto_ref(singleton);
 }
@@ -181,13 +518,58 @@ void bt_crypto_unref(struct bt_crypto *crypto)
 		return;
 
 	close(crypto->urandom);
-	close(crypto->ecb_aes);
-	close(crypto->cmac_aes);
+	alg_close(crypto);
 
 	free(crypto);
 	singleton = NULL;
 }
 
+bool bt_crypto_set_engine(struct bt_crypto *crypto,
+					enum bt_crypto_engine engine)
+{
+	if (!crypto)
+		return false;
+
+	if (engine == BT_CRYPTO_ENGINE_AUTO)
+		engine = aes_accel_supported() ? BT_CRYPTO_ENGINE_ACCEL :
+							BT_CRYPTO_ENGINE_SOFT;
+
+	switch (engine) {
+	case BT_CRYPTO_ENGINE_SOFT:
+		crypto->encrypt = aes_soft_encrypt;
+		alg_close(crypto);
+		break;
+	case BT_CRYPTO_ENGINE_ACCEL:
+		if (!aes_accel_supported())
+			return false;
+
+		crypto->encrypt = aes_accel_encrypt;
+		alg_close(crypto);
+		break;
+	case BT_CRYPTO_ENGINE_ALG:
+		if (!alg_open(crypto))
+			return false;
+
+		crypto->encrypt = NULL;
+		break;
+	case BT_CRYPTO_ENGINE_AUTO:
+	default:
+		return false;
+	}
+
+	crypto->engine = engine;
+
+	return true;
+}
+
+enum bt_crypto_engine bt_crypto_get_engine(struct bt_crypto *crypto)
+{
+	if (!crypto)
+		return BT_CRYPTO_ENGINE_AUTO;
+
+	return crypto->engine;
+}
+
 bool bt_crypto_random_bytes(struct bt_crypto *crypto,
 					void *buf, uint8_t num_bytes)
 {
@@ -251,6 +633,81 @@ static bool alg_encrypt(int fd, const void *inbuf, size_t inlen,
 	return true;
 }
 
+static bool alg_cmac(int fd, const uint8_t key[16], const struct iovec *iov,
+					size_t iov_len, uint8_t mac[16])
+{
+	ssize_t len;
+
+	fd = alg_new(fd, key, 16);
+	if (fd < 0)
+		return false;
+
+	len = writev(fd, iov, iov_len);
+	if (len < 0) {
+		close(fd);
+		return false;
+	}
+
+	len = read(fd, mac, 16);
+	if (len < 0) {
+		close(fd);
+		return false;
+	}
+
+	close(fd);
+
+	return true;
+}
+
+/*
+ * AES-128 block encryption and AES-CMAC with key, input and output in
+ * the standard (most significant octet first) byte order. Either served
+ * by the userspace engine or by the kernel AF_ALG sockets.
+ */
+static bool crypto_ecb(struct bt_crypto *crypto, const uint8_t key[16],
+				const uint8_t in[16], uint8_t out[16])
+{
+	struct aes_key ctx;
+	bool ret;
+	int fd;
+
+	if (crypto->engine != BT_CRYPTO_ENGINE_ALG) {
+		aes_expand_key(key, &ctx);
+		crypto->encrypt(&ctx, in, out);
+		return true;
+	}
+
+	fd = alg_new(crypto->ecb_aes, key, 16);
+	if (fd < 0)
+		return false;
+
+	ret = alg_encrypt(fd, in, 16, out, 16);
+
+	close(fd);
+
+	return ret;
+}
+
+static bool crypto_cmac(struct bt_crypto *crypto, const uint8_t key[16],
+				const struct iovec *iov, size_t iov_len,
+				uint8_t mac[16])
+{
+	struct aes_cmac_ctx ctx;
+	size_t i;
+
+	if (crypto->engine == BT_CRYPTO_ENGINE_ALG)
+		return alg_cmac(crypto->cmac_aes, key, iov, iov_len, mac);
+
+	aes_cmac_init(&ctx, crypto->encrypt, key);
+
+	for (i = 0; i < iov_len; i++)
+		aes_cmac_update(&ctx, iov[i].iov_base, iov[i].iov_len);
+
+	aes_cmac_final(&ctx, mac);
+
+	return true;
+}
+
 static inline void swap_buf(const uint8_t *src, uint8_t *dst, uint16_t len)
 {
 	int i;
@@ -264,12 +721,11 @@ bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 				uint32_t sign_cnt,
 				uint8_t signature[ATT_SIGN_LEN])
 {
-	int fd;
-	int len;
 	uint8_t tmp[16], out[16];
 	uint16_t msg_len = m_len + sizeof(uint32_t);
 	uint8_t msg[msg_len];
 	uint8_t msg_s[msg_len];
+	struct iovec iov;
 
 	if (!crypto)
 		return false;
@@ -283,26 +739,14 @@ bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 	/* The most significant octet of key corresponds to key[0] */
 	swap_buf(key, tmp, 16);
 
-	fd = alg_new(crypto->cmac_aes, tmp, 16);
-	if (fd < 0)
-		return false;
-
 	/* Swap msg before signing */
 	swap_buf(msg, msg_s, msg_len);
 
-	len = send(fd, msg_s, msg_len, 0);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
+	iov.iov_base = msg_s;
+	iov.iov_len = msg_len;
 
-	len = read(fd, out, 16);
-	if (len < 0) {
-		close(fd);
+	if (!crypto_cmac(crypto, tmp, &iov, 1, out))
 		return false;
-	}
-
-	close(fd);
 
 	/*
 	 * As to BT spec. 4.1 Vol[3], Part C, chapter 10.4.1 sign counter should
@@ -358,7 +802,6 @@ bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t plaintext[16], uint8_t encrypted[16])
 {
 	uint8_t tmp[16], in[16], out[16];
-	int fd;
 
 	if (!crypto)
 		return false;
@@ -366,24 +809,15 @@ bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 	/* The most significant octet of key corresponds to key[0] */
 	swap_buf(key, tmp, 16);
 
-	fd = alg_new(crypto->ecb_aes, tmp, 16);
-	if (fd < 0)
-		return false;
-
-
 	/* Most significant octet of plaintextData corresponds to in[0] */
 	swap_buf(plaintext, in, 16);
 
-	if (!alg_encrypt(fd, in, 16, out, 16)) {
-		close(fd);
+	if (!crypto_ecb(crypto, tmp, in, out))
 		return false;
-	}
 
 	/* Most significant octet of encryptedData corresponds to out[0] */
 	swap_buf(out, encrypted, 16);
 
-	close(fd);
-
 	return true;
 }
 
@@ -590,34 +1024,22 @@ static bool aes_cmac(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t *msg, size_t msg_len, uint8_t res[16])
 {
 	uint8_t key_msb[16], out[16], msg_msb[CMAC_MSG_MAX];
-	ssize_t len;
-	int fd;
+	struct iovec iov;
 
 	if (msg_len > CMAC_MSG_MAX)
 		return false;
 
 	swap_buf(key, key_msb, 16);
-	fd = alg_new(crypto->cmac_aes, key_msb, 16);
-	if (fd < 0)
-		return false;
-
 	swap_buf(msg, msg_msb, msg_len);
-	len = send(fd, msg_msb, msg_len, 0);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
 
-	len = read(fd, out, 16);
-	if (len < 0) {
-		close(fd);
+	iov.iov_base = msg_msb;
+	iov.iov_len = msg_len;
+
+	if (!crypto_cmac(crypto, key_msb, &iov, 1, out))
 		return false;
-	}
 
 	swap_buf(out, res, 16);
 
-	close(fd);
-
 	return true;
 }
 
@@ -711,29 +1133,9 @@ bool bt_crypto_gatt_hash(struct bt_crypto *crypto, struct iovec *iov,
 				size_t iov_len, uint8_t res[16])
 {
 	const uint8_t key[16] = {};
-	ssize_t len;
-	int fd;
 
 	if (!crypto)
 		return false;
 
-	fd = alg_new(crypto->cmac_aes, key, 16);
-	if (fd < 0)
-		return false;
-
-	len = writev(fd, iov, iov_len);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	len = read(fd, res, 16);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	close(fd);
-
-	return true;
+	return crypto_cmac(crypto, key, iov, iov_len, res);
 }
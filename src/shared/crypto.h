@@ -14,11 +14,22 @@
 
 struct bt_crypto;
 
+enum bt_crypto_engine {
+	BT_CRYPTO_ENGINE_AUTO,	/* Best available userspace engine */
+	BT_CRYPTO_ENGINE_SOFT,	/* Table based AES-128 */
+	BT_CRYPTO_ENGINE_ACCEL,	/* AES-NI or ARMv8 Crypto Extensions */
+	BT_CRYPTO_ENGINE_ALG,	/* Kernel AF_ALG sockets */
+};
+
 struct bt_crypto *bt_crypto_new(void);
 
 struct bt_crypto *bt_crypto_ref(struct bt_crypto *crypto);
 void bt_crypto_unref(struct bt_crypto *crypto);
 
+bool bt_crypto_set_engine(struct bt_crypto *crypto,
+					enum bt_crypto_engine engine);
+enum bt_crypto_engine bt_crypto_get_engine(struct bt_crypto *crypto);
+
 bool bt_crypto_random_bytes(struct bt_crypto *crypto,
 					void *buf, uint8_t num_bytes);
 
@@ -18,6 +18,7 @@
 #include "src/shared/gatt-helpers.h"
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
+#include "src/shared/hashmap.h"
 #include "src/shared/gatt-db.h"
 #include "src/shared/gatt-client.h"
 
@@ -78,9 +79,14 @@ struct bt_gatt_client {
 
 	unsigned int reliable_write_session_id;
 
-	/* List of registered disconnect/notification/indication callbacks */
-	struct queue *notify_list;
-	struct queue *notify_chrcs;
+	/*
+	 * Registered notification/indication callbacks indexed by their id,
+	 * and the characteristics they are registered for indexed by value
+	 * handle so that incoming notifications are dispatched with a single
+	 * lookup.
+	 */
+	struct hashmap *notify_ids;
+	struct hashmap *notify_chrcs;
 	int next_reg_id;
 	unsigned int disc_id, nfy_id, nfy_mult_id, ind_id;
 
@@ -103,6 +109,7 @@ struct bt_gatt_client {
 	unsigned int next_request_id;
 
 	struct bt_gatt_request *discovery_req;
+	struct queue *discovery_procs;	/* Parallel discovery requests */
 	unsigned int mtu_req_id;
 };
 
@@ -168,6 +175,7 @@ struct notify_chrc {
 	uint16_t properties;
 	unsigned int notify_id;
 	int notify_count;  /* Reference count of registered notify callbacks */
+	struct queue *notify_list;  /* Registered notify callbacks */
 
 	/* Pending calls to register_notify are queued here so that they can be
 	 * processed after a write that modifies the CCC descriptor.
@@ -225,14 +233,6 @@ static void find_ccc(struct gatt_db_attribute *attr, void *user_data)
 	*ccc_ptr = attr;
 }
 
-static bool match_notify_chrc(const void *data, const void *user_data)
-{
-	const struct notify_data *notify_data = data;
-	const struct notify_chrc *chrc = user_data;
-
-	return notify_data->chrc == chrc;
-}
-
 static void notify_data_cleanup(void *data)
 {
 	struct notify_data *notify_data = data;
@@ -251,6 +251,7 @@ static void notify_chrc_free(void *data)
 		gatt_db_attribute_unregister(chrc->attr, chrc->notify_id);
 
 	queue_destroy(chrc->reg_notify_queue, notify_data_unref);
+	queue_destroy(chrc->notify_list, NULL);
 	free(chrc);
 }
 
@@ -262,11 +263,12 @@ static void chrc_removed(struct gatt_db_attribute *attr, void *user_data)
 
 	chrc->notify_id = 0;
 
-	while ((data = queue_remove_if(client->notify_list, match_notify_chrc,
-								chrc)))
+	while ((data = queue_pop_head(chrc->notify_list))) {
+		hashmap_remove_key(client->notify_ids, data->id);
 		notify_data_cleanup(data);
+	}
 
-	queue_remove(client->notify_chrcs, chrc);
+	hashmap_remove_key(client->notify_chrcs, chrc->value_handle);
 	notify_chrc_free(chrc);
 }
 
@@ -299,6 +301,8 @@ static struct notify_chrc *notify_chrc_create(struct bt_gatt_client *client,
 		return NULL;
 	}
 
+	chrc->notify_list = queue_new();
+
 	/*
 	 * Find the CCC characteristic. Some characteristics that allow
 	 * notifications may not have a CCC descriptor. We treat these as
@@ -316,19 +320,11 @@ static struct notify_chrc *notify_chrc_create(struct bt_gatt_client *client,
 	chrc->notify_id = gatt_db_attribute_register(attr, chrc_removed, chrc,
 									NULL);
 
-	queue_push_tail(client->notify_chrcs, chrc);
+	hashmap_insert(client->notify_chrcs, chrc->value_handle, chrc);
 
 	return chrc;
 }
 
-static bool match_notify_data_id(const void *a, const void *b)
-{
-	const struct notify_data *notify_data = a;
-	unsigned int id = PTR_TO_UINT(b);
-
-	return notify_data->id == id;
-}
-
 struct handle_range {
 	uint16_t start;
 	uint16_t end;
@@ -341,6 +337,13 @@ typedef void (*discovery_op_complete_func_t)(struct discovery_op *op,
 							uint8_t att_ecode);
 typedef void (*discovery_op_fail_func_t)(struct discovery_op *op);
 
+enum discovery_phase {
+	DISCOVERY_SERVICES,
+	DISCOVERY_CHARACTERISTICS,
+	DISCOVERY_DESCRIPTORS,
+	DISCOVERY_DONE,
+};
+
 struct discovery_op {
 	struct bt_gatt_client *client;
 	struct queue *discov_ranges;
@@ -360,8 +363,80 @@ struct discovery_op {
 	int ref_count;
 	discovery_op_complete_func_t complete_func;
 	discovery_op_fail_func_t failure_func;
+
+	/*
+	 * With more than one bearer available the included services,
+	 * characteristics and descriptors of each pending service are
+	 * discovered concurrently, keeping up to one request per bearer in
+	 * flight, and inserted into the db in handle order once a service is
+	 * complete.
+	 */
+	struct queue *svcs;
+	struct queue *procs;		/* Requests waiting for a bearer */
+	unsigned int procs_active;
+	unsigned int chrc_procs;	/* Included/characteristic requests */
+
+	enum discovery_phase phase;
+	uint64_t phase_start;
+};
+
+struct discovery_svc {
+	struct discovery_op *op;
+	struct gatt_db_attribute *attr;
+	uint16_t start;
+	uint16_t end;
+	struct queue *incls;
+	struct queue *chrcs;
+	unsigned int pending;
 };
 
+struct discovery_incl {
+	uint16_t handle;
+	uint16_t start;
+	uint16_t end;
+};
+
+struct discovery_desc {
+	uint16_t handle;
+	bt_uuid_t uuid;
+};
+
+enum discovery_proc_type {
+	DISCOVERY_PROC_INCL,
+	DISCOVERY_PROC_CHRC,
+	DISCOVERY_PROC_DESC,
+};
+
+struct discovery_proc {
+	struct discovery_svc *svc;
+	struct discovery_chrc *chrc;
+	enum discovery_proc_type type;
+	uint16_t start;
+	uint16_t end;
+	struct bt_gatt_request *req;
+};
+
+static void discovery_phase_done(struct discovery_op *op)
+{
+	static const char * const phases[] = {
+		"Service", "Characteristic", "Descriptor"
+	};
+	uint64_t now = util_get_time_us();
+
+	if (op->phase >= DISCOVERY_DONE)
+		return;
+
+	util_debug(op->client->debug_callback, op->client->debug_data,
+				"%s discovery completed in %u ms",
+				phases[op->phase],
+				(unsigned int) ((now - op->phase_start) / 1000));
+
+	op->phase++;
+	op->phase_start = now;
+}
+
+static void discovery_svc_free(void *data);
+
 static void discovery_op_free(struct discovery_op *op)
 {
 	if (op->db_id > 0)
@@ -371,6 +446,8 @@ static void discovery_op_free(struct discovery_op *op)
 	queue_destroy(op->pending_svcs, NULL);
 	queue_destroy(op->pending_chrcs, free);
 	queue_destroy(op->ext_prop_desc, NULL);
+	queue_destroy(op->svcs, discovery_svc_free);
+	queue_destroy(op->procs, free);
 	free(op);
 }
 
@@ -383,6 +460,9 @@ static void discovery_op_complete(struct discovery_op *op, bool success,
 
 	op->success = success;
 
+	if (success && op->phase == DISCOVERY_DESCRIPTORS)
+		discovery_phase_done(op);
+
 	/* Read database hash if discovery has been successful */
 	if (success && read_db_hash(op))
 		return;
@@ -457,6 +537,7 @@ static struct discovery_op *discovery_op_create(struct bt_gatt_client *client,
 	op->last = gatt_db_isempty(client->db) ? 0 : UINT16_MAX;
 	op->svc_first = UINT16_MAX;
 	op->svc_last = 0;
+	op->phase_start = util_get_time_us();
 
 	/* Load existing services as pending */
 	gatt_db_foreach_service_in_range(client->db, NULL,
@@ -618,6 +699,36 @@ struct chrc {
 	bt_uuid_t uuid;
 };
 
+struct discovery_chrc {
+	struct chrc data;
+	bool ccc;
+	struct queue *descs;
+};
+
+static void discovery_chrc_free(void *data)
+{
+	struct discovery_chrc *chrc = data;
+
+	queue_destroy(chrc->descs, free);
+	free(chrc);
+}
+
+static void discovery_svc_free(void *data)
+{
+	struct discovery_svc *svc = data;
+
+	queue_destroy(svc->incls, free);
+	queue_destroy(svc->chrcs, discovery_chrc_free);
+	free(svc);
+}
+
+static void discovery_svc_activate(void *data, void *user_data)
+{
+	struct discovery_svc *svc = data;
+
+	gatt_db_service_set_active(svc->attr, true);
+}
+
 static void discover_descs_cb(bool success, uint8_t att_ecode,
 						struct bt_gatt_result *result,
 						void *user_data);
@@ -804,6 +915,12 @@ static void ext_prop_read_cb(bool success, uint8_t att_ecode,
 	if (read_ext_prop_desc(op))
 		return;
 
+	/* Services discovered in parallel are all complete at this point */
+	if (op->svcs) {
+		queue_foreach(op->svcs, discovery_svc_activate, NULL);
+		goto done;
+	}
+
 	if (!discover_descs(op, &discovering))
 			goto failed;
 
@@ -1004,6 +1121,8 @@ next:
 		goto failed;
 	}
 
+	discovery_phase_done(op);
+
 	/*
 	 * Sequentially discover descriptors for each characteristic and insert
 	 * the characteristics into the database as we proceed.
@@ -1137,6 +1256,476 @@ static bool discovery_parse_services(struct discovery_op *op, bool primary,
 	return true;
 }
 
+static bool discovery_svc_insert(struct discovery_svc *svc)
+{
+	struct discovery_op *op = svc->op;
+	struct bt_gatt_client *client = op->client;
+	const struct queue_entry *entry, *desc_entry;
+	struct gatt_db_attribute *attr;
+	bt_uuid_t ccc_uuid, ext_prop_uuid;
+
+	bt_uuid16_create(&ccc_uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+	bt_uuid16_create(&ext_prop_uuid, GATT_CHARAC_EXT_PROPER_UUID);
+
+	/* Attributes are appended to the service so insert them in order */
+	for (entry = queue_get_entries(svc->incls); entry;
+							entry = entry->next) {
+		struct discovery_incl *incl = entry->data;
+
+		attr = gatt_db_get_attribute(client->db, incl->start);
+		if (attr)
+			attr = gatt_db_insert_included(client->db, incl->handle,
+									attr);
+		if (!attr || gatt_db_attribute_get_handle(attr) != incl->handle) {
+			util_debug(client->debug_callback, client->debug_data,
+				"Unable to add include attribute at 0x%04x",
+				incl->handle);
+			return false;
+		}
+	}
+
+	for (entry = queue_get_entries(svc->chrcs); entry;
+							entry = entry->next) {
+		struct discovery_chrc *chrc = entry->data;
+
+		attr = gatt_db_insert_characteristic(client->db,
+							chrc->data.value_handle,
+							&chrc->data.uuid, 0,
+							chrc->data.properties,
+							NULL, NULL, NULL);
+		if (!attr) {
+			util_debug(client->debug_callback, client->debug_data,
+				"Failed to insert characteristic at 0x%04x",
+				chrc->data.value_handle);
+			/* Skip orphaned characteristics, see discover_descs */
+			continue;
+		}
+
+		if (gatt_db_attribute_get_handle(attr) !=
+						chrc->data.value_handle)
+			return false;
+
+		if (chrc->ccc) {
+			gatt_db_insert_descriptor(client->db,
+						chrc->data.value_handle + 1,
+						&ccc_uuid, 0, NULL, NULL, NULL);
+			continue;
+		}
+
+		for (desc_entry = queue_get_entries(chrc->descs); desc_entry;
+						desc_entry = desc_entry->next) {
+			struct discovery_desc *desc = desc_entry->data;
+
+			attr = gatt_db_insert_descriptor(client->db,
+							desc->handle,
+							&desc->uuid, 0, NULL,
+							NULL, NULL);
+			if (!attr) {
+				attr = gatt_db_get_attribute(client->db,
+								desc->handle);
+				if (attr && !bt_uuid_cmp(&desc->uuid,
+					gatt_db_attribute_get_type(attr)))
+					continue;
+
+				util_debug(client->debug_callback,
+					client->debug_data,
+					"Failed to insert descriptor at 0x%04x",
+					desc->handle);
+				return false;
+			}
+
+			if (gatt_db_attribute_get_handle(attr) != desc->handle)
+				return false;
+
+			if (!bt_uuid_cmp(&ext_prop_uuid, &desc->uuid))
+				queue_push_tail(op->ext_prop_desc, attr);
+		}
+	}
+
+	return true;
+}
+
+static void discovery_proc_free(void *data)
+{
+	struct discovery_proc *proc = data;
+	struct discovery_op *op = proc->svc->op;
+
+	free(proc);
+
+	discovery_op_unref(op);
+}
+
+static bool match_proc_op(const void *data, const void *match_data)
+{
+	const struct discovery_proc *proc = data;
+
+	return proc->svc->op == match_data;
+}
+
+static void discovery_proc_cancel(void *data)
+{
+	struct discovery_proc *proc = data;
+
+	bt_gatt_request_cancel(proc->req);
+	bt_gatt_request_unref(proc->req);
+}
+
+static void discovery_push_proc(struct discovery_svc *svc,
+					struct discovery_chrc *chrc,
+					enum discovery_proc_type type,
+					uint16_t start, uint16_t end)
+{
+	struct discovery_proc *proc;
+
+	proc = new0(struct discovery_proc, 1);
+	proc->svc = svc;
+	proc->chrc = chrc;
+	proc->type = type;
+	proc->start = start;
+	proc->end = end;
+
+	queue_push_tail(svc->op->procs, proc);
+
+	svc->pending++;
+
+	if (type != DISCOVERY_PROC_DESC)
+		svc->op->chrc_procs++;
+}
+
+static void discovery_push_descs(struct discovery_svc *svc,
+						struct discovery_chrc *chrc)
+{
+	uint16_t start, end;
+
+	/* Adjust end handle in case the next chrc is not in the service */
+	end = MIN(chrc->data.end_handle, svc->end);
+
+	if (chrc->data.value_handle >= end)
+		return;
+
+	start = chrc->data.value_handle + 1;
+
+	/* A single descriptor must be the CCC if notify/indicate is set */
+	if (start == end && (chrc->data.properties &
+					(BT_GATT_CHRC_PROP_NOTIFY |
+					BT_GATT_CHRC_PROP_INDICATE))) {
+		chrc->ccc = true;
+		return;
+	}
+
+	discovery_push_proc(svc, chrc, DISCOVERY_PROC_DESC, start, end);
+}
+
+static bool discovery_parse_incls(struct discovery_svc *svc,
+						struct bt_gatt_result *result)
+{
+	struct bt_gatt_client *client = svc->op->client;
+	struct bt_gatt_iter iter;
+	struct discovery_incl *incl;
+	uint16_t handle, start, end;
+	uint128_t u128;
+
+	if (!result || !bt_gatt_iter_init(&iter, result))
+		return false;
+
+	util_debug(client->debug_callback, client->debug_data,
+				"Included services found: %u",
+				bt_gatt_result_included_count(result));
+
+	while (bt_gatt_iter_next_included_service(&iter, &handle, &start,
+							&end, u128.data)) {
+		util_debug(client->debug_callback, client->debug_data,
+				"handle: 0x%04x, start: 0x%04x, end: 0x%04x",
+				handle, start, end);
+
+		incl = new0(struct discovery_incl, 1);
+		incl->handle = handle;
+		incl->start = start;
+		incl->end = end;
+
+		queue_push_tail(svc->incls, incl);
+	}
+
+	return true;
+}
+
+static bool discovery_parse_chrcs(struct discovery_svc *svc,
+						struct bt_gatt_result *result)
+{
+	struct bt_gatt_client *client = svc->op->client;
+	struct bt_gatt_iter iter;
+	struct discovery_chrc *chrc;
+	uint16_t start, end, value;
+	uint8_t properties;
+	uint128_t u128;
+	bt_uuid_t uuid;
+	char uuid_str[MAX_LEN_UUID_STR];
+
+	if (!result || !bt_gatt_iter_init(&iter, result))
+		return false;
+
+	util_debug(client->debug_callback, client->debug_data,
+				"Characteristics found: %u",
+				bt_gatt_result_characteristic_count(result));
+
+	while (bt_gatt_iter_next_characteristic(&iter, &start, &end, &value,
+						&properties, u128.data)) {
+		bt_uuid128_create(&uuid, u128);
+
+		/* Log debug message */
+		bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
+		util_debug(client->debug_callback, client->debug_data,
+				"start: 0x%04x, end: 0x%04x, value: 0x%04x, "
+				"props: 0x%02x, uuid: %s",
+				start, end, value, properties, uuid_str);
+
+		chrc = new0(struct discovery_chrc, 1);
+		chrc->data.start_handle = start;
+		chrc->data.end_handle = end;
+		chrc->data.value_handle = value;
+		chrc->data.properties = properties;
+		chrc->data.uuid = uuid;
+		chrc->descs = queue_new();
+
+		queue_push_tail(svc->chrcs, chrc);
+
+		discovery_push_descs(svc, chrc);
+	}
+
+	return true;
+}
+
+static bool discovery_parse_descs(struct discovery_chrc *chrc,
+						struct bt_gatt_client *client,
+						struct bt_gatt_result *result)
+{
+	struct bt_gatt_iter iter;
+	struct discovery_desc *desc;
+	uint16_t handle;
+	uint128_t u128;
+	bt_uuid_t uuid;
+	char uuid_str[MAX_LEN_UUID_STR];
+
+	if (!result || !bt_gatt_iter_init(&iter, result))
+		return false;
+
+	util_debug(client->debug_callback, client->debug_data,
+				"Descriptors found: %u",
+				bt_gatt_result_descriptor_count(result));
+
+	while (bt_gatt_iter_next_descriptor(&iter, &handle, u128.data)) {
+		bt_uuid128_create(&uuid, u128);
+
+		/* Log debug message */
+		bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
+		util_debug(client->debug_callback, client->debug_data,
+						"handle: 0x%04x, uuid: %s",
+						handle, uuid_str);
+
+		desc = new0(struct discovery_desc, 1);
+		desc->handle = handle;
+		desc->uuid = uuid;
+
+		queue_push_tail(chrc->descs, desc);
+	}
+
+	return true;
+}
+
+static void discovery_parallel_fail(struct discovery_op *op, uint8_t err)
+{
+	queue_remove_all(op->procs, NULL, NULL, free);
+	queue_remove_all(op->client->discovery_procs, match_proc_op, op,
+							discovery_proc_cancel);
+
+	discovery_op_complete(op, false, err);
+}
+
+static void discovery_proc_cb(bool success, uint8_t att_ecode,
+						struct bt_gatt_result *result,
+						void *user_data);
+
+static bool discovery_proc_send(struct discovery_proc *proc)
+{
+	struct discovery_op *op = proc->svc->op;
+	struct bt_gatt_client *client = op->client;
+
+	switch (proc->type) {
+	case DISCOVERY_PROC_INCL:
+		proc->req = bt_gatt_discover_included_services(client->att,
+						proc->start, proc->end,
+						discovery_proc_cb, proc,
+						discovery_proc_free);
+		break;
+	case DISCOVERY_PROC_CHRC:
+		proc->req = bt_gatt_discover_characteristics(client->att,
+						proc->start, proc->end,
+						discovery_proc_cb, proc,
+						discovery_proc_free);
+		break;
+	case DISCOVERY_PROC_DESC:
+		proc->req = bt_gatt_discover_descriptors(client->att,
+						proc->start, proc->end,
+						discovery_proc_cb, proc,
+						discovery_proc_free);
+		break;
+	}
+
+	if (!proc->req)
+		return false;
+
+	/* Released by discovery_proc_free once the request is done */
+	discovery_op_ref(op);
+	op->procs_active++;
+	queue_push_tail(client->discovery_procs, proc);
+
+	return true;
+}
+
+static void discovery_dispatch(struct discovery_op *op)
+{
+	struct bt_gatt_client *client = op->client;
+	struct discovery_proc *proc;
+	unsigned int window;
+
+	/* Keep one request per bearer, channels may come and go meanwhile */
+	window = MAX(bt_att_get_channels(client->att), 1);
+
+	while (op->procs_active < window &&
+				(proc = queue_pop_head(op->procs))) {
+		if (discovery_proc_send(proc))
+			continue;
+
+		util_debug(client->debug_callback, client->debug_data,
+				"Failed to start discovery of 0x%04x-0x%04x",
+				proc->start, proc->end);
+		free(proc);
+		discovery_parallel_fail(op, 0);
+		return;
+	}
+
+	if (op->procs_active)
+		return;
+
+	if (read_ext_prop_desc(op))
+		return;
+
+	queue_foreach(op->svcs, discovery_svc_activate, NULL);
+
+	discovery_op_complete(op, true, 0);
+}
+
+static void discovery_proc_cb(bool success, uint8_t att_ecode,
+						struct bt_gatt_result *result,
+						void *user_data)
+{
+	struct discovery_proc *proc = user_data;
+	struct discovery_svc *svc = proc->svc;
+	struct discovery_op *op = svc->op;
+	struct bt_gatt_client *client = op->client;
+
+	queue_remove(client->discovery_procs, proc);
+	bt_gatt_request_unref(proc->req);
+	op->procs_active--;
+
+	if (!success) {
+		if (att_ecode != BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND)
+			goto failed;
+	} else {
+		switch (proc->type) {
+		case DISCOVERY_PROC_INCL:
+			success = discovery_parse_incls(svc, result);
+			break;
+		case DISCOVERY_PROC_CHRC:
+			success = discovery_parse_chrcs(svc, result);
+			break;
+		case DISCOVERY_PROC_DESC:
+			success = discovery_parse_descs(proc->chrc, client,
+									result);
+			break;
+		}
+
+		if (!success) {
+			att_ecode = 0;
+			goto failed;
+		}
+	}
+
+	if (proc->type != DISCOVERY_PROC_DESC && !--op->chrc_procs)
+		discovery_phase_done(op);
+
+	/* Descriptor requests for the service have been queued by now */
+	if (!--svc->pending && !discovery_svc_insert(svc)) {
+		att_ecode = 0;
+		goto failed;
+	}
+
+	discovery_dispatch(op);
+
+	return;
+
+failed:
+	discovery_parallel_fail(op, att_ecode);
+}
+
+static bool match_svc_attr(const void *data, const void *match_data)
+{
+	const struct discovery_svc *svc = data;
+
+	return svc->attr == match_data;
+}
+
+static void discovery_parallel(struct discovery_op *op)
+{
+	struct bt_gatt_client *client = op->client;
+	const struct queue_entry *entry;
+
+	op->svcs = queue_new();
+	op->procs = queue_new();
+
+	for (entry = queue_get_entries(op->pending_svcs); entry;
+							entry = entry->next) {
+		struct gatt_db_attribute *attr = entry->data;
+		struct discovery_svc *svc;
+		struct handle_range range;
+
+		if (queue_find(op->svcs, match_svc_attr, attr))
+			continue;
+
+		gatt_db_attribute_get_service_handles(attr, &range.start,
+								&range.end);
+
+		/* Only services within the ranges left to discover */
+		if (!queue_find(op->discov_ranges, match_handle_range, &range))
+			continue;
+
+		svc = new0(struct discovery_svc, 1);
+		svc->op = op;
+		svc->attr = attr;
+		svc->start = range.start;
+		svc->end = range.end;
+		svc->incls = queue_new();
+		svc->chrcs = queue_new();
+
+		queue_push_tail(op->svcs, svc);
+
+		discovery_push_proc(svc, NULL, DISCOVERY_PROC_INCL, svc->start,
+								svc->end);
+		discovery_push_proc(svc, NULL, DISCOVERY_PROC_CHRC, svc->start,
+								svc->end);
+	}
+
+	util_debug(client->debug_callback, client->debug_data,
+			"Discovering %u services over %d bearers",
+			queue_length(op->svcs),
+			bt_att_get_channels(client->att));
+
+	if (!op->chrc_procs)
+		discovery_phase_done(op);
+
+	discovery_dispatch(op);
+}
+
 static void discover_secondary_cb(bool success, uint8_t att_ecode,
 						struct bt_gatt_result *result,
 						void *user_data)
@@ -1179,6 +1768,8 @@ static void discover_secondary_cb(bool success, uint8_t att_ecode,
 
 
 next:
+	discovery_phase_done(op);
+
 	if (queue_isempty(op->pending_svcs) || queue_isempty(op->discov_ranges))
 		goto done;
 
@@ -1187,6 +1778,11 @@ next:
 	if (op->svc_last < 0xffff)
 		remove_discov_range(op, op->svc_last + 1, 0xffff);
 
+	if (bt_att_get_channels(client->att) > 1) {
+		discovery_parallel(op);
+		return;
+	}
+
 	range = queue_peek_head(op->discov_ranges);
 
 	client->discovery_req = bt_gatt_discover_included_services(client->att,
@@ -1658,14 +2254,6 @@ static void enable_ccc_callback(uint8_t opcode, const void *pdu,
 	bt_gatt_client_unref(notify_data->client);
 }
 
-static bool match_notify_chrc_value_handle(const void *a, const void *b)
-{
-	const struct notify_chrc *chrc = a;
-	uint16_t value_handle = PTR_TO_UINT(b);
-
-	return chrc->value_handle == value_handle;
-}
-
 static unsigned int register_notify(struct bt_gatt_client *client,
 				uint16_t handle,
 				bt_gatt_client_register_callback_t callback,
@@ -1677,8 +2265,7 @@ static unsigned int register_notify(struct bt_gatt_client *client,
 	struct notify_chrc *chrc = NULL;
 
 	/* Check if a characteristic ref count has been started already */
-	chrc = queue_find(client->notify_chrcs, match_notify_chrc_value_handle,
-						UINT_TO_PTR(handle));
+	chrc = hashmap_lookup(client->notify_chrcs, handle);
 
 	if (!chrc) {
 		/*
@@ -1703,14 +2290,17 @@ static unsigned int register_notify(struct bt_gatt_client *client,
 	notify_data->user_data = user_data;
 	notify_data->destroy = destroy;
 
-	/* Add the handler to the bt_gatt_client's general list */
-	queue_push_tail(client->notify_list, notify_data);
+	/* Assign an ID to the handler, skipping any still in use on wrap. */
+	do {
+		if (client->next_reg_id < 1)
+			client->next_reg_id = 1;
 
-	/* Assign an ID to the handler. */
-	if (client->next_reg_id < 1)
-		client->next_reg_id = 1;
+		notify_data->id = client->next_reg_id++;
+	} while (!hashmap_insert(client->notify_ids, notify_data->id,
+								notify_data));
 
-	notify_data->id = client->next_reg_id++;
+	/* Add the handler to the callbacks of the characteristic */
+	queue_push_tail(chrc->notify_list, notify_data);
 
 	/* Increment the per-characteristic ref count of notify handlers */
 	__sync_fetch_and_add(&notify_data->chrc->notify_count, 1);
@@ -1734,7 +2324,8 @@ static unsigned int register_notify(struct bt_gatt_client *client,
 
 	/* Write to the CCC descriptor */
 	if (!notify_data_write_ccc(notify_data, true, enable_ccc_callback)) {
-		queue_remove(client->notify_list, notify_data);
+		hashmap_remove_key(client->notify_ids, notify_data->id);
+		queue_remove(chrc->notify_list, notify_data);
 		free(notify_data);
 		return 0;
 	}
@@ -2140,9 +2731,6 @@ static void notify_handler(void *data, void *user_data)
 	struct notify_data *notify_data = data;
 	struct value_data *value_data = user_data;
 
-	if (notify_data->chrc->value_handle != value_data->handle)
-		return;
-
 	/*
 	 * Even if the notify data has a pending ATT request to write to the
 	 * CCC, there is really no reason not to notify the handlers.
@@ -2152,6 +2740,18 @@ static void notify_handler(void *data, void *user_data)
 				value_data->len, notify_data->user_data);
 }
 
+static void notify_dispatch(struct bt_gatt_client *client,
+						struct value_data *data)
+{
+	struct notify_chrc *chrc;
+
+	chrc = hashmap_lookup(client->notify_chrcs, data->handle);
+	if (!chrc)
+		return;
+
+	queue_foreach(chrc->notify_list, notify_handler, data);
+}
+
 static void notify_cb(struct bt_att_chan *chan, uint8_t opcode,
 					const void *pdu, uint16_t length,
 					void *user_data)
@@ -2175,8 +2775,7 @@ static void notify_cb(struct bt_att_chan *chan, uint8_t opcode,
 
 			data.data = pdu;
 
-			queue_foreach(client->notify_list, notify_handler,
-								&data);
+			notify_dispatch(client, &data);
 
 			length -= data.len;
 		}
@@ -2188,7 +2787,7 @@ static void notify_cb(struct bt_att_chan *chan, uint8_t opcode,
 		data.len = length;
 		data.data = pdu;
 
-		queue_foreach(client->notify_list, notify_handler, &data);
+		notify_dispatch(client, &data);
 	}
 
 	if (opcode == BT_ATT_OP_HANDLE_IND && !client->parent)
@@ -2202,8 +2801,8 @@ static void bt_gatt_client_free(struct bt_gatt_client *client)
 {
 	bt_gatt_client_cancel_all(client);
 
-	queue_destroy(client->notify_chrcs, notify_chrc_free);
-	queue_destroy(client->notify_list, notify_data_cleanup);
+	hashmap_destroy(client->notify_chrcs, notify_chrc_free);
+	hashmap_destroy(client->notify_ids, notify_data_cleanup);
 
 	queue_destroy(client->ready_cbs, ready_destroy);
 
@@ -2224,6 +2823,7 @@ static void bt_gatt_client_free(struct bt_gatt_client *client)
 	queue_destroy(client->svc_chngd_queue, free);
 	queue_destroy(client->long_write_queue, request_unref);
 	queue_destroy(client->pending_requests, request_unref);
+	queue_destroy(client->discovery_procs, NULL);
 
 	if (client->parent) {
 		queue_remove(client->parent->clones, client);
@@ -2266,9 +2866,10 @@ static struct bt_gatt_client *gatt_client_new(struct gatt_db *db,
 	client->ready_cbs = queue_new();
 	client->long_write_queue = queue_new();
 	client->svc_chngd_queue = queue_new();
-	client->notify_list = queue_new();
-	client->notify_chrcs = queue_new();
+	client->notify_ids = hashmap_new();
+	client->notify_chrcs = hashmap_new();
 	client->pending_requests = queue_new();
+	client->discovery_procs = queue_new();
 
 	client->nfy_id = bt_att_register(att, BT_ATT_OP_HANDLE_NFY,
 						notify_cb, client, NULL);
@@ -2574,6 +3175,9 @@ bool bt_gatt_client_cancel_all(struct bt_gatt_client *client)
 		client->discovery_req = NULL;
 	}
 
+	queue_remove_all(client->discovery_procs, NULL, NULL,
+							discovery_proc_cancel);
+
 	if (client->mtu_req_id)
 		bt_att_cancel(client->att, client->mtu_req_id);
 
@@ -3663,11 +4267,12 @@ bool bt_gatt_client_unregister_notify(struct bt_gatt_client *client,
 	if (!client || !id)
 		return false;
 
-	notify_data = queue_remove_if(client->notify_list, match_notify_data_id,
-							UINT_TO_PTR(id));
+	notify_data = hashmap_remove_key(client->notify_ids, id);
 	if (!notify_data)
 		return false;
 
+	queue_remove(notify_data->chrc->notify_list, notify_data);
+
 	/* Remove data if it has been queued */
 	queue_remove(notify_data->chrc->reg_notify_queue, notify_data);
 
@@ -31,7 +31,6 @@
 #define MAX_CHAR_DECL_VALUE_LEN 19
 #define MAX_INCLUDED_VALUE_LEN 6
 #define ATTRIBUTE_TIMEOUT 5000
-#define HASH_UPDATE_TIMEOUT 100
 
 static const bt_uuid_t primary_service_uuid = { .type = BT_UUID16,
 					.value.u16 = GATT_PRIM_SVC_UUID };
@@ -48,9 +47,13 @@ struct gatt_db {
 	int ref_count;
 	struct bt_crypto *crypto;
 	uint8_t hash[16];
-	unsigned int hash_id;
+	bool hash_valid;
 	uint16_t next_handle;
-	struct queue *services;
+
+	/* Services sorted by handle range, for binary search by handle */
+	struct gatt_db_service **services;
+	unsigned int num_services;
+	unsigned int services_size;
 
 	struct queue *notify_list;
 	unsigned int next_notify_id;
@@ -91,13 +94,27 @@ struct pending_write {
 	void *user_data;
 };
 
+/*
+ * The attribute array of a service only grows with the attributes inserted,
+ * remote services may span many more handles than they have attributes.
+ * Values up to the size of a pointer are stored in place of the pointer,
+ * 16-bit UUIDs are shared and other UUIDs are allocated together with the
+ * attribute, the pending operation and notification lists are only created
+ * once needed.
+ */
+#define ATTRIBUTE_INLINE_LEN	sizeof(uint8_t *)
+
 struct gatt_db_attribute {
 	struct gatt_db_service *service;
+	const bt_uuid_t *uuid;
 	uint16_t handle;
-	bt_uuid_t uuid;
-	uint32_t permissions;
 	uint16_t value_len;
-	uint8_t *value;
+	uint32_t permissions;
+	union {
+		uint8_t *ptr;
+		uint8_t data[ATTRIBUTE_INLINE_LEN];
+	} value;
+	bool value_inline;
 
 	gatt_db_read_t read_func;
 	gatt_db_write_t write_func;
@@ -111,6 +128,8 @@ struct gatt_db_attribute {
 
 	unsigned int next_notify_id;
 	struct queue *notify_list;
+
+	bt_uuid_t uuid_data[];
 };
 
 struct gatt_db_service {
@@ -118,7 +137,14 @@ struct gatt_db_service {
 	bool active;
 	bool claimed;
 	uint16_t num_handles;
+	uint16_t num_attributes;
+	uint16_t attributes_size;
 	struct gatt_db_attribute **attributes;
+
+	/* Cached Database Hash input for the attributes of the service */
+	uint8_t *hash_data;
+	size_t hash_len;
+	bool hash_valid;
 };
 
 static void set_attribute_data(struct gatt_db_attribute *attribute,
@@ -178,20 +204,121 @@ static void attribute_notify_destroy(void *data)
 	free(notify);
 }
 
-static void attribute_destroy(struct gatt_db_attribute *attribute)
+static struct gatt_db_attribute *
+service_attribute(const struct gatt_db_service *service, int index)
 {
-	/* Attribute was not initialized by user */
-	if (!attribute)
-		return;
+	if (index < 0 || index >= service->num_attributes)
+		return NULL;
+
+	return service->attributes[index];
+}
+
+static const bt_uuid_t *uuid16_get(uint16_t value)
+{
+	static bt_uuid_t *uuid16[256];
+	bt_uuid_t *table;
+	int i;
+
+	/* 16-bit UUIDs are shared by all attributes of all databases */
+	table = uuid16[value >> 8];
+	if (!table) {
+		table = new0(bt_uuid_t, 256);
+
+		for (i = 0; i < 256; i++)
+			bt_uuid16_create(&table[i], (value & 0xff00) | i);
+
+		uuid16[value >> 8] = table;
+	}
+
+	return &table[value & 0xff];
+}
+
+static uint8_t *attribute_value(const struct gatt_db_attribute *attribute)
+{
+	if (attribute->value_inline)
+		return (uint8_t *) attribute->value.data;
+
+	return attribute->value.ptr;
+}
+
+static bool attribute_resize_value(struct gatt_db_attribute *attribute,
+								uint16_t len)
+{
+	uint16_t keep = len < attribute->value_len ? len : attribute->value_len;
+	uint8_t *buf;
+
+	if (len <= ATTRIBUTE_INLINE_LEN) {
+		buf = attribute->value_inline ? NULL : attribute->value.ptr;
+
+		if (buf)
+			memcpy(attribute->value.data, buf, keep);
+
+		memset(attribute->value.data + keep, 0,
+					ATTRIBUTE_INLINE_LEN - keep);
 
+		free(buf);
+		attribute->value_inline = true;
+	} else if (!attribute->value_inline) {
+		buf = realloc(attribute->value.ptr, len);
+		if (!buf)
+			return false;
+
+		memset(buf + keep, 0, len - keep);
+		attribute->value.ptr = buf;
+	} else {
+		buf = malloc0(len);
+		if (!buf)
+			return false;
+
+		memcpy(buf, attribute->value.data, keep);
+		attribute->value.ptr = buf;
+		attribute->value_inline = false;
+	}
+
+	attribute->value_len = len;
+
+	return true;
+}
+
+static void attribute_destroy(struct gatt_db_attribute *attribute)
+{
 	queue_destroy(attribute->pending_reads, pending_read_free);
 	queue_destroy(attribute->pending_writes, pending_write_free);
 	queue_destroy(attribute->notify_list, attribute_notify_destroy);
 
-	free(attribute->value);
+	if (!attribute->value_inline)
+		free(attribute->value.ptr);
+
 	free(attribute);
 }
 
+static void service_hash_invalidate(struct gatt_db_service *service)
+{
+	/* The hash input of the service has to be generated again */
+	service->hash_valid = false;
+
+	if (service->db)
+		service->db->hash_valid = false;
+}
+
+static bool attribute_value_hashed(const struct gatt_db_attribute *attr)
+{
+	if (bt_uuid_len(attr->uuid) != 2)
+		return false;
+
+	/* Only declaration values are part of the Database Hash input */
+	switch (attr->uuid->value.u16) {
+	case GATT_PRIM_SVC_UUID:
+	case GATT_SND_SVC_UUID:
+	case GATT_INCLUDE_UUID:
+	case GATT_CHARAC_UUID:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Attributes are appended, get_attribute_index() checks there is room */
 static struct gatt_db_attribute *new_attribute(struct gatt_db_service *service,
 							uint16_t handle,
 							const bt_uuid_t *type,
@@ -199,30 +326,57 @@ static struct gatt_db_attribute *new_attribute(struct gatt_db_service *service,
 							uint16_t len)
 {
 	struct gatt_db_attribute *attribute;
+	size_t size = sizeof(*attribute);
+
+	if (service->num_attributes == service->attributes_size) {
+		struct gatt_db_attribute **attributes;
+		unsigned int attributes_size;
+
+		attributes_size = service->attributes_size ?
+					service->attributes_size * 2 : 4;
+		if (attributes_size > service->num_handles)
+			attributes_size = service->num_handles;
+
+		attributes = realloc(service->attributes, attributes_size *
+						sizeof(*attributes));
+		if (!attributes)
+			return NULL;
+
+		service->attributes = attributes;
+		service->attributes_size = attributes_size;
+	}
 
-	attribute = new0(struct gatt_db_attribute, 1);
+	if (type->type != BT_UUID16)
+		size += sizeof(bt_uuid_t);
+
+	attribute = malloc0(size);
+	if (!attribute)
+		return NULL;
 
 	attribute->service = service;
 	attribute->handle = handle;
-	attribute->uuid = *type;
-	attribute->value_len = len;
-	if (len) {
-		attribute->value = malloc0(len);
-		if (!attribute->value)
-			goto failed;
+	attribute->value_inline = true;
 
-		memcpy(attribute->value, val, len);
+	if (!attribute_resize_value(attribute, len)) {
+		free(attribute);
+		return NULL;
 	}
 
-	attribute->pending_reads = queue_new();
-	attribute->pending_writes = queue_new();
-	attribute->notify_list = queue_new();
+	if (len)
+		memcpy(attribute_value(attribute), val, len);
 
-	return attribute;
+	if (type->type == BT_UUID16) {
+		attribute->uuid = uuid16_get(type->value.u16);
+	} else {
+		attribute->uuid_data[0] = *type;
+		attribute->uuid = attribute->uuid_data;
+	}
 
-failed:
-	attribute_destroy(attribute);
-	return NULL;
+	service->attributes[service->num_attributes++] = attribute;
+
+	service_hash_invalidate(service);
+
+	return attribute;
 }
 
 struct gatt_db *gatt_db_ref(struct gatt_db *db)
@@ -241,7 +395,6 @@ struct gatt_db *gatt_db_new(void)
 
 	db = new0(struct gatt_db, 1);
 	db->crypto = bt_crypto_new();
-	db->services = queue_new();
 	db->notify_list = queue_new();
 	db->next_handle = 0x0001;
 
@@ -282,83 +435,97 @@ static void handle_notify(void *data, void *user_data)
 		notify->service_removed(notify_data->attr, notify->user_data);
 }
 
-struct hash_data {
-	struct iovec *iov;
-	uint16_t i;
-};
-
-static void gen_hash_m(struct gatt_db_attribute *attr, void *user_data)
+static size_t gen_hash_m(const struct gatt_db_attribute *attr, uint8_t *data)
 {
-	struct hash_data *hash = user_data;
-	uint8_t *data;
 	size_t len;
 
-	if (bt_uuid_len(&attr->uuid) != 2)
-		return;
+	if (bt_uuid_len(attr->uuid) != 2)
+		return 0;
 
-	switch (attr->uuid.value.u16) {
+	switch (attr->uuid->value.u16) {
 	case GATT_PRIM_SVC_UUID:
 	case GATT_SND_SVC_UUID:
 	case GATT_INCLUDE_UUID:
 	case GATT_CHARAC_UUID:
-		/* Allocate space for handle + type + value */
+		/* Handle + type + value */
 		len = 2 + 2 + attr->value_len;
-		data = malloc(2 + 2 + attr->value_len);
-		put_le16(attr->handle, data);
-		bt_uuid_to_le(&attr->uuid, data + 2);
-		memcpy(data + 4, attr->value, attr->value_len);
+		if (data)
+			memcpy(data + 4, attribute_value(attr),
+							attr->value_len);
 		break;
 	case GATT_CHARAC_USER_DESC_UUID:
 	case GATT_CLIENT_CHARAC_CFG_UUID:
 	case GATT_SERVER_CHARAC_CFG_UUID:
 	case GATT_CHARAC_FMT_UUID:
 	case GATT_CHARAC_AGREG_FMT_UUID:
-		/* Allocate space for handle + type  */
+		/* Handle + type */
 		len = 2 + 2;
-		data = malloc(2 + 2 + attr->value_len);
-		put_le16(attr->handle, data);
-		bt_uuid_to_le(&attr->uuid, data + 2);
 		break;
 	default:
-		return;
+		return 0;
 	}
 
-	hash->iov[hash->i].iov_base = data;
-	hash->iov[hash->i].iov_len = len;
-
-	hash->i++;
+	if (data) {
+		put_le16(attr->handle, data);
+		bt_uuid_to_le(attr->uuid, data + 2);
+	}
 
-	return;
+	return len;
 }
 
-static void service_gen_hash_m(struct gatt_db_attribute *attr, void *user_data)
+static void service_gen_hash(struct gatt_db_service *service)
 {
-	gatt_db_service_foreach(attr, NULL, gen_hash_m, user_data);
+	size_t len = 0;
+	int i;
+
+	if (service->hash_valid)
+		return;
+
+	for (i = 0; i < service->num_attributes; i++)
+		len += gen_hash_m(service->attributes[i], NULL);
+
+	free(service->hash_data);
+	service->hash_data = malloc(len);
+	service->hash_len = 0;
+
+	for (i = 0; i < service->num_attributes; i++)
+		service->hash_len += gen_hash_m(service->attributes[i],
+					service->hash_data + service->hash_len);
+
+	service->hash_valid = true;
 }
 
-static bool db_hash_update(void *user_data)
+static void db_hash_update(struct gatt_db *db)
 {
-	struct gatt_db *db = user_data;
-	struct hash_data hash;
-	uint16_t i;
+	struct iovec *iov;
+	unsigned int i, n = 0;
 
-	db->hash_id = 0;
+	iov = db->num_services ? new0(struct iovec, db->num_services) : NULL;
 
-	if (!db->next_handle)
-		return false;
+	/*
+	 * Only services whose attributes changed are serialized again, the
+	 * others are fed to the CMAC straight from their cached input.
+	 */
+	for (i = 0; i < db->num_services; i++) {
+		struct gatt_db_service *service = db->services[i];
 
-	hash.iov = new0(struct iovec, db->next_handle);
-	hash.i = 0;
+		if (!service->active)
+			continue;
 
-	gatt_db_foreach_service(db, NULL, service_gen_hash_m, &hash);
-	bt_crypto_gatt_hash(db->crypto, hash.iov, db->next_handle, db->hash);
+		service_gen_hash(service);
 
-	for (i = 0; i < hash.i; i++)
-		free(hash.iov[i].iov_base);
+		if (!service->hash_len)
+			continue;
 
-	free(hash.iov);
+		iov[n].iov_base = service->hash_data;
+		iov[n].iov_len = service->hash_len;
+		n++;
+	}
 
-	return false;
+	bt_crypto_gatt_hash(db->crypto, iov, n, db->hash);
+	db->hash_valid = true;
+
+	free(iov);
 }
 
 static void handle_attribute_notify(void *data, void *user_data)
@@ -374,12 +541,9 @@ static void notify_attribute_changed(struct gatt_db_service *service)
 {
 	int i;
 
-	for (i = 0; i < service->num_handles; i++) {
+	for (i = 0; i < service->num_attributes; i++) {
 		struct gatt_db_attribute *attr = service->attributes[i];
 
-		if (!attr)
-			continue;
-
 		queue_foreach(attr->notify_list, handle_attribute_notify, attr);
 	}
 }
@@ -393,6 +557,9 @@ static void notify_service_changed(struct gatt_db *db,
 	if (!added)
 		notify_attribute_changed(service);
 
+	/* The hash is only generated again once it is read */
+	db->hash_valid = false;
+
 	if (queue_isempty(db->notify_list))
 		return;
 
@@ -403,11 +570,6 @@ static void notify_service_changed(struct gatt_db *db,
 
 	queue_foreach(db->notify_list, handle_notify, &data);
 
-	/* Tigger hash update */
-	if (!db->hash_id && db->crypto)
-		db->hash_id = timeout_add(HASH_UPDATE_TIMEOUT, db_hash_update,
-								db, NULL);
-
 	gatt_db_unref(db);
 }
 
@@ -419,10 +581,11 @@ static void gatt_db_service_destroy(void *data)
 	if (service->active)
 		notify_service_changed(service->db, service, false);
 
-	for (i = 0; i < service->num_handles; i++)
+	for (i = 0; i < service->num_attributes; i++)
 		attribute_destroy(service->attributes[i]);
 
 	free(service->attributes);
+	free(service->hash_data);
 	free(service);
 }
 
@@ -440,10 +603,9 @@ static void gatt_db_destroy(struct gatt_db *db)
 	queue_destroy(db->notify_list, notify_destroy);
 	db->notify_list = NULL;
 
-	if (db->hash_id)
-		timeout_remove(db->hash_id);
+	gatt_db_clear(db);
 
-	queue_destroy(db->services, gatt_db_service_destroy);
+	free(db->services);
 	free(db);
 }
 
@@ -463,7 +625,7 @@ bool gatt_db_isempty(struct gatt_db *db)
 	if (!db)
 		return true;
 
-	return queue_isempty(db->services);
+	return db->num_services == 0;
 }
 
 static int uuid_to_le(const bt_uuid_t *uuid, uint8_t *dst)
@@ -517,7 +679,7 @@ static struct gatt_db_service *gatt_db_service_create(const bt_uuid_t *uuid,
 		return NULL;
 
 	service = new0(struct gatt_db_service, 1);
-	service->attributes = new0(struct gatt_db_attribute *, num_handles);
+	service->num_handles = num_handles;
 
 	if (primary)
 		type = &primary_service_uuid;
@@ -526,18 +688,95 @@ static struct gatt_db_service *gatt_db_service_create(const bt_uuid_t *uuid,
 
 	len = uuid_to_le(uuid, value);
 
-	service->attributes[0] = new_attribute(service, handle, type, value,
-									len);
-	if (!service->attributes[0]) {
+	if (!new_attribute(service, handle, type, value, len)) {
 		gatt_db_service_destroy(service);
 		return NULL;
 	}
 
-	set_attribute_data(service->attributes[0], NULL, NULL, BT_ATT_PERM_READ, NULL);
+	set_attribute_data(service->attributes[0], NULL, NULL,
+						BT_ATT_PERM_READ, NULL);
 
 	return service;
 }
 
+static void gatt_db_service_get_handles(const struct gatt_db_service *service,
+							uint16_t *start_handle,
+							uint16_t *end_handle)
+{
+	if (start_handle)
+		*start_handle = service->attributes[0]->handle;
+
+	if (end_handle)
+		*end_handle = service->attributes[0]->handle +
+						service->num_handles - 1;
+}
+
+/* Returns the index of the first service which doesn't end before handle */
+static unsigned int service_index_lookup(struct gatt_db *db, uint16_t handle)
+{
+	unsigned int low = 0, high = db->num_services;
+
+	while (low < high) {
+		unsigned int mid = (low + high) / 2;
+		uint16_t end;
+
+		gatt_db_service_get_handles(db->services[mid], NULL, &end);
+
+		if (end < handle)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static struct gatt_db_service *service_index_find(struct gatt_db *db,
+							uint16_t handle)
+{
+	unsigned int i;
+
+	i = service_index_lookup(db, handle);
+	if (i == db->num_services)
+		return NULL;
+
+	return db->services[i];
+}
+
+static void service_index_insert(struct gatt_db *db,
+					struct gatt_db_service *service,
+					unsigned int i)
+{
+	if (db->num_services == db->services_size) {
+		db->services_size = db->services_size ?
+						db->services_size * 2 : 8;
+		db->services = realloc(db->services, db->services_size *
+						sizeof(*db->services));
+	}
+
+	memmove(&db->services[i + 1], &db->services[i],
+			(db->num_services - i) * sizeof(*db->services));
+
+	db->services[i] = service;
+	db->num_services++;
+}
+
+static bool service_index_remove(struct gatt_db *db,
+					struct gatt_db_service *service)
+{
+	unsigned int i;
+
+	i = service_index_lookup(db, service->attributes[0]->handle);
+	if (i == db->num_services || db->services[i] != service)
+		return false;
+
+	db->num_services--;
+
+	memmove(&db->services[i], &db->services[i + 1],
+			(db->num_services - i) * sizeof(*db->services));
+
+	return true;
+}
 
 bool gatt_db_remove_service(struct gatt_db *db,
 					struct gatt_db_attribute *attrib)
@@ -549,7 +788,7 @@ bool gatt_db_remove_service(struct gatt_db *db,
 
 	service = attrib->service;
 
-	queue_remove(db->services, service);
+	service_index_remove(db, service);
 
 	gatt_db_service_destroy(service);
 
@@ -561,53 +800,42 @@ bool gatt_db_clear(struct gatt_db *db)
 	return gatt_db_clear_range(db, 1, UINT16_MAX);
 }
 
-static void gatt_db_service_get_handles(const struct gatt_db_service *service,
-							uint16_t *start_handle,
-							uint16_t *end_handle)
-{
-	if (start_handle)
-		*start_handle = service->attributes[0]->handle;
-
-	if (end_handle)
-		*end_handle = service->attributes[0]->handle +
-						service->num_handles - 1;
-}
-
-struct clear_range {
-	uint16_t start, end;
-};
-
-static bool match_range(const void *a, const void *b)
-{
-	const struct gatt_db_service *service = a;
-	const struct clear_range *range = b;
-	uint16_t svc_start, svc_end;
-
-	gatt_db_service_get_handles(service, &svc_start, &svc_end);
-
-	return svc_start <= range->end && svc_end >= range->start;
-}
-
 bool gatt_db_clear_range(struct gatt_db *db, uint16_t start_handle,
 							uint16_t end_handle)
 {
-	struct clear_range range;
+	struct gatt_db_service *service;
 
 	if (!db || start_handle > end_handle)
 		return false;
 
 	/* Check if it is a full clear */
 	if (start_handle == 1 && end_handle == UINT16_MAX) {
-		queue_remove_all(db->services, NULL, NULL,
-						gatt_db_service_destroy);
+		struct gatt_db_service **services = db->services;
+		unsigned int i, num_services = db->num_services;
+
+		/* Detach all services first, as removal notifies users */
+		db->services = NULL;
+		db->num_services = 0;
+		db->services_size = 0;
+
+		for (i = 0; i < num_services; i++)
+			gatt_db_service_destroy(services[i]);
+
+		free(services);
 		goto done;
 	}
 
-	range.start = start_handle;
-	range.end = end_handle;
+	while ((service = service_index_find(db, start_handle))) {
+		uint16_t svc_start;
+
+		gatt_db_service_get_handles(service, &svc_start, NULL);
+
+		if (svc_start > end_handle)
+			break;
 
-	queue_remove_all(db->services, match_range, &range,
-						gatt_db_service_destroy);
+		service_index_remove(db, service);
+		gatt_db_service_destroy(service);
+	}
 
 done:
 	if (gatt_db_isempty(db))
@@ -618,16 +846,12 @@ done:
 
 uint8_t *gatt_db_get_hash(struct gatt_db *db)
 {
-	uint8_t hash[16] = {};
-
 	if (!db || !db->crypto)
 		return NULL;
 
-	/* Generate hash if if has not been generated yet */
-	if (db->hash_id || !memcmp(db->hash, hash, 16)) {
-		timeout_remove(db->hash_id);
+	/* Changes are batched until the hash is actually needed */
+	if (!db->hash_valid)
 		db_hash_update(db);
-	}
 
 	return db->hash;
 }
@@ -642,33 +866,22 @@ bool gatt_db_hash_support(struct gatt_db *db)
 
 static struct gatt_db_service *find_insert_loc(struct gatt_db *db,
 						uint16_t start, uint16_t end,
-						struct gatt_db_service **after)
+						unsigned int *index)
 {
-	const struct queue_entry *services_entry;
 	struct gatt_db_service *service;
-	uint16_t cur_start, cur_end;
-
-	*after = NULL;
-
-	services_entry = queue_get_entries(db->services);
-
-	while (services_entry) {
-		service = services_entry->data;
-
-		gatt_db_service_get_handles(service, &cur_start, &cur_end);
+	uint16_t cur_start;
 
-		if (start >= cur_start && start <= cur_end)
-			return service;
+	*index = service_index_lookup(db, start);
+	if (*index == db->num_services)
+		return NULL;
 
-		if (end >= cur_start && end <= cur_end)
-			return service;
+	service = db->services[*index];
 
-		if (end < cur_start)
-			return NULL;
+	/* Any service overlapping the range would be the one found */
+	gatt_db_service_get_handles(service, &cur_start, NULL);
 
-		*after = service;
-		services_entry = services_entry->next;
-	}
+	if (cur_start <= end)
+		return service;
 
 	return NULL;
 }
@@ -679,9 +892,8 @@ struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 							bool primary,
 							uint16_t num_handles)
 {
-	struct gatt_db_service *service, *after;
-
-	after = NULL;
+	struct gatt_db_service *service;
+	unsigned int index;
 
 	if (!db)
 		return NULL;
@@ -692,7 +904,7 @@ struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 	if (num_handles < 1 || (handle + num_handles - 1) > UINT16_MAX)
 		return NULL;
 
-	service = find_insert_loc(db, handle, handle + num_handles - 1, &after);
+	service = find_insert_loc(db, handle, handle + num_handles - 1, &index);
 	if (service) {
 		const bt_uuid_t *type;
 		bt_uuid_t value;
@@ -706,7 +918,7 @@ struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 									&value);
 
 		/* Check if service match */
-		if (!bt_uuid_cmp(&service->attributes[0]->uuid, type) &&
+		if (!bt_uuid_cmp(service->attributes[0]->uuid, type) &&
 				!bt_uuid_cmp(&value, uuid) &&
 				service->num_handles == num_handles &&
 				service->attributes[0]->handle == handle)
@@ -720,25 +932,14 @@ struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 	if (!service)
 		return NULL;
 
-	if (after) {
-		if (!queue_push_after(db->services, after, service))
-			goto fail;
-	} else if (!queue_push_head(db->services, service)) {
-		goto fail;
-	}
+	service_index_insert(db, service, index);
 
 	service->db = db;
-	service->attributes[0]->handle = handle;
-	service->num_handles = num_handles;
 
 	/* Fast-forward next_handle if the new service was added to the end */
 	db->next_handle = MAX(handle + num_handles, db->next_handle);
 
 	return service->attributes[0];
-
-fail:
-	gatt_db_service_destroy(service);
-	return NULL;
 }
 
 struct gatt_db_attribute *gatt_db_add_service(struct gatt_db *db,
@@ -811,14 +1012,11 @@ bool gatt_db_set_authorize(struct gatt_db *db, gatt_db_authorize_cb_t cb,
 static uint16_t get_attribute_index(struct gatt_db_service *service,
 							int end_offset)
 {
-	int i = 0;
-
-	/* Here we look for first free attribute index with given offset */
-	while (i < (service->num_handles - end_offset) &&
-						service->attributes[i])
-		i++;
+	/* Index of the next attribute if there is room for end_offset more */
+	if (service->num_attributes >= service->num_handles - end_offset)
+		return 0;
 
-	return i == (service->num_handles - end_offset) ? 0 : i;
+	return service->num_attributes;
 }
 
 static uint16_t get_handle_at_index(struct gatt_db_service *service,
@@ -837,6 +1035,7 @@ service_insert_characteristic(struct gatt_db_service *service,
 					gatt_db_write_t write_func,
 					void *user_data)
 {
+	struct gatt_db_attribute *decl, *attrib;
 	uint8_t value[MAX_CHAR_DECL_VALUE_LEN];
 	uint16_t len = 0;
 	int i;
@@ -872,26 +1071,24 @@ service_insert_characteristic(struct gatt_db_service *service,
 	len += sizeof(uint16_t);
 	len += uuid_to_le(uuid, &value[3]);
 
-	service->attributes[i] = new_attribute(service, handle - 1,
-							&characteristic_uuid,
-							value, len);
-	if (!service->attributes[i])
+	decl = new_attribute(service, handle - 1, &characteristic_uuid,
+								value, len);
+	if (!decl)
 		return NULL;
 
-	set_attribute_data(service->attributes[i], NULL, NULL, BT_ATT_PERM_READ, NULL);
+	set_attribute_data(decl, NULL, NULL, BT_ATT_PERM_READ, NULL);
 
-	i++;
-
-	service->attributes[i] = new_attribute(service, handle, uuid, NULL, 0);
-	if (!service->attributes[i]) {
-		free(service->attributes[i - 1]);
+	attrib = new_attribute(service, handle, uuid, NULL, 0);
+	if (!attrib) {
+		service->num_attributes--;
+		attribute_destroy(decl);
 		return NULL;
 	}
 
-	set_attribute_data(service->attributes[i], read_func, write_func,
-							permissions, user_data);
+	set_attribute_data(attrib, read_func, write_func, permissions,
+								user_data);
 
-	return service->attributes[i];
+	return attrib;
 }
 
 struct gatt_db_attribute *
@@ -962,6 +1159,7 @@ service_insert_descriptor(struct gatt_db_service *service,
 					gatt_db_write_t write_func,
 					void *user_data)
 {
+	struct gatt_db_attribute *attrib;
 	int i;
 
 	i = get_attribute_index(service, 0);
@@ -975,14 +1173,14 @@ service_insert_descriptor(struct gatt_db_service *service,
 	if (!handle)
 		handle = get_handle_at_index(service, i - 1) + 1;
 
-	service->attributes[i] = new_attribute(service, handle, uuid, NULL, 0);
-	if (!service->attributes[i])
+	attrib = new_attribute(service, handle, uuid, NULL, 0);
+	if (!attrib)
 		return NULL;
 
-	set_attribute_data(service->attributes[i], read_func, write_func,
-							permissions, user_data);
+	set_attribute_data(attrib, read_func, write_func, permissions,
+								user_data);
 
-	return service->attributes[i];
+	return attrib;
 }
 
 struct gatt_db_attribute *
@@ -1043,6 +1241,7 @@ service_insert_included(struct gatt_db_service *service, uint16_t handle,
 					struct gatt_db_attribute *include)
 {
 	struct gatt_db_service *included;
+	struct gatt_db_attribute *attrib;
 	uint8_t value[MAX_INCLUDED_VALUE_LEN];
 	uint16_t included_handle, len = 0;
 	int index;
@@ -1065,7 +1264,8 @@ service_insert_included(struct gatt_db_service *service, uint16_t handle,
 	 * Bluetooth UUID. Vol 2. Part G. 3.2
 	 */
 	if (include->value_len == sizeof(uint16_t)) {
-		memcpy(&value[len], include->value, include->value_len);
+		memcpy(&value[len], attribute_value(include),
+							include->value_len);
 		len += include->value_len;
 	}
 
@@ -1080,10 +1280,9 @@ service_insert_included(struct gatt_db_service *service, uint16_t handle,
 	if (!handle)
 		handle = get_handle_at_index(service, index - 1) + 1;
 
-	service->attributes[index] = new_attribute(service, handle,
-							&included_service_uuid,
-							value, len);
-	if (!service->attributes[index])
+	attrib = new_attribute(service, handle, &included_service_uuid,
+								value, len);
+	if (!attrib)
 		return NULL;
 
 	/* The Attribute Permissions shall be read only and not require
@@ -1091,10 +1290,9 @@ service_insert_included(struct gatt_db_service *service, uint16_t handle,
 	 *
 	 * TODO handle permissions
 	 */
-	set_attribute_data(service->attributes[index], NULL, NULL,
-					BT_ATT_PERM_READ, NULL);
+	set_attribute_data(attrib, NULL, NULL, BT_ATT_PERM_READ, NULL);
 
-	return service->attributes[index];
+	return attrib;
 }
 
 struct gatt_db_attribute *
@@ -1211,7 +1409,7 @@ static void find_by_type(struct gatt_db_attribute *attribute, void *user_data)
 		if (search_data->value_len != attribute->value_len)
 			return;
 
-		if (memcmp(attribute->value, search_data->value,
+		if (memcmp(attribute_value(attribute), search_data->value,
 					search_data->value_len))
 			return;
 	}
@@ -1310,11 +1508,10 @@ struct foreach_data {
 	bool attr;
 };
 
-static void foreach_service_in_range(void *data, void *user_data)
+static void foreach_service_in_range(struct gatt_db_service *service,
+						struct foreach_data *foreach_data)
 {
-	struct gatt_db_service *service = data;
 	struct gatt_db_attribute *attribute = service->attributes[0];
-	struct foreach_data *foreach_data = user_data;
 	bt_uuid_t uuid;
 
 	if (foreach_data->uuid) {
@@ -1323,7 +1520,7 @@ static void foreach_service_in_range(void *data, void *user_data)
 			/* Compare with attribute UUID in case it is a lookup
 			 * by group type.
 			 */
-			if (bt_uuid_cmp(&attribute->uuid, foreach_data->uuid))
+			if (bt_uuid_cmp(attribute->uuid, foreach_data->uuid))
 				return;
 		}
 	}
@@ -1331,10 +1528,9 @@ static void foreach_service_in_range(void *data, void *user_data)
 	foreach_data->func(service->attributes[0], foreach_data->user_data);
 }
 
-static void foreach_in_range(void *data, void *user_data)
+static void foreach_in_service(struct gatt_db_service *service,
+						struct foreach_data *foreach_data)
 {
-	struct gatt_db_service *service = data;
-	struct foreach_data *foreach_data = user_data;
 	uint16_t svc_start, svc_end;
 	int i;
 
@@ -1343,23 +1539,16 @@ static void foreach_in_range(void *data, void *user_data)
 
 	gatt_db_service_get_handles(service, &svc_start, &svc_end);
 
-	/* Check if service is within requested range */
-	if (svc_start > foreach_data->end || svc_end < foreach_data->start)
-		return;
-
 	if (!foreach_data->attr) {
 		if (svc_start < foreach_data->start ||
 					svc_start > foreach_data->end)
 			return;
-		return foreach_service_in_range(data, user_data);
+		return foreach_service_in_range(service, foreach_data);
 	}
 
-	for (i = 0; i < service->num_handles; i++) {
+	for (i = 0; i < service->num_attributes; i++) {
 		struct gatt_db_attribute *attribute = service->attributes[i];
 
-		if (!attribute)
-			continue;
-
 		if (attribute->handle < foreach_data->start)
 			continue;
 
@@ -1367,13 +1556,39 @@ static void foreach_in_range(void *data, void *user_data)
 			return;
 
 		if (foreach_data->uuid && bt_uuid_cmp(foreach_data->uuid,
-							&attribute->uuid))
+							attribute->uuid))
 			continue;
 
 		foreach_data->func(attribute, foreach_data->user_data);
 	}
 }
 
+static void foreach_in_range(struct gatt_db *db,
+					struct foreach_data *foreach_data)
+{
+	struct gatt_db_service *service;
+	uint32_t handle = foreach_data->start;
+
+	/*
+	 * Look up each service by handle rather than walking the index so
+	 * that callbacks are free to add or remove services.
+	 */
+	while (handle <= foreach_data->end &&
+				(service = service_index_find(db, handle))) {
+		uint16_t svc_start, svc_end;
+
+		gatt_db_service_get_handles(service, &svc_start, &svc_end);
+
+		/* Services past the requested range are skipped altogether */
+		if (svc_start > foreach_data->end)
+			break;
+
+		handle = svc_end + 1;
+
+		foreach_in_service(service, foreach_data);
+	}
+}
+
 void gatt_db_foreach_service_in_range(struct gatt_db *db,
 						const bt_uuid_t *uuid,
 						gatt_db_attribute_cb_t func,
@@ -1393,7 +1608,7 @@ void gatt_db_foreach_service_in_range(struct gatt_db *db,
 	data.end = end_handle;
 	data.attr = false;
 
-	queue_foreach(db->services, foreach_in_range, &data);
+	foreach_in_range(db, &data);
 }
 
 void gatt_db_foreach_in_range(struct gatt_db *db, const bt_uuid_t *uuid,
@@ -1414,7 +1629,7 @@ void gatt_db_foreach_in_range(struct gatt_db *db, const bt_uuid_t *uuid,
 	data.end = end_handle;
 	data.attr = true;
 
-	queue_foreach(db->services, foreach_in_range, &data);
+	foreach_in_range(db, &data);
 }
 
 void gatt_db_service_foreach(struct gatt_db_attribute *attrib,
@@ -1431,12 +1646,10 @@ void gatt_db_service_foreach(struct gatt_db_attribute *attrib,
 
 	service = attrib->service;
 
-	for (i = 0; i < service->num_handles; i++) {
+	for (i = 0; i < service->num_attributes; i++) {
 		attr = service->attributes[i];
-		if (!attr)
-			continue;
 
-		if (uuid && bt_uuid_cmp(uuid, &attr->uuid))
+		if (uuid && bt_uuid_cmp(uuid, attr->uuid))
 			continue;
 
 		func(attr, user_data);
@@ -1462,27 +1675,25 @@ void gatt_db_service_foreach_desc(struct gatt_db_attribute *attrib,
 		return;
 
 	/* Return if this attribute is not a characteristic declaration */
-	if (bt_uuid_cmp(&characteristic_uuid, &attrib->uuid))
+	if (bt_uuid_cmp(&characteristic_uuid, attrib->uuid))
 		return;
 
 	service = attrib->service;
 
 	/* Start from the attribute following the value handle */
-	for (i = 0; i < service->num_handles; i++) {
+	for (i = 0; i < service->num_attributes; i++) {
 		if (service->attributes[i] == attrib) {
 			i += 2;
 			break;
 		}
 	}
 
-	for (; i < service->num_handles; i++) {
+	for (; i < service->num_attributes; i++) {
 		attr = service->attributes[i];
-		if (!attr)
-			continue;
 
 		/* Return if we reached the end of this characteristic */
-		if (!bt_uuid_cmp(&characteristic_uuid, &attr->uuid) ||
-			!bt_uuid_cmp(&included_service_uuid, &attr->uuid))
+		if (!bt_uuid_cmp(&characteristic_uuid, attr->uuid) ||
+			!bt_uuid_cmp(&included_service_uuid, attr->uuid))
 			return;
 
 		func(attr, user_data);
@@ -1497,15 +1708,24 @@ void gatt_db_service_foreach_incl(struct gatt_db_attribute *attrib,
 								user_data);
 }
 
-static bool find_service_for_handle(const void *data, const void *user_data)
+static struct gatt_db_service *find_service_for_handle(struct gatt_db *db,
+							uint16_t handle)
 {
-	const struct gatt_db_service *service = data;
-	uint16_t handle = PTR_TO_UINT(user_data);
-	uint16_t start, end;
+	struct gatt_db_service *service;
+	uint16_t start;
+
+	if (!db || !handle)
+		return NULL;
 
-	gatt_db_service_get_handles(service, &start, &end);
+	service = service_index_find(db, handle);
+	if (!service)
+		return NULL;
+
+	gatt_db_service_get_handles(service, &start, NULL);
+	if (start > handle)
+		return NULL;
 
-	return (start <= handle) && (handle <= end);
+	return service;
 }
 
 struct gatt_db_attribute *gatt_db_get_service(struct gatt_db *db,
@@ -1513,11 +1733,7 @@ struct gatt_db_attribute *gatt_db_get_service(struct gatt_db *db,
 {
 	struct gatt_db_service *service;
 
-	if (!db || !handle)
-		return NULL;
-
-	service = queue_find(db->services, find_service_for_handle,
-						UINT_TO_PTR(handle));
+	service = find_service_for_handle(db, handle);
 	if (!service)
 		return NULL;
 
@@ -1531,47 +1747,46 @@ struct gatt_db_attribute *gatt_db_get_attribute(struct gatt_db *db,
 	struct gatt_db_service *service;
 	int i;
 
-	attrib = gatt_db_get_service(db, handle);
-	if (!attrib)
+	service = find_service_for_handle(db, handle);
+	if (!service)
 		return NULL;
 
-	service = attrib->service;
+	/* Attributes are usually laid out without gaps in handle order */
+	i = handle - service->attributes[0]->handle;
+	attrib = service_attribute(service, i);
+	if (attrib && attrib->handle == handle)
+		return attrib;
 
-	for (i = 0; i < service->num_handles; i++) {
-		if (!service->attributes[i])
-			continue;
+	for (i = 0; i < service->num_attributes; i++) {
+		attrib = service->attributes[i];
 
-		if (service->attributes[i]->handle == handle)
-			return service->attributes[i];
+		if (attrib->handle == handle)
+			return attrib;
 	}
 
 	return NULL;
 }
 
-static bool find_service_with_uuid(const void *data, const void *user_data)
-{
-	const struct gatt_db_service *service = data;
-	const bt_uuid_t *uuid = user_data;
-	bt_uuid_t svc_uuid;
-
-	gatt_db_attribute_get_service_uuid(service->attributes[0], &svc_uuid);
-
-	return bt_uuid_cmp(uuid, &svc_uuid) == 0;
-}
-
 struct gatt_db_attribute *gatt_db_get_service_with_uuid(struct gatt_db *db,
 							const bt_uuid_t *uuid)
 {
-	struct gatt_db_service *service;
+	unsigned int i;
 
 	if (!db || !uuid)
 		return NULL;
 
-	service = queue_find(db->services, find_service_with_uuid, uuid);
-	if (!service)
-		return NULL;
+	for (i = 0; i < db->num_services; i++) {
+		struct gatt_db_service *service = db->services[i];
+		bt_uuid_t svc_uuid;
 
-	return service->attributes[0];
+		gatt_db_attribute_get_service_uuid(service->attributes[0],
+								&svc_uuid);
+
+		if (!bt_uuid_cmp(uuid, &svc_uuid))
+			return service->attributes[0];
+	}
+
+	return NULL;
 }
 
 const bt_uuid_t *gatt_db_attribute_get_type(
@@ -1580,7 +1795,7 @@ const bt_uuid_t *gatt_db_attribute_get_type(
 	if (!attrib)
 		return NULL;
 
-	return &attrib->uuid;
+	return attrib->uuid;
 }
 
 uint16_t gatt_db_attribute_get_handle(const struct gatt_db_attribute *attrib)
@@ -1604,7 +1819,7 @@ bool gatt_db_attribute_get_service_uuid(const struct gatt_db_attribute *attrib,
 	if (service->attributes[0]->value_len == sizeof(uint16_t)) {
 		uint16_t value;
 
-		value = get_le16(service->attributes[0]->value);
+		value = get_le16(attribute_value(service->attributes[0]));
 		bt_uuid16_create(uuid, value);
 
 		return true;
@@ -1613,7 +1828,7 @@ bool gatt_db_attribute_get_service_uuid(const struct gatt_db_attribute *attrib,
 	if (service->attributes[0]->value_len == sizeof(uint128_t)) {
 		uint128_t value;
 
-		bswap_128(service->attributes[0]->value, &value);
+		bswap_128(attribute_value(service->attributes[0]), &value);
 		bt_uuid128_create(uuid, value);
 
 		return true;
@@ -1657,7 +1872,7 @@ bool gatt_db_attribute_get_service_data(const struct gatt_db_attribute *attrib,
 	gatt_db_service_get_handles(service, start_handle, end_handle);
 
 	if (primary)
-		*primary = bt_uuid_cmp(&decl->uuid, &secondary_service_uuid);
+		*primary = bt_uuid_cmp(decl->uuid, &secondary_service_uuid);
 
 	if (!uuid)
 		return true;
@@ -1666,7 +1881,7 @@ bool gatt_db_attribute_get_service_data(const struct gatt_db_attribute *attrib,
 	 * The service declaration attribute value is the 16 or 128 bit service
 	 * UUID.
 	 */
-	return le_to_uuid(decl->value, decl->value_len, uuid);
+	return le_to_uuid(attribute_value(decl), decl->value_len, uuid);
 }
 
 static void read_ext_prop_value(struct gatt_db_attribute *attrib,
@@ -1693,7 +1908,7 @@ static void read_ext_prop(struct gatt_db_attribute *attrib,
 	if (*ext_prop != 0)
 		return;
 
-	if (bt_uuid_cmp(&ext_desc_uuid, &attrib->uuid))
+	if (bt_uuid_cmp(&ext_desc_uuid, attrib->uuid))
 		return;
 
 	gatt_db_attribute_read(attrib, 0, BT_ATT_OP_READ_REQ, NULL,
@@ -1707,11 +1922,11 @@ static uint8_t get_char_extended_prop(const struct gatt_db_attribute *attrib)
 	if (!attrib)
 		return 0;
 
-	if (bt_uuid_cmp(&characteristic_uuid, &attrib->uuid))
+	if (bt_uuid_cmp(&characteristic_uuid, attrib->uuid))
 		return 0;
 
 	/* Check properties first */
-	if (!(attrib->value[0] & BT_GATT_CHRC_PROP_EXT_PROP))
+	if (!(attribute_value(attrib)[0] & BT_GATT_CHRC_PROP_EXT_PROP))
 		return 0;
 
 	ext_prop = 0;
@@ -1733,10 +1948,12 @@ bool gatt_db_attribute_get_char_data(const struct gatt_db_attribute *attrib,
 							uint16_t *ext_prop,
 							bt_uuid_t *uuid)
 {
+	const uint8_t *value;
+
 	if (!attrib)
 		return false;
 
-	if (bt_uuid_cmp(&characteristic_uuid, &attrib->uuid))
+	if (bt_uuid_cmp(&characteristic_uuid, attrib->uuid))
 		return false;
 
 	/*
@@ -1745,26 +1962,27 @@ bool gatt_db_attribute_get_char_data(const struct gatt_db_attribute *attrib,
 	 * 2 octets: Characteristic value handle
 	 * 2 or 16 octets: characteristic UUID
 	 */
-	if (!attrib->value || (attrib->value_len != 5 &&
-						attrib->value_len != 19))
+	if (attrib->value_len != 5 && attrib->value_len != 19)
 		return false;
 
+	value = attribute_value(attrib);
+
 	if (handle)
 		*handle = attrib->handle;
 
 	if (properties)
-		*properties = attrib->value[0];
+		*properties = value[0];
 
 	if (ext_prop)
 		*ext_prop = get_char_extended_prop(attrib);
 
 	if (value_handle)
-		*value_handle = get_le16(attrib->value + 1);
+		*value_handle = get_le16(value + 1);
 
 	if (!uuid)
 		return true;
 
-	return le_to_uuid(attrib->value + 3, attrib->value_len - 3, uuid);
+	return le_to_uuid(value + 3, attrib->value_len - 3, uuid);
 }
 
 bool gatt_db_attribute_get_incl_data(const struct gatt_db_attribute *attrib,
@@ -1772,10 +1990,12 @@ bool gatt_db_attribute_get_incl_data(const struct gatt_db_attribute *attrib,
 							uint16_t *start_handle,
 							uint16_t *end_handle)
 {
+	const uint8_t *value;
+
 	if (!attrib)
 		return false;
 
-	if (bt_uuid_cmp(&included_service_uuid, &attrib->uuid))
+	if (bt_uuid_cmp(&included_service_uuid, attrib->uuid))
 		return false;
 
 	/*
@@ -1784,9 +2004,11 @@ bool gatt_db_attribute_get_incl_data(const struct gatt_db_attribute *attrib,
 	 * 2 octets: end handle of included service
 	 * optional 2 octets: 16-bit Bluetooth UUID
 	 */
-	if (!attrib->value || attrib->value_len < 4 || attrib->value_len > 6)
+	if (attrib->value_len < 4 || attrib->value_len > 6)
 		return false;
 
+	value = attribute_value(attrib);
+
 	/*
 	 * We only return the handles since the UUID can be easily obtained
 	 * from the corresponding attribute.
@@ -1795,10 +2017,10 @@ bool gatt_db_attribute_get_incl_data(const struct gatt_db_attribute *attrib,
 		*handle = attrib->handle;
 
 	if (start_handle)
-		*start_handle = get_le16(attrib->value);
+		*start_handle = get_le16(value);
 
 	if (end_handle)
-		*end_handle = get_le16(attrib->value + 2);
+		*end_handle = get_le16(value + 2);
 
 	return true;
 }
@@ -1851,11 +2073,11 @@ bool gatt_db_attribute_set_fixed_length(struct gatt_db_attribute *attrib,
 		return false;
 
 	/* If attribute is a characteristic declaration ajust to its value */
-	if (!bt_uuid_cmp(&characteristic_uuid, &attrib->uuid)) {
+	if (!bt_uuid_cmp(&characteristic_uuid, attrib->uuid)) {
 		int i;
 
 		/* Start from the attribute following the value handle */
-		for (i = 0; i < service->num_handles; i++) {
+		for (i = 0; i + 1 < service->num_attributes; i++) {
 			if (service->attributes[i] == attrib) {
 				attrib = service->attributes[i + 1];
 				break;
@@ -1863,9 +2085,7 @@ bool gatt_db_attribute_set_fixed_length(struct gatt_db_attribute *attrib,
 		}
 	}
 
-	attrib->value_len = len;
-
-	return true;
+	return attribute_resize_value(attrib, len);
 }
 
 bool gatt_db_attribute_read(struct gatt_db_attribute *attrib, uint16_t offset,
@@ -1901,6 +2121,9 @@ bool gatt_db_attribute_read(struct gatt_db_attribute *attrib, uint16_t offset,
 		p->func = func;
 		p->user_data = user_data;
 
+		if (!attrib->pending_reads)
+			attrib->pending_reads = queue_new();
+
 		queue_push_tail(attrib->pending_reads, p);
 
 		attrib->read_func(attrib, p->id, offset, opcode, att,
@@ -1909,7 +2132,8 @@ bool gatt_db_attribute_read(struct gatt_db_attribute *attrib, uint16_t offset,
 	}
 
 	/* Guard against invalid access if offset equals to value length */
-	value = offset == attrib->value_len ? NULL : &attrib->value[offset];
+	value = offset == attrib->value_len ? NULL :
+					&attribute_value(attrib)[offset];
 
 	func(attrib, 0, value, attrib->value_len - offset, user_data);
 
@@ -1995,6 +2219,9 @@ bool gatt_db_attribute_write(struct gatt_db_attribute *attrib, uint16_t offset,
 		p->func = func;
 		p->user_data = user_data;
 
+		if (!attrib->pending_writes)
+			attrib->pending_writes = queue_new();
+
 		queue_push_tail(attrib->pending_writes, p);
 
 		attrib->write_func(attrib, p->id, offset, value, len, opcode,
@@ -2007,24 +2234,17 @@ bool gatt_db_attribute_write(struct gatt_db_attribute *attrib, uint16_t offset,
 		goto done;
 
 	/* For values stored in db allocate on demand */
-	if (!attrib->value || offset >= attrib->value_len ||
+	if (offset >= attrib->value_len ||
 				len > (unsigned) (attrib->value_len - offset)) {
-		void *buf;
-
-		buf = realloc(attrib->value, len + offset);
-		if (!buf)
+		/* Any gap up to offset is zero filled */
+		if (!attribute_resize_value(attrib, len + offset))
 			return false;
-
-		attrib->value = buf;
-
-		/* Init data in the first allocation */
-		if (!attrib->value_len)
-			memset(attrib->value, 0, offset);
-
-		attrib->value_len = len + offset;
 	}
 
-	memcpy(&attrib->value[offset], value, len);
+	memcpy(&attribute_value(attrib)[offset], value, len);
+
+	if (attribute_value_hashed(attrib))
+		service_hash_invalidate(attrib->service);
 
 done:
 	func(attrib, err, user_data);
@@ -2055,12 +2275,13 @@ bool gatt_db_attribute_reset(struct gatt_db_attribute *attrib)
 	if (!attrib)
 		return false;
 
-	if (!attrib->value || !attrib->value_len)
+	if (!attrib->value_len)
 		return true;
 
-	free(attrib->value);
-	attrib->value = NULL;
-	attrib->value_len = 0;
+	attribute_resize_value(attrib, 0);
+
+	if (attribute_value_hashed(attrib))
+		service_hash_invalidate(attrib->service);
 
 	return true;
 }
@@ -2101,6 +2322,9 @@ unsigned int gatt_db_attribute_register(struct gatt_db_attribute *attrib,
 
 	notify->id = attrib->next_notify_id++;
 
+	if (!attrib->notify_list)
+		attrib->notify_list = queue_new();
+
 	if (!queue_push_tail(attrib->notify_list, notify)) {
 		free(notify);
 		return 0;
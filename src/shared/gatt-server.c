@@ -40,6 +40,7 @@
 #define DEFAULT_MAX_PREP_QUEUE_LEN 30
 
 #define NFY_MULT_TIMEOUT 10
+#define NFY_MULT_MAX_PENDING 2
 
 struct async_read_op {
 	struct bt_att_chan *chan;
@@ -81,6 +82,13 @@ struct nfy_mult_data {
 	uint8_t *pdu;
 	uint16_t offset;
 	uint16_t len;
+	uint16_t count;
+	bool expired;
+};
+
+/* Multiple Handle Value Notification queued in bt_att */
+struct nfy_mult_pdu {
+	struct bt_gatt_server *server;
 };
 
 struct bt_gatt_server {
@@ -116,8 +124,21 @@ struct bt_gatt_server {
 	void *authorize_data;
 
 	struct nfy_mult_data *nfy_mult;
+	struct queue *nfy_mult_pdus;
+	uint16_t nfy_mult_timeout;
+	uint8_t nfy_mult_max_pending;
+	struct bt_gatt_server_nfy_stats nfy_stats;
 };
 
+static void nfy_mult_flush(struct bt_gatt_server *server);
+
+static void nfy_mult_pdu_detach(void *data)
+{
+	struct nfy_mult_pdu *pdu = data;
+
+	pdu->server = NULL;
+}
+
 static void bt_gatt_server_free(struct bt_gatt_server *server)
 {
 	if (server->debug_destroy)
@@ -139,6 +160,12 @@ static void bt_gatt_server_free(struct bt_gatt_server *server)
 
 	queue_destroy(server->prep_queue, prep_write_data_destroy);
 
+	/* Aggregated values still go out, the PDUs just stop reporting back */
+	if (server->nfy_mult)
+		nfy_mult_flush(server);
+
+	queue_destroy(server->nfy_mult_pdus, nfy_mult_pdu_detach);
+
 	gatt_db_unref(server->db);
 	bt_att_unref(server->att);
 	free(server);
@@ -1622,6 +1649,8 @@ struct bt_gatt_server *bt_gatt_server_new(struct gatt_db *db,
 	server->max_prep_queue_len = DEFAULT_MAX_PREP_QUEUE_LEN;
 	server->prep_queue = queue_new();
 	server->min_enc_size = min_enc_size;
+	server->nfy_mult_timeout = NFY_MULT_TIMEOUT;
+	server->nfy_mult_max_pending = NFY_MULT_MAX_PENDING;
 
 	if (!gatt_server_register_att_handlers(server)) {
 		bt_gatt_server_free(server);
@@ -1686,17 +1715,105 @@ bool bt_gatt_server_set_debug(struct bt_gatt_server *server,
 	return true;
 }
 
+static void nfy_mult_pdu_sent(void *user_data)
+{
+	struct nfy_mult_pdu *pdu = user_data;
+	struct bt_gatt_server *server = pdu->server;
+
+	if (server)
+		queue_remove(server->nfy_mult_pdus, pdu);
+
+	free(pdu);
+
+	if (!server)
+		return;
+
+	/* Send what was held back past its deadline now that one got out */
+	if (server->nfy_mult && server->nfy_mult->expired)
+		nfy_mult_flush(server);
+}
+
+static bool send_single_notification(struct bt_gatt_server *server,
+					uint16_t handle, const uint8_t *value,
+					uint16_t length)
+{
+	struct iovec iov[2];
+	uint8_t hdr[2];
+
+	put_le16(handle, hdr);
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *) value;
+	iov[1].iov_len = MIN(bt_att_get_mtu(server->att) - 3, length);
+
+	return !!bt_att_send_iov(server->att, BT_ATT_OP_HANDLE_NFY, iov, 2,
+							NULL, NULL, NULL);
+}
+
+static void nfy_mult_flush(struct bt_gatt_server *server)
+{
+	struct nfy_mult_data *data = server->nfy_mult;
+	struct nfy_mult_pdu *pdu;
+
+	server->nfy_mult = NULL;
+
+	if (data->id)
+		timeout_remove(data->id);
+
+	server->nfy_stats.pdus++;
+
+	/* The multiple variant needs at least two values */
+	if (data->count == 1) {
+		send_single_notification(server, get_le16(data->pdu),
+						data->pdu + 4, data->offset - 4);
+		goto done;
+	}
+
+	pdu = new0(struct nfy_mult_pdu, 1);
+	pdu->server = server;
+
+	if (!server->nfy_mult_pdus)
+		server->nfy_mult_pdus = queue_new();
+
+	queue_push_tail(server->nfy_mult_pdus, pdu);
+
+	if (!bt_att_send(server->att, BT_ATT_OP_HANDLE_NFY_MULT, data->pdu,
+					data->offset, NULL, pdu,
+					nfy_mult_pdu_sent)) {
+		queue_remove(server->nfy_mult_pdus, pdu);
+		free(pdu);
+	}
+
+	server->nfy_stats.mult_pdus++;
+
+	if (data->count > server->nfy_stats.max_values)
+		server->nfy_stats.max_values = data->count;
+
+done:
+	free(data->pdu);
+	free(data);
+}
+
 static bool notify_multiple(void *user_data)
 {
 	struct bt_gatt_server *server = user_data;
 
-	bt_att_send(server->att, BT_ATT_OP_HANDLE_NFY_MULT,
-			server->nfy_mult->pdu, server->nfy_mult->offset, NULL,
-			NULL, NULL);
+	server->nfy_mult->id = 0;
 
-	free(server->nfy_mult->pdu);
-	free(server->nfy_mult);
-	server->nfy_mult = NULL;
+	/*
+	 * Keep filling the PDU while too many are still waiting to be
+	 * written, it is sent as soon as one of those goes out.
+	 */
+	if (server->nfy_mult_max_pending &&
+			queue_length(server->nfy_mult_pdus) >=
+					server->nfy_mult_max_pending) {
+		server->nfy_mult->expired = true;
+		server->nfy_stats.held++;
+		return false;
+	}
+
+	nfy_mult_flush(server);
 
 	return false;
 }
@@ -1705,52 +1822,86 @@ bool bt_gatt_server_send_notification(struct bt_gatt_server *server,
 					uint16_t handle, const uint8_t *value,
 					uint16_t length, bool multiple)
 {
-	struct nfy_mult_data *data = NULL;
-	bool result;
+	struct nfy_mult_data *data;
+	uint16_t mtu;
 
 	if (!server || (length && !value))
 		return false;
 
-	if (multiple)
-		data = server->nfy_mult;
+	/* Single notifications are gathered straight into the ATT PDU */
+	if (!multiple)
+		return send_single_notification(server, handle, value, length);
+
+	mtu = bt_att_get_mtu(server->att);
+
+	server->nfy_stats.values++;
+
+	/* Flush rather than truncate values that no longer fit */
+	data = server->nfy_mult;
+	if (data && data->offset + 4 + length > data->len) {
+		server->nfy_stats.full++;
+		nfy_mult_flush(server);
+		data = NULL;
+	}
+
+	/* Values too long to share a PDU go out on their own */
+	if (4 + length > mtu - 1) {
+		server->nfy_stats.pdus++;
+		return send_single_notification(server, handle, value, length);
+	}
 
 	if (!data) {
 		data = new0(struct nfy_mult_data, 1);
-		data->len = bt_att_get_mtu(server->att) - 1;
+		data->len = mtu - 1;
 		data->pdu = malloc(data->len);
+		server->nfy_mult = data;
 	}
 
 	put_le16(handle, data->pdu + data->offset);
 	data->offset += 2;
 
-	length = MIN(data->len - data->offset, length);
-
-	if (multiple) {
-		put_le16(length, data->pdu + data->offset);
-		data->offset += 2;
-	}
+	put_le16(length, data->pdu + data->offset);
+	data->offset += 2;
 
 	memcpy(data->pdu + data->offset, value, length);
 	data->offset += length;
+	data->count++;
 
-	if (multiple) {
-		if (!server->nfy_mult)
-			server->nfy_mult = data;
-
-		if (!server->nfy_mult->id)
-			server->nfy_mult->id = timeout_add(NFY_MULT_TIMEOUT,
-						   notify_multiple, server,
-						   NULL);
-
+	/* Not even an empty value fits anymore */
+	if (data->len - data->offset < 4) {
+		server->nfy_stats.full++;
+		nfy_mult_flush(server);
 		return true;
 	}
 
-	result = !!bt_att_send(server->att, BT_ATT_OP_HANDLE_NFY,
-				data->pdu, data->offset, NULL, NULL, NULL);
-	free(data->pdu);
-	free(data);
+	if (!data->id && !data->expired)
+		data->id = timeout_add(server->nfy_mult_timeout,
+						notify_multiple, server, NULL);
 
-	return result;
+	return true;
+}
+
+bool bt_gatt_server_set_nfy_mult(struct bt_gatt_server *server,
+					uint16_t timeout, uint8_t max_pending)
+{
+	if (!server)
+		return false;
+
+	server->nfy_mult_timeout = timeout;
+	server->nfy_mult_max_pending = max_pending;
+
+	return true;
+}
+
+bool bt_gatt_server_get_nfy_stats(struct bt_gatt_server *server,
+					struct bt_gatt_server_nfy_stats *stats)
+{
+	if (!server || !stats)
+		return false;
+
+	*stats = server->nfy_stats;
+
+	return true;
 }
 
 struct ind_data {
@@ -1785,36 +1936,33 @@ bool bt_gatt_server_send_indication(struct bt_gatt_server *server,
 					void *user_data,
 					bt_gatt_server_destroy_func_t destroy)
 {
-	uint16_t pdu_len;
-	uint8_t *pdu;
+	struct iovec iov[2];
+	uint8_t hdr[2];
 	struct ind_data *data;
 	bool result;
 
 	if (!server || (length && !value))
 		return false;
 
-	pdu_len = MIN(bt_att_get_mtu(server->att) - 1, length + 2);
-	pdu = malloc(pdu_len);
-	if (!pdu)
-		return false;
-
 	data = new0(struct ind_data, 1);
 
 	data->callback = callback;
 	data->destroy = destroy;
 	data->user_data = user_data;
 
-	put_le16(handle, pdu);
-	memcpy(pdu + 2, value, pdu_len - 2);
+	put_le16(handle, hdr);
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *) value;
+	iov[1].iov_len = MIN(bt_att_get_mtu(server->att) - 3, length);
 
-	result = !!bt_att_send(server->att, BT_ATT_OP_HANDLE_IND, pdu,
-							pdu_len, conf_cb,
-							data, destroy_ind_data);
+	result = !!bt_att_send_iov(server->att, BT_ATT_OP_HANDLE_IND, iov, 2,
+							conf_cb, data,
+							destroy_ind_data);
 	if (!result)
 		destroy_ind_data(data);
 
-	free(pdu);
-
 	return result;
 }
 
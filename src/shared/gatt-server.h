@@ -41,6 +41,27 @@ bool bt_gatt_server_send_notification(struct bt_gatt_server *server,
 					uint16_t handle, const uint8_t *value,
 					uint16_t length, bool multiple);
 
+/*
+ * Values sent with multiple set are aggregated into Multiple Handle Value
+ * Notifications, flushed when full or after timeout milliseconds. Once
+ * max_pending of them are waiting to be written, with 0 meaning no limit,
+ * expired ones keep aggregating until one of those is out.
+ */
+bool bt_gatt_server_set_nfy_mult(struct bt_gatt_server *server,
+					uint16_t timeout, uint8_t max_pending);
+
+struct bt_gatt_server_nfy_stats {
+	uint64_t values;	/* Values sent with multiple set */
+	uint64_t pdus;		/* Notification PDUs carrying those */
+	uint64_t mult_pdus;	/* Of which Multiple Handle Value */
+	uint64_t full;		/* Flushed before the timeout when full */
+	uint64_t held;		/* Timeouts deferred by max_pending */
+	uint16_t max_values;	/* Most values in a single PDU */
+};
+
+bool bt_gatt_server_get_nfy_stats(struct bt_gatt_server *server,
+				struct bt_gatt_server_nfy_stats *stats);
+
 bool bt_gatt_server_send_indication(struct bt_gatt_server *server,
 					uint16_t handle, const uint8_t *value,
 					uint16_t length,
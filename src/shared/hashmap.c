@@ -0,0 +1,428 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  BlueZ contributors
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "src/shared/util.h"
+#include "src/shared/hashmap.h"
+
+/*
+ * Entries are kept in a dense array in insertion order, which is what
+ * iteration walks, and an open addressing table with linear probing maps
+ * keys to positions in that array. Removed entries leave a hole behind
+ * so iteration order stays stable; holes are compacted away whenever the
+ * table is rebuilt outside of an iteration.
+ */
+#define HASHMAP_MIN_SIZE	8
+
+#define SLOT_EMPTY	0
+#define SLOT_REMOVED	UINT32_MAX
+
+struct hashmap_entry {
+	uint64_t key;
+	void *data;
+	bool used;
+};
+
+struct hashmap {
+	int ref_count;
+	struct hashmap_entry *entries;
+	unsigned int num_entries;	/* Used array slots, holes included */
+	unsigned int entries_size;
+	uint32_t *slots;		/* Entry index + 1 or SLOT_* */
+	unsigned int slots_size;	/* Power of two */
+	unsigned int slots_used;	/* Removed markers included */
+	unsigned int length;
+	unsigned int iterating;
+};
+
+static struct hashmap *hashmap_ref(struct hashmap *map)
+{
+	if (!map)
+		return NULL;
+
+	__sync_fetch_and_add(&map->ref_count, 1);
+
+	return map;
+}
+
+static void hashmap_unref(struct hashmap *map)
+{
+	if (__sync_sub_and_fetch(&map->ref_count, 1))
+		return;
+
+	free(map->entries);
+	free(map->slots);
+	free(map);
+}
+
+static inline unsigned int hash_key(const struct hashmap *map, uint64_t key)
+{
+	/* Fibonacci hashing spreads sequential ids and addresses evenly */
+	key *= 0x9e3779b97f4a7c15ULL;
+
+	return (key ^ (key >> 32)) & (map->slots_size - 1);
+}
+
+static uint32_t *lookup_slot(struct hashmap *map, uint64_t key)
+{
+	unsigned int i;
+
+	if (!map->slots_size)
+		return NULL;
+
+	for (i = hash_key(map, key);; i = (i + 1) & (map->slots_size - 1)) {
+		uint32_t *slot = &map->slots[i];
+
+		if (*slot == SLOT_EMPTY)
+			return NULL;
+
+		if (*slot == SLOT_REMOVED)
+			continue;
+
+		if (map->entries[*slot - 1].key == key)
+			return slot;
+	}
+}
+
+static void insert_slot(struct hashmap *map, uint64_t key, uint32_t index)
+{
+	unsigned int i;
+
+	i = hash_key(map, key);
+
+	while (map->slots[i] != SLOT_EMPTY)
+		i = (i + 1) & (map->slots_size - 1);
+
+	map->slots[i] = index + 1;
+	map->slots_used++;
+}
+
+static void compact_entries(struct hashmap *map)
+{
+	unsigned int i, j;
+
+	for (i = 0, j = 0; i < map->num_entries; i++) {
+		if (!map->entries[i].used)
+			continue;
+
+		if (i != j)
+			map->entries[j] = map->entries[i];
+
+		j++;
+	}
+
+	map->num_entries = j;
+}
+
+static void rebuild(struct hashmap *map, unsigned int needed)
+{
+	unsigned int size = HASHMAP_MIN_SIZE;
+	unsigned int i;
+
+	/* Positions must not move while foreach walks the array */
+	if (!map->iterating)
+		compact_entries(map);
+
+	/* Keep the load factor of the table below 1/2 after rebuilding */
+	while (size < (map->length + needed) * 2)
+		size <<= 1;
+
+	if (size != map->slots_size) {
+		free(map->slots);
+		map->slots = new0(uint32_t, size);
+		map->slots_size = size;
+	} else
+		memset(map->slots, 0, size * sizeof(*map->slots));
+
+	map->slots_used = 0;
+
+	for (i = 0; i < map->num_entries; i++) {
+		if (map->entries[i].used)
+			insert_slot(map, map->entries[i].key, i);
+	}
+}
+
+static void reclaim(struct hashmap *map)
+{
+	if (map->iterating)
+		return;
+
+	/* Reclaim space once most of the array has turned into holes */
+	if (!map->length) {
+		map->num_entries = 0;
+		map->slots_used = 0;
+
+		if (map->slots)
+			memset(map->slots, 0,
+				map->slots_size * sizeof(*map->slots));
+	} else if (map->length < map->num_entries / 4 &&
+					map->num_entries > HASHMAP_MIN_SIZE)
+		rebuild(map, 0);
+}
+
+static void remove_entry(struct hashmap *map, uint32_t *slot)
+{
+	struct hashmap_entry *entry = &map->entries[*slot - 1];
+
+	entry->used = false;
+	entry->data = NULL;
+	*slot = SLOT_REMOVED;
+	map->length--;
+
+	reclaim(map);
+}
+
+struct hashmap *hashmap_new(void)
+{
+	struct hashmap *map;
+
+	map = new0(struct hashmap, 1);
+
+	return hashmap_ref(map);
+}
+
+void hashmap_destroy(struct hashmap *map, hashmap_destroy_func_t destroy)
+{
+	if (!map)
+		return;
+
+	hashmap_remove_all(map, NULL, NULL, destroy);
+
+	hashmap_unref(map);
+}
+
+bool hashmap_insert(struct hashmap *map, uint64_t key, void *data)
+{
+	struct hashmap_entry *entry;
+
+	if (!map || lookup_slot(map, key))
+		return false;
+
+	if ((map->slots_used + 1) * 4 > map->slots_size * 3)
+		rebuild(map, 1);
+
+	if (map->num_entries == map->entries_size) {
+		if (map->entries_size)
+			map->entries_size *= 2;
+		else
+			map->entries_size = HASHMAP_MIN_SIZE;
+
+		map->entries = realloc(map->entries, map->entries_size *
+							sizeof(*map->entries));
+	}
+
+	entry = &map->entries[map->num_entries];
+	entry->key = key;
+	entry->data = data;
+	entry->used = true;
+
+	insert_slot(map, key, map->num_entries);
+
+	map->num_entries++;
+	map->length++;
+
+	return true;
+}
+
+void *hashmap_lookup(struct hashmap *map, uint64_t key)
+{
+	uint32_t *slot;
+
+	if (!map)
+		return NULL;
+
+	slot = lookup_slot(map, key);
+	if (!slot)
+		return NULL;
+
+	return map->entries[*slot - 1].data;
+}
+
+void *hashmap_remove_key(struct hashmap *map, uint64_t key)
+{
+	uint32_t *slot;
+	void *data;
+
+	if (!map)
+		return NULL;
+
+	slot = lookup_slot(map, key);
+	if (!slot)
+		return NULL;
+
+	data = map->entries[*slot - 1].data;
+
+	remove_entry(map, slot);
+
+	return data;
+}
+
+void hashmap_foreach(struct hashmap *map, hashmap_foreach_func_t function,
+							void *user_data)
+{
+	unsigned int i;
+
+	if (!map || !function || !map->length)
+		return;
+
+	hashmap_ref(map);
+	map->iterating++;
+
+	for (i = 0; i < map->num_entries && map->ref_count > 1; i++) {
+		struct hashmap_entry *entry = &map->entries[i];
+
+		if (entry->used)
+			function(entry->data, user_data);
+	}
+
+	map->iterating--;
+
+	reclaim(map);
+
+	hashmap_unref(map);
+}
+
+static bool direct_match(const void *a, const void *b)
+{
+	return a == b;
+}
+
+static struct hashmap_entry *find_entry(struct hashmap *map,
+					hashmap_match_func_t function,
+					const void *match_data)
+{
+	unsigned int i;
+
+	if (!function)
+		function = direct_match;
+
+	for (i = 0; i < map->num_entries; i++) {
+		struct hashmap_entry *entry = &map->entries[i];
+
+		if (entry->used && function(entry->data, match_data))
+			return entry;
+	}
+
+	return NULL;
+}
+
+void *hashmap_find(struct hashmap *map, hashmap_match_func_t function,
+							const void *match_data)
+{
+	struct hashmap_entry *entry;
+
+	if (!map)
+		return NULL;
+
+	entry = find_entry(map, function, match_data);
+	if (!entry)
+		return NULL;
+
+	return entry->data;
+}
+
+bool hashmap_remove(struct hashmap *map, void *data)
+{
+	struct hashmap_entry *entry;
+
+	if (!map)
+		return false;
+
+	entry = find_entry(map, direct_match, data);
+	if (!entry)
+		return false;
+
+	remove_entry(map, lookup_slot(map, entry->key));
+
+	return true;
+}
+
+void *hashmap_remove_if(struct hashmap *map, hashmap_match_func_t function,
+							void *user_data)
+{
+	struct hashmap_entry *entry;
+	void *data;
+
+	if (!map)
+		return NULL;
+
+	entry = find_entry(map, function, user_data);
+	if (!entry)
+		return NULL;
+
+	data = entry->data;
+
+	remove_entry(map, lookup_slot(map, entry->key));
+
+	return data;
+}
+
+unsigned int hashmap_remove_all(struct hashmap *map,
+				hashmap_match_func_t function,
+				void *user_data, hashmap_destroy_func_t destroy)
+{
+	unsigned int i, count = 0;
+
+	if (!map)
+		return 0;
+
+	/* Destroy callbacks may modify the map so hold back compaction */
+	hashmap_ref(map);
+	map->iterating++;
+
+	for (i = 0; i < map->num_entries; i++) {
+		struct hashmap_entry *entry = &map->entries[i];
+		void *data;
+
+		if (!entry->used)
+			continue;
+
+		if (function && !function(entry->data, user_data))
+			continue;
+
+		data = entry->data;
+
+		remove_entry(map, lookup_slot(map, entry->key));
+
+		if (destroy)
+			destroy(data);
+
+		count++;
+	}
+
+	map->iterating--;
+
+	reclaim(map);
+
+	hashmap_unref(map);
+
+	return count;
+}
+
+unsigned int hashmap_length(struct hashmap *map)
+{
+	if (!map)
+		return 0;
+
+	return map->length;
+}
+
+bool hashmap_isempty(struct hashmap *map)
+{
+	if (!map)
+		return true;
+
+	return map->length == 0;
+}
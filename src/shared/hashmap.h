@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  BlueZ contributors
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lib/bluetooth.h"
+
+typedef void (*hashmap_destroy_func_t)(void *data);
+
+struct hashmap;
+
+struct hashmap *hashmap_new(void);
+void hashmap_destroy(struct hashmap *map, hashmap_destroy_func_t destroy);
+
+bool hashmap_insert(struct hashmap *map, uint64_t key, void *data);
+void *hashmap_lookup(struct hashmap *map, uint64_t key);
+void *hashmap_remove_key(struct hashmap *map, uint64_t key);
+
+typedef void (*hashmap_foreach_func_t)(void *data, void *user_data);
+
+void hashmap_foreach(struct hashmap *map, hashmap_foreach_func_t function,
+							void *user_data);
+
+typedef bool (*hashmap_match_func_t)(const void *data,
+						const void *match_data);
+
+void *hashmap_find(struct hashmap *map, hashmap_match_func_t function,
+							const void *match_data);
+
+bool hashmap_remove(struct hashmap *map, void *data);
+void *hashmap_remove_if(struct hashmap *map, hashmap_match_func_t function,
+							void *user_data);
+unsigned int hashmap_remove_all(struct hashmap *map,
+				hashmap_match_func_t function,
+				void *user_data, hashmap_destroy_func_t destroy);
+
+unsigned int hashmap_length(struct hashmap *map);
+bool hashmap_isempty(struct hashmap *map);
+
+static inline uint64_t hashmap_ptr_key(const void *ptr)
+{
+	return (uintptr_t) ptr;
+}
+
+static inline uint64_t hashmap_bdaddr_key(const bdaddr_t *bdaddr,
+							uint8_t bdaddr_type)
+{
+	uint64_t key = bdaddr_type;
+	int i;
+
+	for (i = 5; i >= 0; i--)
+		key = (key << 8) | bdaddr->b[i];
+
+	return key;
+}
@@ -12,7 +12,10 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
 
 #include <glib.h>
 
@@ -270,6 +273,36 @@ ssize_t io_send(struct io *io, const struct iovec *iov, int iovcnt)
 	return ret;
 }
 
+int io_send_batch(struct io *io, const struct iovec *iov, int count)
+{
+	struct mmsghdr msgs[IO_SEND_BATCH_MAX];
+	int fd, i, ret;
+
+	if (!io || !io->channel)
+		return -ENOTCONN;
+
+	fd = io_get_fd(io);
+
+	if (count > IO_SEND_BATCH_MAX)
+		count = IO_SEND_BATCH_MAX;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < count; i++) {
+		msgs[i].msg_hdr.msg_iov = (struct iovec *) &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	do {
+		ret = sendmmsg(fd, msgs, count, MSG_DONTWAIT);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -errno;
+
+	return ret;
+}
+
 bool io_shutdown(struct io *io)
 {
 	if (!io || !io->channel)
@@ -12,8 +12,10 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <errno.h>
+#include <string.h>
 #include <sys/socket.h>
 
 #include "src/shared/mainloop.h"
@@ -302,6 +304,34 @@ ssize_t io_send(struct io *io, const struct iovec *iov, int iovcnt)
 	return ret;
 }
 
+int io_send_batch(struct io *io, const struct iovec *iov, int count)
+{
+	struct mmsghdr msgs[IO_SEND_BATCH_MAX];
+	int i, ret;
+
+	if (!io || io->fd < 0)
+		return -ENOTCONN;
+
+	if (count > IO_SEND_BATCH_MAX)
+		count = IO_SEND_BATCH_MAX;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < count; i++) {
+		msgs[i].msg_hdr.msg_iov = (struct iovec *) &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	do {
+		ret = sendmmsg(io->fd, msgs, count, MSG_DONTWAIT);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -errno;
+
+	return ret;
+}
+
 bool io_shutdown(struct io *io)
 {
 	if (!io || io->fd < 0)
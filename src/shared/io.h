@@ -22,6 +22,11 @@ int io_get_fd(struct io *io);
 bool io_set_close_on_destroy(struct io *io, bool do_close);
 
 ssize_t io_send(struct io *io, const struct iovec *iov, int iovcnt);
+
+/* Each iovec goes out as a message of its own, without blocking */
+#define IO_SEND_BATCH_MAX	16
+
+int io_send_batch(struct io *io, const struct iovec *iov, int count);
 bool io_shutdown(struct io *io);
 
 typedef bool (*io_callback_func_t)(struct io *io, void *user_data);
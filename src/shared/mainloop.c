@@ -19,8 +19,11 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/signalfd.h>
 #include <sys/timerfd.h>
 #include <sys/epoll.h>
@@ -30,7 +33,13 @@
 #include "mainloop.h"
 #include "mainloop-notify.h"
 
-#define MAX_EPOLL_EVENTS 10
+/*
+ * The epoll_wait batch grows while wakeups keep filling it completely and
+ * shrinks again after a run of mostly idle wakeups.
+ */
+#define MIN_EPOLL_EVENTS	16
+#define MAX_EPOLL_EVENTS	1024
+#define EPOLL_SHRINK_WAKEUPS	64
 
 static int epoll_fd;
 static int epoll_terminate;
@@ -42,27 +51,188 @@ struct mainloop_data {
 	mainloop_event_func callback;
 	mainloop_destroy_func destroy;
 	void *user_data;
+	struct mainloop_data *next;
+};
+
+/*
+ * Registered fds are tracked in an fd indexed table which grows on demand.
+ * The mainloop_data entries come from slabs and are recycled through a
+ * free list. Entries removed while events are being dispatched are only
+ * recycled once the batch is done, so that stale events referring to
+ * them can be recognized (callback is NULL) and skipped.
+ */
+#define MAINLOOP_SLAB_ENTRIES	64
+
+struct mainloop_slab {
+	struct mainloop_slab *next;
+	struct mainloop_data entries[MAINLOOP_SLAB_ENTRIES];
 };
 
-#define MAX_MAINLOOP_ENTRIES 128
+static struct mainloop_data **mainloop_list;
+static unsigned int mainloop_list_size;
+static struct mainloop_slab *mainloop_slabs;
+static struct mainloop_data *mainloop_free;
+static struct mainloop_data *mainloop_removed;
+static bool mainloop_dispatching;
 
-static struct mainloop_data *mainloop_list[MAX_MAINLOOP_ENTRIES];
+/*
+ * All timeouts are multiplexed onto a single timerfd by a hierarchical
+ * timing wheel with a resolution of one millisecond. Level n has
+ * TIMER_WHEEL_SLOTS slots, each covering TIMER_WHEEL_SLOTS^n ticks, and
+ * timeouts are moved (cascaded) to lower levels as their expiry draws
+ * near. Adding, modifying and removing a timeout are O(1) and all
+ * timeouts expiring in the same tick are dispatched from one wakeup.
+ */
+#define TIMER_WHEEL_BITS	6
+#define TIMER_WHEEL_SLOTS	(1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK	(TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS	6
+
+struct timeout_list {
+	struct timeout_list *prev;
+	struct timeout_list *next;
+};
 
 struct timeout_data {
-	int fd;
+	struct timeout_list link;
+	int id;
+	uint64_t expire;
+	unsigned int level;
+	unsigned int slot;
 	mainloop_timeout_func callback;
 	mainloop_destroy_func destroy;
 	void *user_data;
 };
 
-void mainloop_init(void)
+struct timer_wheel {
+	int fd;
+	uint64_t tick;
+	uint64_t armed;
+	unsigned int count;
+	uint64_t pending[TIMER_WHEEL_LEVELS];
+	struct timeout_list slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	struct timeout_list expired;
+	struct timeout_data **timeouts;
+	int *free_ids;
+	unsigned int timeouts_size;
+	unsigned int free_count;
+};
+
+static struct timer_wheel wheel = { .fd = -1 };
+
+#define timeout_entry(ptr) ((struct timeout_data *) \
+		((char *) (ptr) - offsetof(struct timeout_data, link)))
+
+static struct mainloop_data *mainloop_data_new(void)
 {
-	unsigned int i;
+	struct mainloop_data *data;
+
+	if (!mainloop_free) {
+		struct mainloop_slab *slab;
+		unsigned int i;
+
+		slab = malloc(sizeof(*slab));
+		if (!slab)
+			return NULL;
+
+		for (i = 0; i < MAINLOOP_SLAB_ENTRIES; i++) {
+			slab->entries[i].next = mainloop_free;
+			mainloop_free = &slab->entries[i];
+		}
+
+		slab->next = mainloop_slabs;
+		mainloop_slabs = slab;
+	}
+
+	data = mainloop_free;
+	mainloop_free = data->next;
+
+	memset(data, 0, sizeof(*data));
+
+	return data;
+}
+
+static void mainloop_data_free(struct mainloop_data *data)
+{
+	data->callback = NULL;
+
+	if (mainloop_dispatching) {
+		data->next = mainloop_removed;
+		mainloop_removed = data;
+		return;
+	}
+
+	data->next = mainloop_free;
+	mainloop_free = data;
+}
+
+static void mainloop_data_release_removed(void)
+{
+	while (mainloop_removed) {
+		struct mainloop_data *data = mainloop_removed;
+
+		mainloop_removed = data->next;
+		data->next = mainloop_free;
+		mainloop_free = data;
+	}
+}
+
+static void mainloop_data_cleanup(void)
+{
+	while (mainloop_slabs) {
+		struct mainloop_slab *slab = mainloop_slabs;
+
+		mainloop_slabs = slab->next;
+		free(slab);
+	}
+
+	mainloop_free = NULL;
+	mainloop_removed = NULL;
+
+	free(mainloop_list);
+	mainloop_list = NULL;
+	mainloop_list_size = 0;
+}
+
+static bool mainloop_list_grow(int fd)
+{
+	struct mainloop_data **list;
+	unsigned int size = mainloop_list_size ? mainloop_list_size : 128;
+
+	while (size <= (unsigned int) fd)
+		size *= 2;
+
+	if (size == mainloop_list_size)
+		return true;
+
+	list = realloc(mainloop_list, size * sizeof(*list));
+	if (!list)
+		return false;
+
+	memset(list + mainloop_list_size, 0,
+			(size - mainloop_list_size) * sizeof(*list));
+
+	mainloop_list = list;
+	mainloop_list_size = size;
+
+	return true;
+}
+
+static struct mainloop_data *mainloop_list_get(int fd)
+{
+	if (fd < 0 || (unsigned int) fd >= mainloop_list_size)
+		return NULL;
+
+	return mainloop_list[fd];
+}
 
+void mainloop_init(void)
+{
 	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++)
-		mainloop_list[i] = NULL;
+	if (mainloop_list)
+		memset(mainloop_list, 0,
+				mainloop_list_size * sizeof(*mainloop_list));
 
 	epoll_terminate = 0;
 
@@ -90,25 +260,53 @@ void mainloop_exit_failure(void)
 
 int mainloop_run(void)
 {
-	unsigned int i;
+	struct epoll_event *events;
+	unsigned int i, max_events = MIN_EPOLL_EVENTS, idle = 0;
+
+	events = malloc(MAX_EPOLL_EVENTS * sizeof(*events));
+	if (!events)
+		return EXIT_FAILURE;
 
 	while (!epoll_terminate) {
-		struct epoll_event events[MAX_EPOLL_EVENTS];
 		int n, nfds;
 
-		nfds = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+		nfds = epoll_wait(epoll_fd, events, max_events, -1);
 		if (nfds < 0)
 			continue;
 
+		mainloop_dispatching = true;
+
 		for (n = 0; n < nfds; n++) {
 			struct mainloop_data *data = events[n].data.ptr;
 
+			/* Removed by an earlier callback of this batch */
+			if (!data->callback)
+				continue;
+
 			data->callback(data->fd, events[n].events,
 							data->user_data);
 		}
+
+		mainloop_dispatching = false;
+		mainloop_data_release_removed();
+
+		if ((unsigned int) nfds == max_events) {
+			if (max_events < MAX_EPOLL_EVENTS)
+				max_events *= 2;
+			idle = 0;
+		} else if ((unsigned int) nfds < max_events / 4 &&
+					max_events > MIN_EPOLL_EVENTS) {
+			if (++idle >= EPOLL_SHRINK_WAKEUPS) {
+				max_events /= 2;
+				idle = 0;
+			}
+		} else
+			idle = 0;
 	}
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++) {
+	free(events);
+
+	for (i = 0; i < mainloop_list_size; i++) {
 		struct mainloop_data *data = mainloop_list[i];
 
 		mainloop_list[i] = NULL;
@@ -119,10 +317,12 @@ int mainloop_run(void)
 			if (data->destroy)
 				data->destroy(data->user_data);
 
-			free(data);
+			mainloop_data_free(data);
 		}
 	}
 
+	mainloop_data_cleanup();
+
 	close(epoll_fd);
 	epoll_fd = 0;
 
@@ -138,14 +338,16 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1 || !callback)
+	if (fd < 0 || !callback)
 		return -EINVAL;
 
-	data = malloc(sizeof(*data));
+	if (!mainloop_list_grow(fd))
+		return -ENOMEM;
+
+	data = mainloop_data_new();
 	if (!data)
 		return -ENOMEM;
 
-	memset(data, 0, sizeof(*data));
 	data->fd = fd;
 	data->events = events;
 	data->callback = callback;
@@ -158,7 +360,7 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 
 	err = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, data->fd, &ev);
 	if (err < 0) {
-		free(data);
+		mainloop_data_free(data);
 		return err;
 	}
 
@@ -173,10 +375,10 @@ int mainloop_modify_fd(int fd, uint32_t events)
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0)
 		return -EINVAL;
 
-	data = mainloop_list[fd];
+	data = mainloop_list_get(fd);
 	if (!data)
 		return -ENXIO;
 
@@ -198,10 +400,10 @@ int mainloop_remove_fd(int fd)
 	struct mainloop_data *data;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0)
 		return -EINVAL;
 
-	data = mainloop_list[fd];
+	data = mainloop_list_get(fd);
 	if (!data)
 		return -ENXIO;
 
@@ -212,53 +414,368 @@ int mainloop_remove_fd(int fd)
 	if (data->destroy)
 		data->destroy(data->user_data);
 
-	free(data);
+	mainloop_data_free(data);
 
 	return err;
 }
 
-static void timeout_destroy(void *user_data)
+static inline void timeout_list_init(struct timeout_list *list)
 {
-	struct timeout_data *data = user_data;
+	list->prev = list;
+	list->next = list;
+}
 
-	close(data->fd);
-	data->fd = -1;
+static inline bool timeout_list_empty(const struct timeout_list *list)
+{
+	return list->next == list;
+}
 
-	if (data->destroy)
-		data->destroy(data->user_data);
+static inline void timeout_list_add_tail(struct timeout_list *head,
+						struct timeout_list *entry)
+{
+	entry->prev = head->prev;
+	entry->next = head;
+	head->prev->next = entry;
+	head->prev = entry;
+}
 
-	free(data);
+static inline void timeout_list_del(struct timeout_list *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+	timeout_list_init(entry);
 }
 
-static void timeout_callback(int fd, uint32_t events, void *user_data)
+static uint64_t timeout_now(bool round_up)
 {
-	struct timeout_data *data = user_data;
-	uint64_t expired;
-	ssize_t result;
+	struct timespec ts;
+	uint64_t ms;
 
-	if (events & (EPOLLERR | EPOLLHUP))
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	ms = (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+	if (round_up && ts.tv_nsec % 1000000)
+		ms++;
+
+	return ms;
+}
+
+static bool wheel_empty(void)
+{
+	unsigned int level;
+
+	if (!timeout_list_empty(&wheel.expired))
+		return false;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		if (wheel.pending[level])
+			return false;
+	}
+
+	return true;
+}
+
+static void wheel_place(struct timeout_data *data)
+{
+	unsigned int level, shift = 0;
+	uint64_t base, slot;
+
+	if (data->expire <= wheel.tick) {
+		data->level = TIMER_WHEEL_LEVELS;
+		timeout_list_add_tail(&wheel.expired, &data->link);
 		return;
+	}
+
+	/*
+	 * Use the lowest level where the expiry is less than a full turn
+	 * ahead, which makes its slot distinct from the current one.
+	 */
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		shift = level * TIMER_WHEEL_BITS;
+		base = wheel.tick >> shift;
+
+		if ((data->expire >> shift) - base < TIMER_WHEEL_SLOTS)
+			break;
+	}
+
+	if (level == TIMER_WHEEL_LEVELS) {
+		/* Out of range, park in the last slot and cascade from there */
+		level--;
+		slot = (base + TIMER_WHEEL_SLOTS - 1) & TIMER_WHEEL_MASK;
+	} else
+		slot = (data->expire >> shift) & TIMER_WHEEL_MASK;
 
-	result = read(data->fd, &expired, sizeof(expired));
-	if (result != sizeof(expired))
+	data->level = level;
+	data->slot = slot;
+
+	timeout_list_add_tail(&wheel.slots[level][slot], &data->link);
+	wheel.pending[level] |= 1ULL << slot;
+}
+
+static void wheel_unlink(struct timeout_data *data)
+{
+	if (timeout_list_empty(&data->link))
 		return;
 
-	if (data->callback)
-		data->callback(data->fd, data->user_data);
+	timeout_list_del(&data->link);
+
+	if (data->level < TIMER_WHEEL_LEVELS &&
+			timeout_list_empty(&wheel.slots[data->level][data->slot]))
+		wheel.pending[data->level] &= ~(1ULL << data->slot);
 }
 
-static inline int timeout_set(int fd, unsigned int msec)
+/* Next tick at which a slot either expires or has to be cascaded */
+static uint64_t wheel_next_tick(void)
+{
+	uint64_t next = UINT64_MAX;
+	unsigned int level;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		unsigned int shift = level * TIMER_WHEEL_BITS;
+		uint64_t base = wheel.tick >> shift;
+		uint64_t pending = wheel.pending[level];
+		unsigned int start, offset;
+		uint64_t tick;
+
+		if (!pending)
+			continue;
+
+		start = (base + 1) & TIMER_WHEEL_MASK;
+		if (start)
+			pending = (pending >> start) |
+					(pending << (TIMER_WHEEL_SLOTS - start));
+
+		offset = __builtin_ctzll(pending);
+		tick = (base + 1 + offset) << shift;
+
+		if (tick < next)
+			next = tick;
+	}
+
+	return next;
+}
+
+static void wheel_cascade(uint64_t tick)
+{
+	int level;
+
+	wheel.tick = tick;
+
+	for (level = TIMER_WHEEL_LEVELS - 1; level >= 0; level--) {
+		unsigned int shift = level * TIMER_WHEEL_BITS;
+		unsigned int slot = (tick >> shift) & TIMER_WHEEL_MASK;
+		struct timeout_list list;
+
+		if (tick & ((1ULL << shift) - 1))
+			continue;
+
+		if (!(wheel.pending[level] & (1ULL << slot)))
+			continue;
+
+		/* Detach the whole slot and place its entries again */
+		list = wheel.slots[level][slot];
+		list.next->prev = &list;
+		list.prev->next = &list;
+		timeout_list_init(&wheel.slots[level][slot]);
+		wheel.pending[level] &= ~(1ULL << slot);
+
+		while (!timeout_list_empty(&list)) {
+			struct timeout_data *data;
+
+			data = timeout_entry(list.next);
+			timeout_list_del(&data->link);
+			wheel_place(data);
+		}
+	}
+}
+
+static void wheel_rearm(void)
 {
 	struct itimerspec itimer;
-	unsigned int sec = msec / 1000;
+	uint64_t next;
+
+	if (wheel.fd < 0)
+		return;
+
+	if (!timeout_list_empty(&wheel.expired))
+		next = wheel.tick;
+	else
+		next = wheel_next_tick();
+
+	/*
+	 * Only move the timer to an earlier expiry, waking up too early
+	 * because of a removed timeout is harmless and just re-arms it.
+	 */
+	if (next >= wheel.armed)
+		return;
 
 	memset(&itimer, 0, sizeof(itimer));
-	itimer.it_interval.tv_sec = 0;
-	itimer.it_interval.tv_nsec = 0;
-	itimer.it_value.tv_sec = sec;
-	itimer.it_value.tv_nsec = (msec - (sec * 1000)) * 1000 * 1000;
+	itimer.it_value.tv_sec = next / 1000;
+	itimer.it_value.tv_nsec = (next % 1000) * 1000 * 1000;
+
+	/* An all zero it_value would disarm the timer */
+	if (!next)
+		itimer.it_value.tv_nsec = 1;
+
+	if (timerfd_settime(wheel.fd, TFD_TIMER_ABSTIME, &itimer, NULL) < 0)
+		return;
+
+	wheel.armed = next;
+}
+
+static void wheel_callback(int fd, uint32_t events, void *user_data)
+{
+	uint64_t expired, now, next;
+	ssize_t result;
+
+	if (events & (EPOLLERR | EPOLLHUP))
+		return;
+
+	result = read(wheel.fd, &expired, sizeof(expired));
+	if (result != sizeof(expired) && errno != EAGAIN)
+		return;
+
+	wheel.armed = UINT64_MAX;
+
+	now = timeout_now(false);
+
+	while ((next = wheel_next_tick()) <= now)
+		wheel_cascade(next);
+
+	if (now > wheel.tick)
+		wheel.tick = now;
+
+	while (!timeout_list_empty(&wheel.expired)) {
+		struct timeout_data *data;
+
+		data = timeout_entry(wheel.expired.next);
+		timeout_list_del(&data->link);
+
+		/* The callback might remove or modify the timeout */
+		data->callback(data->id, data->user_data);
+	}
+
+	wheel_rearm();
+}
+
+static void wheel_destroy(void *user_data)
+{
+	unsigned int i;
+
+	close(wheel.fd);
+	wheel.fd = -1;
+
+	for (i = 0; i < wheel.timeouts_size; i++) {
+		struct timeout_data *data = wheel.timeouts[i];
+
+		if (!data)
+			continue;
+
+		wheel.timeouts[i] = NULL;
+
+		if (data->destroy)
+			data->destroy(data->user_data);
+
+		free(data);
+	}
+
+	free(wheel.timeouts);
+	free(wheel.free_ids);
+
+	memset(&wheel, 0, sizeof(wheel));
+	wheel.fd = -1;
+}
+
+static int wheel_setup(void)
+{
+	unsigned int level, slot;
+	int fd;
 
-	return timerfd_settime(fd, 0, &itimer, NULL);
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		return -EIO;
+
+	memset(&wheel, 0, sizeof(wheel));
+	wheel.fd = fd;
+	wheel.armed = UINT64_MAX;
+	wheel.tick = timeout_now(false);
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+		for (slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+			timeout_list_init(&wheel.slots[level][slot]);
+
+	timeout_list_init(&wheel.expired);
+
+	if (mainloop_add_fd(fd, EPOLLIN, wheel_callback, NULL,
+						wheel_destroy) < 0) {
+		close(fd);
+		wheel.fd = -1;
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int timeout_id_alloc(struct timeout_data *data)
+{
+	unsigned int index;
+
+	if (!wheel.free_count) {
+		unsigned int i, size = wheel.timeouts_size ?
+					wheel.timeouts_size * 2 : 16;
+		struct timeout_data **timeouts;
+		int *free_ids;
+
+		timeouts = realloc(wheel.timeouts, size * sizeof(*timeouts));
+		if (!timeouts)
+			return -ENOMEM;
+
+		wheel.timeouts = timeouts;
+
+		free_ids = realloc(wheel.free_ids, size * sizeof(*free_ids));
+		if (!free_ids)
+			return -ENOMEM;
+
+		wheel.free_ids = free_ids;
+
+		/* Hand out the lower ids first */
+		for (i = size; i > wheel.timeouts_size; i--) {
+			wheel.timeouts[i - 1] = NULL;
+			wheel.free_ids[wheel.free_count++] = i;
+		}
+
+		wheel.timeouts_size = size;
+	}
+
+	data->id = wheel.free_ids[--wheel.free_count];
+
+	index = data->id - 1;
+	wheel.timeouts[index] = data;
+
+	return data->id;
+}
+
+static struct timeout_data *timeout_lookup(int id)
+{
+	if (id <= 0 || (unsigned int) id > wheel.timeouts_size)
+		return NULL;
+
+	return wheel.timeouts[id - 1];
+}
+
+static void timeout_set(struct timeout_data *data, unsigned int msec)
+{
+	wheel_unlink(data);
+
+	/* Nothing pending means the wheel can jump straight to now */
+	if (wheel_empty())
+		wheel.tick = timeout_now(false);
+
+	data->expire = timeout_now(true) + msec;
+	wheel_place(data);
+
+	wheel_rearm();
 }
 
 int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
@@ -269,53 +786,61 @@ int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
 	if (!callback)
 		return -EINVAL;
 
+	if (wheel.fd < 0 && wheel_setup() < 0)
+		return -EIO;
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
 
 	memset(data, 0, sizeof(*data));
+	timeout_list_init(&data->link);
 	data->callback = callback;
 	data->destroy = destroy;
 	data->user_data = user_data;
 
-	data->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
-	if (data->fd < 0) {
+	if (timeout_id_alloc(data) < 0) {
 		free(data);
-		return -EIO;
-	}
-
-	if (msec > 0) {
-		if (timeout_set(data->fd, msec) < 0) {
-			close(data->fd);
-			free(data);
-			return -EIO;
-		}
+		return -ENOMEM;
 	}
 
-	if (mainloop_add_fd(data->fd, EPOLLIN | EPOLLONESHOT,
-				timeout_callback, data, timeout_destroy) < 0) {
-		close(data->fd);
-		free(data);
-		return -EIO;
-	}
+	if (msec > 0)
+		timeout_set(data, msec);
 
-	return data->fd;
+	return data->id;
 }
 
 int mainloop_modify_timeout(int id, unsigned int msec)
 {
-	if (msec > 0) {
-		if (timeout_set(id, msec) < 0)
-			return -EIO;
-	}
+	struct timeout_data *data;
 
-	if (mainloop_modify_fd(id, EPOLLIN | EPOLLONESHOT) < 0)
+	data = timeout_lookup(id);
+	if (!data)
 		return -EIO;
 
+	if (msec > 0)
+		timeout_set(data, msec);
+
 	return 0;
 }
 
 int mainloop_remove_timeout(int id)
 {
-	return mainloop_remove_fd(id);
+	struct timeout_data *data;
+
+	data = timeout_lookup(id);
+	if (!data)
+		return -ENXIO;
+
+	wheel_unlink(data);
+
+	wheel.timeouts[id - 1] = NULL;
+	wheel.free_ids[wheel.free_count++] = id;
+
+	if (data->destroy)
+		data->destroy(data->user_data);
+
+	free(data);
+
+	return 0;
 }
@@ -22,6 +22,7 @@
 #include <dirent.h>
 #include <limits.h>
 #include <string.h>
+#include <time.h>
 
 #include "src/shared/util.h"
 
@@ -150,6 +151,16 @@ void util_clear_uid(unsigned int *bitmap, uint8_t id)
 	*bitmap &= ~(1u << (id - 1));
 }
 
+/* Monotonic time in microseconds, for measuring intervals */
+uint64_t util_get_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
 static const struct {
 	uint16_t uuid;
 	const char *str;
@@ -20,7 +20,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
 #include <time.h>
+#include <dirent.h>
 #include <sys/file.h>
 #include <sys/stat.h>
 
@@ -31,6 +34,9 @@
 #include "lib/sdp_lib.h"
 #include "lib/uuid.h"
 
+#include "src/shared/util.h"
+#include "log.h"
+#include "btd.h"
 #include "textfile.h"
 #include "uuid-helper.h"
 #include "storage.h"
@@ -184,3 +190,1159 @@ sdp_record_t *find_record_in_list(sdp_list_t *recs, const char *uuid)
 	}
 	return NULL;
 }
+
+/*
+ * Storage backend.
+ *
+ * By default every file below the storage directory, STORAGEDIR outside of
+ * the unit tests, is kept as is on the file system. With the log backend
+ * they are kept as entries of a single log structured file instead, keyed
+ * by their path relative to the storage directory, while files elsewhere,
+ * e.g. the configuration, are still accessed directly.
+ */
+static char *storage_dir = NULL;
+static char *storage_log_path = NULL;
+static struct logfile *storage_log = NULL;
+
+struct storage_file;
+
+static struct storage_file *storage_file_find(const char *filename);
+static gboolean storage_file_load(struct storage_file *file,
+							GKeyFile *key_file);
+static char *storage_file_contents(struct storage_file *file, size_t *len);
+
+static const char *storage_key(const char *filename)
+{
+	size_t len;
+
+	if (!storage_log)
+		return NULL;
+
+	len = strlen(storage_dir);
+	if (strncmp(filename, storage_dir, len) || filename[len] != '/')
+		return NULL;
+
+	return filename + len + 1;
+}
+
+static gboolean storage_load(GKeyFile *key_file, const char *filename)
+{
+	const char *key = storage_key(filename);
+	gboolean ret;
+	char *data;
+	size_t len;
+
+	if (!key)
+		return g_key_file_load_from_file(key_file, filename, 0, NULL);
+
+	data = logfile_get(storage_log, key, &len);
+	if (!data)
+		return FALSE;
+
+	ret = g_key_file_load_from_data(key_file, data, len, 0, NULL);
+	free(data);
+
+	return ret;
+}
+
+/* Queued writes are served before what is stored */
+gboolean btd_storage_load(GKeyFile *key_file, const char *filename)
+{
+	struct storage_file *file = storage_file_find(filename);
+
+	if (file)
+		return storage_file_load(file, key_file);
+
+	return storage_load(key_file, filename);
+}
+
+char *btd_storage_get_contents(const char *filename, size_t *len)
+{
+	const char *key = storage_key(filename);
+	struct storage_file *file;
+	char *contents;
+	gsize length;
+
+	file = storage_file_find(filename);
+	if (file)
+		return storage_file_contents(file, len);
+
+	if (!key) {
+		if (!g_file_get_contents(filename, &contents, &length, NULL))
+			return NULL;
+
+		*len = length;
+
+		return contents;
+	}
+
+	/* The value is NUL terminated already */
+	return logfile_get(storage_log, key, len);
+}
+
+/* Read the start of a file, for headers, without loading all of it */
+ssize_t btd_storage_read(const char *filename, void *buf, size_t len)
+{
+	const char *key = storage_key(filename);
+	struct storage_file *file;
+	char *contents;
+	size_t size;
+	ssize_t ret;
+	int fd;
+
+	file = storage_file_find(filename);
+	if (file) {
+		contents = storage_file_contents(file, &size);
+		len = MIN(len, size);
+		memcpy(buf, contents, len);
+		g_free(contents);
+
+		return len;
+	}
+
+	if (key)
+		return logfile_read(storage_log, key, buf, len);
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	ret = read(fd, buf, len);
+	if (ret < 0)
+		ret = -errno;
+
+	close(fd);
+
+	return ret;
+}
+
+int btd_storage_set_contents(const char *filename, const char *data,
+								size_t len)
+{
+	const char *key = storage_key(filename);
+
+	if (key)
+		return logfile_put(storage_log, key, data, len);
+
+	create_file(filename, S_IRUSR | S_IWUSR);
+
+	if (!g_file_set_contents(filename, data, len, NULL))
+		return -EIO;
+
+	return 0;
+}
+
+static void delete_folder_tree(const char *dirname)
+{
+	DIR *dir;
+	struct dirent *entry;
+	char filename[PATH_MAX];
+
+	dir = opendir(dirname);
+	if (dir == NULL)
+		return;
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (g_str_equal(entry->d_name, ".") ||
+				g_str_equal(entry->d_name, ".."))
+			continue;
+
+		if (entry->d_type == DT_UNKNOWN)
+			entry->d_type = util_get_dt(dirname, entry->d_name);
+
+		snprintf(filename, PATH_MAX, "%s/%s", dirname, entry->d_name);
+
+		if (entry->d_type == DT_DIR)
+			delete_folder_tree(filename);
+		else
+			unlink(filename);
+	}
+	closedir(dir);
+
+	rmdir(dirname);
+}
+
+struct match_prefix {
+	const char *prefix;
+	size_t len;
+	GSList *keys;
+};
+
+static void match_prefix(const char *key, size_t len, void *user_data)
+{
+	struct match_prefix *match = user_data;
+
+	if (!strncmp(key, match->prefix, match->len))
+		match->keys = g_slist_prepend(match->keys, g_strdup(key));
+}
+
+static GSList *storage_keys(const char *dirname)
+{
+	struct match_prefix match;
+	char *prefix;
+
+	prefix = g_strconcat(dirname, "/", NULL);
+
+	match.prefix = prefix;
+	match.len = strlen(prefix);
+	match.keys = NULL;
+
+	logfile_foreach(storage_log, match_prefix, &match);
+
+	g_free(prefix);
+
+	return match.keys;
+}
+
+bool btd_storage_exists(const char *path)
+{
+	const char *key = storage_key(path);
+	struct stat st;
+	GSList *keys;
+	char *data;
+
+	if (!key)
+		return stat(path, &st) == 0;
+
+	data = logfile_get(storage_log, key, NULL);
+	if (data) {
+		free(data);
+		return true;
+	}
+
+	/* Directories exist as long as there is something stored in them */
+	keys = storage_keys(key);
+	g_slist_free_full(keys, g_free);
+
+	return keys != NULL;
+}
+
+int btd_storage_remove(const char *path)
+{
+	const char *key = storage_key(path);
+	struct stat st;
+	GSList *keys, *l;
+
+	if (!key) {
+		if (stat(path, &st) < 0)
+			return -errno;
+
+		if (S_ISDIR(st.st_mode))
+			delete_folder_tree(path);
+		else if (unlink(path) < 0)
+			return -errno;
+
+		return 0;
+	}
+
+	/* Remove the entry itself and anything stored beneath it at once */
+	keys = storage_keys(key);
+
+	logfile_begin(storage_log);
+
+	logfile_del(storage_log, key);
+
+	for (l = keys; l; l = l->next)
+		logfile_del(storage_log, l->data);
+
+	g_slist_free_full(keys, g_free);
+
+	return logfile_commit(storage_log);
+}
+
+char **btd_storage_list_dirs(const char *dirname)
+{
+	const char *key = storage_key(dirname);
+	GPtrArray *names;
+	GSList *keys, *l;
+	DIR *dir;
+	struct dirent *entry;
+
+	names = g_ptr_array_new();
+
+	if (key) {
+		size_t len = strlen(key) + 1;
+		GHashTable *seen;
+
+		seen = g_hash_table_new(g_str_hash, g_str_equal);
+		keys = storage_keys(key);
+
+		/* Entries nested further down make up the directories */
+		for (l = keys; l; l = l->next) {
+			char *name = (char *) l->data + len;
+			char *end = strchr(name, '/');
+
+			if (!end)
+				continue;
+
+			*end = '\0';
+
+			if (g_hash_table_lookup(seen, name))
+				continue;
+
+			g_hash_table_insert(seen, name, name);
+			g_ptr_array_add(names, g_strdup(name));
+		}
+
+		g_hash_table_destroy(seen);
+		g_slist_free_full(keys, g_free);
+
+		goto done;
+	}
+
+	dir = opendir(dirname);
+	if (!dir)
+		goto done;
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (g_str_equal(entry->d_name, ".") ||
+				g_str_equal(entry->d_name, ".."))
+			continue;
+
+		if (entry->d_type == DT_UNKNOWN)
+			entry->d_type = util_get_dt(dirname, entry->d_name);
+
+		if (entry->d_type == DT_DIR)
+			g_ptr_array_add(names, g_strdup(entry->d_name));
+	}
+
+	closedir(dir);
+
+done:
+	g_ptr_array_add(names, NULL);
+
+	return (char **) g_ptr_array_free(names, FALSE);
+}
+
+/*
+ * Anything else right below an adapter directory is in the old text format.
+ * Those files are only read, and marked as converted, with textfile_*() so
+ * they stay where they are.
+ */
+static bool is_adapter_file(const char *name)
+{
+	return g_str_equal(name, "settings") || g_str_equal(name, "identity");
+}
+
+static void import_dir(const char *dirname, bool adapter, GSList **files)
+{
+	DIR *dir;
+	struct dirent *entry;
+
+	dir = opendir(dirname);
+	if (!dir)
+		return;
+
+	while ((entry = readdir(dir)) != NULL) {
+		char *filename;
+
+		if (g_str_equal(entry->d_name, ".") ||
+				g_str_equal(entry->d_name, ".."))
+			continue;
+
+		if (entry->d_type == DT_UNKNOWN)
+			entry->d_type = util_get_dt(dirname, entry->d_name);
+
+		if (entry->d_type == DT_REG && adapter &&
+					!is_adapter_file(entry->d_name))
+			continue;
+
+		filename = g_strdup_printf("%s/%s", dirname, entry->d_name);
+
+		if (entry->d_type == DT_DIR) {
+			import_dir(filename, false, files);
+			g_free(filename);
+		} else if (entry->d_type == DT_REG)
+			*files = g_slist_prepend(*files, filename);
+		else
+			g_free(filename);
+	}
+
+	closedir(dir);
+}
+
+/* Only take what belongs to bluetoothd, mesh keeps its data here as well */
+static bool is_adapter_dir(const char *name)
+{
+	if (g_str_has_prefix(name, "static-"))
+		name += 7;
+
+	return bachk(name) == 0;
+}
+
+static GSList *import_files(void)
+{
+	GSList *files = NULL;
+	char filename[PATH_MAX];
+	DIR *dir;
+	struct dirent *entry;
+
+	dir = opendir(storage_dir);
+	if (!dir)
+		return NULL;
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (!is_adapter_dir(entry->d_name))
+			continue;
+
+		snprintf(filename, PATH_MAX, "%s/%s", storage_dir,
+							entry->d_name);
+		import_dir(filename, true, &files);
+	}
+
+	closedir(dir);
+
+	snprintf(filename, PATH_MAX, "%s/addresses", storage_dir);
+
+	if (!access(filename, F_OK))
+		files = g_slist_prepend(files, g_strdup(filename));
+
+	return files;
+}
+
+/* Move the existing directory layout into a newly created log */
+static int storage_import(void)
+{
+	GSList *files, *l;
+	unsigned int count = 0;
+	int err;
+
+	files = import_files();
+
+	logfile_begin(storage_log);
+
+	for (l = files; l; l = l->next) {
+		const char *filename = l->data;
+		char *data;
+		gsize len;
+
+		/* Leave whatever can't be read where it is */
+		if (!g_file_get_contents(filename, &data, &len, NULL)) {
+			g_free(l->data);
+			l->data = NULL;
+			continue;
+		}
+
+		err = logfile_put(storage_log, storage_key(filename), data,
+									len);
+		g_free(data);
+
+		/* The log is thrown away on error so nothing gets lost */
+		if (err < 0) {
+			error("Unable to import %s: %s (%d)", filename,
+							strerror(-err), -err);
+			goto done;
+		}
+
+		count++;
+	}
+
+	err = logfile_commit(storage_log);
+	if (err < 0)
+		goto done;
+
+	/* The files are the only other copy, make sure the log is on disk */
+	err = logfile_sync(storage_log);
+	if (err < 0)
+		goto done;
+
+	/* Only the log is used from now on so don't leave stale copies */
+	for (l = files; l; l = l->next) {
+		char *dirname;
+
+		if (!l->data)
+			continue;
+
+		unlink(l->data);
+
+		dirname = g_path_get_dirname(l->data);
+
+		/* Directories left empty go too, the rest stays in place */
+		while (strcmp(dirname, storage_dir) && !rmdir(dirname)) {
+			char *parent = g_path_get_dirname(dirname);
+
+			g_free(dirname);
+			dirname = parent;
+		}
+
+		g_free(dirname);
+	}
+
+	info("Imported %u files into %s", count, storage_log_path);
+
+done:
+	g_slist_free_full(files, g_free);
+
+	return err;
+}
+
+struct export_data {
+	struct logfile *log;
+	unsigned int count;
+	int err;
+};
+
+static void export_entry(const char *key, size_t len, void *user_data)
+{
+	struct export_data *export = user_data;
+	char filename[PATH_MAX];
+	char *data;
+
+	data = logfile_get(export->log, key, &len);
+	if (!data) {
+		export->err = -errno;
+		return;
+	}
+
+	snprintf(filename, PATH_MAX, "%s/%s", storage_dir, key);
+
+	create_file(filename, S_IRUSR | S_IWUSR);
+
+	if (g_file_set_contents(filename, data, len, NULL))
+		export->count++;
+	else
+		export->err = -EIO;
+
+	free(data);
+}
+
+/* Write the log back to the directory layout when it is no longer used */
+static void storage_export(void)
+{
+	struct export_data export;
+	char filename[PATH_MAX];
+
+	memset(&export, 0, sizeof(export));
+
+	export.log = logfile_open(storage_log_path, true);
+	if (!export.log) {
+		error("Unable to open %s: %s (%d)", storage_log_path,
+						strerror(errno), errno);
+		return;
+	}
+
+	logfile_foreach(export.log, export_entry, &export);
+	logfile_close(export.log);
+
+	if (export.err < 0) {
+		error("Unable to export %s: %s (%d)", storage_log_path,
+					strerror(-export.err), -export.err);
+		return;
+	}
+
+	/* Keep the log around as backup but don't import it again */
+	snprintf(filename, PATH_MAX, "%s.old", storage_log_path);
+
+	if (rename(storage_log_path, filename) < 0)
+		error("Unable to rename %s: %s (%d)", storage_log_path,
+						strerror(errno), errno);
+
+	info("Exported %u files from %s", export.count, storage_log_path);
+}
+
+void btd_storage_init(const char *dirname)
+{
+	char filename[PATH_MAX];
+	struct stat st;
+	bool exists;
+	int err;
+
+	g_free(storage_dir);
+	storage_dir = g_strdup(dirname);
+
+	g_free(storage_log_path);
+	storage_log_path = g_strconcat(dirname, "/storage.log", NULL);
+
+	exists = stat(storage_log_path, &st) == 0;
+
+	if (btd_opts.storage_backend != BT_STORAGE_LOG) {
+		if (exists)
+			storage_export();
+		return;
+	}
+
+	storage_log = logfile_open(storage_log_path, btd_opts.storage_sync);
+	if (!storage_log && errno == EBADMSG) {
+		/*
+		 * Go on with what was committed before the damage and keep
+		 * the damaged log aside. If that fails the log is left as is
+		 * and the files are used directly instead.
+		 */
+		snprintf(filename, PATH_MAX, "%s.corrupt", storage_log_path);
+
+		error("%s is corrupted, keeping it as %s", storage_log_path,
+								filename);
+
+		err = logfile_recover(storage_log_path, filename);
+		if (err < 0) {
+			error("Unable to recover %s: %s (%d)", storage_log_path,
+							strerror(-err), -err);
+			errno = EBADMSG;
+		} else
+			storage_log = logfile_open(storage_log_path,
+						btd_opts.storage_sync);
+	}
+
+	if (!storage_log) {
+		error("Unable to open %s: %s (%d)", storage_log_path,
+						strerror(errno), errno);
+		return;
+	}
+
+	if (exists) {
+		DBG("%u entries in %s", logfile_count(storage_log),
+							storage_log_path);
+		return;
+	}
+
+	err = storage_import();
+	if (err < 0) {
+		error("Unable to import into %s: %s (%d)", storage_log_path,
+							strerror(-err), -err);
+		logfile_close(storage_log);
+		storage_log = NULL;
+		unlink(storage_log_path);
+	}
+}
+
+static void storage_files_drop(void);
+
+void btd_storage_cleanup(void)
+{
+	btd_storage_flush();
+
+	/* Whatever still failed to be written is lost */
+	storage_files_drop();
+
+	logfile_close(storage_log);
+	storage_log = NULL;
+
+	g_free(storage_log_path);
+	storage_log_path = NULL;
+
+	g_free(storage_dir);
+	storage_dir = NULL;
+}
+
+/*
+ * Write-behind cache for storage files.
+ *
+ * Updates are queued per file and written out in one batch once the flush
+ * delay expires. Key file updates are merged into the current on-disk
+ * contents at flush time so that files which are also written directly,
+ * e.g. the info file holding the keys, are never clobbered.
+ */
+struct storage_update {
+	btd_storage_update_t func;
+	void *user_data;
+	GDestroyNotify destroy;
+};
+
+struct storage_file {
+	char *filename;
+	GSList *updates;
+	char *data;
+	size_t len;
+	bool raw;
+};
+
+static GHashTable *storage_files = NULL;
+static guint storage_flush_id = 0;
+
+static void storage_update_free(void *data)
+{
+	struct storage_update *update = data;
+
+	if (update->destroy)
+		update->destroy(update->user_data);
+
+	g_free(update);
+}
+
+static void storage_file_free(void *data)
+{
+	struct storage_file *file = data;
+
+	g_slist_free_full(file->updates, storage_update_free);
+	g_free(file->data);
+	g_free(file->filename);
+	g_free(file);
+}
+
+static int storage_write_file(const char *filename, const char *data,
+								size_t len)
+{
+	const char *key = storage_key(filename);
+	char tmp[PATH_MAX];
+	ssize_t written;
+	int fd, err = 0;
+
+	if (key)
+		return logfile_put(storage_log, key, data, len);
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", filename) >= (int) sizeof(tmp))
+		return -ENAMETOOLONG;
+
+	if (create_file(tmp, S_IRUSR | S_IWUSR) < 0)
+		return -errno;
+
+	fd = open(tmp, O_WRONLY | O_TRUNC | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	while (len > 0) {
+		written = write(fd, data, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			break;
+		}
+
+		data += written;
+		len -= written;
+	}
+
+	if (!err && btd_opts.storage_sync && fsync(fd) < 0)
+		err = -errno;
+
+	close(fd);
+
+	if (!err && rename(tmp, filename) < 0)
+		err = -errno;
+
+	if (err < 0) {
+		error("Unable to write %s: %s (%d)", filename, strerror(-err),
+									-err);
+		unlink(tmp);
+	}
+
+	return err;
+}
+
+static struct storage_file *storage_file_find(const char *filename)
+{
+	if (!storage_files)
+		return NULL;
+
+	return g_hash_table_lookup(storage_files, filename);
+}
+
+static void apply_update(gpointer data, gpointer user_data)
+{
+	struct storage_update *update = data;
+
+	update->func(user_data, update->user_data);
+}
+
+static gboolean storage_file_load(struct storage_file *file,
+							GKeyFile *key_file)
+{
+	gboolean ret;
+
+	if (file->raw)
+		ret = g_key_file_load_from_data(key_file, file->data,
+							file->len, 0, NULL);
+	else
+		ret = storage_load(key_file, file->filename);
+
+	if (!file->updates)
+		return ret;
+
+	/* Updates create the file if there is none yet */
+	g_slist_foreach(file->updates, apply_update, key_file);
+
+	return TRUE;
+}
+
+static char *storage_file_contents(struct storage_file *file, size_t *len)
+{
+	GKeyFile *key_file;
+	char *contents;
+	gsize length;
+
+	if (!file->updates) {
+		contents = g_malloc(file->len + 1);
+		memcpy(contents, file->data, file->len);
+		contents[file->len] = '\0';
+		*len = file->len;
+
+		return contents;
+	}
+
+	key_file = g_key_file_new();
+	storage_file_load(file, key_file);
+	contents = g_key_file_to_data(key_file, &length, NULL);
+	g_key_file_free(key_file);
+
+	*len = length;
+
+	return contents;
+}
+
+static int storage_file_flush(struct storage_file *file)
+{
+	GKeyFile *key_file;
+	char *base, *data;
+	gsize base_len, len;
+	int err = 0;
+
+	if (!file->updates) {
+		if (file->raw)
+			err = storage_write_file(file->filename, file->data,
+								file->len);
+		return err;
+	}
+
+	key_file = g_key_file_new();
+
+	/* Queued contents take precedence over what is on disk */
+	if (file->raw)
+		g_key_file_load_from_data(key_file, file->data, file->len, 0,
+									NULL);
+	else
+		storage_load(key_file, file->filename);
+
+	base = g_key_file_to_data(key_file, &base_len, NULL);
+
+	g_slist_foreach(file->updates, apply_update, key_file);
+
+	data = g_key_file_to_data(key_file, &len, NULL);
+
+	/* Skip the write if the updates didn't change anything */
+	if (file->raw || len != base_len || memcmp(data, base, len))
+		err = storage_write_file(file->filename, data, len);
+
+	g_free(data);
+	g_free(base);
+	g_key_file_free(key_file);
+
+	return err;
+}
+
+static gboolean storage_flush_cb(gpointer user_data);
+
+static struct storage_file *storage_file_get(const char *filename)
+{
+	struct storage_file *file;
+
+	if (!storage_files)
+		storage_files = g_hash_table_new_full(g_str_hash, g_str_equal,
+						NULL, storage_file_free);
+
+	if (!storage_flush_id)
+		storage_flush_id = g_timeout_add(btd_opts.storage_delay,
+							storage_flush_cb, NULL);
+
+	file = g_hash_table_lookup(storage_files, filename);
+	if (file)
+		return file;
+
+	file = g_new0(struct storage_file, 1);
+	file->filename = g_strdup(filename);
+	g_hash_table_insert(storage_files, file->filename, file);
+
+	return file;
+}
+
+/*
+ * Put a file that failed to be written back into the queue so the next
+ * flush retries it. Anything queued for it in the meantime is newer, so
+ * its updates go last and its raw contents win.
+ */
+static void storage_file_requeue(struct storage_file *file)
+{
+	struct storage_file *queued = storage_file_get(file->filename);
+
+	/* Newer contents replace the failed write entirely */
+	if (queued->raw) {
+		storage_file_free(file);
+		return;
+	}
+
+	if (file->raw) {
+		queued->data = file->data;
+		queued->len = file->len;
+		queued->raw = true;
+		file->data = NULL;
+	}
+
+	queued->updates = g_slist_concat(file->updates, queued->updates);
+	file->updates = NULL;
+
+	storage_file_free(file);
+}
+
+static void flush_file(gpointer key, gpointer value, gpointer user_data)
+{
+	GSList **failed = user_data;
+
+	if (storage_file_flush(value) < 0)
+		*failed = g_slist_prepend(*failed, value);
+}
+
+static void requeue_file(gpointer data, gpointer user_data)
+{
+	struct storage_file *file = data;
+
+	g_hash_table_steal(user_data, file->filename);
+	storage_file_requeue(file);
+}
+
+/* Write out the current batch, returns false if anything failed */
+static bool storage_flush_batch(void)
+{
+	GHashTable *files = storage_files;
+	GSList *failed = NULL;
+	GList *values;
+
+	if (!files)
+		return true;
+
+	/* Updaters may queue new writes, those go into a new batch */
+	storage_files = NULL;
+
+	/* With the log backend the whole batch is a single transaction */
+	if (storage_log)
+		logfile_begin(storage_log);
+
+	g_hash_table_foreach(files, flush_file, &failed);
+
+	if (storage_log) {
+		int err = logfile_commit(storage_log);
+
+		if (err < 0) {
+			error("Unable to write %s: %s (%d)", storage_log_path,
+							strerror(-err), -err);
+
+			/* Nothing of the batch made it, retry all of it */
+			g_slist_free(failed);
+			failed = NULL;
+
+			values = g_hash_table_get_values(files);
+			g_list_foreach(values, requeue_file, files);
+			g_list_free(values);
+			g_hash_table_destroy(files);
+
+			return false;
+		}
+	}
+
+	/* Keep what failed queued and retry it on the next flush */
+	g_slist_foreach(failed, requeue_file, files);
+	g_hash_table_destroy(files);
+
+	if (!failed)
+		return true;
+
+	g_slist_free(failed);
+
+	return false;
+}
+
+static gboolean storage_flush_cb(gpointer user_data)
+{
+	storage_flush_id = 0;
+
+	storage_flush_batch();
+
+	return FALSE;
+}
+
+static void storage_files_drop(void)
+{
+	if (storage_flush_id) {
+		g_source_remove(storage_flush_id);
+		storage_flush_id = 0;
+	}
+
+	if (!storage_files)
+		return;
+
+	error("Dropping %u unwritten storage files",
+					g_hash_table_size(storage_files));
+
+	g_hash_table_destroy(storage_files);
+	storage_files = NULL;
+}
+
+void btd_storage_update(const char *filename, btd_storage_update_t func,
+				void *user_data, GDestroyNotify destroy)
+{
+	struct storage_file *file = storage_file_get(filename);
+	struct storage_update *update;
+	GSList *l;
+
+	/* Coalesce with a pending update of the same kind */
+	for (l = file->updates; l; l = l->next) {
+		update = l->data;
+
+		if (update->func != func)
+			continue;
+
+		if (update->user_data != user_data) {
+			if (update->destroy)
+				update->destroy(update->user_data);
+			update->user_data = user_data;
+		}
+
+		update->destroy = destroy;
+
+		return;
+	}
+
+	update = g_new0(struct storage_update, 1);
+	update->func = func;
+	update->user_data = user_data;
+	update->destroy = destroy;
+
+	file->updates = g_slist_append(file->updates, update);
+}
+
+void btd_storage_write(const char *filename, const void *data, size_t len)
+{
+	struct storage_file *file = storage_file_get(filename);
+
+	/* New contents replace anything queued before */
+	g_slist_free_full(file->updates, storage_update_free);
+	file->updates = NULL;
+
+	g_free(file->data);
+	file->data = g_memdup(data, len);
+	file->len = len;
+	file->raw = true;
+}
+
+bool btd_storage_pending(const char *filename)
+{
+	if (!storage_files)
+		return false;
+
+	return g_hash_table_lookup(storage_files, filename) != NULL;
+}
+
+int btd_storage_sync(const char *filename)
+{
+	struct storage_file *file = storage_file_find(filename);
+	int err;
+
+	if (!file)
+		return 0;
+
+	g_hash_table_steal(storage_files, filename);
+
+	err = storage_file_flush(file);
+	if (err < 0) {
+		/* Leave it to the next flush to retry */
+		storage_file_requeue(file);
+		return err;
+	}
+
+	storage_file_free(file);
+
+	return 0;
+}
+
+void btd_storage_discard(const char *filename)
+{
+	if (storage_files)
+		g_hash_table_remove(storage_files, filename);
+}
+
+static gboolean cancel_updates(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	struct storage_file *file = value;
+	GSList *l, *next;
+
+	for (l = file->updates; l; l = next) {
+		struct storage_update *update = l->data;
+
+		next = l->next;
+
+		if (update->user_data != user_data)
+			continue;
+
+		file->updates = g_slist_delete_link(file->updates, l);
+		storage_update_free(update);
+	}
+
+	return !file->updates && !file->raw;
+}
+
+void btd_storage_cancel(void *user_data)
+{
+	if (storage_files)
+		g_hash_table_foreach_remove(storage_files, cancel_updates,
+								user_data);
+}
+
+struct sync_data {
+	void *user_data;
+	GSList *filenames;
+};
+
+static void find_updates(gpointer key, gpointer value, gpointer user_data)
+{
+	struct storage_file *file = value;
+	struct sync_data *data = user_data;
+	GSList *l;
+
+	for (l = file->updates; l; l = l->next) {
+		struct storage_update *update = l->data;
+
+		if (update->user_data != data->user_data)
+			continue;
+
+		data->filenames = g_slist_prepend(data->filenames,
+						g_strdup(file->filename));
+		return;
+	}
+}
+
+/*
+ * Write out every file with updates referencing user_data, for when it is
+ * about to go away, and drop whatever couldn't be written.
+ */
+int btd_storage_sync_updates(void *user_data)
+{
+	struct sync_data data;
+	GSList *l;
+	int err = 0, ret;
+
+	if (!storage_files)
+		return 0;
+
+	data.user_data = user_data;
+	data.filenames = NULL;
+
+	g_hash_table_foreach(storage_files, find_updates, &data);
+
+	for (l = data.filenames; l; l = l->next) {
+		ret = btd_storage_sync(l->data);
+		if (ret < 0)
+			err = ret;
+	}
+
+	g_slist_free_full(data.filenames, g_free);
+
+	/* Failed updates can't be retried once user_data is gone */
+	btd_storage_cancel(user_data);
+
+	return err;
+}
+
+void btd_storage_flush(void)
+{
+	if (storage_flush_id) {
+		g_source_remove(storage_flush_id);
+		storage_flush_id = 0;
+	}
+
+	/* Flushing may queue more writes so loop until settled */
+	while (storage_files) {
+		/* Failed writes are left for the timer to retry */
+		if (!storage_flush_batch())
+			break;
+	}
+}
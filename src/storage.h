@@ -14,3 +14,27 @@ int read_on_mode(const char *src, char *mode, int length);
 int read_local_name(const bdaddr_t *bdaddr, char *name);
 sdp_record_t *record_from_string(const char *str);
 sdp_record_t *find_record_in_list(sdp_list_t *recs, const char *uuid);
+
+typedef void (*btd_storage_update_t)(GKeyFile *key_file, void *user_data);
+
+void btd_storage_update(const char *filename, btd_storage_update_t func,
+				void *user_data, GDestroyNotify destroy);
+void btd_storage_write(const char *filename, const void *data, size_t len);
+bool btd_storage_pending(const char *filename);
+int btd_storage_sync(const char *filename);
+void btd_storage_discard(const char *filename);
+void btd_storage_cancel(void *user_data);
+int btd_storage_sync_updates(void *user_data);
+void btd_storage_flush(void);
+
+void btd_storage_init(const char *dirname);
+void btd_storage_cleanup(void);
+
+gboolean btd_storage_load(GKeyFile *key_file, const char *filename);
+char *btd_storage_get_contents(const char *filename, size_t *len);
+ssize_t btd_storage_read(const char *filename, void *buf, size_t len);
+int btd_storage_set_contents(const char *filename, const char *data,
+								size_t len);
+bool btd_storage_exists(const char *path);
+int btd_storage_remove(const char *path);
+char **btd_storage_list_dirs(const char *dirname);
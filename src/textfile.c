@@ -19,12 +19,16 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/param.h>
 
+#include "src/shared/util.h"
+#include "src/shared/hashmap.h"
 #include "textfile.h"
 
 static int create_dirs(const char *filename, const mode_t mode)
@@ -461,3 +465,870 @@ close:
 
 	return 0;
 }
+
+/*
+ * Log structured key/value file
+ *
+ * Every change is appended to the file as a record and an index built when
+ * the file is opened maps each key to the offset of its current value.
+ * Records are grouped into transactions, the last record of each carries
+ * the commit flag, and anything following the last complete transaction
+ * is dropped when the file is opened. A file damaged anywhere else fails to
+ * open with EBADMSG instead. Once most of the file is taken up by
+ * overwritten values it is rewritten with just the live records.
+ *
+ * The file starts with a magic and version, each record is made of:
+ *
+ *	crc32 (4)	covering everything that follows in the record
+ *	type (1)	LOGFILE_PUT or LOGFILE_DEL
+ *	flags (1)	LOGFILE_COMMIT on the last record of a transaction
+ *	key length (2)
+ *	value length (4)
+ *	key, value
+ */
+#define LOGFILE_MAGIC		0x474f4c42	/* "BLOG" */
+#define LOGFILE_VERSION		1
+#define LOGFILE_HDR_SIZE	8
+#define LOGFILE_REC_SIZE	12
+
+#define LOGFILE_PUT		0x01
+#define LOGFILE_DEL		0x02
+
+#define LOGFILE_COMMIT		0x01
+
+#define LOGFILE_COMPACT_MIN	(64 * 1024)
+
+struct logfile_entry {
+	struct logfile_entry *next;	/* Keys with the same hash */
+	char *key;
+	off_t offset;			/* Offset of the value */
+	uint32_t len;
+	uint32_t size;			/* Size of the whole record */
+};
+
+struct logfile {
+	char *pathname;
+	int fd;
+	bool sync;
+	struct hashmap *index;
+	unsigned int count;
+	off_t size;
+	off_t live;			/* Bytes taken by current values */
+	uint8_t *txn;
+	size_t txn_len;
+	size_t txn_size;
+	size_t txn_last;
+	bool txn_open;
+};
+
+static uint32_t logfile_crc(const uint8_t *data, size_t len)
+{
+	static uint32_t table[256];
+	uint32_t crc = 0xffffffff;
+	size_t i;
+
+	if (!table[1]) {
+		for (i = 0; i < 256; i++) {
+			uint32_t c = i;
+			int j;
+
+			for (j = 0; j < 8; j++)
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+
+			table[i] = c;
+		}
+	}
+
+	for (i = 0; i < len; i++)
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+	return crc ^ 0xffffffff;
+}
+
+static uint64_t logfile_hash(const char *key)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	/* FNV-1a */
+	while (*key) {
+		hash ^= (uint8_t) *key++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static struct logfile_entry *logfile_lookup(struct logfile *lf,
+							const char *key)
+{
+	struct logfile_entry *entry;
+
+	entry = hashmap_lookup(lf->index, logfile_hash(key));
+
+	for (; entry; entry = entry->next) {
+		if (!strcmp(entry->key, key))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static void logfile_set(struct logfile *lf, const char *key, off_t offset,
+						uint32_t len, uint32_t size)
+{
+	struct logfile_entry *entry, *head;
+	uint64_t hash;
+
+	entry = logfile_lookup(lf, key);
+	if (entry) {
+		lf->live -= entry->size;
+		goto done;
+	}
+
+	hash = logfile_hash(key);
+
+	entry = calloc(1, sizeof(*entry));
+	entry->key = strdup(key);
+
+	head = hashmap_remove_key(lf->index, hash);
+	entry->next = head;
+	hashmap_insert(lf->index, hash, entry);
+
+	lf->count++;
+
+done:
+	entry->offset = offset;
+	entry->len = len;
+	entry->size = size;
+
+	lf->live += size;
+}
+
+static void logfile_unset(struct logfile *lf, const char *key)
+{
+	struct logfile_entry *entry, *head, **prev;
+	uint64_t hash;
+
+	hash = logfile_hash(key);
+
+	head = hashmap_remove_key(lf->index, hash);
+
+	for (prev = &head; *prev; prev = &(*prev)->next) {
+		entry = *prev;
+
+		if (strcmp(entry->key, key))
+			continue;
+
+		*prev = entry->next;
+
+		lf->live -= entry->size;
+		lf->count--;
+
+		free(entry->key);
+		free(entry);
+		break;
+	}
+
+	if (head)
+		hashmap_insert(lf->index, hash, head);
+}
+
+static void logfile_entry_free(void *data)
+{
+	struct logfile_entry *entry = data;
+
+	while (entry) {
+		struct logfile_entry *next = entry->next;
+
+		free(entry->key);
+		free(entry);
+
+		entry = next;
+	}
+}
+
+/* Parse the record at offset, returns its size or 0 if it isn't valid */
+static size_t logfile_record(const uint8_t *data, size_t size, size_t offset)
+{
+	const uint8_t *rec = data + offset;
+	uint16_t key_len;
+	uint32_t len;
+
+	if (size - offset < LOGFILE_REC_SIZE)
+		return 0;
+
+	if (rec[4] != LOGFILE_PUT && rec[4] != LOGFILE_DEL)
+		return 0;
+
+	if (rec[5] & ~LOGFILE_COMMIT)
+		return 0;
+
+	key_len = get_le16(rec + 6);
+	len = get_le32(rec + 8);
+
+	if (!key_len || size - offset - LOGFILE_REC_SIZE < key_len ||
+			size - offset - LOGFILE_REC_SIZE - key_len < len)
+		return 0;
+
+	if (memchr(rec + LOGFILE_REC_SIZE, '\0', key_len))
+		return 0;
+
+	if (get_le32(rec) != logfile_crc(rec + 4, LOGFILE_REC_SIZE - 4 +
+							key_len + len))
+		return 0;
+
+	return LOGFILE_REC_SIZE + key_len + len;
+}
+
+static void logfile_apply(struct logfile *lf, const uint8_t *data,
+						size_t len, off_t base)
+{
+	size_t offset = 0;
+
+	while (offset < len) {
+		const uint8_t *rec = data + offset;
+		uint16_t key_len = get_le16(rec + 6);
+		uint32_t value_len = get_le32(rec + 8);
+		size_t size = LOGFILE_REC_SIZE + key_len + value_len;
+		char *key;
+
+		key = strndup((const char *) rec + LOGFILE_REC_SIZE, key_len);
+
+		if (rec[4] == LOGFILE_PUT)
+			logfile_set(lf, key, base + offset + LOGFILE_REC_SIZE +
+						key_len, value_len, size);
+		else
+			logfile_unset(lf, key);
+
+		free(key);
+
+		offset += size;
+	}
+}
+
+/*
+ * An interrupted write only ever leaves a partial transaction at the end of
+ * the file, any committed record following the damage means the file got
+ * corrupted and truncating it would throw away committed data.
+ *
+ * The CRC is only computed where the header makes sense, and a valid record
+ * is skipped as a whole, so the search stays linear in the size of the file.
+ */
+static bool logfile_damaged(const uint8_t *data, size_t size, size_t offset)
+{
+	for (offset++; offset < size;) {
+		size_t len = logfile_record(data, size, offset);
+
+		if (!len) {
+			offset++;
+			continue;
+		}
+
+		if (data[offset + 5] & LOGFILE_COMMIT)
+			return true;
+
+		offset += len;
+	}
+
+	return false;
+}
+
+/* Find the end of the last complete transaction and of the valid records */
+static size_t logfile_end(const uint8_t *data, size_t size, size_t *valid)
+{
+	size_t offset, end;
+
+	for (offset = end = LOGFILE_HDR_SIZE; offset < size;) {
+		size_t len = logfile_record(data, size, offset);
+
+		if (!len)
+			break;
+
+		offset += len;
+
+		if (data[offset - len + 5] & LOGFILE_COMMIT)
+			end = offset;
+	}
+
+	*valid = offset;
+
+	return end;
+}
+
+static int logfile_load(struct logfile *lf)
+{
+	struct stat st;
+	uint8_t hdr[LOGFILE_HDR_SIZE];
+	uint8_t *map;
+	size_t size, offset, end;
+
+	if (fstat(lf->fd, &st) < 0)
+		return -errno;
+
+	if (!st.st_size) {
+		put_le32(LOGFILE_MAGIC, hdr);
+		put_le32(LOGFILE_VERSION, hdr + 4);
+
+		if (pwrite(lf->fd, hdr, sizeof(hdr), 0) != sizeof(hdr))
+			return -EIO;
+
+		lf->size = sizeof(hdr);
+
+		return 0;
+	}
+
+	size = st.st_size;
+	if (size < LOGFILE_HDR_SIZE)
+		return -EILSEQ;
+
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, lf->fd, 0);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	if (get_le32(map) != LOGFILE_MAGIC ||
+				get_le32(map + 4) != LOGFILE_VERSION) {
+		munmap(map, size);
+		return -EILSEQ;
+	}
+
+	end = logfile_end(map, size, &offset);
+
+	if (offset < size && logfile_damaged(map, size, offset)) {
+		munmap(map, size);
+		return -EBADMSG;
+	}
+
+	logfile_apply(lf, map + LOGFILE_HDR_SIZE, end - LOGFILE_HDR_SIZE,
+							LOGFILE_HDR_SIZE);
+
+	munmap(map, size);
+
+	/* Drop whatever an interrupted write left behind */
+	if (end < size && ftruncate(lf->fd, end) < 0)
+		return -errno;
+
+	lf->size = end;
+
+	return 0;
+}
+
+struct logfile *logfile_open(const char *pathname, bool sync)
+{
+	struct logfile *lf;
+	int err;
+
+	lf = calloc(1, sizeof(*lf));
+	if (!lf)
+		return NULL;
+
+	create_dirs(pathname, S_IRUSR | S_IWUSR | S_IXUSR);
+
+	lf->fd = open(pathname, O_RDWR | O_CREAT | O_CLOEXEC,
+							S_IRUSR | S_IWUSR);
+	if (lf->fd < 0) {
+		err = -errno;
+		free(lf);
+		errno = -err;
+		return NULL;
+	}
+
+	if (flock(lf->fd, LOCK_EX | LOCK_NB) < 0) {
+		err = -errno;
+		goto failed;
+	}
+
+	lf->pathname = strdup(pathname);
+	lf->sync = sync;
+	lf->index = hashmap_new();
+
+	if (!lf->pathname || !lf->index) {
+		err = -ENOMEM;
+		goto failed;
+	}
+
+	err = logfile_load(lf);
+	if (err < 0)
+		goto failed;
+
+	if (lf->size > LOGFILE_COMPACT_MIN && lf->live * 2 < lf->size)
+		logfile_compact(lf);
+
+	return lf;
+
+failed:
+	logfile_close(lf);
+	errno = -err;
+
+	return NULL;
+}
+
+void logfile_close(struct logfile *lf)
+{
+	if (!lf)
+		return;
+
+	hashmap_destroy(lf->index, logfile_entry_free);
+	close(lf->fd);
+	free(lf->txn);
+	free(lf->pathname);
+	free(lf);
+}
+
+static int logfile_append(struct logfile *lf, uint8_t type, const char *key,
+					const void *value, size_t len)
+{
+	size_t key_len = strlen(key);
+	size_t size = LOGFILE_REC_SIZE + key_len + len;
+	uint8_t *rec;
+
+	if (!key_len || key_len > UINT16_MAX || len > UINT32_MAX)
+		return -EINVAL;
+
+	if (lf->txn_len + size > lf->txn_size) {
+		size_t txn_size = lf->txn_size ? lf->txn_size : 1024;
+		uint8_t *txn;
+
+		while (txn_size < lf->txn_len + size)
+			txn_size *= 2;
+
+		txn = realloc(lf->txn, txn_size);
+		if (!txn)
+			return -ENOMEM;
+
+		lf->txn = txn;
+		lf->txn_size = txn_size;
+	}
+
+	rec = lf->txn + lf->txn_len;
+	rec[4] = type;
+	rec[5] = 0;
+	put_le16(key_len, rec + 6);
+	put_le32(len, rec + 8);
+	memcpy(rec + LOGFILE_REC_SIZE, key, key_len);
+	if (len)
+		memcpy(rec + LOGFILE_REC_SIZE + key_len, value, len);
+
+	lf->txn_last = lf->txn_len;
+	lf->txn_len += size;
+
+	return 0;
+}
+
+static int write_all(int fd, const uint8_t *data, size_t len, off_t offset)
+{
+	while (len > 0) {
+		ssize_t written = pwrite(fd, data, len, offset);
+
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		data += written;
+		offset += written;
+		len -= written;
+	}
+
+	return 0;
+}
+
+void logfile_begin(struct logfile *lf)
+{
+	lf->txn_open = true;
+}
+
+int logfile_commit(struct logfile *lf)
+{
+	size_t offset;
+	int err;
+
+	lf->txn_open = false;
+
+	if (!lf->txn_len)
+		return 0;
+
+	lf->txn[lf->txn_last + 5] |= LOGFILE_COMMIT;
+
+	for (offset = 0; offset < lf->txn_len;) {
+		uint8_t *rec = lf->txn + offset;
+		size_t size = LOGFILE_REC_SIZE + get_le16(rec + 6) +
+							get_le32(rec + 8);
+
+		put_le32(logfile_crc(rec + 4, size - 4), rec);
+		offset += size;
+	}
+
+	err = write_all(lf->fd, lf->txn, lf->txn_len, lf->size);
+	if (!err && lf->sync && fdatasync(lf->fd) < 0)
+		err = -errno;
+
+	if (err < 0) {
+		if (ftruncate(lf->fd, lf->size) < 0)
+			err = -errno;
+		lf->txn_len = 0;
+		return err;
+	}
+
+	logfile_apply(lf, lf->txn, lf->txn_len, lf->size);
+
+	lf->size += lf->txn_len;
+	lf->txn_len = 0;
+
+	if (lf->size > LOGFILE_COMPACT_MIN && lf->live * 2 < lf->size)
+		logfile_compact(lf);
+
+	return 0;
+}
+
+/* Flush committed transactions to disk regardless of the sync setting */
+int logfile_sync(struct logfile *lf)
+{
+	if (fsync(lf->fd) < 0)
+		return -errno;
+
+	return 0;
+}
+
+int logfile_put(struct logfile *lf, const char *key, const void *value,
+								size_t len)
+{
+	int err;
+
+	err = logfile_append(lf, LOGFILE_PUT, key, value, len);
+	if (err < 0 || lf->txn_open)
+		return err;
+
+	return logfile_commit(lf);
+}
+
+int logfile_del(struct logfile *lf, const char *key)
+{
+	int err;
+
+	if (!logfile_lookup(lf, key) && !lf->txn_open)
+		return 0;
+
+	err = logfile_append(lf, LOGFILE_DEL, key, NULL, 0);
+	if (err < 0 || lf->txn_open)
+		return err;
+
+	return logfile_commit(lf);
+}
+
+static int logfile_pread(struct logfile *lf, struct logfile_entry *entry,
+						uint8_t *buf, size_t len)
+{
+	size_t offset = 0;
+
+	while (offset < len) {
+		ssize_t n = pread(lf->fd, buf + offset, len - offset,
+						entry->offset + offset);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return -EIO;
+
+		offset += n;
+	}
+
+	return 0;
+}
+
+void *logfile_get(struct logfile *lf, const char *key, size_t *len)
+{
+	struct logfile_entry *entry;
+	uint8_t *value;
+
+	entry = logfile_lookup(lf, key);
+	if (!entry) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	/* Keep room for a terminating nul so text can be used as is */
+	value = malloc(entry->len + 1);
+	if (!value)
+		return NULL;
+
+	if (logfile_pread(lf, entry, value, entry->len) < 0) {
+		free(value);
+		errno = EIO;
+		return NULL;
+	}
+
+	value[entry->len] = '\0';
+
+	if (len)
+		*len = entry->len;
+
+	return value;
+}
+
+/* Read at most len bytes from the start of the value stored for key */
+ssize_t logfile_read(struct logfile *lf, const char *key, void *buf,
+								size_t len)
+{
+	struct logfile_entry *entry;
+	int err;
+
+	entry = logfile_lookup(lf, key);
+	if (!entry)
+		return -ENOENT;
+
+	len = MIN(len, entry->len);
+
+	err = logfile_pread(lf, entry, buf, len);
+	if (err < 0)
+		return err;
+
+	return len;
+}
+
+struct foreach_data {
+	logfile_cb func;
+	void *user_data;
+};
+
+static void foreach_entry(void *data, void *user_data)
+{
+	struct logfile_entry *entry = data;
+	struct foreach_data *foreach = user_data;
+
+	for (; entry; entry = entry->next)
+		foreach->func(entry->key, entry->len, foreach->user_data);
+}
+
+void logfile_foreach(struct logfile *lf, logfile_cb func, void *user_data)
+{
+	struct foreach_data foreach = { func, user_data };
+
+	hashmap_foreach(lf->index, foreach_entry, &foreach);
+}
+
+struct compact_data {
+	struct logfile *lf;
+	uint8_t *buf;
+	size_t len;
+	int err;
+};
+
+static void compact_entry(void *data, void *user_data)
+{
+	struct logfile_entry *entry = data;
+	struct compact_data *compact = user_data;
+
+	for (; entry; entry = entry->next) {
+		size_t key_len = strlen(entry->key);
+		uint8_t *rec = compact->buf + compact->len;
+		uint8_t *value = rec + LOGFILE_REC_SIZE + key_len;
+		size_t offset = 0;
+
+		if (compact->err)
+			return;
+
+		rec[4] = LOGFILE_PUT;
+		rec[5] = 0;
+		put_le16(key_len, rec + 6);
+		put_le32(entry->len, rec + 8);
+		memcpy(rec + LOGFILE_REC_SIZE, entry->key, key_len);
+
+		while (offset < entry->len) {
+			ssize_t n = pread(compact->lf->fd, value + offset,
+						entry->len - offset,
+						entry->offset + offset);
+
+			if (n < 0 && errno == EINTR)
+				continue;
+
+			if (n <= 0) {
+				compact->err = -EIO;
+				return;
+			}
+
+			offset += n;
+		}
+
+		compact->len += LOGFILE_REC_SIZE + key_len + entry->len;
+	}
+}
+
+int logfile_compact(struct logfile *lf)
+{
+	struct compact_data compact;
+	char *tmp;
+	int fd, err;
+
+	if (lf->txn_len)
+		return -EBUSY;
+
+	memset(&compact, 0, sizeof(compact));
+	compact.lf = lf;
+	compact.buf = malloc(LOGFILE_HDR_SIZE + lf->live + 1);
+	if (!compact.buf)
+		return -ENOMEM;
+
+	put_le32(LOGFILE_MAGIC, compact.buf);
+	put_le32(LOGFILE_VERSION, compact.buf + 4);
+	compact.len = LOGFILE_HDR_SIZE;
+
+	hashmap_foreach(lf->index, compact_entry, &compact);
+	if (compact.err) {
+		free(compact.buf);
+		return compact.err;
+	}
+
+	/* All live records go into a single transaction */
+	if (compact.len > LOGFILE_HDR_SIZE) {
+		size_t offset;
+
+		for (offset = LOGFILE_HDR_SIZE; offset < compact.len;) {
+			uint8_t *rec = compact.buf + offset;
+			size_t size = LOGFILE_REC_SIZE + get_le16(rec + 6) +
+							get_le32(rec + 8);
+
+			if (offset + size == compact.len)
+				rec[5] |= LOGFILE_COMMIT;
+
+			put_le32(logfile_crc(rec + 4, size - 4), rec);
+			offset += size;
+		}
+	}
+
+	if (asprintf(&tmp, "%s.tmp", lf->pathname) < 0) {
+		free(compact.buf);
+		return -ENOMEM;
+	}
+
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+							S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		err = -errno;
+		goto done;
+	}
+
+	/* The old file is gone after the rename so always sync this one */
+	err = write_all(fd, compact.buf, compact.len, 0);
+	if (!err && fsync(fd) < 0)
+		err = -errno;
+
+	if (!err && flock(fd, LOCK_EX | LOCK_NB) < 0)
+		err = -errno;
+
+	if (!err && rename(tmp, lf->pathname) < 0)
+		err = -errno;
+
+	if (err < 0) {
+		close(fd);
+		unlink(tmp);
+		goto done;
+	}
+
+	close(lf->fd);
+	lf->fd = fd;
+
+	/* Offsets have all changed so rebuild the index */
+	hashmap_destroy(lf->index, logfile_entry_free);
+	lf->index = hashmap_new();
+	lf->count = 0;
+	lf->live = 0;
+
+	logfile_apply(lf, compact.buf + LOGFILE_HDR_SIZE,
+				compact.len - LOGFILE_HDR_SIZE,
+				LOGFILE_HDR_SIZE);
+
+	lf->size = compact.len;
+
+done:
+	free(tmp);
+	free(compact.buf);
+
+	return err;
+}
+
+/*
+ * Keep a damaged file as backup and replace it with the transactions that
+ * were committed before the damage, everything following it is lost.
+ */
+int logfile_recover(const char *pathname, const char *backup)
+{
+	struct stat st;
+	uint8_t *map;
+	size_t size, end, offset;
+	char *tmp;
+	int fd, err;
+
+	fd = open(pathname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	size = st.st_size;
+	if (size < LOGFILE_HDR_SIZE) {
+		close(fd);
+		return -EILSEQ;
+	}
+
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return -errno;
+
+	if (get_le32(map) != LOGFILE_MAGIC ||
+				get_le32(map + 4) != LOGFILE_VERSION) {
+		munmap(map, size);
+		return -EILSEQ;
+	}
+
+	end = logfile_end(map, size, &offset);
+
+	if (asprintf(&tmp, "%s.tmp", pathname) < 0) {
+		munmap(map, size);
+		return -ENOMEM;
+	}
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+							S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		err = -errno;
+		goto done;
+	}
+
+	err = write_all(fd, map, end, 0);
+	if (!err && fsync(fd) < 0)
+		err = -errno;
+
+	close(fd);
+
+	/* The damaged file stays around under its new name either way */
+	if (!err && unlink(backup) < 0 && errno != ENOENT)
+		err = -errno;
+
+	if (!err && link(pathname, backup) < 0)
+		err = -errno;
+
+	if (!err && rename(tmp, pathname) < 0)
+		err = -errno;
+
+	if (err < 0)
+		unlink(tmp);
+
+done:
+	free(tmp);
+	munmap(map, size);
+
+	return err;
+}
+
+unsigned int logfile_count(struct logfile *lf)
+{
+	return lf->count;
+}
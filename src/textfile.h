@@ -19,3 +19,26 @@ char *textfile_get(const char *pathname, const char *key);
 typedef void (*textfile_cb) (char *key, char *value, void *data);
 
 int textfile_foreach(const char *pathname, textfile_cb func, void *data);
+
+struct logfile;
+
+struct logfile *logfile_open(const char *pathname, bool sync);
+void logfile_close(struct logfile *lf);
+
+void logfile_begin(struct logfile *lf);
+int logfile_commit(struct logfile *lf);
+int logfile_sync(struct logfile *lf);
+
+int logfile_put(struct logfile *lf, const char *key, const void *value,
+								size_t len);
+int logfile_del(struct logfile *lf, const char *key);
+void *logfile_get(struct logfile *lf, const char *key, size_t *len);
+ssize_t logfile_read(struct logfile *lf, const char *key, void *buf,
+								size_t len);
+
+typedef void (*logfile_cb) (const char *key, size_t len, void *data);
+
+void logfile_foreach(struct logfile *lf, logfile_cb func, void *data);
+int logfile_compact(struct logfile *lf);
+int logfile_recover(const char *pathname, const char *backup);
+unsigned int logfile_count(struct logfile *lf);
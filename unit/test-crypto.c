@@ -16,6 +16,7 @@
 #include "src/shared/util.h"
 #include "src/shared/tester.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <glib.h>
 
@@ -311,6 +312,118 @@ static void test_verify_sign(gconstpointer data)
 	tester_test_passed();
 }
 
+static const struct {
+	enum bt_crypto_engine engine;
+	const char *name;
+} engines[] = {
+	{ BT_CRYPTO_ENGINE_SOFT,	"soft"	},
+	{ BT_CRYPTO_ENGINE_ACCEL,	"accel"	},
+	{ BT_CRYPTO_ENGINE_ALG,		"af_alg" },
+};
+
+#define ENGINE_ROUNDS	64
+
+static void engine_run(uint8_t e[ENGINE_ROUNDS][16],
+					uint8_t hash[ENGINE_ROUNDS][16],
+					uint8_t sign[ENGINE_ROUNDS][12])
+{
+	uint8_t key[16], in[16], msg[128];
+	struct iovec iov[2];
+	unsigned int i, j;
+
+	/* Deterministic pseudo random input so all engines see the same */
+	for (i = 0; i < ENGINE_ROUNDS; i++) {
+		for (j = 0; j < sizeof(key); j++)
+			key[j] = i * 31 + j * 7;
+
+		for (j = 0; j < sizeof(in); j++)
+			in[j] = i * 13 + j * 3;
+
+		for (j = 0; j < sizeof(msg); j++)
+			msg[j] = i + j * 17;
+
+		g_assert(bt_crypto_e(crypto, key, in, e[i]));
+
+		iov[0].iov_base = msg;
+		iov[0].iov_len = i;
+		iov[1].iov_base = msg + i;
+		iov[1].iov_len = i % 17;
+
+		g_assert(bt_crypto_gatt_hash(crypto, iov, 2, hash[i]));
+		g_assert(bt_crypto_sign_att(crypto, key, msg, i, i, sign[i]));
+	}
+}
+
+static void test_engine_compare(gconstpointer data)
+{
+	uint8_t ref_e[ENGINE_ROUNDS][16], ref_hash[ENGINE_ROUNDS][16];
+	uint8_t ref_sign[ENGINE_ROUNDS][12];
+	uint8_t e[ENGINE_ROUNDS][16], hash[ENGINE_ROUNDS][16];
+	uint8_t sign[ENGINE_ROUNDS][12];
+	unsigned int i;
+
+	g_assert(bt_crypto_set_engine(crypto, BT_CRYPTO_ENGINE_SOFT));
+	engine_run(ref_e, ref_hash, ref_sign);
+
+	for (i = 1; i < G_N_ELEMENTS(engines); i++) {
+		if (!bt_crypto_set_engine(crypto, engines[i].engine)) {
+			tester_debug("%s: not available", engines[i].name);
+			continue;
+		}
+
+		engine_run(e, hash, sign);
+
+		g_assert(!memcmp(e, ref_e, sizeof(e)));
+		g_assert(!memcmp(hash, ref_hash, sizeof(hash)));
+		g_assert(!memcmp(sign, ref_sign, sizeof(sign)));
+
+		tester_debug("%s: matches soft engine", engines[i].name);
+	}
+
+	bt_crypto_set_engine(crypto, BT_CRYPTO_ENGINE_AUTO);
+
+	tester_test_passed();
+}
+
+/* Only run on request, e.g. TEST_BENCHMARK=1 unit/test-crypto */
+#define BENCHMARK_COUNT	10000
+
+static void test_benchmark(gconstpointer data)
+{
+	const uint8_t k[16] = { 0x01 };
+	uint8_t in[16] = { 0x02 };
+	uint8_t msg[64] = { 0x03 };
+	uint8_t sign[12];
+	unsigned int i, n;
+	gint64 start, e_time, sign_time;
+
+	for (i = 0; i < G_N_ELEMENTS(engines); i++) {
+		if (!bt_crypto_set_engine(crypto, engines[i].engine)) {
+			tester_print("%s: not available", engines[i].name);
+			continue;
+		}
+
+		start = g_get_monotonic_time();
+		for (n = 0; n < BENCHMARK_COUNT; n++)
+			bt_crypto_e(crypto, k, in, in);
+		e_time = g_get_monotonic_time() - start;
+
+		start = g_get_monotonic_time();
+		for (n = 0; n < BENCHMARK_COUNT; n++)
+			bt_crypto_sign_att(crypto, k, msg, sizeof(msg), n, sign);
+		sign_time = g_get_monotonic_time() - start;
+
+		tester_print("%s: e %" G_GINT64_FORMAT " ns/op, sign_att %"
+				G_GINT64_FORMAT " ns/op", engines[i].name,
+				e_time * 1000 / BENCHMARK_COUNT,
+				sign_time * 1000 / BENCHMARK_COUNT);
+	}
+
+	bt_crypto_set_engine(crypto, BT_CRYPTO_ENGINE_AUTO);
+
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	int exit_status;
@@ -338,6 +451,13 @@ int main(int argc, char *argv[])
 	tester_add("/crypto/verify_sign_too_short", &verify_sign_too_short_data,
 						NULL, test_verify_sign, NULL);
 
+	tester_add("/crypto/engine_compare", NULL, NULL,
+						test_engine_compare, NULL);
+
+	if (getenv("TEST_BENCHMARK"))
+		tester_add("/crypto/benchmark", NULL, NULL, test_benchmark,
+									NULL);
+
 	exit_status = tester_run();
 
 	bt_crypto_unref(crypto);
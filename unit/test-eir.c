@@ -30,6 +30,12 @@ struct test_data {
 	const char *name;
 	bool name_complete;
 	int8_t tx_power;
+	uint32_t class;
+	uint16_t appearance;
+	uint16_t did_vendor;
+	uint16_t did_product;
+	uint16_t did_version;
+	uint16_t did_source;
 	const char **uuid;
 };
 
@@ -515,6 +521,29 @@ static const struct test_data citizen_scan_test = {
 	.uuid = citizen_scan_uuid,
 };
 
+static const unsigned char did_data[] = {
+		0x02, 0x01, 0x06, 0x07, 0x09, 0x42, 0x6c, 0x75,
+		0x65, 0x5a, 0x00, 0x04, 0x0d, 0x0c, 0x02, 0x5a,
+		0x03, 0x19, 0xc1, 0x03, 0x09, 0x10, 0x02, 0x00,
+		0x6b, 0x1d, 0x46, 0x02, 0x05, 0x05, 0x02, 0x0a,
+		0xf4, 0x00, 0x00, 0x00,
+};
+
+static const struct test_data did_test = {
+	.eir_data = did_data,
+	.eir_size = sizeof(did_data),
+	.flags = 0x06,
+	.name = "BlueZ",
+	.name_complete = true,
+	.tx_power = -12,
+	.class = 0x5a020c,
+	.appearance = 0x03c1,
+	.did_vendor = 0x1d6b,
+	.did_product = 0x0246,
+	.did_version = 0x0505,
+	.did_source = 0x0002,
+};
+
 static void test_basic(const void *data)
 {
 	struct eir_data eir;
@@ -543,6 +572,7 @@ static void test_parsing(gconstpointer data)
 {
 	const struct test_data *test = data;
 	struct eir_data eir;
+	struct eir_view view;
 	GSList *list;
 
 	memset(&eir, 0, sizeof(eir));
@@ -569,6 +599,12 @@ static void test_parsing(gconstpointer data)
 	}
 
 	g_assert(eir.tx_power == test->tx_power);
+	g_assert_cmpint(eir.class, ==, test->class);
+	g_assert_cmpint(eir.appearance, ==, test->appearance);
+	g_assert_cmpint(eir.did_vendor, ==, test->did_vendor);
+	g_assert_cmpint(eir.did_product, ==, test->did_product);
+	g_assert_cmpint(eir.did_version, ==, test->did_version);
+	g_assert_cmpint(eir.did_source, ==, test->did_source);
 
 	if (test->uuid) {
 		GSList *list;
@@ -583,6 +619,38 @@ static void test_parsing(gconstpointer data)
 		g_assert(eir.services == NULL);
 	}
 
+	eir_parse_view(&view, test->eir_data, test->eir_size);
+
+	g_assert_cmpint(view.flags, ==, test->flags);
+	g_assert(view.tx_power == test->tx_power);
+	g_assert_cmpint(view.class, ==, test->class);
+	g_assert_cmpint(view.appearance, ==, test->appearance);
+	g_assert_cmpint(view.did_vendor, ==, test->did_vendor);
+	g_assert_cmpint(view.did_product, ==, test->did_product);
+	g_assert_cmpint(view.did_version, ==, test->did_version);
+	g_assert_cmpint(view.did_source, ==, test->did_source);
+
+	/* The name is left as is, without NUL bytes at the end */
+	if (test->name) {
+		g_assert_cmpint(view.name_len, ==, strlen(test->name));
+		g_assert(!memcmp(view.name, test->name, view.name_len));
+		g_assert(view.name_complete == test->name_complete);
+	} else {
+		g_assert(view.name == NULL);
+	}
+
+	if (test->uuid) {
+		int n;
+
+		for (n = 0; test->uuid[n]; n++) {
+			bt_uuid_t uuid;
+
+			g_assert(!bt_string_to_uuid(&uuid, test->uuid[n]));
+			g_assert(eir_has_uuid(test->eir_data, test->eir_size,
+								&uuid));
+		}
+	}
+
 	for (list = eir.msd_list; list; list = list->next) {
 		struct eir_msd *msd = list->data;
 
@@ -656,6 +724,7 @@ int main(int argc, char *argv[])
 	tester_add("/eir/sl910", &gigaset_sl910_test, NULL, test_parsing, NULL);
 	tester_add("/eir/bh907", &nokia_bh907_test, NULL, test_parsing, NULL);
 	tester_add("/eir/fuelband", &fuelband_test, NULL, test_parsing, NULL);
+	tester_add("/eir/did", &did_test, NULL, test_parsing, NULL);
 	tester_add("/ad/bluesc", &bluesc_test, NULL, test_parsing, NULL);
 	tester_add("/ad/wahooscale", &wahoo_scale_test, NULL, test_parsing,
 									NULL);
@@ -18,6 +18,7 @@
 #include <inttypes.h>
 #include <string.h>
 #include <fcntl.h>
+#include <malloc.h>
 #include <sys/socket.h>
 
 #include <glib.h>
@@ -643,11 +644,32 @@ static void client_ready_cb(bool success, uint8_t att_ecode, void *user_data)
 	context_quit(context);
 }
 
+/* Watch the peer end of a socketpair, the watch owns the fd from now on */
+static guint watch_fd(int fd, GIOFunc func, gpointer user_data)
+{
+	GIOChannel *channel;
+	guint source;
+
+	channel = g_io_channel_unix_new(fd);
+
+	g_io_channel_set_close_on_unref(channel, TRUE);
+	g_io_channel_set_encoding(channel, NULL, NULL);
+	g_io_channel_set_buffered(channel, FALSE);
+
+	source = g_io_add_watch(channel,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				func, user_data);
+	g_assert(source > 0);
+
+	g_io_channel_unref(channel);
+
+	return source;
+}
+
 static struct context *create_context(uint16_t mtu, gconstpointer data)
 {
 	struct context *context = g_new0(struct context, 1);
 	const struct test_data *test_data = data;
-	GIOChannel *channel;
 	int err, sv[2];
 
 	err = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv);
@@ -691,19 +713,7 @@ static struct context *create_context(uint16_t mtu, gconstpointer data)
 		break;
 	}
 
-	channel = g_io_channel_unix_new(sv[1]);
-
-	g_io_channel_set_close_on_unref(channel, TRUE);
-	g_io_channel_set_encoding(channel, NULL, NULL);
-	g_io_channel_set_buffered(channel, FALSE);
-
-	context->source = g_io_add_watch(channel,
-				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
-				test_handler, context);
-	g_assert(context->source > 0);
-
-	g_io_channel_unref(channel);
-
+	context->source = watch_fd(sv[1], test_handler, context);
 	context->fd = sv[1];
 	context->data = data;
 
@@ -2268,6 +2278,302 @@ static const struct test_step test_notification_server_1 = {
 	.length = 0x03,
 };
 
+struct nfy_test;
+
+typedef void (*nfy_test_func_t)(struct nfy_test *test);
+
+/* Server over a socketpair checking the notifications the peer gets */
+struct nfy_test {
+	struct gatt_db *db;
+	struct bt_att *att;
+	struct bt_gatt_server *server;
+	int fd;
+	guint source;
+	unsigned int filler;		/* Messages written ahead of the PDUs */
+	const struct iovec *pdus;
+	unsigned int num_pdus;
+	unsigned int received;
+	nfy_test_func_t done;
+};
+
+static gboolean nfy_test_quit(gpointer user_data)
+{
+	struct nfy_test *test = user_data;
+
+	g_source_remove(test->source);
+	bt_gatt_server_unref(test->server);
+	bt_att_unref(test->att);
+	gatt_db_unref(test->db);
+	g_free(test);
+
+	tester_test_passed();
+
+	return FALSE;
+}
+
+static gboolean nfy_test_read(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	struct nfy_test *test = user_data;
+	const struct iovec *pdu;
+	uint8_t buf[512];
+	ssize_t len;
+
+	g_assert(!(cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)));
+
+	len = read(test->fd, buf, sizeof(buf));
+	g_assert(len > 0);
+
+	if (test->filler) {
+		test->filler--;
+		return TRUE;
+	}
+
+	tester_monitor('>', 0x0004, 0x0000, buf, len);
+
+	/* Every PDU arrives on its own and in the order it was sent */
+	g_assert_cmpint(test->received, <, test->num_pdus);
+	pdu = &test->pdus[test->received++];
+
+	g_assert_cmpint(len, ==, pdu->iov_len);
+	g_assert(!memcmp(buf, pdu->iov_base, len));
+
+	if (test->received < test->num_pdus)
+		return TRUE;
+
+	test->done(test);
+
+	g_idle_add(nfy_test_quit, test);
+
+	return TRUE;
+}
+
+static struct nfy_test *nfy_test_new(const struct iovec *pdus,
+					unsigned int num_pdus,
+					nfy_test_func_t done)
+{
+	struct nfy_test *test = g_new0(struct nfy_test, 1);
+	int err, sv[2];
+
+	err = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv);
+	g_assert(err == 0);
+
+	test->db = make_test_spec_small_db();
+
+	test->att = bt_att_new(sv[0], false);
+	g_assert(test->att);
+
+	bt_att_set_close_on_unref(test->att, true);
+
+	/* Local channels stay at the default MTU */
+	test->server = bt_gatt_server_new(test->db, test->att,
+						BT_ATT_DEFAULT_LE_MTU, 0);
+	g_assert(test->server);
+
+	bt_gatt_server_set_debug(test->server, print_debug,
+						"bt_gatt_server:", NULL);
+
+	test->fd = sv[1];
+	test->pdus = pdus;
+	test->num_pdus = num_pdus;
+	test->done = done;
+
+	return test;
+}
+
+static void nfy_test_read_pdus(struct nfy_test *test)
+{
+	test->source = watch_fd(test->fd, nfy_test_read, test);
+}
+
+static void nfy_test_send(struct nfy_test *test, unsigned int count,
+							bool multiple)
+{
+	while (count--)
+		g_assert(bt_gatt_server_send_notification(test->server, 0x0003,
+							read_data_1,
+							sizeof(read_data_1),
+							multiple));
+}
+
+/* More than the socket buffer takes so part of it has to be requeued */
+#define NOTIFICATION_BURST 24
+
+static uint8_t burst_pdus[NOTIFICATION_BURST][6];
+static struct iovec burst_iov[NOTIFICATION_BURST];
+
+static void nfy_test_burst_done(struct nfy_test *test)
+{
+	struct bt_att_chan_stats stats;
+
+	g_assert(bt_att_get_chan_stats(test->att, 0, &stats));
+
+	tester_debug("%" PRIu64 " PDUs in %" PRIu64 " writes", stats.tx_pdus,
+							stats.tx_writes);
+
+	g_assert_cmpint(stats.tx_pdus, ==, NOTIFICATION_BURST);
+	g_assert_cmpint(stats.tx_writes, <, stats.tx_pdus);
+}
+
+static void test_notification_burst(const void *data)
+{
+	struct nfy_test *test;
+	uint8_t value[] = { 0x00, 0x02, 0x03 };
+	int err, sndbuf = 1;
+
+	for (value[0] = 0; value[0] < NOTIFICATION_BURST; value[0]++) {
+		uint8_t *pdu = burst_pdus[value[0]];
+
+		pdu[0] = BT_ATT_OP_HANDLE_NFY;
+		put_le16(0x0003, pdu + 1);
+		memcpy(pdu + 3, value, sizeof(value));
+
+		burst_iov[value[0]].iov_base = pdu;
+		burst_iov[value[0]].iov_len = sizeof(burst_pdus[0]);
+	}
+
+	test = nfy_test_new(burst_iov, NOTIFICATION_BURST,
+						nfy_test_burst_done);
+
+	/* Clamped to the minimum, that holds only part of the burst */
+	err = setsockopt(bt_att_get_fd(test->att), SOL_SOCKET, SO_SNDBUF,
+						&sndbuf, sizeof(sndbuf));
+	g_assert(err == 0);
+
+	nfy_test_read_pdus(test);
+
+	/* Nothing is written until the main loop runs again */
+	for (value[0] = 0; value[0] < NOTIFICATION_BURST; value[0]++)
+		g_assert(bt_gatt_server_send_notification(test->server, 0x0003,
+							value, sizeof(value),
+							false));
+}
+
+/* As many 3 byte values as fit in a default MTU Multiple Handle Value PDU */
+#define NOTIFICATION_MULT_FULL 3
+
+#define NFY_MULT_TUPLE	0x03, 0x00, 0x03, 0x00, 0x01, 0x02, 0x03
+
+static const uint8_t nfy_mult_full[] = {
+	BT_ATT_OP_HANDLE_NFY_MULT, NFY_MULT_TUPLE, NFY_MULT_TUPLE,
+	NFY_MULT_TUPLE
+};
+
+static const uint8_t nfy_mult_two[] = {
+	BT_ATT_OP_HANDLE_NFY_MULT, NFY_MULT_TUPLE, NFY_MULT_TUPLE
+};
+
+static const uint8_t nfy_single[] = {
+	BT_ATT_OP_HANDLE_NFY, 0x03, 0x00, 0x01, 0x02, 0x03
+};
+
+/*
+ * The last value does not fit with the others and, being left on its own,
+ * is sent as a regular notification once the timeout expires.
+ */
+static const struct iovec nfy_mult_full_pdus[] = {
+	{ (void *) nfy_mult_full, sizeof(nfy_mult_full) },
+	{ (void *) nfy_single, sizeof(nfy_single) },
+};
+
+static void nfy_test_mult_full_done(struct nfy_test *test)
+{
+	struct bt_gatt_server_nfy_stats stats;
+
+	g_assert(bt_gatt_server_get_nfy_stats(test->server, &stats));
+
+	g_assert_cmpint(stats.values, ==, NOTIFICATION_MULT_FULL + 1);
+	g_assert_cmpint(stats.pdus, ==, 2);
+	g_assert_cmpint(stats.mult_pdus, ==, 1);
+	g_assert_cmpint(stats.full, ==, 1);
+	g_assert_cmpint(stats.held, ==, 0);
+	g_assert_cmpint(stats.max_values, ==, NOTIFICATION_MULT_FULL);
+}
+
+static void test_notification_mult_full(const void *data)
+{
+	struct nfy_test *test;
+
+	test = nfy_test_new(nfy_mult_full_pdus,
+					G_N_ELEMENTS(nfy_mult_full_pdus),
+					nfy_test_mult_full_done);
+
+	nfy_test_read_pdus(test);
+
+	/* One more than fits so the first PDU has to be flushed when full */
+	nfy_test_send(test, NOTIFICATION_MULT_FULL + 1, true);
+}
+
+/*
+ * The full PDU is stuck behind the filler when the timeout for the next
+ * one expires, that one is held until the full one is written.
+ */
+static const struct iovec nfy_mult_held_pdus[] = {
+	{ (void *) nfy_mult_full, sizeof(nfy_mult_full) },
+	{ (void *) nfy_mult_two, sizeof(nfy_mult_two) },
+};
+
+#define NFY_MULT_HELD_LATENCY	1
+
+static void nfy_test_mult_held_done(struct nfy_test *test)
+{
+	struct bt_gatt_server_nfy_stats stats;
+
+	g_assert(bt_gatt_server_get_nfy_stats(test->server, &stats));
+
+	g_assert_cmpint(stats.values, ==, NOTIFICATION_MULT_FULL + 2);
+	g_assert_cmpint(stats.pdus, ==, 2);
+	g_assert_cmpint(stats.mult_pdus, ==, 2);
+	g_assert_cmpint(stats.full, ==, 1);
+	g_assert_cmpint(stats.held, ==, 1);
+	g_assert_cmpint(stats.max_values, ==, NOTIFICATION_MULT_FULL);
+}
+
+static gboolean nfy_test_mult_held_read(gpointer user_data)
+{
+	struct nfy_test *test = user_data;
+	struct bt_gatt_server_nfy_stats stats;
+
+	/* Keep the peer from reading until the expired PDU is held */
+	g_assert(bt_gatt_server_get_nfy_stats(test->server, &stats));
+	if (!stats.held)
+		return TRUE;
+
+	/* Nothing got out yet, the full PDU is still the only one sent */
+	g_assert_cmpint(stats.held, ==, 1);
+	g_assert_cmpint(stats.mult_pdus, ==, 1);
+
+	nfy_test_read_pdus(test);
+
+	return FALSE;
+}
+
+static void test_notification_mult_held(const void *data)
+{
+	struct nfy_test *test;
+	uint8_t filler = 0;
+	int fd;
+
+	test = nfy_test_new(nfy_mult_held_pdus,
+					G_N_ELEMENTS(nfy_mult_held_pdus),
+					nfy_test_mult_held_done);
+
+	g_assert(bt_gatt_server_set_nfy_mult(test->server,
+						NFY_MULT_HELD_LATENCY, 1));
+
+	/* Fill the socket so nothing gets written until the peer reads */
+	fd = bt_att_get_fd(test->att);
+
+	while (send(fd, &filler, sizeof(filler), MSG_DONTWAIT) > 0)
+		test->filler++;
+
+	g_assert(test->filler > 0);
+
+	nfy_test_send(test, NOTIFICATION_MULT_FULL + 2, true);
+
+	g_idle_add(nfy_test_mult_held_read, test);
+}
+
 static uint8_t indication_received;
 
 static void test_indication_cb(void *user_data)
@@ -2332,6 +2638,793 @@ static const struct test_step test_indication_server_1 = {
 	.length = 0x03,
 };
 
+#define MEMORY_DB_COUNT 100
+
+/* Separately allocated attributes with their own UUID took 331 bytes */
+#define MEMORY_ATTRIBUTE_MAX	200
+
+/* A service spanning the rest of the handle range with 3 attributes */
+#define MEMORY_SPARSE_MAX	1024
+
+static void count_attribute(struct gatt_db_attribute *attrib, void *user_data)
+{
+	unsigned int *count = user_data;
+
+	(*count)++;
+}
+
+static void count_service(struct gatt_db_attribute *attrib, void *user_data)
+{
+	gatt_db_service_foreach(attrib, NULL, count_attribute, user_data);
+}
+
+static size_t heap_in_use(void)
+{
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+	struct mallinfo2 info = mallinfo2();
+
+	/* Large blocks are mapped separately and not part of uordblks */
+	return info.uordblks + info.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+static void test_db_memory(const void *data)
+{
+	struct gatt_db *dbs[MEMORY_DB_COUNT];
+	unsigned int i, count = 0;
+	size_t before, after;
+
+	before = heap_in_use();
+
+	for (i = 0; i < MEMORY_DB_COUNT; i++) {
+		dbs[i] = make_test_spec_large_db_1();
+		gatt_db_foreach_service(dbs[i], NULL, count_service, &count);
+	}
+
+	after = heap_in_use();
+
+	/* Heap usage can't be told with sanitizers replacing malloc */
+	if (after > before) {
+		tester_debug("%u attributes: %zu bytes per attribute", count,
+						(after - before) / count);
+		g_assert((after - before) / count <= MEMORY_ATTRIBUTE_MAX);
+	}
+
+	for (i = 0; i < MEMORY_DB_COUNT; i++)
+		gatt_db_unref(dbs[i]);
+
+	tester_test_passed();
+}
+
+static void test_db_memory_sparse(const void *data)
+{
+	struct gatt_db *db;
+	struct gatt_db_attribute *service, *attr;
+	uint16_t start, end;
+	size_t before, after;
+	bt_uuid_t uuid;
+
+	db = gatt_db_new();
+
+	before = heap_in_use();
+
+	/* Remote services are created to span the whole discovered range */
+	bt_string_to_uuid(&uuid, "a6695ace-ee7f-4fb9-881a-5fac66c629af");
+	service = gatt_db_insert_service(db, 0x0010, &uuid, true,
+							0xffff - 0x0010 + 1);
+	g_assert(service);
+
+	bt_string_to_uuid(&uuid, "d4e08d4c-c8e2-4e1f-9fd0-1b6a2bc4a0c5");
+	attr = gatt_db_insert_characteristic(db, 0x0012, &uuid,
+						BT_ATT_PERM_READ,
+						BT_GATT_CHRC_PROP_READ,
+						NULL, NULL, NULL);
+	g_assert(attr);
+
+	after = heap_in_use();
+
+	if (after > before) {
+		tester_debug("Sparse service: %zu bytes", after - before);
+		g_assert(after - before <= MEMORY_SPARSE_MAX);
+	}
+
+	g_assert(gatt_db_attribute_get_service_handles(service, &start,
+								&end));
+	g_assert(start == 0x0010 && end == 0xffff);
+
+	g_assert(gatt_db_get_attribute(db, 0x0012) == attr);
+	g_assert(!bt_uuid_cmp(gatt_db_attribute_get_type(attr), &uuid));
+	g_assert(gatt_db_attribute_get_handle(gatt_db_get_attribute(db,
+							0x0011)) == 0x0011);
+	g_assert(!gatt_db_get_attribute(db, 0x0013));
+	g_assert(!gatt_db_get_attribute(db, 0xffff));
+
+	/* More attributes still fit anywhere in the range */
+	bt_uuid16_create(&uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+	attr = gatt_db_insert_descriptor(db, 0xfffe, &uuid,
+					BT_ATT_PERM_READ | BT_ATT_PERM_WRITE,
+					NULL, NULL, NULL);
+	g_assert(attr);
+	g_assert(gatt_db_get_attribute(db, 0xfffe) == attr);
+
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
+static struct gatt_db_attribute *add_battery_service(struct gatt_db *db)
+{
+	struct gatt_db_attribute *service;
+	bt_uuid_t uuid;
+	uint8_t level = 100;
+
+	bt_uuid16_create(&uuid, 0x180f);
+	service = gatt_db_insert_service(db, 0x0100, &uuid, true, 4);
+	g_assert(service);
+
+	bt_uuid16_create(&uuid, 0x2a19);
+	add_char_with_value(service, 0, &uuid, BT_ATT_PERM_READ,
+				BT_GATT_CHRC_PROP_READ |
+				BT_GATT_CHRC_PROP_NOTIFY, &level,
+				sizeof(level));
+
+	bt_uuid16_create(&uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+	g_assert(gatt_db_service_add_descriptor(service, &uuid,
+					BT_ATT_PERM_READ | BT_ATT_PERM_WRITE,
+					NULL, NULL, NULL));
+
+	gatt_db_service_set_active(service, true);
+
+	return service;
+}
+
+static void check_db_hash(struct gatt_db *db, struct gatt_db *ref)
+{
+	/* The reference database has its hash generated in one go */
+	g_assert(!memcmp(gatt_db_get_hash(db), gatt_db_get_hash(ref), 16));
+}
+
+static void test_db_hash(const void *data)
+{
+	struct gatt_db *db, *ref;
+	struct gatt_db_attribute *attrib, *service;
+	uint8_t hash[16];
+	const uint8_t value[] = { 0x01, 0x02, 0x03 };
+
+	db = make_test_spec_small_db();
+	memcpy(hash, gatt_db_get_hash(db), sizeof(hash));
+
+	/* Characteristic values are not part of the hash */
+	attrib = gatt_db_get_attribute(db, 0x0003);
+	g_assert(attrib);
+	g_assert(gatt_db_attribute_write(attrib, 0, value, sizeof(value),
+						0x00, NULL, att_write_cb,
+						NULL));
+	g_assert(!memcmp(gatt_db_get_hash(db), hash, sizeof(hash)));
+
+	/* Adding a service only regenerates the input of that service */
+	service = add_battery_service(db);
+	g_assert(memcmp(gatt_db_get_hash(db), hash, sizeof(hash)));
+
+	ref = make_test_spec_small_db();
+	add_battery_service(ref);
+	check_db_hash(db, ref);
+	gatt_db_unref(ref);
+
+	/* Inactive services are left out */
+	gatt_db_service_set_active(service, false);
+
+	ref = make_test_spec_small_db();
+	check_db_hash(db, ref);
+
+	gatt_db_service_set_active(service, true);
+	gatt_db_remove_service(db, service);
+	check_db_hash(db, ref);
+	g_assert(!memcmp(gatt_db_get_hash(db), hash, sizeof(hash)));
+
+	gatt_db_unref(ref);
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
+#define SCHED_PEERS 3
+
+struct sched_test;
+
+struct sched_peer {
+	struct sched_test *test;
+	int fd;
+	guint source;
+	bool hold;			/* Answer requests only when released */
+	bool silent;			/* Leave requests and indications */
+	unsigned int reqs;
+	unsigned int inds;
+	unsigned int cmds;
+	uint16_t max_len;
+};
+
+typedef void (*sched_step_t)(struct sched_test *test);
+
+struct sched_test {
+	struct bt_att *att;
+	struct sched_peer peers[SCHED_PEERS];
+	unsigned int num_peers;
+	unsigned int waiting;		/* PDUs yet to make it through */
+	sched_step_t step;
+};
+
+static void sched_test_next(struct sched_test *test, sched_step_t step,
+							unsigned int waiting)
+{
+	test->step = step;
+	test->waiting = waiting;
+}
+
+static void sched_test_done_one(struct sched_test *test)
+{
+	g_assert(test->waiting > 0);
+
+	if (--test->waiting)
+		return;
+
+	test->step(test);
+}
+
+static void sched_peer_write(struct sched_peer *peer, const uint8_t *pdu,
+							size_t len)
+{
+	g_assert_cmpint(write(peer->fd, pdu, len), ==, len);
+}
+
+static void sched_peer_respond(struct sched_peer *peer)
+{
+	static const uint8_t rsp[] = { BT_ATT_OP_READ_RSP, 0x01, 0x02, 0x03 };
+
+	sched_peer_write(peer, rsp, sizeof(rsp));
+}
+
+static gboolean sched_peer_read(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	static const uint8_t conf[] = { BT_ATT_OP_HANDLE_CONF };
+	struct sched_peer *peer = user_data;
+	uint8_t buf[512];
+	ssize_t len;
+
+	if (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)) {
+		peer->source = 0;
+		return FALSE;
+	}
+
+	len = read(peer->fd, buf, sizeof(buf));
+	g_assert(len > 0);
+
+	tester_monitor('>', 0x0004, 0x0000, buf, len);
+
+	switch (buf[0]) {
+	case BT_ATT_OP_READ_REQ:
+		peer->reqs++;
+
+		if (peer->silent || peer->hold)
+			break;
+
+		sched_peer_respond(peer);
+		break;
+	case BT_ATT_OP_HANDLE_IND:
+		peer->inds++;
+
+		if (peer->silent)
+			sched_test_done_one(peer->test);
+		else
+			sched_peer_write(peer, conf, sizeof(conf));
+		break;
+	case BT_ATT_OP_WRITE_CMD:
+		peer->cmds++;
+		peer->max_len = MAX(peer->max_len, len);
+		sched_test_done_one(peer->test);
+		break;
+	default:
+		g_assert_not_reached();
+	}
+
+	return TRUE;
+}
+
+static void sched_peer_init(struct sched_test *test, struct sched_peer *peer,
+								int fd)
+{
+	peer->test = test;
+	peer->fd = fd;
+	peer->source = watch_fd(fd, sched_peer_read, peer);
+}
+
+/*
+ * Peer 0 sits on the original channel, the others on channels attached
+ * after it so the last peer is at the head of the channel list.
+ */
+static struct sched_test *sched_test_new(unsigned int num_peers,
+						enum bt_att_sched sched,
+						uint16_t mtu)
+{
+	struct sched_test *test = g_new0(struct sched_test, 1);
+	unsigned int i;
+	int err, sv[2];
+
+	for (i = 0; i < num_peers; i++) {
+		err = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0,
+									sv);
+		g_assert(err == 0);
+
+		if (!i) {
+			test->att = bt_att_new(sv[0], false);
+			g_assert(test->att);
+
+			bt_att_set_close_on_unref(test->att, true);
+			bt_att_set_debug(test->att, 1, print_debug, "bt_att:",
+									NULL);
+			g_assert(bt_att_set_mtu(test->att, mtu));
+		} else
+			g_assert(bt_att_attach_local_fd(test->att,
+								sv[0]) == 0);
+
+		sched_peer_init(test, &test->peers[i], sv[1]);
+	}
+
+	test->num_peers = num_peers;
+
+	g_assert(bt_att_set_scheduler(test->att, sched));
+
+	return test;
+}
+
+static gboolean sched_test_quit(gpointer user_data)
+{
+	struct sched_test *test = user_data;
+	unsigned int i;
+
+	for (i = 0; i < test->num_peers; i++) {
+		if (test->peers[i].source)
+			g_source_remove(test->peers[i].source);
+	}
+
+	bt_att_unref(test->att);
+	g_free(test);
+
+	tester_test_passed();
+
+	return FALSE;
+}
+
+static void sched_rsp_cb(uint8_t opcode, const void *pdu, uint16_t length,
+							void *user_data)
+{
+	struct sched_test *test = user_data;
+
+	g_assert_cmpint(opcode, ==, BT_ATT_OP_READ_RSP);
+
+	sched_test_done_one(test);
+}
+
+static void sched_send_read(struct sched_test *test, unsigned int count)
+{
+	uint8_t pdu[] = { 0x03, 0x00 };
+
+	while (count--)
+		g_assert(bt_att_send(test->att, BT_ATT_OP_READ_REQ, pdu,
+						sizeof(pdu), sched_rsp_cb,
+						test, NULL));
+}
+
+static void sched_send_write(struct sched_test *test, uint16_t len)
+{
+	uint8_t pdu[64] = { 0x03, 0x00 };
+
+	g_assert(len <= sizeof(pdu));
+	g_assert(bt_att_send(test->att, BT_ATT_OP_WRITE_CMD, pdu, len,
+							NULL, NULL, NULL));
+}
+
+static void sched_conf_cb(uint8_t opcode, const void *pdu, uint16_t length,
+							void *user_data)
+{
+	/* Never confirmed, this only runs as the test goes away */
+	g_assert_cmpint(opcode, ==, BT_ATT_OP_ERROR_RSP);
+}
+
+static void sched_least_outstanding_done(struct sched_test *test)
+{
+	/* The request went around the indication left pending */
+	g_assert_cmpint(test->peers[1].inds, ==, 1);
+	g_assert_cmpint(test->peers[1].reqs, ==, 0);
+	g_assert_cmpint(test->peers[0].reqs, ==, 1);
+
+	g_idle_add(sched_test_quit, test);
+}
+
+static void sched_least_outstanding_read(struct sched_test *test)
+{
+	sched_test_next(test, sched_least_outstanding_done, 1);
+	sched_send_read(test, 1);
+}
+
+static void test_sched_least_outstanding(const void *data)
+{
+	struct sched_test *test;
+	uint8_t pdu[] = { 0x03, 0x00, 0x01 };
+
+	test = sched_test_new(2, BT_ATT_SCHED_LEAST_OUTSTANDING,
+							BT_ATT_DEFAULT_LE_MTU);
+
+	/* Peers are idle so the indication goes to the head channel */
+	test->peers[1].silent = true;
+
+	sched_test_next(test, sched_least_outstanding_read, 1);
+	g_assert(bt_att_send(test->att, BT_ATT_OP_HANDLE_IND, pdu,
+					sizeof(pdu), sched_conf_cb, NULL, NULL));
+}
+
+#define SCHED_SMALL_LEN		10
+#define SCHED_LARGE_LEN		40
+
+static void sched_mtu_fit_done(struct sched_test *test)
+{
+	/* Only what does not fit the default MTU takes the bigger one */
+	g_assert_cmpint(test->peers[0].cmds, ==, 2);
+	g_assert_cmpint(test->peers[0].max_len, ==, SCHED_LARGE_LEN + 1);
+	g_assert_cmpint(test->peers[1].cmds + test->peers[2].cmds, ==, 4);
+	g_assert_cmpint(test->peers[1].max_len, <=, SCHED_SMALL_LEN + 1);
+	g_assert_cmpint(test->peers[2].max_len, <=, SCHED_SMALL_LEN + 1);
+
+	g_idle_add(sched_test_quit, test);
+}
+
+static void test_sched_mtu_fit(const void *data)
+{
+	struct sched_test *test;
+
+	test = sched_test_new(3, BT_ATT_SCHED_MTU_FIT, 64);
+
+	sched_test_next(test, sched_mtu_fit_done, 6);
+
+	sched_send_write(test, SCHED_SMALL_LEN);
+	sched_send_write(test, SCHED_SMALL_LEN);
+	sched_send_write(test, SCHED_LARGE_LEN);
+	sched_send_write(test, SCHED_SMALL_LEN);
+	sched_send_write(test, SCHED_SMALL_LEN);
+	sched_send_write(test, SCHED_LARGE_LEN);
+}
+
+/*
+ * The slow peer holds its answer while the fast one goes through this many
+ * round trips, the slow round trip ends up far longer than the fast one.
+ */
+#define SCHED_LATENCY_TRIPS	64
+#define SCHED_LATENCY_READS	8
+
+static void sched_latency_done(struct sched_test *test)
+{
+	/* The idle slow channel is not worth waiting on */
+	g_assert_cmpint(test->peers[0].reqs, ==, 1);
+	g_assert_cmpint(test->peers[1].reqs, ==,
+				SCHED_LATENCY_TRIPS + SCHED_LATENCY_READS);
+
+	g_idle_add(sched_test_quit, test);
+}
+
+static void sched_latency_read(struct sched_test *test)
+{
+	struct bt_att_chan_stats fast, slow;
+
+	/* Both channels have a round trip measured by now */
+	g_assert(bt_att_get_chan_stats(test->att, 0, &fast));
+	g_assert(bt_att_get_chan_stats(test->att, 1, &slow));
+	g_assert_cmpint(slow.rtt, >, (uint64_t) fast.rtt *
+						(SCHED_LATENCY_READS + 1));
+	g_assert_cmpint(test->peers[0].reqs, ==, 1);
+	g_assert_cmpint(test->peers[1].reqs, ==, SCHED_LATENCY_TRIPS);
+
+	g_assert(bt_att_set_scheduler(test->att, BT_ATT_SCHED_LATENCY));
+
+	sched_test_next(test, sched_latency_done, SCHED_LATENCY_READS);
+	sched_send_read(test, SCHED_LATENCY_READS);
+}
+
+static void sched_latency_trip(struct sched_test *test)
+{
+	if (test->peers[1].reqs < SCHED_LATENCY_TRIPS) {
+		sched_test_next(test, sched_latency_trip, 1);
+		sched_send_read(test, 1);
+		return;
+	}
+
+	sched_test_next(test, sched_latency_read, 1);
+	sched_peer_respond(&test->peers[0]);
+}
+
+static void test_sched_latency(const void *data)
+{
+	struct sched_test *test;
+
+	/* Spread the reads until both channels have a round trip time */
+	test = sched_test_new(2, BT_ATT_SCHED_LEAST_OUTSTANDING,
+							BT_ATT_DEFAULT_LE_MTU);
+
+	test->peers[0].hold = true;
+
+	/* One read each, only the fast one is answered */
+	sched_test_next(test, sched_latency_trip, 1);
+	sched_send_read(test, 2);
+}
+
+#define PARALLEL_BEARERS 3
+
+/*
+ * Client and server over several bearers, optionally with the original
+ * bearer of the client answering every request with an error.
+ */
+struct parallel_test {
+	struct gatt_db *server_db;
+	struct gatt_db *client_db;
+	struct bt_att *server_att;
+	struct bt_att *client_att;
+	struct bt_gatt_server *server;
+	struct bt_gatt_client *client;
+	int bad_fd;
+	guint bad_source;
+	unsigned int bad_reqs;
+	unsigned int reqs;		/* Discovery requests the server got */
+	unsigned int reqs_cancel;
+	bool ready;
+};
+
+static gboolean parallel_test_quit(gpointer user_data)
+{
+	struct parallel_test *test = user_data;
+
+	if (test->bad_source)
+		g_source_remove(test->bad_source);
+
+	bt_gatt_client_unref(test->client);
+	bt_gatt_server_unref(test->server);
+	bt_att_unref(test->client_att);
+	bt_att_unref(test->server_att);
+	gatt_db_unref(test->client_db);
+	gatt_db_unref(test->server_db);
+	g_free(test);
+
+	tester_test_passed();
+
+	return FALSE;
+}
+
+static gboolean parallel_bad_read(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	struct parallel_test *test = user_data;
+	uint8_t buf[512], rsp[5];
+	ssize_t len;
+
+	if (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)) {
+		test->bad_source = 0;
+		return FALSE;
+	}
+
+	len = read(test->bad_fd, buf, sizeof(buf));
+	g_assert(len >= 3);
+
+	/* Only the parallel discovery requests reach this bearer */
+	g_assert(buf[0] == BT_ATT_OP_READ_BY_TYPE_REQ ||
+					buf[0] == BT_ATT_OP_FIND_INFO_REQ);
+
+	test->bad_reqs++;
+
+	rsp[0] = BT_ATT_OP_ERROR_RSP;
+	rsp[1] = buf[0];
+	memcpy(rsp + 2, buf + 1, 2);
+	rsp[4] = BT_ATT_ERROR_UNLIKELY;
+
+	g_assert_cmpint(write(test->bad_fd, rsp, sizeof(rsp)), ==,
+								sizeof(rsp));
+
+	return TRUE;
+}
+
+static void parallel_bad_bearer(struct parallel_test *test, int fd)
+{
+	test->bad_fd = fd;
+	test->bad_source = watch_fd(fd, parallel_bad_read, test);
+}
+
+static void parallel_server_req(struct bt_att_chan *chan, uint8_t opcode,
+					const void *pdu, uint16_t length,
+					void *user_data)
+{
+	struct parallel_test *test = user_data;
+
+	test->reqs++;
+}
+
+static struct parallel_test *parallel_test_new(bool bad_bearer,
+					bt_gatt_client_callback_t ready)
+{
+	struct parallel_test *test = g_new0(struct parallel_test, 1);
+	int i, err, sv[2];
+
+	for (i = 0; i < PARALLEL_BEARERS; i++) {
+		err = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0,
+									sv);
+		g_assert(err == 0);
+
+		if (!i) {
+			test->client_att = bt_att_new(sv[0], false);
+			g_assert(test->client_att);
+			bt_att_set_close_on_unref(test->client_att, true);
+		} else
+			g_assert(bt_att_attach_local_fd(test->client_att,
+								sv[0]) == 0);
+
+		if (!i && bad_bearer) {
+			parallel_bad_bearer(test, sv[1]);
+			continue;
+		}
+
+		if (!test->server_att) {
+			test->server_att = bt_att_new(sv[1], false);
+			g_assert(test->server_att);
+			bt_att_set_close_on_unref(test->server_att, true);
+		} else
+			g_assert(bt_att_attach_local_fd(test->server_att,
+								sv[1]) == 0);
+	}
+
+	/*
+	 * With one request in flight it goes to the channel attached last,
+	 * only the parallel discovery spreads over all of them.
+	 */
+	g_assert(bt_att_set_scheduler(test->client_att,
+					BT_ATT_SCHED_LEAST_OUTSTANDING));
+
+	bt_att_register(test->server_att, BT_ATT_OP_READ_BY_TYPE_REQ,
+					parallel_server_req, test, NULL);
+	bt_att_register(test->server_att, BT_ATT_OP_FIND_INFO_REQ,
+					parallel_server_req, test, NULL);
+
+	test->server_db = make_test_spec_large_db_1();
+	test->server = bt_gatt_server_new(test->server_db, test->server_att,
+						BT_ATT_DEFAULT_LE_MTU, 0);
+	g_assert(test->server);
+
+	test->client_db = gatt_db_new();
+	test->client = bt_gatt_client_new(test->client_db, test->client_att,
+						BT_ATT_DEFAULT_LE_MTU, 0);
+	g_assert(test->client);
+
+	bt_gatt_client_set_debug(test->client, print_debug,
+						"bt_gatt_client:", NULL);
+
+	bt_gatt_client_ready_register(test->client, ready, test, NULL);
+
+	return test;
+}
+
+static void count_services(struct gatt_db_attribute *attrib, void *user_data)
+{
+	unsigned int *count = user_data;
+
+	(*count)++;
+}
+
+static void parallel_complete_ready(bool success, uint8_t att_ecode,
+							void *user_data)
+{
+	struct parallel_test *test = user_data;
+	struct bt_att_chan_stats stats;
+	unsigned int i, svcs = 0, ref_svcs = 0, used = 0;
+
+	g_assert(success);
+
+	gatt_db_foreach_service(test->client_db, NULL, match_services,
+							test->server_db);
+	gatt_db_foreach_service(test->client_db, NULL, count_services, &svcs);
+	gatt_db_foreach_service(test->server_db, NULL, count_services,
+								&ref_svcs);
+	g_assert_cmpint(svcs, ==, ref_svcs);
+
+	for (i = 0; bt_att_get_chan_stats(test->client_att, i, &stats); i++)
+		if (stats.tx_pdus)
+			used++;
+
+	g_assert_cmpint(used, ==, PARALLEL_BEARERS);
+
+	g_idle_add(parallel_test_quit, test);
+}
+
+static void test_parallel_discovery(const void *data)
+{
+	parallel_test_new(false, parallel_complete_ready);
+}
+
+static void parallel_error_ready(bool success, uint8_t att_ecode,
+							void *user_data)
+{
+	struct parallel_test *test = user_data;
+
+	g_assert(!success);
+	g_assert_cmpint(att_ecode, ==, BT_ATT_ERROR_UNLIKELY);
+	g_assert_cmpint(test->bad_reqs, ==, 1);
+
+	/* Nothing of the failed discovery is left behind in the db */
+	g_assert(gatt_db_isempty(test->client_db));
+
+	g_idle_add(parallel_test_quit, test);
+}
+
+static void test_parallel_discovery_error(const void *data)
+{
+	parallel_test_new(true, parallel_error_ready);
+}
+
+static void parallel_cancel_ready(bool success, uint8_t att_ecode,
+							void *user_data)
+{
+	struct parallel_test *test = user_data;
+
+	test->ready = true;
+}
+
+static gboolean parallel_cancel_check(gpointer user_data)
+{
+	struct parallel_test *test = user_data;
+	struct bt_att_chan_stats stats;
+	unsigned int i;
+
+	/* Wait for the answers to what was already on its way */
+	for (i = 0; bt_att_get_chan_stats(test->client_att, i, &stats); i++) {
+		g_assert_cmpint(stats.queued, ==, 0);
+
+		if (stats.outstanding)
+			return TRUE;
+	}
+
+	g_assert(!test->ready);
+
+	/* At most what was already on its way made it to the server */
+	g_assert_cmpint(test->reqs, <, test->reqs_cancel + PARALLEL_BEARERS);
+
+	parallel_test_quit(test);
+
+	return FALSE;
+}
+
+static void parallel_cancel_req(struct bt_att_chan *chan, uint8_t opcode,
+					const void *pdu, uint16_t length,
+					void *user_data)
+{
+	struct parallel_test *test = user_data;
+
+	if (test->reqs_cancel)
+		return;
+
+	/* Cancel as soon as descriptor discovery has started */
+	test->reqs_cancel = test->reqs;
+	g_assert(bt_gatt_client_cancel_all(test->client));
+
+	g_idle_add(parallel_cancel_check, test);
+}
+
+static void test_parallel_discovery_cancel(const void *data)
+{
+	struct parallel_test *test;
+
+	test = parallel_test_new(false, parallel_cancel_ready);
+
+	bt_att_register(test->server_att, BT_ATT_OP_FIND_INFO_REQ,
+					parallel_cancel_req, test, NULL);
+}
+
 int main(int argc, char *argv[])
 {
 	struct gatt_db *service_db_1, *service_db_2, *service_db_3;
@@ -4472,5 +5565,28 @@ int main(int argc, char *argv[])
 			raw_pdu(0xff, 0x00),
 			raw_pdu());
 
+	tester_add("/gatt-db/memory", NULL, NULL, test_db_memory, NULL);
+	tester_add("/gatt-db/memory/sparse", NULL, NULL,
+						test_db_memory_sparse, NULL);
+	tester_add("/gatt-db/hash", NULL, NULL, test_db_hash, NULL);
+
+	tester_add("/att/sched/least-outstanding", NULL, NULL,
+					test_sched_least_outstanding, NULL);
+	tester_add("/att/sched/mtu-fit", NULL, NULL, test_sched_mtu_fit, NULL);
+	tester_add("/att/sched/latency", NULL, NULL, test_sched_latency, NULL);
+
+	tester_add("/gatt-client/parallel-discovery", NULL, NULL,
+					test_parallel_discovery, NULL);
+	tester_add("/gatt-client/parallel-discovery/error", NULL, NULL,
+					test_parallel_discovery_error, NULL);
+	tester_add("/gatt-client/parallel-discovery/cancel", NULL, NULL,
+					test_parallel_discovery_cancel, NULL);
+	tester_add("/att/batch/notification-burst", NULL, NULL,
+					test_notification_burst, NULL);
+	tester_add("/gatt-server/notify-multiple/full", NULL, NULL,
+					test_notification_mult_full, NULL);
+	tester_add("/gatt-server/notify-multiple/max-pending", NULL, NULL,
+					test_notification_mult_held, NULL);
+
 	return tester_run();
 }
@@ -2023,6 +2023,57 @@ static void check_k4(const struct mesh_crypto_test *keys)
 	l_info("");
 }
 
+static void check_cached(const struct mesh_crypto_test *keys)
+{
+	uint8_t *dev_key;
+	uint8_t *app_key;
+	uint8_t *net_key;
+	uint8_t enc_key[16];
+	uint8_t priv_key[16];
+	uint8_t p[] = { 0 };
+	uint8_t nid;
+	struct crypto_key *ck;
+
+	dev_key = l_util_from_hexstring(keys->dev_key, NULL);
+	app_key = l_util_from_hexstring(keys->app_key, NULL);
+	net_key = l_util_from_hexstring(keys->net_key, NULL);
+
+	mesh_crypto_k2(net_key, p, sizeof(p), &nid, enc_key, priv_key);
+
+	mesh_crypto_key_ref(enc_key);
+	mesh_crypto_key_ref(priv_key);
+	mesh_crypto_key_ref(app_key);
+	mesh_crypto_key_ref(dev_key);
+
+	/* Run twice so the second pass reuses the cached contexts */
+	check_encrypt(keys);
+	check_decrypt(keys);
+	check_decrypt(keys);
+
+	l_info(COLOR_BLUE "[Cached %s]" COLOR_OFF, keys->name);
+
+	ck = crypto_key_find(priv_key);
+	verify_uint8("PrivacyECB", 0, true, ck && ck->ecb);
+
+	ck = crypto_key_find(enc_key);
+	verify_uint8("NetworkCCM", 0, true, ck && (ck->ccm4 || ck->ccm8));
+
+	ck = crypto_key_find(keys->akf ? app_key : dev_key);
+	verify_uint8("AccessCCM", 0, true, ck && (ck->ccm4 || ck->ccm8));
+
+	mesh_crypto_key_unref(dev_key);
+	mesh_crypto_key_unref(app_key);
+	mesh_crypto_key_unref(priv_key);
+	mesh_crypto_key_unref(enc_key);
+
+	verify_uint8("Released", 0, true, crypto_keys == NULL);
+	l_info("");
+
+	l_free(net_key);
+	l_free(app_key);
+	l_free(dev_key);
+}
+
 int main(int argc, char *argv[])
 {
 	l_log_set_stderr();
@@ -2069,6 +2120,10 @@ int main(int argc, char *argv[])
 	check_encrypt(&s8_3_22);
 	check_decrypt(&s8_3_22);
 
+	/* Section 8.3 Sample Data with cached key contexts */
+	check_cached(&s8_3_6);
+	check_cached(&s8_3_22);
+
 	/* Section 8.4 Beacon Sample Data */
 	check_beacon(&s8_4_3);
 
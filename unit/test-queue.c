@@ -12,10 +12,13 @@
 #include <config.h>
 #endif
 
+#include <stdlib.h>
+
 #include <glib.h>
 
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
+#include "src/shared/hashmap.h"
 #include "src/shared/tester.h"
 
 static void test_basic(const void *data)
@@ -246,6 +249,252 @@ static void test_remove_all(const void *data)
 	tester_test_passed();
 }
 
+static void test_hashmap_basic(const void *data)
+{
+	struct hashmap *map;
+	unsigned int n, i;
+
+	map = hashmap_new();
+	g_assert(map != NULL);
+
+	for (n = 0; n < 1024; n++) {
+		for (i = 1; i < n + 2; i++)
+			g_assert(hashmap_insert(map, i, UINT_TO_PTR(i)));
+
+		g_assert(hashmap_length(map) == n + 1);
+		g_assert(!hashmap_insert(map, 1, UINT_TO_PTR(1)));
+
+		for (i = 1; i < n + 2; i++)
+			g_assert(hashmap_lookup(map, i) == UINT_TO_PTR(i));
+
+		g_assert(hashmap_lookup(map, n + 2) == NULL);
+
+		for (i = 1; i < n + 2; i++)
+			g_assert(hashmap_remove_key(map, i) == UINT_TO_PTR(i));
+
+		g_assert(hashmap_isempty(map) == true);
+	}
+
+	hashmap_destroy(map, NULL);
+	tester_test_passed();
+}
+
+static void check_order(void *data, void *user_data)
+{
+	unsigned int *next = user_data;
+
+	g_assert(PTR_TO_UINT(data) == *next);
+
+	*next += 2;
+}
+
+static void test_hashmap_order(const void *data)
+{
+	struct hashmap *map;
+	unsigned int i, next;
+
+	map = hashmap_new();
+	g_assert(map != NULL);
+
+	/* Keys are inserted in reverse, iteration follows insertion order */
+	for (i = 0; i < 256; i++)
+		g_assert(hashmap_insert(map, 256 - i, UINT_TO_PTR(i)));
+
+	for (i = 1; i < 256; i += 2)
+		g_assert(hashmap_remove(map, UINT_TO_PTR(i)));
+
+	next = 0;
+	hashmap_foreach(map, check_order, &next);
+	g_assert(next == 256);
+
+	g_assert(hashmap_find(map, match_int, INT_TO_PTR(100)) ==
+							UINT_TO_PTR(100));
+	g_assert(hashmap_find(map, match_int, INT_TO_PTR(101)) == NULL);
+	g_assert(hashmap_remove_if(map, match_int, INT_TO_PTR(0)) == NULL);
+	g_assert(hashmap_length(map) == 127);
+
+	hashmap_destroy(map, NULL);
+	tester_test_passed();
+}
+
+static struct hashmap *static_map;
+
+static void hashmap_foreach_remove(void *data, void *user_data)
+{
+	unsigned int i = PTR_TO_UINT(data);
+
+	/* Remove the current entry and the one after it */
+	g_assert(hashmap_remove_key(static_map, i) == data);
+	hashmap_remove_key(static_map, i + 1);
+
+	/* Entries added while iterating are visited as well */
+	if (i < 64)
+		g_assert(hashmap_insert(static_map, i + 1000,
+						UINT_TO_PTR(i + 1000)));
+
+	(*(unsigned int *) user_data)++;
+}
+
+static void test_hashmap_foreach_remove(const void *data)
+{
+	unsigned int i, count = 0;
+
+	static_map = hashmap_new();
+	g_assert(static_map != NULL);
+
+	for (i = 0; i < 64; i++)
+		g_assert(hashmap_insert(static_map, i, UINT_TO_PTR(i)));
+
+	hashmap_foreach(static_map, hashmap_foreach_remove, &count);
+
+	g_assert(count == 64);
+	g_assert(hashmap_isempty(static_map));
+
+	hashmap_destroy(static_map, NULL);
+	tester_test_passed();
+}
+
+static void hashmap_foreach_destroy(void *data, void *user_data)
+{
+	struct hashmap *map = user_data;
+
+	hashmap_destroy(map, NULL);
+}
+
+static void test_hashmap_foreach_destroy(const void *data)
+{
+	struct hashmap *map;
+
+	map = hashmap_new();
+	g_assert(map != NULL);
+
+	hashmap_insert(map, 1, UINT_TO_PTR(1));
+	hashmap_insert(map, 2, UINT_TO_PTR(2));
+
+	hashmap_foreach(map, hashmap_foreach_destroy, map);
+	tester_test_passed();
+}
+
+static void test_hashmap_remove_all(const void *data)
+{
+	struct hashmap *map;
+	unsigned int i;
+
+	map = hashmap_new();
+	g_assert(map != NULL);
+
+	for (i = 0; i < 100; i++)
+		g_assert(hashmap_insert(map, i, INT_TO_PTR(i % 10)));
+
+	g_assert(hashmap_remove_all(map, match_int, INT_TO_PTR(3),
+								NULL) == 10);
+	g_assert(hashmap_length(map) == 90);
+	g_assert(hashmap_lookup(map, 13) == NULL);
+	g_assert(hashmap_lookup(map, 14) == INT_TO_PTR(4));
+
+	g_assert(hashmap_remove_all(map, NULL, NULL, NULL) == 90);
+	g_assert(hashmap_isempty(map));
+
+	hashmap_destroy(map, NULL);
+	tester_test_passed();
+}
+
+static void test_hashmap_bdaddr(const void *data)
+{
+	struct hashmap *map;
+	bdaddr_t addr = {{ 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 }};
+
+	map = hashmap_new();
+	g_assert(map != NULL);
+
+	g_assert(hashmap_insert(map, hashmap_bdaddr_key(&addr, 0x01),
+							UINT_TO_PTR(1)));
+	g_assert(hashmap_insert(map, hashmap_bdaddr_key(&addr, 0x02),
+							UINT_TO_PTR(2)));
+
+	g_assert(hashmap_lookup(map, hashmap_bdaddr_key(&addr, 0x01)) ==
+							UINT_TO_PTR(1));
+	g_assert(hashmap_lookup(map, hashmap_bdaddr_key(&addr, 0x02)) ==
+							UINT_TO_PTR(2));
+
+	addr.b[5] = 0x07;
+	g_assert(hashmap_lookup(map, hashmap_bdaddr_key(&addr, 0x01)) ==
+									NULL);
+
+	hashmap_destroy(map, NULL);
+	tester_test_passed();
+}
+
+/* Only run on request, e.g. TEST_BENCHMARK=1 unit/test-queue */
+#define BENCHMARK_OPS	100000
+
+static void test_benchmark(const void *data)
+{
+	static const unsigned int sizes[] = { 8, 64, 512, 4096 };
+	unsigned int i, n;
+
+	for (i = 0; i < G_N_ELEMENTS(sizes); i++) {
+		struct queue *queue = queue_new();
+		struct hashmap *map = hashmap_new();
+		gint64 start, queue_find_time, map_find_time;
+		gint64 queue_remove_time, map_remove_time;
+
+		for (n = 0; n < sizes[i]; n++) {
+			queue_push_tail(queue, UINT_TO_PTR(n + 1));
+			hashmap_insert(map, n + 1, UINT_TO_PTR(n + 1));
+		}
+
+		start = g_get_monotonic_time();
+		for (n = 0; n < BENCHMARK_OPS; n++)
+			g_assert(queue_find(queue, match_int,
+					UINT_TO_PTR(n % sizes[i] + 1)));
+		queue_find_time = g_get_monotonic_time() - start;
+
+		start = g_get_monotonic_time();
+		for (n = 0; n < BENCHMARK_OPS; n++)
+			g_assert(hashmap_lookup(map, n % sizes[i] + 1));
+		map_find_time = g_get_monotonic_time() - start;
+
+		/*
+		 * Take random entries out and put them back, a fixed order
+		 * would leave the next one at the head of the queue.
+		 */
+		srand(i);
+		start = g_get_monotonic_time();
+		for (n = 0; n < BENCHMARK_OPS; n++) {
+			void *entry = UINT_TO_PTR(rand() % sizes[i] + 1);
+
+			g_assert(queue_remove_if(queue, match_int, entry));
+			queue_push_tail(queue, entry);
+		}
+		queue_remove_time = g_get_monotonic_time() - start;
+
+		srand(i);
+		start = g_get_monotonic_time();
+		for (n = 0; n < BENCHMARK_OPS; n++) {
+			unsigned int key = rand() % sizes[i] + 1;
+
+			g_assert(hashmap_remove_key(map, key));
+			hashmap_insert(map, key, UINT_TO_PTR(key));
+		}
+		map_remove_time = g_get_monotonic_time() - start;
+
+		tester_print("%u entries: find %" G_GINT64_FORMAT "/%"
+				G_GINT64_FORMAT " ns/op, remove %"
+				G_GINT64_FORMAT "/%" G_GINT64_FORMAT
+				" ns/op (queue/hashmap)", sizes[i],
+				queue_find_time * 1000 / BENCHMARK_OPS,
+				map_find_time * 1000 / BENCHMARK_OPS,
+				queue_remove_time * 1000 / BENCHMARK_OPS,
+				map_remove_time * 1000 / BENCHMARK_OPS);
+
+		queue_destroy(queue, NULL);
+		hashmap_destroy(map, NULL);
+	}
+
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -263,6 +512,19 @@ int main(int argc, char *argv[])
 						test_destroy_remove, NULL);
 	tester_add("/queue/push_after",  NULL, NULL, test_push_after, NULL);
 	tester_add("/queue/remove_all",  NULL, NULL, test_remove_all, NULL);
+	tester_add("/hashmap/basic", NULL, NULL, test_hashmap_basic, NULL);
+	tester_add("/hashmap/order", NULL, NULL, test_hashmap_order, NULL);
+	tester_add("/hashmap/foreach_remove", NULL, NULL,
+					test_hashmap_foreach_remove, NULL);
+	tester_add("/hashmap/foreach_destroy", NULL, NULL,
+					test_hashmap_foreach_destroy, NULL);
+	tester_add("/hashmap/remove_all", NULL, NULL,
+					test_hashmap_remove_all, NULL);
+	tester_add("/hashmap/bdaddr", NULL, NULL, test_hashmap_bdaddr, NULL);
+
+	if (getenv("TEST_BENCHMARK"))
+		tester_add("/queue/benchmark", NULL, NULL, test_benchmark,
+									NULL);
 
 	return tester_run();
 }
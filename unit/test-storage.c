@@ -0,0 +1,749 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+#include "lib/sdp.h"
+
+#include "src/shared/tester.h"
+#include "src/btd.h"
+#include "src/textfile.h"
+#include "src/storage.h"
+
+#define FLUSH_DELAY	50
+
+struct btd_opts btd_opts;
+
+/* Everything lives below a private directory created at runtime */
+static char test_dir[PATH_MAX];
+static char *log_file;
+static char *settings_file;
+static char *info_file;
+static char *adapter_dir;
+static char *device_dir;
+static char *cache_file;
+static char *other_file;
+static char *legacy_file;
+static char *mesh_file;
+static char *old_file;
+static char *corrupt_file;
+static char *addresses_file;
+static char *unknown_dir;
+
+static char *test_path(const char *name)
+{
+	return g_strconcat(test_dir, "/", name, NULL);
+}
+
+static const char owner_a[] = "a";
+static const char owner_b[] = "b";
+
+static unsigned int update_count;
+static unsigned int destroy_count;
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+							struct FTW *ftw)
+{
+	return remove(path);
+}
+
+static void storage_wipe(void)
+{
+	nftw(test_dir, remove_entry, 5, FTW_DEPTH | FTW_PHYS);
+}
+
+static void storage_reset(void)
+{
+	storage_wipe();
+	g_assert(mkdir(test_dir, 0700) == 0);
+
+	update_count = 0;
+	destroy_count = 0;
+}
+
+static void set_name(GKeyFile *key_file, void *user_data)
+{
+	update_count++;
+	g_key_file_set_string(key_file, "General", "Name", user_data);
+}
+
+static void set_alias(GKeyFile *key_file, void *user_data)
+{
+	update_count++;
+	g_key_file_set_string(key_file, "General", "Alias", user_data);
+}
+
+static void name_free(void *data)
+{
+	destroy_count++;
+	g_free(data);
+}
+
+static void check_value(const char *filename, const char *key,
+							const char *value)
+{
+	GKeyFile *key_file;
+	char *str;
+
+	key_file = g_key_file_new();
+	g_assert(btd_storage_load(key_file, filename));
+
+	str = g_key_file_get_string(key_file, "General", key, NULL);
+
+	tester_debug("%s %s=%s", filename, key, str);
+
+	if (value) {
+		g_assert(str != NULL);
+		g_assert(strcmp(str, value) == 0);
+	} else
+		g_assert(str == NULL);
+
+	g_free(str);
+	g_key_file_free(key_file);
+}
+
+static ino_t file_ino(const char *filename)
+{
+	struct stat st;
+
+	g_assert(stat(filename, &st) == 0);
+
+	return st.st_ino;
+}
+
+static gboolean debounce_check(gpointer user_data)
+{
+	g_assert(!btd_storage_pending(settings_file));
+
+	/* Both updates went out together in a single flush */
+	g_assert(update_count == 2);
+	check_value(settings_file, "Name", "a");
+	check_value(settings_file, "Alias", "b");
+
+	tester_test_passed();
+
+	return FALSE;
+}
+
+static gboolean debounce_update(gpointer user_data)
+{
+	g_assert(!btd_storage_exists(settings_file));
+
+	btd_storage_update(settings_file, set_alias, (void *) owner_b, NULL);
+
+	g_timeout_add(FLUSH_DELAY * 2, debounce_check, NULL);
+
+	return FALSE;
+}
+
+static void test_debounce(const void *data)
+{
+	storage_reset();
+
+	btd_storage_update(settings_file, set_name, (void *) owner_a, NULL);
+
+	/* Nothing is written before the flush delay expires */
+	g_assert(btd_storage_pending(settings_file));
+	g_assert(!btd_storage_exists(settings_file));
+	g_assert(update_count == 0);
+
+	g_timeout_add(FLUSH_DELAY / 2, debounce_update, NULL);
+}
+
+static void test_sync(const void *data)
+{
+	storage_reset();
+
+	btd_storage_update(settings_file, set_name, (void *) owner_a, NULL);
+
+	g_assert(btd_storage_sync(settings_file) == 0);
+	g_assert(!btd_storage_pending(settings_file));
+	g_assert(update_count == 1);
+	check_value(settings_file, "Name", "a");
+
+	/* The pending timer must not write the file again */
+	btd_storage_flush();
+	g_assert(update_count == 1);
+
+	tester_test_passed();
+}
+
+static void test_coalesce(const void *data)
+{
+	static const char raw_x[] = "[General]\nName=x\n";
+	static const char raw_y[] = "[General]\nName=y\n";
+	ino_t ino;
+
+	storage_reset();
+
+	/* A later update of the same kind replaces the earlier one */
+	btd_storage_update(settings_file, set_name, g_strdup("a"), name_free);
+	btd_storage_update(settings_file, set_name, g_strdup("b"), name_free);
+	g_assert(destroy_count == 1);
+
+	/* New contents replace what was queued, updates apply on top */
+	btd_storage_write(info_file, raw_x, strlen(raw_x));
+	btd_storage_write(info_file, raw_y, strlen(raw_y));
+	btd_storage_update(info_file, set_alias, (void *) owner_b, NULL);
+
+	btd_storage_flush();
+
+	g_assert(update_count == 2);
+	g_assert(destroy_count == 2);
+	check_value(settings_file, "Name", "b");
+	check_value(info_file, "Name", "y");
+	check_value(info_file, "Alias", "b");
+
+	/* Updates which leave the contents as they are skip the write */
+	ino = file_ino(settings_file);
+
+	btd_storage_update(settings_file, set_name, g_strdup("b"), name_free);
+	btd_storage_flush();
+
+	g_assert(update_count == 3);
+	g_assert(file_ino(settings_file) == ino);
+
+	tester_test_passed();
+}
+
+static void test_discard(const void *data)
+{
+	static const char raw[] = "[General]\nName=x\n";
+
+	storage_reset();
+
+	g_assert(btd_storage_set_contents(info_file, raw, strlen(raw)) == 0);
+
+	btd_storage_update(info_file, set_name, g_strdup("a"), name_free);
+	btd_storage_update(info_file, set_alias, g_strdup("b"), name_free);
+
+	btd_storage_discard(info_file);
+
+	g_assert(!btd_storage_pending(info_file));
+	g_assert(destroy_count == 2);
+
+	btd_storage_flush();
+
+	g_assert(update_count == 0);
+	check_value(info_file, "Name", "x");
+	check_value(info_file, "Alias", NULL);
+
+	tester_test_passed();
+}
+
+static void test_cancel(const void *data)
+{
+	static const char raw[] = "[General]\nName=x\n";
+
+	storage_reset();
+
+	btd_storage_update(settings_file, set_name, (void *) owner_a, NULL);
+	btd_storage_update(settings_file, set_alias, (void *) owner_b, NULL);
+
+	btd_storage_write(info_file, raw, strlen(raw));
+	btd_storage_update(info_file, set_alias, (void *) owner_a, NULL);
+
+	btd_storage_cancel((void *) owner_a);
+
+	/* Queued contents stay even when no update is left for them */
+	g_assert(btd_storage_pending(settings_file));
+	g_assert(btd_storage_pending(info_file));
+
+	btd_storage_cancel((void *) owner_b);
+
+	g_assert(!btd_storage_pending(settings_file));
+	g_assert(btd_storage_pending(info_file));
+
+	btd_storage_flush();
+
+	g_assert(update_count == 0);
+	g_assert(!btd_storage_exists(settings_file));
+	check_value(info_file, "Name", "x");
+	check_value(info_file, "Alias", NULL);
+
+	tester_test_passed();
+}
+
+static void test_load(const void *data)
+{
+	static const char raw[] = "[General]\nName=x\n";
+	char buf[9];
+	char *str;
+	size_t len;
+
+	storage_reset();
+
+	g_assert(btd_storage_set_contents(settings_file, raw,
+							strlen(raw)) == 0);
+
+	/* Reads see the updates before they are written */
+	btd_storage_update(settings_file, set_alias, (void *) owner_b, NULL);
+	btd_storage_update(info_file, set_name, (void *) owner_a, NULL);
+
+	check_value(settings_file, "Name", "x");
+	check_value(settings_file, "Alias", "b");
+	check_value(info_file, "Name", "a");
+	g_assert(access(info_file, F_OK) < 0);
+
+	str = btd_storage_get_contents(settings_file, &len);
+	g_assert(str != NULL);
+	g_assert(len == strlen(str));
+	g_assert(strstr(str, "Alias=b") != NULL);
+	g_free(str);
+
+	/* And so do the queued contents */
+	btd_storage_write(info_file, raw, strlen(raw));
+
+	g_assert(btd_storage_read(info_file, buf, sizeof(buf)) == sizeof(buf));
+	g_assert(memcmp(buf, raw, sizeof(buf)) == 0);
+
+	str = btd_storage_get_contents(info_file, &len);
+	g_assert(str != NULL);
+	g_assert(len == strlen(raw));
+	g_assert(strcmp(str, raw) == 0);
+	g_free(str);
+
+	/* Nothing was written by the reads */
+	g_assert(btd_storage_pending(settings_file));
+	g_assert(btd_storage_pending(info_file));
+	g_assert(access(info_file, F_OK) < 0);
+
+	btd_storage_flush();
+
+	check_value(settings_file, "Alias", "b");
+	check_value(info_file, "Name", "x");
+
+	tester_test_passed();
+}
+
+/* A non-empty directory in place of the file makes the write fail */
+static void block_file(const char *filename)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, PATH_MAX, "%s/block", filename);
+
+	g_assert(create_file(path, S_IRUSR | S_IWUSR) == 0);
+}
+
+static void unblock_file(const char *filename)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, PATH_MAX, "%s/block", filename);
+
+	g_assert(unlink(path) == 0);
+	g_assert(rmdir(filename) == 0);
+}
+
+static gboolean retry_check(gpointer user_data)
+{
+	/* The timer retried the failed update along with the newer one */
+	g_assert(!btd_storage_pending(settings_file));
+	check_value(settings_file, "Name", "a");
+	check_value(settings_file, "Alias", "b");
+	g_assert(destroy_count == 1);
+
+	tester_test_passed();
+
+	return FALSE;
+}
+
+static void test_retry(const void *data)
+{
+	storage_reset();
+
+	block_file(settings_file);
+
+	btd_storage_update(settings_file, set_name, g_strdup("a"), name_free);
+	btd_storage_flush();
+
+	/* The update stays queued instead of being dropped */
+	g_assert(btd_storage_pending(settings_file));
+	g_assert(destroy_count == 0);
+
+	g_assert(btd_storage_sync(settings_file) < 0);
+	g_assert(btd_storage_pending(settings_file));
+
+	btd_storage_update(settings_file, set_alias, (void *) owner_b, NULL);
+
+	unblock_file(settings_file);
+
+	g_timeout_add(FLUSH_DELAY * 2, retry_check, NULL);
+}
+
+static void test_sync_updates(const void *data)
+{
+	storage_reset();
+
+	btd_storage_update(settings_file, set_name, (void *) owner_a, NULL);
+	btd_storage_update(info_file, set_name, (void *) owner_b, NULL);
+	btd_storage_update(info_file, set_alias, (void *) owner_a, NULL);
+	btd_storage_update(cache_file, set_name, (void *) owner_b, NULL);
+
+	g_assert(btd_storage_sync_updates((void *) owner_a) == 0);
+
+	/* Every file referencing it is written out as a whole */
+	g_assert(!btd_storage_pending(settings_file));
+	g_assert(!btd_storage_pending(info_file));
+	g_assert(btd_storage_pending(cache_file));
+
+	check_value(settings_file, "Name", "a");
+	check_value(info_file, "Name", "b");
+	check_value(info_file, "Alias", "a");
+
+	/* What can't be written is dropped as it can't be retried */
+	block_file(other_file);
+
+	btd_storage_update(other_file, set_name, (void *) owner_a, NULL);
+
+	g_assert(btd_storage_sync_updates((void *) owner_a) < 0);
+	g_assert(!btd_storage_pending(other_file));
+
+	unblock_file(other_file);
+
+	btd_storage_flush();
+
+	g_assert(access(other_file, F_OK) < 0);
+	check_value(cache_file, "Name", "b");
+
+	tester_test_passed();
+}
+
+static const char contents[] = "[General]\nName=x\n";
+
+static void put_file(const char *filename)
+{
+	g_assert(create_file(filename, S_IRUSR | S_IWUSR) == 0);
+	g_assert(g_file_set_contents(filename, contents, strlen(contents),
+								NULL));
+}
+
+static void put_files(void)
+{
+	g_assert(btd_storage_set_contents(settings_file, contents,
+						strlen(contents)) == 0);
+	g_assert(btd_storage_set_contents(info_file, contents,
+						strlen(contents)) == 0);
+	g_assert(btd_storage_set_contents(cache_file, contents,
+						strlen(contents)) == 0);
+	g_assert(btd_storage_set_contents(other_file, contents,
+						strlen(contents)) == 0);
+}
+
+static void check_contents(const char *filename)
+{
+	char *data;
+	size_t len;
+
+	data = btd_storage_get_contents(filename, &len);
+	g_assert(data != NULL);
+	g_assert(len == strlen(contents));
+	g_assert(memcmp(data, contents, len) == 0);
+
+	g_free(data);
+}
+
+static void check_dirs(const char *dirname, const char * const *expected)
+{
+	char **names;
+	unsigned int i, j;
+
+	names = btd_storage_list_dirs(dirname);
+	g_assert(names != NULL);
+
+	for (i = 0; names[i]; i++) {
+		tester_debug("%s/%s", dirname, names[i]);
+
+		for (j = 0; expected[j]; j++) {
+			if (!strcmp(names[i], expected[j]))
+				break;
+		}
+
+		g_assert(expected[j] != NULL);
+	}
+
+	g_assert(i == g_strv_length((char **) expected));
+
+	g_strfreev(names);
+}
+
+static void storage_start(bt_storage_t backend)
+{
+	btd_opts.storage_backend = backend;
+	btd_storage_init(test_dir);
+
+	g_assert((access(log_file, F_OK) == 0) == (backend == BT_STORAGE_LOG));
+}
+
+static void storage_stop(void)
+{
+	btd_storage_cleanup();
+	btd_opts.storage_backend = BT_STORAGE_FILES;
+}
+
+static unsigned int log_count(void)
+{
+	struct logfile *lf;
+	unsigned int count;
+
+	lf = logfile_open(log_file, false);
+	g_assert(lf != NULL);
+
+	count = logfile_count(lf);
+	logfile_close(lf);
+
+	return count;
+}
+
+static void test_layout(const void *data)
+{
+	static const char * const adapter_dirs[] = {
+		"66:77:88:99:AA:BB", "66:77:88:99:AA:CC", "cache", NULL
+	};
+	static const char * const other_dirs[] = {
+		"66:77:88:99:AA:CC", "cache", NULL
+	};
+	static const char * const no_dirs[] = { NULL };
+	const bt_storage_t *backend = data;
+
+	storage_reset();
+	storage_start(*backend);
+
+	put_files();
+
+	check_contents(info_file);
+	check_dirs(adapter_dir, adapter_dirs);
+	check_dirs(device_dir, no_dirs);
+
+	/* Directories only exist as long as there is something in them */
+	g_assert(btd_storage_exists(adapter_dir));
+	g_assert(btd_storage_exists(device_dir));
+	g_assert(btd_storage_exists(info_file));
+	g_assert(!btd_storage_exists(unknown_dir));
+
+	/* Only what is below the device goes, not the cache of the same name */
+	g_assert(btd_storage_remove(device_dir) == 0);
+
+	g_assert(!btd_storage_exists(device_dir));
+	g_assert(!btd_storage_exists(info_file));
+	check_contents(cache_file);
+	check_contents(other_file);
+	check_dirs(adapter_dir, other_dirs);
+
+	g_assert(btd_storage_remove(cache_file) == 0);
+	g_assert(!btd_storage_exists(cache_file));
+	check_contents(settings_file);
+
+	g_assert(btd_storage_remove(adapter_dir) == 0);
+	g_assert(!btd_storage_exists(settings_file));
+	g_assert(!btd_storage_exists(other_file));
+
+	storage_stop();
+	tester_test_passed();
+}
+
+static void test_import(const void *data)
+{
+	storage_reset();
+
+	put_files();
+	put_file(legacy_file);
+	put_file(mesh_file);
+	put_file(addresses_file);
+
+	storage_start(BT_STORAGE_LOG);
+
+	check_contents(settings_file);
+	check_contents(info_file);
+	check_contents(cache_file);
+	check_contents(other_file);
+	check_contents(addresses_file);
+
+	/* Imported files and the directories left empty are gone */
+	g_assert(access(settings_file, F_OK) < 0);
+	g_assert(access(device_dir, F_OK) < 0);
+	g_assert(access(addresses_file, F_OK) < 0);
+
+	/* Legacy files are still read directly, and mesh is left alone */
+	g_assert(access(legacy_file, F_OK) == 0);
+	g_assert(access(mesh_file, F_OK) == 0);
+	g_assert(!btd_storage_exists(legacy_file));
+
+	storage_stop();
+
+	g_assert(log_count() == 5);
+
+	tester_test_passed();
+}
+
+static void test_export(const void *data)
+{
+	storage_reset();
+	storage_start(BT_STORAGE_LOG);
+
+	put_files();
+
+	storage_stop();
+
+	g_assert(access(info_file, F_OK) < 0);
+
+	/* Switching back writes every entry out as a file of its own */
+	storage_start(BT_STORAGE_FILES);
+
+	g_assert(access(log_file, F_OK) < 0);
+	g_assert(access(old_file, F_OK) == 0);
+
+	check_contents(settings_file);
+	check_contents(info_file);
+	check_contents(cache_file);
+	check_contents(other_file);
+
+	storage_stop();
+	tester_test_passed();
+}
+
+static off_t file_size(const char *filename)
+{
+	struct stat st;
+
+	g_assert(stat(filename, &st) == 0);
+
+	return st.st_size;
+}
+
+static void test_corrupt(const void *data)
+{
+	off_t offset, size;
+	int fd;
+
+	storage_reset();
+	storage_start(BT_STORAGE_LOG);
+
+	g_assert(btd_storage_set_contents(settings_file, contents,
+						strlen(contents)) == 0);
+	g_assert(btd_storage_set_contents(cache_file, contents,
+						strlen(contents)) == 0);
+	offset = file_size(log_file);
+
+	g_assert(btd_storage_set_contents(info_file, contents,
+						strlen(contents)) == 0);
+	g_assert(btd_storage_set_contents(other_file, contents,
+						strlen(contents)) == 0);
+	size = file_size(log_file);
+
+	storage_stop();
+
+	/* Damage a record in the middle, a committed one follows it */
+	fd = open(log_file, O_WRONLY);
+	g_assert(fd >= 0);
+	g_assert(pwrite(fd, "X", 1, offset + 20) == 1);
+	close(fd);
+
+	storage_start(BT_STORAGE_LOG);
+
+	/* The damaged log is kept aside as it was */
+	g_assert(file_size(corrupt_file) == size);
+
+	/* What was committed before the damage survives, the rest is lost */
+	check_contents(settings_file);
+	check_contents(cache_file);
+	g_assert(!btd_storage_exists(info_file));
+	g_assert(!btd_storage_exists(other_file));
+
+	g_assert(btd_storage_set_contents(info_file, contents,
+						strlen(contents)) == 0);
+
+	storage_stop();
+
+	g_assert(log_count() == 3);
+
+	/* And it all survives another restart */
+	storage_start(BT_STORAGE_LOG);
+
+	check_contents(settings_file);
+	check_contents(cache_file);
+	check_contents(info_file);
+
+	storage_stop();
+	tester_test_passed();
+}
+
+static const bt_storage_t files_backend = BT_STORAGE_FILES;
+static const bt_storage_t log_backend = BT_STORAGE_LOG;
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	tester_init(&argc, &argv);
+
+	snprintf(test_dir, PATH_MAX, "%s/test-storage-XXXXXX",
+					g_get_tmp_dir());
+	if (!mkdtemp(test_dir)) {
+		perror("Unable to create test directory");
+		return EXIT_FAILURE;
+	}
+
+	log_file = test_path("storage.log");
+	old_file = test_path("storage.log.old");
+	corrupt_file = test_path("storage.log.corrupt");
+	adapter_dir = test_path("00:11:22:33:44:55");
+	unknown_dir = test_path("00:11:22:33:44:66");
+	settings_file = test_path("00:11:22:33:44:55/settings");
+	device_dir = test_path("00:11:22:33:44:55/66:77:88:99:AA:BB");
+	info_file = test_path("00:11:22:33:44:55/66:77:88:99:AA:BB/info");
+	cache_file = test_path("00:11:22:33:44:55/cache/66:77:88:99:AA:BB");
+	other_file = test_path("00:11:22:33:44:55/66:77:88:99:AA:CC/info");
+	legacy_file = test_path("00:11:22:33:44:55/names");
+	mesh_file = test_path("mesh/config.json");
+	addresses_file = test_path("addresses");
+
+	btd_opts.storage_backend = BT_STORAGE_FILES;
+	btd_opts.storage_delay = FLUSH_DELAY;
+
+	tester_add("/storage/write/debounce", NULL, NULL, test_debounce, NULL);
+	tester_add("/storage/write/sync", NULL, NULL, test_sync, NULL);
+	tester_add("/storage/write/coalesce", NULL, NULL, test_coalesce, NULL);
+	tester_add("/storage/write/discard", NULL, NULL, test_discard, NULL);
+	tester_add("/storage/write/cancel", NULL, NULL, test_cancel, NULL);
+	tester_add("/storage/write/load", NULL, NULL, test_load, NULL);
+	tester_add("/storage/write/retry", NULL, NULL, test_retry, NULL);
+	tester_add("/storage/write/sync-updates", NULL, NULL,
+						test_sync_updates, NULL);
+	tester_add("/storage/files/layout", &files_backend, NULL,
+							test_layout, NULL);
+	tester_add("/storage/log/layout", &log_backend, NULL,
+							test_layout, NULL);
+	tester_add("/storage/log/import", NULL, NULL, test_import, NULL);
+	tester_add("/storage/log/export", NULL, NULL, test_export, NULL);
+	tester_add("/storage/log/corrupt", NULL, NULL, test_corrupt, NULL);
+
+	ret = tester_run();
+
+	storage_wipe();
+
+	return ret;
+}
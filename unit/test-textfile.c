@@ -14,10 +14,13 @@
 
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include <glib.h>
 
@@ -25,6 +28,8 @@
 #include "src/shared/tester.h"
 
 static const char test_pathname[] = "/tmp/textfile";
+static const char test_logname[] = "/tmp/textfile.log";
+static const char test_backupname[] = "/tmp/textfile.log.corrupt";
 
 static void util_create_empty(void)
 {
@@ -249,6 +254,264 @@ static void test_multiple(const void *data)
 	tester_test_passed();
 }
 
+static void check_log_value(struct logfile *lf, const char *key,
+							const char *value)
+{
+	char *str;
+	size_t len;
+
+	str = logfile_get(lf, key, &len);
+
+	if (!value) {
+		g_assert(str == NULL);
+		return;
+	}
+
+	g_assert(str != NULL);
+	g_assert(len == strlen(value));
+	g_assert(strcmp(str, value) == 0);
+
+	free(str);
+}
+
+static off_t log_size(void)
+{
+	struct stat st;
+
+	g_assert(stat(test_logname, &st) == 0);
+
+	return st.st_size;
+}
+
+static void test_log(const void *data)
+{
+	struct logfile *lf;
+
+	unlink(test_logname);
+
+	lf = logfile_open(test_logname, false);
+	g_assert(lf != NULL);
+
+	g_assert(logfile_put(lf, "a/info", "Name=a", 6) == 0);
+	g_assert(logfile_put(lf, "b/info", "Name=b", 6) == 0);
+	g_assert(logfile_put(lf, "a/info", "Name=aa", 7) == 0);
+	g_assert(logfile_del(lf, "b/info") == 0);
+	g_assert(logfile_count(lf) == 1);
+
+	check_log_value(lf, "a/info", "Name=aa");
+	check_log_value(lf, "b/info", NULL);
+
+	/* A second instance must not be able to open the same file */
+	g_assert(logfile_open(test_logname, false) == NULL);
+
+	logfile_close(lf);
+
+	lf = logfile_open(test_logname, false);
+	g_assert(lf != NULL);
+	g_assert(logfile_count(lf) == 1);
+
+	check_log_value(lf, "a/info", "Name=aa");
+	check_log_value(lf, "b/info", NULL);
+
+	logfile_close(lf);
+	tester_test_passed();
+}
+
+static void test_log_transaction(const void *data)
+{
+	struct logfile *lf;
+	off_t size;
+
+	unlink(test_logname);
+
+	lf = logfile_open(test_logname, false);
+	g_assert(lf != NULL);
+
+	g_assert(logfile_put(lf, "a/info", "Name=a", 6) == 0);
+	size = log_size();
+
+	logfile_begin(lf);
+	g_assert(logfile_put(lf, "b/info", "Name=b", 6) == 0);
+	g_assert(logfile_put(lf, "c/info", "Name=c", 6) == 0);
+
+	/* Nothing is visible before the commit */
+	check_log_value(lf, "b/info", NULL);
+	g_assert(log_size() == size);
+
+	g_assert(logfile_commit(lf) == 0);
+	check_log_value(lf, "b/info", "Name=b");
+	check_log_value(lf, "c/info", "Name=c");
+
+	logfile_close(lf);
+
+	/* Cut the transaction short as if the write was interrupted */
+	g_assert(truncate(test_logname, log_size() - 1) == 0);
+
+	lf = logfile_open(test_logname, false);
+	g_assert(lf != NULL);
+	g_assert(log_size() == size);
+
+	check_log_value(lf, "a/info", "Name=a");
+	check_log_value(lf, "b/info", NULL);
+	check_log_value(lf, "c/info", NULL);
+
+	logfile_close(lf);
+	tester_test_passed();
+}
+
+static void test_log_damaged(const void *data)
+{
+	static const uint8_t zero[64];
+	struct logfile *lf;
+	off_t size;
+	int fd;
+
+	unlink(test_logname);
+
+	lf = logfile_open(test_logname, false);
+	g_assert(lf != NULL);
+
+	g_assert(logfile_put(lf, "a/info", "Name=a", 6) == 0);
+	g_assert(logfile_put(lf, "b/info", "Name=b", 6) == 0);
+	size = log_size();
+
+	logfile_close(lf);
+
+	/* Space allocated for a write that never made it to the disk */
+	fd = open(test_logname, O_WRONLY | O_APPEND);
+	g_assert(fd >= 0);
+	g_assert(write(fd, zero, sizeof(zero)) == sizeof(zero));
+	close(fd);
+
+	lf = logfile_open(test_logname, false);
+	g_assert(lf != NULL);
+	g_assert(log_size() == size);
+
+	check_log_value(lf, "a/info", "Name=a");
+	check_log_value(lf, "b/info", "Name=b");
+
+	logfile_close(lf);
+
+	/* Damage the value of the first record, the second one follows it */
+	fd = open(test_logname, O_WRONLY);
+	g_assert(fd >= 0);
+	g_assert(pwrite(fd, "X", 1, 8 + 12 + 6) == 1);
+	close(fd);
+
+	lf = logfile_open(test_logname, false);
+	g_assert(lf == NULL);
+	g_assert(errno == EBADMSG);
+
+	/* Nothing committed must have been dropped */
+	g_assert(log_size() == size);
+
+	unlink(test_logname);
+	tester_test_passed();
+}
+
+static void test_log_recover(const void *data)
+{
+	struct logfile *lf;
+	struct stat st;
+	off_t offset, size;
+	int fd;
+
+	unlink(test_logname);
+
+	lf = logfile_open(test_logname, false);
+	g_assert(lf != NULL);
+
+	g_assert(logfile_put(lf, "a/info", "Name=a", 6) == 0);
+	offset = log_size();
+	g_assert(logfile_put(lf, "b/info", "Name=b", 6) == 0);
+	g_assert(logfile_put(lf, "c/info", "Name=c", 6) == 0);
+	size = log_size();
+
+	logfile_close(lf);
+
+	/* Damage the value of the second record, the third one follows it */
+	fd = open(test_logname, O_WRONLY);
+	g_assert(fd >= 0);
+	g_assert(pwrite(fd, "X", 1, offset + 12 + 6) == 1);
+	close(fd);
+
+	g_assert(logfile_open(test_logname, false) == NULL);
+	g_assert(errno == EBADMSG);
+
+	g_assert(logfile_recover(test_logname, test_backupname) == 0);
+	g_assert(log_size() == offset);
+
+	lf = logfile_open(test_logname, false);
+	g_assert(lf != NULL);
+	g_assert(logfile_count(lf) == 1);
+
+	check_log_value(lf, "a/info", "Name=a");
+	check_log_value(lf, "b/info", NULL);
+	check_log_value(lf, "c/info", NULL);
+
+	logfile_close(lf);
+
+	/* The damaged file is kept as it was */
+	g_assert(stat(test_backupname, &st) == 0);
+	g_assert(st.st_size == size);
+
+	lf = logfile_open(test_backupname, false);
+	g_assert(lf == NULL);
+	g_assert(errno == EBADMSG);
+
+	unlink(test_backupname);
+	unlink(test_logname);
+	tester_test_passed();
+}
+
+static void test_log_compact(const void *data)
+{
+	struct logfile *lf;
+	char key[32], value[512];
+	unsigned int i;
+	off_t size;
+
+	unlink(test_logname);
+
+	lf = logfile_open(test_logname, false);
+	g_assert(lf != NULL);
+
+	memset(value, 0, sizeof(value));
+	memset(value, 'x', sizeof(value) - 1);
+
+	for (i = 0; i < 1000; i++) {
+		sprintf(key, "00:00:00:00:00:%02X/info", i % 10);
+		value[0] = '0' + i % 10;
+		g_assert(logfile_put(lf, key, value, strlen(value)) == 0);
+	}
+
+	g_assert(logfile_count(lf) == 10);
+
+	/* Overwritten values have been dropped along the way */
+	size = log_size();
+	tester_debug("Log size after 1000 updates is %ld\n", (long) size);
+	g_assert(size < 1000 * (off_t) sizeof(value) / 2);
+
+	g_assert(logfile_compact(lf) == 0);
+	g_assert(log_size() < size);
+
+	for (i = 0; i < 10; i++) {
+		sprintf(key, "00:00:00:00:00:%02X/info", i);
+		value[0] = '0' + i;
+		check_log_value(lf, key, value);
+	}
+
+	logfile_close(lf);
+
+	lf = logfile_open(test_logname, false);
+	g_assert(lf != NULL);
+	g_assert(logfile_count(lf) == 10);
+
+	logfile_close(lf);
+	unlink(test_logname);
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -257,6 +520,12 @@ int main(int argc, char *argv[])
 	tester_add("/textfile/delete", NULL, NULL, test_delete, NULL);
 	tester_add("/textfile/overwrite", NULL, NULL, test_overwrite, NULL);
 	tester_add("/textfile/multiple", NULL, NULL, test_multiple, NULL);
+	tester_add("/textfile/log", NULL, NULL, test_log, NULL);
+	tester_add("/textfile/log/transaction", NULL, NULL,
+						test_log_transaction, NULL);
+	tester_add("/textfile/log/damaged", NULL, NULL, test_log_damaged, NULL);
+	tester_add("/textfile/log/recover", NULL, NULL, test_log_recover, NULL);
+	tester_add("/textfile/log/compact", NULL, NULL, test_log_compact, NULL);
 
 	return tester_run();
 }